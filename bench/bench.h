@@ -0,0 +1,171 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "parallel.h"
+
+namespace bench {
+
+// Command line options shared by all benchmark executables:
+//   --json <file>       write the results as JSON ("-" for stdout)
+//   --filter <text>     run only cases whose name contains text
+//   --min-time <sec>    minimum measured time per case (default 0.5)
+//   --min-iters <n>     minimum number of measured iterations (default 5)
+struct Options {
+    std::string json_path;
+    std::string filter;
+    double min_time = 0.5;
+    std::size_t min_iterations = 5;
+    std::size_t max_iterations = 100000;
+    std::size_t warmup = 1;
+};
+
+inline Options parse_options(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc) options.json_path = argv[++i];
+        else if (arg == "--filter" && i + 1 < argc) options.filter = argv[++i];
+        else if (arg == "--min-time" && i + 1 < argc) options.min_time = std::atof(argv[++i]);
+        else if (arg == "--min-iters" && i + 1 < argc) options.min_iterations = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--help") {
+            std::printf("usage: %s [--json <file>] [--filter <text>] [--min-time <sec>] [--min-iters <n>]\n", argv[0]);
+            std::exit(EXIT_SUCCESS);
+        }
+    }
+    return options;
+}
+
+// Keeps the compiler from discarding a computed value.
+template <class T>
+inline void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Timing summary of one case. Times are in nanoseconds per iteration;
+// throughput is derived from the items and bytes processed per iteration.
+struct Result {
+    std::string name;
+    std::size_t iterations = 0;
+    double median_ns = 0, p90_ns = 0, p99_ns = 0, min_ns = 0, max_ns = 0, mean_ns = 0;
+    double items = 0, bytes = 0;
+    std::vector<std::pair<std::string, double>> counters;   // extra figures, e.g. sizes or ratios
+
+    double items_per_second() const { return median_ns > 0 ? items * 1e9 / median_ns : 0; }
+    double bytes_per_second() const { return median_ns > 0 ? bytes * 1e9 / median_ns : 0; }
+};
+
+// Nearest-rank percentile of sorted samples.
+inline double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    std::size_t rank = static_cast<std::size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+class Suite {
+public:
+    Suite(const std::string& name, const Options& options) : m_name(name), m_options(options) {}
+
+    bool selected(const std::string& name) const {
+        return m_options.filter.empty() || name.find(m_options.filter) != std::string::npos;
+    }
+
+    // Times fn() after setup(); only fn is measured. Each iteration processes
+    // the given number of items and bytes. Returns the recorded result, or
+    // nullptr if the case was filtered out.
+    template <class Setup, class Fn>
+    Result* run(const std::string& name, double items, double bytes, Setup setup, Fn fn) {
+        typedef std::chrono::steady_clock clock;
+        if (!selected(name)) return nullptr;
+
+        for (std::size_t i = 0; i < m_options.warmup; ++i) { setup(); fn(); }
+
+        std::vector<double> samples;
+        double total = 0;
+        while (samples.size() < m_options.max_iterations &&
+               (samples.size() < m_options.min_iterations || total < m_options.min_time * 1e9)) {
+            setup();
+            clock::time_point start = clock::now();
+            fn();
+            double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+            samples.push_back(ns);
+            total += ns;
+        }
+        std::sort(samples.begin(), samples.end());
+
+        Result result;
+        result.name = name;
+        result.iterations = samples.size();
+        result.median_ns = percentile(samples, 0.5);
+        result.p90_ns = percentile(samples, 0.9);
+        result.p99_ns = percentile(samples, 0.99);
+        result.min_ns = samples.front();
+        result.max_ns = samples.back();
+        result.mean_ns = total / samples.size();
+        result.items = items;
+        result.bytes = bytes;
+        m_results.push_back(result);
+
+        std::printf("%-48s %8zu it  median %12.3f us  p90 %12.3f us", name.c_str(), result.iterations,
+                    result.median_ns * 1e-3, result.p90_ns * 1e-3);
+        if (bytes > 0) std::printf("  %9.2f MB/s", result.bytes_per_second() * 1e-6);
+        else if (items > 0) std::printf("  %12.0f items/s", result.items_per_second());
+        std::printf("\n");
+        std::fflush(stdout);
+        return &m_results.back();
+    }
+
+    template <class Fn>
+    Result* run(const std::string& name, double items, double bytes, Fn fn) {
+        return run(name, items, bytes, [] {}, fn);
+    }
+
+    // Writes the JSON report if requested. Returns the process exit code.
+    int finish() const {
+        if (m_options.json_path.empty()) return EXIT_SUCCESS;
+        std::FILE* out = m_options.json_path == "-" ? stdout : std::fopen(m_options.json_path.c_str(), "w");
+        if (!out) {
+            std::fprintf(stderr, "Failed to open %s\n", m_options.json_path.c_str());
+            return EXIT_FAILURE;
+        }
+        std::fprintf(out, "{\n  \"suite\": \"%s\",\n  \"threads\": %u,\n  \"results\": [", m_name.c_str(),
+                     mesh_tools::num_threads());
+        for (std::size_t i = 0; i < m_results.size(); ++i) {
+            const Result& r = m_results[i];
+            std::fprintf(out, "%s\n    {\"name\": \"%s\", \"iterations\": %zu, \"median_ns\": %.1f, "
+                              "\"p90_ns\": %.1f, \"p99_ns\": %.1f, \"min_ns\": %.1f, \"max_ns\": %.1f, "
+                              "\"mean_ns\": %.1f, \"items\": %.0f, \"bytes\": %.0f, "
+                              "\"items_per_second\": %.1f, \"bytes_per_second\": %.1f",
+                         i ? "," : "", r.name.c_str(), r.iterations, r.median_ns, r.p90_ns, r.p99_ns,
+                         r.min_ns, r.max_ns, r.mean_ns, r.items, r.bytes,
+                         r.items_per_second(), r.bytes_per_second());
+            if (!r.counters.empty()) {
+                std::fprintf(out, ", \"counters\": {");
+                for (std::size_t c = 0; c < r.counters.size(); ++c)
+                    std::fprintf(out, "%s\"%s\": %.6g", c ? ", " : "", r.counters[c].first.c_str(), r.counters[c].second);
+                std::fprintf(out, "}");
+            }
+            std::fprintf(out, "}");
+        }
+        std::fprintf(out, "\n  ]\n}\n");
+        bool ok = out == stdout ? std::fflush(out) == 0 : std::fclose(out) == 0;
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+private:
+    std::string m_name;
+    Options m_options;
+    std::vector<Result> m_results;
+};
+
+} // namespace bench
+
+#endif // BENCH_H
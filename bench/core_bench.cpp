@@ -0,0 +1,521 @@
+// Benchmarks of the CGAL-free parts: STL/OFF reading, vertex welding, the
+// viewer's model preparation (full and quantized), STL writing, mesh packs
+// the face BVH, thumbnail rendering, the concurrent union-find, polygon
+// offsetting and the SDF clustering.
+//
+// Also checks that the STL readers with reused scratch buffers do not
+// allocate once warmed up and that the polygon offsets trim cleanly, and
+// exits with failure if either does not hold.
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "corpus.h"
+#include "face_bvh.h"
+#include "mesh_pack.h"
+#include "mesh_reorder.h"
+#include "off_reader.h"
+#include "png_writer.h"
+#include "polygon_offset.h"
+#include "rasterizer.h"
+#include "stl_model.hpp"
+#include "stl_reader.h"
+#include "stl_writer.h"
+#include "union_find.h"
+#include "waste/SdfClustering.h"
+
+using bench::Corpus_file;
+
+// Heap allocations of the whole process, to check that the scratch-based
+// readers don't allocate once warmed up. The array forms are replaced too, so
+// that every form of delete frees what the matching new allocated.
+static std::atomic<unsigned long long> g_allocations(0);
+
+static void* counted_malloc(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size) { return counted_malloc(size); }
+void* operator new[](std::size_t size) { return counted_malloc(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+typedef stl_reader::StlMesh<float, unsigned int> StlMesh;
+
+// Unwelded input of RemoveDoubles for one mesh: every corner its own vertex.
+struct Weld_input {
+    std::vector<float> normals;
+    std::vector<unsigned int> tris;
+    std::vector<unsigned int> solids;
+    std::vector<stl_reader::stl_reader_impl::CoordWithIndex<float, unsigned int>> coords;
+};
+
+Weld_input make_weld_input(const StlMesh& mesh) {
+    Weld_input input;
+    for (std::size_t t = 0; t < mesh.num_tris(); ++t) {
+        input.normals.insert(input.normals.end(), mesh.tri_normal(t), mesh.tri_normal(t) + 3);
+        for (int c = 0; c < 3; ++c) {
+            stl_reader::stl_reader_impl::CoordWithIndex<float, unsigned int> coord;
+            const float* p = mesh.tri_corner_coords(t, c);
+            for (int i = 0; i < 3; ++i) coord[i] = p[i];
+            coord.index = static_cast<unsigned int>(input.tris.size());
+            input.tris.push_back(coord.index);
+            input.coords.push_back(coord);
+        }
+    }
+    return input;
+}
+
+// Normalized SDF-like values: a few well separated bands with jitter.
+std::vector<double> make_sdf_values(std::size_t n) {
+    std::vector<double> values(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        double band = static_cast<double>(i % 4) / 3.0;
+        values[i] = std::min(1.0, std::max(0.0, band + 0.05 * std::sin(static_cast<double>(i) * 12.9898)));
+    }
+    return values;
+}
+
+// Slices of a made up part in micrometres: a star with a random radius per
+// point, 20 to 40 mm across, and a round hole in the middle.
+std::vector<mesh_tools::Contour_set> make_star_layers(std::size_t num_layers, std::size_t num_points) {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> radius(10000, 20000);
+    std::vector<mesh_tools::Contour_set> layers(num_layers);
+    std::vector<mesh_tools::Int_point> ring(num_points);
+    const double pi = 3.14159265358979323846;
+    for (mesh_tools::Contour_set& layer : layers) {
+        for (std::size_t i = 0; i < num_points; ++i) {
+            const double a = 2 * pi * static_cast<double>(i) / static_cast<double>(num_points), r = radius(rng);
+            ring[i] = { std::llround(r * std::cos(a)), std::llround(r * std::sin(a)) };
+        }
+        layer.add_ring(ring.data(), ring.size());
+        for (std::size_t i = 0; i < 64; ++i) {
+            const double a = -2 * pi * static_cast<double>(i) / 64;
+            ring[i] = { std::llround(3000 * std::cos(a)), std::llround(3000 * std::sin(a)) };
+        }
+        layer.add_ring(ring.data(), 64);
+    }
+    return layers;
+}
+
+// Runs one case on model.stl and one on the whole Models/ corpus.
+template <class Select, class Items, class Bytes, class Fn>
+void run_split(bench::Suite& suite, const std::string& name, const std::vector<Corpus_file>& corpus,
+               Select select, Items items, Bytes bytes, Fn fn) {
+    std::vector<const Corpus_file*> model_stl, models;
+    for (const Corpus_file& file : corpus) {
+        if (!select(file)) continue;
+        (file.off_path.empty() ? model_stl : models).push_back(&file);
+    }
+    const std::pair<const char*, std::vector<const Corpus_file*>*> groups[] = {
+        {"model.stl", &model_stl}, {"Models", &models}};
+    for (const auto& group : groups) {
+        const std::vector<const Corpus_file*>& files = *group.second;
+        if (files.empty()) continue;
+        double total_items = 0, total_bytes = 0;
+        for (const Corpus_file* file : files) {
+            total_items += static_cast<double>(items(*file));
+            total_bytes += static_cast<double>(bytes(*file));
+        }
+        suite.run(name + "/" + group.first, total_items, total_bytes, [&] {
+            for (const Corpus_file* file : files) fn(*file);
+        });
+    }
+}
+
+// Heap allocations made by one call of fn.
+template <class Fn>
+double count_allocations(Fn fn) {
+    const unsigned long long before = g_allocations.load();
+    fn();
+    return static_cast<double>(g_allocations.load() - before);
+}
+
+bool all(const Corpus_file&) { return true; }
+std::size_t tris(const Corpus_file& file) { return file.num_tris; }
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Options options = bench::parse_options(argc, argv);
+    bench::Suite suite("core_bench", options);
+
+    std::vector<Corpus_file> corpus = bench::prepare_corpus(BENCH_DATA_DIR, BENCH_WORK_DIR);
+    std::printf("Corpus: %zu models, %.0f triangles\n\n", corpus.size(), bench::corpus_total(corpus, tris));
+
+    std::vector<float> coords, normals;
+    std::vector<unsigned int> tris_out, solids;
+
+    run_split(suite, "ReadStlFile_BINARY", corpus, all, tris,
+              [](const Corpus_file& f) { return f.binary_bytes; },
+              [&](const Corpus_file& f) {
+                  stl_reader::ReadStlFile_BINARY(f.binary_stl.c_str(), coords, normals, tris_out, solids);
+                  bench::do_not_optimize(tris_out.data());
+              });
+
+    run_split(suite, "ReadStlFile_ASCII", corpus, all, tris,
+              [](const Corpus_file& f) { return f.ascii_bytes; },
+              [&](const Corpus_file& f) {
+                  stl_reader::ReadStlFile_ASCII(f.ascii_stl.c_str(), coords, normals, tris_out, solids);
+                  bench::do_not_optimize(tris_out.data());
+              });
+
+    // The same loads with reused scratch buffers and outputs. After the timed
+    // runs the buffers have grown to the largest file, so loading the whole
+    // corpus once more should not allocate at all.
+    stl_reader::StlReadScratch<float, unsigned int> scratch;
+    bool failed = false;
+    const char* const formats[] = {"BINARY", "ASCII"};
+    for (const char* format : formats) {
+        const bool binary = format == formats[0];
+        auto load = [&](const Corpus_file& f) {
+            const std::string& path = binary ? f.binary_stl : f.ascii_stl;
+            stl_reader::ReadStlFile(path.c_str(), coords, normals, tris_out, solids, scratch);
+            bench::do_not_optimize(tris_out.data());
+        };
+        auto bytes = [=](const Corpus_file& f) { return binary ? f.binary_bytes : f.ascii_bytes; };
+        bench::Result* result = suite.run("ReadStlFile/scratch/" + std::string(format),
+                                          bench::corpus_total(corpus, tris), bench::corpus_total(corpus, bytes),
+                                          [&] { for (const Corpus_file& f : corpus) load(f); });
+        if (result) {
+            const double allocations = count_allocations([&] {
+                for (const Corpus_file& f : corpus) load(f);
+            }) / static_cast<double>(corpus.size());
+            result->counters.push_back(std::make_pair("allocations_per_load", allocations));
+            if (allocations != 0) {
+                std::fprintf(stderr, "FAILED: ReadStlFile/scratch/%s makes %g allocations per load once warmed up, "
+                                     "expected none\n", format, allocations);
+                failed = true;
+            }
+            result->counters.push_back(std::make_pair("allocations_per_load_without_scratch", count_allocations([&] {
+                for (const Corpus_file& f : corpus) {
+                    const std::string& path = binary ? f.binary_stl : f.ascii_stl;
+                    stl_reader::ReadStlFile(path.c_str(), coords, normals, tris_out, solids);
+                }
+            }) / static_cast<double>(corpus.size())));
+        }
+    }
+
+    // RemoveDoubles consumes its input, so a fresh copy is made outside the timed region
+    std::vector<StlMesh> meshes;
+    std::vector<stl_viewer::QuantizedStlMesh> quantized_meshes;
+    std::vector<Weld_input> weld_inputs;
+    for (const Corpus_file& file : corpus) {
+        meshes.push_back(StlMesh(file.binary_stl.c_str()));
+        quantized_meshes.push_back(stl_viewer::QuantizedStlMesh(file.binary_stl));
+        weld_inputs.push_back(make_weld_input(meshes.back()));
+    }
+    for (std::size_t i = 0; i < corpus.size(); ++i) {
+        if (!corpus[i].off_path.empty() && corpus[i].num_tris < 10000) continue;
+        Weld_input work;
+        suite.run("RemoveDoubles/" + corpus[i].name, static_cast<double>(corpus[i].num_tris) * 3, 0,
+                  [&] { work = weld_inputs[i]; },
+                  [&] {
+                      stl_reader::stl_reader_impl::RemoveDoubles(coords, work.tris, work.normals,
+                                                                 work.solids, work.coords);
+                      bench::do_not_optimize(coords.data());
+                  });
+    }
+
+    run_split(suite, "loadModel", corpus, all, tris,
+              [](const Corpus_file&) { return 0; },
+              [&](const Corpus_file& f) {
+                  std::size_t i = static_cast<std::size_t>(&f - corpus.data());
+                  std::vector<float> vertices, vertex_normals;
+                  stl_viewer::loadModel(meshes[i], vertices, vertex_normals);
+                  bench::do_not_optimize(vertices.data());
+              });
+
+    // Quantized storage: load time including compression, memory per triangle
+    // and the largest position error relative to the model size
+    stl_viewer::QuantizedStlMesh quantized_mesh;
+    bench::Result* result = suite.run("StlMesh/quantized/read_file", bench::corpus_total(corpus, tris),
+                                      bench::corpus_total(corpus, [](const Corpus_file& f) { return f.binary_bytes; }),
+                                      [&] { for (const Corpus_file& f : corpus) quantized_mesh.read_file(f.binary_stl); });
+    if (result) {
+        double full_bytes = 0, quantized_bytes = 0, max_error = 0;
+        for (std::size_t i = 0; i < corpus.size(); ++i) {
+            const stl_viewer::QuantizedStlMesh& quantized_mesh = quantized_meshes[i];
+            full_bytes += static_cast<double>(meshes[i].memory_bytes());
+            quantized_bytes += static_cast<double>(quantized_mesh.memory_bytes());
+            const stl_viewer::ModelStats stats = stl_viewer::quantizedModelStats(quantized_mesh);
+            for (std::size_t v = 0; v < meshes[i].num_vrts(); ++v)
+                for (int c = 0; c < 3; ++c)
+                    max_error = std::max(max_error, std::fabs(static_cast<double>(quantized_mesh.vrt_coords(v)[c]) -
+                                                              meshes[i].vrt_coords(v)[c]) / stats.size);
+        }
+        const double num_tris = bench::corpus_total(corpus, tris);
+        result->counters.push_back(std::make_pair("full_bytes_per_tri", full_bytes / num_tris));
+        result->counters.push_back(std::make_pair("quantized_bytes_per_tri", quantized_bytes / num_tris));
+        result->counters.push_back(std::make_pair("max_relative_error", max_error));
+    }
+
+    run_split(suite, "loadModelQuantized", corpus, all, tris,
+              [](const Corpus_file&) { return 0; },
+              [&](const Corpus_file& f) {
+                  std::size_t i = static_cast<std::size_t>(&f - corpus.data());
+                  std::vector<uint16_t> vertices;
+                  std::vector<int16_t> vertex_normals;
+                  stl_viewer::loadModelQuantized(quantized_meshes[i], vertices, vertex_normals);
+                  bench::do_not_optimize(vertices.data());
+              });
+
+    // Vertex cache order: time to compute it, and the average cache miss
+    // ratio (transformed vertices per triangle) of the file order and of the result
+    for (bool overdraw : {false, true}) {
+        mesh_reorder::Reordering<unsigned int> reordering;
+        auto reorder = [&](std::size_t i) {
+            reordering = mesh_reorder::ReorderTris(meshes[i].raw_tris(), meshes[i].num_tris(), meshes[i].num_vrts(),
+                                                   meshes[i].raw_solids(), meshes[i].num_solids() + 1,
+                                                   mesh_reorder::DEFAULT_CACHE_SIZE, overdraw, meshes[i].raw_coords());
+        };
+        result = suite.run(std::string("mesh_reorder::ReorderTris") + (overdraw ? "/overdraw" : ""),
+                           bench::corpus_total(corpus, tris), 0, [&] {
+                               for (std::size_t i = 0; i < corpus.size(); ++i) reorder(i);
+                               bench::do_not_optimize(reordering.triOrder.data());
+                           });
+        if (result) {
+            double acmr_before = 0, acmr_after = 0;
+            for (std::size_t i = 0; i < corpus.size(); ++i) {
+                reorder(i);
+                acmr_before += reordering.acmrBefore * static_cast<double>(meshes[i].num_tris());
+                acmr_after += reordering.acmrAfter * static_cast<double>(meshes[i].num_tris());
+            }
+            const double num_tris = bench::corpus_total(corpus, tris);
+            result->counters.push_back(std::make_pair("acmr_before", acmr_before / num_tris));
+            result->counters.push_back(std::make_pair("acmr_after", acmr_after / num_tris));
+        }
+    }
+
+    // Picking: BVH build per mesh, then rays from outside the model towards
+    // random face centroids, against testing every triangle
+    {
+        std::vector<mesh_tools::Face_bvh> bvhs(corpus.size());
+        suite.run("Face_bvh::build", bench::corpus_total(corpus, tris), 0, [&] {
+            for (std::size_t i = 0; i < corpus.size(); ++i)
+                bvhs[i].build(meshes[i].raw_coords(), meshes[i].raw_tris(), meshes[i].num_tris());
+        });
+        for (std::size_t i = 0; i < corpus.size(); ++i)
+            bvhs[i].build(meshes[i].raw_coords(), meshes[i].raw_tris(), meshes[i].num_tris());
+
+        struct Ray { std::size_t mesh; float origin[3], dir[3]; };
+        std::vector<Ray> rays;
+        std::mt19937 random(7);
+        for (std::size_t i = 0; i < corpus.size(); ++i) {
+            const stl_viewer::ModelStats stats = stl_viewer::quantizedModelStats(quantized_meshes[i]);
+            const float center[3] = {stats.centerX, stats.centerY, stats.centerZ};
+            std::uniform_real_distribution<float> offset(-stats.size, stats.size);
+            for (int r = 0; r < 64; ++r) {
+                Ray ray;
+                ray.mesh = i;
+                const std::size_t f = random() % meshes[i].num_tris();
+                for (int j = 0; j < 3; ++j) {
+                    ray.origin[j] = center[j] + offset(random);
+                    const float target = (meshes[i].tri_corner_coords(f, 0)[j] + meshes[i].tri_corner_coords(f, 1)[j] +
+                                          meshes[i].tri_corner_coords(f, 2)[j]) / 3;
+                    ray.dir[j] = target - ray.origin[j];
+                }
+                rays.push_back(ray);
+            }
+        }
+        mesh_tools::Face_hit hit;
+        result = suite.run("Face_bvh::intersect", static_cast<double>(rays.size()), 0, [&] {
+            for (const Ray& ray : rays) bvhs[ray.mesh].intersect(ray.origin, ray.dir, hit);
+            bench::do_not_optimize(hit.face);
+        });
+        if (result) {
+            double nodes = 0, bytes = 0;
+            for (const mesh_tools::Face_bvh& bvh : bvhs) {
+                nodes += static_cast<double>(bvh.num_nodes());
+                bytes += static_cast<double>(bvh.memory_bytes());
+            }
+            result->counters.push_back(std::make_pair("nodes_per_tri", nodes / bench::corpus_total(corpus, tris)));
+            result->counters.push_back(std::make_pair("bytes_per_tri", bytes / bench::corpus_total(corpus, tris)));
+        }
+        // The same rays tested against every triangle
+        suite.run("pick/brute_force", static_cast<double>(rays.size()), 0, [&] {
+            for (const Ray& ray : rays) {
+                const StlMesh& mesh = meshes[ray.mesh];
+                float best = std::numeric_limits<float>::infinity();
+                for (std::size_t t = 0; t < mesh.num_tris(); ++t) {
+                    const float* a = mesh.tri_corner_coords(t, 0);
+                    const float* b = mesh.tri_corner_coords(t, 1);
+                    const float* c = mesh.tri_corner_coords(t, 2);
+                    const float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+                    const float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+                    const float s[3] = {ray.origin[0] - a[0], ray.origin[1] - a[1], ray.origin[2] - a[2]};
+                    const float* d = ray.dir;
+                    const float p[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0]};
+                    const float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+                    if (std::fabs(det) < 1e-20f) continue;
+                    const float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) / det;
+                    const float q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0]};
+                    const float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) / det;
+                    const float t_hit = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) / det;
+                    if (u >= 0 && v >= 0 && u + v <= 1 && t_hit >= 0 && t_hit < best) best = t_hit;
+                }
+                bench::do_not_optimize(best);
+            }
+        });
+    }
+
+    // Thumbnails: four 256 pixel views of every model, colored in bands of
+    // faces as a stand-in for segments, and the PNG files
+    {
+        std::vector<std::vector<std::uint8_t>> face_colors(corpus.size());
+        for (std::size_t i = 0; i < corpus.size(); ++i) {
+            face_colors[i].resize(meshes[i].num_tris() * 3);
+            for (std::size_t t = 0; t < meshes[i].num_tris(); ++t)
+                mesh_tools::segment_color(t * 8 / meshes[i].num_tris(), &face_colors[i][t * 3]);
+        }
+        std::vector<mesh_tools::Raster_image> images(corpus.size());
+        result = suite.run("render_views/4x256", bench::corpus_total(corpus, tris), 0, [&] {
+            for (std::size_t i = 0; i < corpus.size(); ++i)
+                images[i] = mesh_tools::render_views(meshes[i].raw_coords(), meshes[i].num_vrts(), meshes[i].raw_tris(),
+                                                     meshes[i].num_tris(), face_colors[i].data(),
+                                                     mesh_tools::thumbnail_views(), 256);
+        });
+        if (result) {
+            result->counters.push_back(std::make_pair("ms_per_model", result->median_ns * 1e-6 / static_cast<double>(corpus.size())));
+        }
+        const std::string thumbnail = std::string(BENCH_WORK_DIR) + "/thumbnail.png";
+        result = suite.run("write_png/4x256", static_cast<double>(corpus.size()), 0, [&] {
+            for (const mesh_tools::Raster_image& image : images)
+                mesh_tools::write_png(thumbnail, image.width, image.height, image.rgb.data());
+        });
+        if (result) {
+            result->counters.push_back(std::make_pair("bytes", static_cast<double>(bench::file_size(thumbnail))));
+        }
+    }
+
+    // Concurrent union-find on a 1024 x 1024 grid: every node is united with
+    // its right and lower neighbours from all threads, then flattened
+    {
+        const std::uint32_t side = 1024;
+        mesh_tools::Concurrent_union_find sets;
+        const double num_edges = 2.0 * side * (side - 1);
+        suite.run("Concurrent_union_find/grid", num_edges, 0, [&] { sets.reset(std::size_t(side) * side); }, [&] {
+            mesh_tools::parallel_for(std::size_t(side) * side, [&](std::size_t i) {
+                const std::uint32_t x = static_cast<std::uint32_t>(i % side), y = static_cast<std::uint32_t>(i / side);
+                if (x + 1 < side) sets.unite(static_cast<std::uint32_t>(i), static_cast<std::uint32_t>(i + 1));
+                if (y + 1 < side) sets.unite(static_cast<std::uint32_t>(i), static_cast<std::uint32_t>(i + side));
+            });
+            mesh_tools::parallel_for(std::size_t(side) * side, [&](std::size_t i) {
+                bench::do_not_optimize(sets.find(static_cast<std::uint32_t>(i)));
+            });
+        });
+    }
+
+    // Perimeters of 64 layers, 0.4 mm apart as for a 0.4 mm nozzle
+    {
+        const std::vector<mesh_tools::Contour_set> layers = make_star_layers(64, 200);
+        std::vector<mesh_tools::Contour_set> rings(layers.size());
+        mesh_tools::Offset_params params;
+        params.first = -200;
+        params.step = -400;
+        params.max_rings = 20;
+        params.arc_tolerance = 5;
+        mesh_tools::Offset_scratch scratch;
+        std::size_t num_unsettled = 0;
+        result = suite.run("offset_contours/serial", static_cast<double>(layers.size()), 0, [&] {
+            num_unsettled = 0;
+            for (std::size_t i = 0; i < layers.size(); ++i)
+                num_unsettled += mesh_tools::offset_contours(layers[i], params, rings[i], scratch);
+        });
+        if (result) {
+            double num_rings = 0;
+            for (const mesh_tools::Contour_set& r : rings) num_rings += static_cast<double>(r.num_rings());
+            result->counters.push_back(std::make_pair("rings_per_layer", num_rings / static_cast<double>(layers.size())));
+        }
+        suite.run("offset_layers", static_cast<double>(layers.size()), 0, [&] {
+            num_unsettled += mesh_tools::offset_layers(layers.data(), layers.size(), params, rings.data());
+        });
+        if (num_unsettled != 0) {
+            std::fprintf(stderr, "FAILED: %zu offset ring sets still had crossings after the last trimming pass\n",
+                         num_unsettled);
+            failed = true;
+        }
+    }
+
+    // Mesh packs of the corpus, against the binary STL files they replace
+    std::vector<std::string> packs;
+    for (const Corpus_file& file : corpus)
+        packs.push_back(std::string(BENCH_WORK_DIR) + "/" + file.name + ".mpk");
+    run_split(suite, "WriteMeshPack", corpus, all, tris,
+              [](const Corpus_file& f) { return f.binary_bytes; },
+              [&](const Corpus_file& f) {
+                  std::size_t i = static_cast<std::size_t>(&f - corpus.data());
+                  mesh_pack::WriteMeshPack(packs[i].c_str(), meshes[i]);
+              });
+    for (std::size_t i = 0; i < corpus.size(); ++i) mesh_pack::WriteMeshPack(packs[i].c_str(), meshes[i]);
+    result = suite.run("ReadMeshPack", bench::corpus_total(corpus, tris),
+                       bench::corpus_total(corpus, [](const Corpus_file& f) { return f.binary_bytes; }), [&] {
+                           for (const std::string& pack : packs) {
+                               mesh_pack::ReadMeshPack(pack.c_str(), coords, normals, tris_out, solids);
+                               bench::do_not_optimize(tris_out.data());
+                           }
+                       });
+    if (result) {
+        double pack_bytes = 0;
+        for (const std::string& pack : packs) pack_bytes += static_cast<double>(bench::file_size(pack));
+        result->counters.push_back(std::make_pair("pack_bytes_per_tri", pack_bytes / bench::corpus_total(corpus, tris)));
+        result->counters.push_back(std::make_pair("compression_vs_binary_stl",
+            bench::corpus_total(corpus, [](const Corpus_file& f) { return f.binary_bytes; }) / pack_bytes));
+    }
+    for (const std::string& pack : packs) std::remove(pack.c_str());
+
+    std::vector<double> off_coords;
+    std::vector<unsigned int> face_vrts, face_offsets;
+    run_split(suite, "ReadOffFile", corpus, [](const Corpus_file& f) { return !f.off_path.empty(); },
+              tris, [](const Corpus_file& f) { return f.off_bytes; },
+              [&](const Corpus_file& f) {
+                  off_reader::ReadOffFile(f.off_path.c_str(), off_coords, face_vrts, face_offsets);
+                  bench::do_not_optimize(face_vrts.data());
+              });
+
+    const std::string output = std::string(BENCH_WORK_DIR) + "/write_bench.stl";
+    run_split(suite, "WriteStlMesh_BINARY", corpus, all, tris,
+              [](const Corpus_file& f) { return f.binary_bytes; },
+              [&](const Corpus_file& f) {
+                  std::size_t i = static_cast<std::size_t>(&f - corpus.data());
+                  stl_writer::WriteStlMesh_BINARY(output.c_str(), meshes[i]);
+              });
+    std::remove(output.c_str());
+
+    // The silhouette is quadratic in the number of faces, so it is measured on
+    // a fixed size rather than on the corpus
+    const std::size_t cluster_sizes[] = {500, 2000};
+    for (std::size_t n : cluster_sizes) {
+        std::vector<double> values = make_sdf_values(n);
+        std::vector<int> labels;
+        suite.run("kmeansSdf/k=5/n=" + std::to_string(n), static_cast<double>(n), 0, [&] {
+            labels = kmeansSdf(values, 5);
+            bench::do_not_optimize(labels.data());
+        });
+        suite.run("silhouetteScore/k=5/n=" + std::to_string(n), static_cast<double>(n), 0, [&] {
+            bench::do_not_optimize(silhouetteScore(values, labels, 5));
+        });
+        suite.run("chooseClusterCount/k<=10/n=" + std::to_string(n), static_cast<double>(n), 0, [&] {
+            double silhouette = 0;
+            bench::do_not_optimize(chooseClusterCount(values, 10, labels, silhouette));
+        });
+    }
+
+    const int status = suite.finish();
+    return failed ? EXIT_FAILURE : status;
+}
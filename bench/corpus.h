@@ -0,0 +1,149 @@
+#ifndef BENCH_CORPUS_H
+#define BENCH_CORPUS_H
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "off_reader.h"
+#include "stl_reader.h"
+#include "stl_writer.h"
+
+namespace bench {
+
+// One input of the benchmark corpus. Every model is available as binary and
+// ASCII STL; models from Models/ additionally keep their original OFF file.
+struct Corpus_file {
+    std::string name;
+    std::string off_path;      // empty for model.stl
+    std::string binary_stl;
+    std::string ascii_stl;
+    std::size_t num_tris = 0;
+    std::size_t off_bytes = 0, binary_bytes = 0, ascii_bytes = 0;
+};
+
+inline std::size_t file_size(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? static_cast<std::size_t>(st.st_size) : 0;
+}
+
+namespace detail {
+
+// Triangle soup of an OFF file, polygons fanned around their first corner.
+inline bool off_triangles(const std::string& path, std::vector<float>& soup) {
+    std::vector<double> coords;
+    std::vector<unsigned> face_vrts, face_offsets;
+    if (!off_reader::ReadOffFile(path.c_str(), coords, face_vrts, face_offsets)) return false;
+    soup.clear();
+    for (std::size_t f = 0; f + 1 < face_offsets.size(); ++f) {
+        for (unsigned c = face_offsets[f] + 1; c + 1 < face_offsets[f + 1]; ++c) {
+            const unsigned corners[3] = {face_vrts[face_offsets[f]], face_vrts[c], face_vrts[c + 1]};
+            for (unsigned v : corners)
+                for (int i = 0; i < 3; ++i) soup.push_back(static_cast<float>(coords[v * 3 + i]));
+        }
+    }
+    return true;
+}
+
+inline bool stl_triangles(const std::string& path, std::vector<float>& soup) {
+    stl_reader::StlMesh<float, unsigned> mesh(path.c_str());
+    soup.clear();
+    for (std::size_t t = 0; t < mesh.num_tris(); ++t)
+        for (int c = 0; c < 3; ++c)
+            soup.insert(soup.end(), mesh.tri_corner_coords(t, c), mesh.tri_corner_coords(t, c) + 3);
+    return true;
+}
+
+inline bool write_binary_stl(const std::string& path, const std::vector<float>& soup) {
+    return stl_writer::WriteStlFile_BINARY(path.c_str(), soup.size() / 9,
+        [&](std::size_t t, float* record, std::uint16_t&) {
+            const float* p = &soup[t * 9];
+            stl_writer::stl_writer_impl::TriNormal(p, p + 3, p + 6, record);
+            std::copy(p, p + 9, record + 3);
+        }, "bench corpus");
+}
+
+inline bool write_ascii_stl(const std::string& path, const std::vector<float>& soup) {
+    std::FILE* out = std::fopen(path.c_str(), "w");
+    if (!out) return false;
+    bool ok = std::fprintf(out, "solid bench\n") > 0;
+    for (std::size_t t = 0; ok && t < soup.size() / 9; ++t) {
+        const float* p = &soup[t * 9];
+        float n[3];
+        stl_writer::stl_writer_impl::TriNormal(p, p + 3, p + 6, n);
+        ok = std::fprintf(out, "facet normal %g %g %g\nouter loop\n", n[0], n[1], n[2]) > 0;
+        for (int c = 0; ok && c < 3; ++c)
+            ok = std::fprintf(out, "vertex %.9g %.9g %.9g\n", p[c * 3], p[c * 3 + 1], p[c * 3 + 2]) > 0;
+        ok = ok && std::fprintf(out, "endloop\nendfacet\n") > 0;
+    }
+    ok = ok && std::fprintf(out, "endsolid bench\n") > 0;
+    return std::fclose(out) == 0 && ok;
+}
+
+} // namespace detail
+
+// Collects model.stl and Models/*.off from data_dir and writes binary and
+// ASCII STL copies of every model to work_dir. Files that cannot be read are
+// reported and skipped.
+inline std::vector<Corpus_file> prepare_corpus(const std::string& data_dir, const std::string& work_dir) {
+    std::vector<Corpus_file> corpus;
+    std::vector<std::string> off_names;
+    if (DIR* dir = opendir((data_dir + "/Models").c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".off") == 0) off_names.push_back(name);
+        }
+        closedir(dir);
+    }
+    std::sort(off_names.begin(), off_names.end());
+
+    std::vector<std::string> names(1, "model.stl");
+    names.insert(names.end(), off_names.begin(), off_names.end());
+
+    std::vector<float> soup;
+    for (const std::string& name : names) {
+        Corpus_file file;
+        file.name = name;
+        const bool is_off = name != "model.stl";
+        const std::string stem = name.substr(0, name.size() - 4);
+        try {
+            if (is_off) {
+                file.off_path = data_dir + "/Models/" + name;
+                if (!detail::off_triangles(file.off_path, soup)) throw std::runtime_error("unreadable");
+                file.binary_stl = work_dir + "/" + stem + "_binary.stl";
+                if (!detail::write_binary_stl(file.binary_stl, soup)) throw std::runtime_error("not written");
+            } else {
+                file.binary_stl = data_dir + "/" + name;
+                detail::stl_triangles(file.binary_stl, soup);
+            }
+            file.ascii_stl = work_dir + "/" + stem + "_ascii.stl";
+            if (!detail::write_ascii_stl(file.ascii_stl, soup)) throw std::runtime_error("not written");
+        } catch (const std::exception& e) {
+            std::fprintf(stderr, "Skipping %s: %s\n", name.c_str(), e.what());
+            continue;
+        }
+        file.num_tris = soup.size() / 9;
+        file.off_bytes = is_off ? file_size(file.off_path) : 0;
+        file.binary_bytes = file_size(file.binary_stl);
+        file.ascii_bytes = file_size(file.ascii_stl);
+        corpus.push_back(file);
+    }
+    return corpus;
+}
+
+// Sum of a per-file figure over the corpus.
+template <class Fn>
+double corpus_total(const std::vector<Corpus_file>& corpus, Fn fn) {
+    double total = 0;
+    for (const Corpus_file& file : corpus) total += static_cast<double>(fn(file));
+    return total;
+}
+
+} // namespace bench
+
+#endif // BENCH_CORPUS_H
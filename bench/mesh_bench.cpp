@@ -0,0 +1,256 @@
+// Benchmarks of the CGAL pipeline: reading into a Surface_mesh (OFF, STL and
+// mesh packs), face adjacency, SDF, segmentation (graph cut, merge tree and
+// normal cones)
+// and segment export, the latter in file order and in spatial order.
+
+#include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
+#include <CGAL/Surface_mesh.h>
+#include <CGAL/IO/OFF.h>
+#include <CGAL/IO/STL.h>
+#include <CGAL/mesh_segmentation.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "corpus.h"
+#include "face_adjacency.h"
+#include "face_order.h"
+#include "merge_tree.h"
+#include "mesh_io.h"
+#include "normal_regions.h"
+#include "out_of_core.h"
+#include "segment_boundaries.h"
+#include "segment_cleanup.h"
+#include "segment_view.h"
+#include "vertex_curvature.h"
+#include "waste/SdfClustering.h"
+
+typedef CGAL::Exact_predicates_inexact_constructions_kernel Kernel;
+typedef CGAL::Surface_mesh<Kernel::Point_3> Surface_mesh;
+typedef boost::graph_traits<Surface_mesh>::face_descriptor face_descriptor;
+
+using bench::Corpus_file;
+
+namespace {
+
+// Reference path: CGAL's STL reader followed by add_face for every triangle
+bool cgal_read_STL(const std::string& filename, Surface_mesh& mesh) {
+    std::vector<Kernel::Point_3> points;
+    std::vector<std::array<std::size_t, 3>> triangles;
+    if (!CGAL::IO::read_STL(filename, points, triangles)) return false;
+    mesh.clear();
+    for (const Kernel::Point_3& p : points) mesh.add_vertex(p);
+    for (const std::array<std::size_t, 3>& t : triangles)
+        mesh.add_face(Surface_mesh::Vertex_index(t[0]), Surface_mesh::Vertex_index(t[1]),
+                      Surface_mesh::Vertex_index(t[2]));
+    return true;
+}
+
+// Visits the neighbours of every face by walking halfedges
+double walk_halfedges(const Surface_mesh& mesh) {
+    double sum = 0;
+    for (face_descriptor f : mesh.faces()) {
+        for (auto h : CGAL::halfedges_around_face(mesh.halfedge(f), mesh)) {
+            auto g = mesh.face(mesh.opposite(h));
+            if (g != Surface_mesh::null_face()) sum += static_cast<double>(g.idx());
+        }
+    }
+    return sum;
+}
+
+// The same traversal over the shared CSR adjacency
+double walk_adjacency(const mesh_tools::Face_adjacency& adjacency) {
+    double sum = 0;
+    for (std::size_t f = 0; f < adjacency.num_faces(); ++f)
+        for (std::uint32_t i = adjacency.begin(f); i < adjacency.end(f); ++i)
+            sum += static_cast<double>(adjacency.neighbor[i]);
+    return sum;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bench::Options options = bench::parse_options(argc, argv);
+    bench::Suite suite("mesh_bench", options);
+
+    std::vector<Corpus_file> corpus = bench::prepare_corpus(BENCH_DATA_DIR, BENCH_WORK_DIR);
+
+    for (const Corpus_file& file : corpus) {
+        const double tris = static_cast<double>(file.num_tris);
+        Surface_mesh mesh;
+
+        if (!file.off_path.empty()) {
+            const bench::Result* cgal = suite.run("CGAL::IO::read_OFF/" + file.name, tris,
+                                                  static_cast<double>(file.off_bytes), [&] {
+                mesh.clear();
+                CGAL::IO::read_OFF(file.off_path, mesh);
+            });
+            const double cgal_ns = cgal ? cgal->median_ns : 0;
+            bench::Result* result = suite.run("mesh_tools::read_OFF/" + file.name, tris,
+                                              static_cast<double>(file.off_bytes), [&] {
+                mesh_tools::read_OFF(file.off_path, mesh);
+            });
+            // Ratio of the CGAL reader's median time to this one's
+            if (cgal_ns > 0 && result && result->median_ns > 0)
+                result->counters.push_back(std::make_pair("speedup_vs_cgal", cgal_ns / result->median_ns));
+        }
+        suite.run("CGAL::IO::read_STL/" + file.name, tris, static_cast<double>(file.binary_bytes), [&] {
+            cgal_read_STL(file.binary_stl, mesh);
+        });
+        suite.run("mesh_tools::read_STL/" + file.name, tris, static_cast<double>(file.binary_bytes), [&] {
+            mesh_tools::read_STL(file.binary_stl, mesh);
+        });
+        const std::string pack = std::string(BENCH_WORK_DIR) + "/" + file.name + ".mpk";
+        mesh_pack::WriteMeshPack(pack.c_str(), stl_reader::StlMesh<float, unsigned>(file.binary_stl));
+        suite.run("mesh_tools::read_mesh_pack/" + file.name, tris, static_cast<double>(file.binary_bytes), [&] {
+            mesh_tools::read_mesh_pack(pack, mesh);
+        });
+        std::remove(pack.c_str());
+
+        mesh_tools::Mesh_build_report report;
+        if (!mesh_tools::read_STL(file.binary_stl, mesh, &report) || mesh.is_empty()) continue;
+
+        mesh_tools::Face_adjacency adjacency;
+        suite.run("build_face_adjacency/" + file.name, tris, 0, [&] {
+            mesh_tools::build_face_adjacency(mesh, adjacency);
+        });
+        suite.run("face_neighbors/halfedge_walk/" + file.name, tris, 0, [&] {
+            bench::do_not_optimize(walk_halfedges(mesh));
+        });
+        suite.run("face_neighbors/csr/" + file.name, tris, 0, [&] {
+            bench::do_not_optimize(walk_adjacency(adjacency));
+        });
+
+        // Per-vertex differential quantities over the one-ring CSR
+        {
+            mesh_tools::Vertex_rings rings;
+            suite.run("build_vertex_rings/" + file.name, tris, 0, [&] {
+                mesh_tools::build_vertex_rings(mesh, rings);
+            });
+            mesh_tools::Vertex_curvature curvature;
+            suite.run("compute_vertex_curvature/" + file.name, tris, 0, [&] {
+                mesh_tools::compute_vertex_curvature(mesh, rings, curvature);
+            });
+        }
+
+        auto sdf_pmap = mesh.add_property_map<face_descriptor, double>("f:sdf").first;
+        auto segment_pmap = mesh.add_property_map<face_descriptor, std::size_t>("f:segment_id").first;
+        suite.run("sdf_values/" + file.name, tris, 0, [&] {
+            CGAL::sdf_values(mesh, sdf_pmap);
+        });
+
+        std::size_t num_segments = 0;
+        suite.run("segmentation_from_sdf_values/k=5/" + file.name, tris, 0, [&] {
+            num_segments = CGAL::segmentation_from_sdf_values(mesh, sdf_pmap, segment_pmap, 5);
+        });
+
+        // Graph-cut segments fall apart into patches; split them and merge
+        // the ones below 1% of the area
+        {
+            std::vector<std::size_t> graph_cut(mesh.number_of_faces());
+            for (face_descriptor f : mesh.faces()) graph_cut[f.idx()] = segment_pmap[f];
+            auto restore = [&] {
+                for (face_descriptor f : mesh.faces()) segment_pmap[f] = graph_cut[f.idx()];
+            };
+            suite.run("clean_segments/1%/" + file.name, tris, 0, restore, [&] {
+                bench::do_not_optimize(mesh_tools::clean_segments(mesh, adjacency, segment_pmap, 0.01));
+            });
+            restore();
+        }
+        suite.run("extract_segment_boundaries/k=5/" + file.name, tris, 0, [&] {
+            bench::do_not_optimize(mesh_tools::extract_segment_boundaries(mesh, segment_pmap).num_polylines());
+        });
+
+        // Normal-cone regions need no SDF
+        suite.run("grow_normal_regions/" + file.name, tris, 0, [&] {
+            bench::do_not_optimize(mesh_tools::grow_normal_regions(mesh, adjacency).num_regions());
+        });
+
+        // The same regions out of core, in eight tiles streamed from the STL
+        {
+            mesh_tools::Out_of_core_params params;
+            params.max_tile_faces = std::max<std::size_t>(1, file.num_tris / 8);
+            params.work_dir = BENCH_WORK_DIR;
+            const std::string labels = std::string(BENCH_WORK_DIR) + "/" + file.name + ".labels";
+            auto segment_tile = [](const std::string& path, std::size_t num_faces, std::uint32_t* tile_labels) {
+                Surface_mesh tile;
+                mesh_tools::Mesh_build_report tile_report;
+                mesh_tools::read_STL(path, tile, &tile_report);
+                mesh_tools::Face_adjacency tile_adjacency;
+                mesh_tools::build_face_adjacency(tile, tile_adjacency);
+                mesh_tools::Normal_regions regions = mesh_tools::grow_normal_regions(tile, tile_adjacency);
+                std::size_t next_rejected = 0, f = 0;
+                for (std::size_t i = 0; i < num_faces; ++i) {
+                    if (next_rejected < tile_report.rejected_faces.size() && tile_report.rejected_faces[next_rejected] == i)
+                        ++next_rejected;
+                    else
+                        tile_labels[i] = regions.face_region[f++];
+                }
+                return regions.num_regions();
+            };
+            suite.run("segment_out_of_core/normal/" + file.name, tris, static_cast<double>(file.binary_bytes), [&] {
+                bench::do_not_optimize(mesh_tools::segment_out_of_core(file.binary_stl, labels, segment_tile, params));
+            });
+            std::remove(labels.c_str());
+        }
+
+        // Hierarchical alternative: the tree is built once, every cluster
+        // count is a cut
+        {
+            mesh_tools::Merge_tree tree;
+            suite.run("build_merge_tree/" + file.name, tris, 0, [&] {
+                tree = mesh_tools::build_merge_tree(mesh, adjacency, sdf_pmap);
+            });
+            std::vector<std::uint32_t> labels(mesh.number_of_faces());
+            suite.run("cut_merge_tree/k=5/" + file.name, tris, 0, [&] {
+                bench::do_not_optimize(mesh_tools::cut_merge_tree(tree, 5, labels));
+            });
+        }
+
+        // The same stages after sorting faces and vertices along a Hilbert curve
+        {
+            Surface_mesh sorted;
+            suite.run("spatial_sort_mesh/hilbert/" + file.name, tris, 0, [&] { sorted = mesh; },
+                      [&] { mesh_tools::spatial_sort_mesh(sorted, mesh_tools::Space_filling_curve::Hilbert); });
+            suite.run("spatial_sort_mesh/morton/" + file.name, tris, 0, [&] { sorted = mesh; },
+                      [&] { mesh_tools::spatial_sort_mesh(sorted, mesh_tools::Space_filling_curve::Morton); });
+            sorted = mesh;
+            mesh_tools::spatial_sort_mesh(sorted, mesh_tools::Space_filling_curve::Hilbert);
+            auto sorted_sdf = sorted.property_map<face_descriptor, double>("f:sdf").first;
+            auto sorted_segments = sorted.property_map<face_descriptor, std::size_t>("f:segment_id").first;
+            suite.run("sdf_values/hilbert/" + file.name, tris, 0, [&] {
+                CGAL::sdf_values(sorted, sorted_sdf);
+            });
+            suite.run("segmentation_from_sdf_values/k=5/hilbert/" + file.name, tris, 0, [&] {
+                CGAL::segmentation_from_sdf_values(sorted, sorted_sdf, sorted_segments, 5);
+            });
+        }
+
+        // The waste clustering is quadratic, so it only runs on the smaller models
+        if (file.num_tris <= 4000) {
+            std::vector<double> values;
+            for (face_descriptor f : mesh.faces()) values.push_back(sdf_pmap[f]);
+            std::vector<int> labels;
+            suite.run("chooseClusterCount/k<=10/" + file.name, tris, 0, [&] {
+                double silhouette = 0;
+                bench::do_not_optimize(chooseClusterCount(values, 10, labels, silhouette));
+            });
+        }
+
+        mesh_tools::Segment_buckets buckets = mesh_tools::bucket_faces_by_segment(mesh, segment_pmap, num_segments);
+        std::vector<mesh_tools::Segment_view> views = mesh_tools::make_segment_views(mesh, buckets);
+        const std::string prefix = std::string(BENCH_WORK_DIR) + "/segment";
+        suite.run("export_segments/stl/" + file.name, tris, 0, [&] {
+            mesh_tools::export_segments(mesh, views, prefix, mesh_tools::Segment_file_format::STL);
+        });
+        for (std::size_t s = 0; s < num_segments; ++s)
+            std::remove(mesh_tools::segment_filename(prefix, s, mesh_tools::Segment_file_format::STL).c_str());
+    }
+
+    return suite.finish();
+}
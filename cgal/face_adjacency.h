@@ -0,0 +1,222 @@
+#ifndef FACE_ADJACENCY_H
+#define FACE_ADJACENCY_H
+
+#include <CGAL/Surface_mesh.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "memory_stats.h"
+#include "parallel.h"
+
+namespace mesh_tools {
+
+// Face-to-face adjacency of a Surface_mesh in compressed sparse row form.
+//
+// The neighbours of face f are the entries [offsets[f], offsets[f + 1]) of the
+// per-entry arrays. Those are kept as separate arrays (structure of arrays) so a
+// stage that only follows neighbour indices does not drag edge lengths and
+// angles through the cache. Border edges have no entry.
+//
+// Face indices are the raw Surface_mesh indices, so the mesh must not contain
+// garbage (call collect_garbage() after removing elements) and the adjacency has
+// to be rebuilt whenever the connectivity changes.
+struct Face_adjacency {
+    counted_vector<std::uint32_t> offsets;     // num_faces() + 1 entries
+    counted_vector<std::uint32_t> neighbor;    // index of the adjacent face
+    counted_vector<float> edge_length;         // length of the shared edge
+    counted_vector<float> dihedral;            // angle between the two face normals, 0 if coplanar
+
+    std::size_t num_faces() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+    std::size_t num_entries() const { return neighbor.size(); }
+    bool empty() const { return offsets.empty(); }
+
+    std::uint32_t begin(std::size_t f) const { return offsets[f]; }
+    std::uint32_t end(std::size_t f) const { return offsets[f + 1]; }
+
+    std::size_t memory_bytes() const {
+        return (offsets.capacity() + neighbor.capacity()) * sizeof(std::uint32_t) +
+               (edge_length.capacity() + dihedral.capacity()) * sizeof(float);
+    }
+
+    void clear() {
+        offsets.clear();
+        neighbor.clear();
+        edge_length.clear();
+        dihedral.clear();
+    }
+};
+
+namespace detail {
+
+inline void normalize3(double n[3]) {
+    const double len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (len > 0.0) {
+        n[0] /= len;
+        n[1] /= len;
+        n[2] /= len;
+    }
+}
+
+// Newell normal of a face, which is robust for non-planar polygons as well.
+template <class Mesh>
+void face_normal(const Mesh& mesh, typename Mesh::Face_index f, float out[3]) {
+    double n[3] = { 0.0, 0.0, 0.0 };
+    const typename Mesh::Halfedge_index h0 = mesh.halfedge(f);
+    typename Mesh::Halfedge_index h = h0;
+    do {
+        const auto& p = mesh.point(mesh.source(h));
+        const auto& q = mesh.point(mesh.target(h));
+        const double px = CGAL::to_double(p.x()), py = CGAL::to_double(p.y()), pz = CGAL::to_double(p.z());
+        const double qx = CGAL::to_double(q.x()), qy = CGAL::to_double(q.y()), qz = CGAL::to_double(q.z());
+        n[0] += (py - qy) * (pz + qz);
+        n[1] += (pz - qz) * (px + qx);
+        n[2] += (px - qx) * (py + qy);
+        h = mesh.next(h);
+    } while (h != h0);
+    normalize3(n);
+    out[0] = static_cast<float>(n[0]);
+    out[1] = static_cast<float>(n[1]);
+    out[2] = static_cast<float>(n[2]);
+}
+
+// Area of a face, from the fan of triangles around its first corner.
+template <class Mesh>
+double face_area(const Mesh& mesh, typename Mesh::Face_index f) {
+    auto h = mesh.halfedge(f);
+    const auto& a = mesh.point(mesh.target(h));
+    double n[3] = { 0, 0, 0 };
+    for (h = mesh.next(h); mesh.next(h) != mesh.halfedge(f); h = mesh.next(h)) {
+        const auto& b = mesh.point(mesh.target(h));
+        const auto& c = mesh.point(mesh.target(mesh.next(h)));
+        const double u[3] = { CGAL::to_double(b.x() - a.x()), CGAL::to_double(b.y() - a.y()),
+                              CGAL::to_double(b.z() - a.z()) };
+        const double w[3] = { CGAL::to_double(c.x() - a.x()), CGAL::to_double(c.y() - a.y()),
+                              CGAL::to_double(c.z() - a.z()) };
+        n[0] += u[1] * w[2] - u[2] * w[1];
+        n[1] += u[2] * w[0] - u[0] * w[2];
+        n[2] += u[0] * w[1] - u[1] * w[0];
+    }
+    return 0.5 * std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+}
+
+template <class Mesh>
+double halfedge_length(const Mesh& mesh, typename Mesh::Halfedge_index h) {
+    const auto& p = mesh.point(mesh.source(h));
+    const auto& q = mesh.point(mesh.target(h));
+    const double dx = CGAL::to_double(q.x()) - CGAL::to_double(p.x());
+    const double dy = CGAL::to_double(q.y()) - CGAL::to_double(p.y());
+    const double dz = CGAL::to_double(q.z()) - CGAL::to_double(p.z());
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+} // namespace detail
+
+// Builds the CSR adjacency of all faces of the mesh. Face normals, degrees and
+// the per-entry arrays are each computed in a parallel pass; only the prefix
+// sum over the degrees is serial.
+template <class Mesh>
+void build_face_adjacency(const Mesh& mesh, Face_adjacency& adj) {
+    typedef typename Mesh::Face_index Face_index;
+    typedef typename Mesh::Halfedge_index Halfedge_index;
+    MESH_TRACE_SCOPE("build_face_adjacency");
+
+    const std::size_t num_faces = mesh.number_of_faces();
+    adj.clear();
+    adj.offsets.resize(num_faces + 1, 0);
+
+    counted_vector<float> normals(num_faces * 3);
+    parallel_for(num_faces, [&](std::size_t f) {
+        const Face_index fd(static_cast<typename Mesh::size_type>(f));
+        detail::face_normal(mesh, fd, &normals[f * 3]);
+
+        std::uint32_t degree = 0;
+        const Halfedge_index h0 = mesh.halfedge(fd);
+        Halfedge_index h = h0;
+        do {
+            if (!mesh.is_border(mesh.opposite(h))) ++degree;
+            h = mesh.next(h);
+        } while (h != h0);
+        adj.offsets[f + 1] = degree;
+    });
+
+    for (std::size_t f = 0; f < num_faces; ++f)
+        adj.offsets[f + 1] += adj.offsets[f];
+
+    const std::size_t num_entries = adj.offsets[num_faces];
+    adj.neighbor.resize(num_entries);
+    adj.edge_length.resize(num_entries);
+    adj.dihedral.resize(num_entries);
+
+    parallel_for(num_faces, [&](std::size_t f) {
+        const Face_index fd(static_cast<typename Mesh::size_type>(f));
+        const float* n = &normals[f * 3];
+        std::uint32_t e = adj.offsets[f];
+
+        const Halfedge_index h0 = mesh.halfedge(fd);
+        Halfedge_index h = h0;
+        do {
+            const Halfedge_index o = mesh.opposite(h);
+            if (!mesh.is_border(o)) {
+                const std::uint32_t g = static_cast<std::uint32_t>(mesh.face(o).idx());
+                const float* m = &normals[std::size_t(g) * 3];
+                const float c = n[0] * m[0] + n[1] * m[1] + n[2] * m[2];
+
+                adj.neighbor[e] = g;
+                adj.edge_length[e] = static_cast<float>(detail::halfedge_length(mesh, h));
+                adj.dihedral[e] = std::acos(std::max(-1.0f, std::min(1.0f, c)));
+                ++e;
+            }
+            h = mesh.next(h);
+        } while (h != h0);
+    });
+}
+
+template <class Mesh>
+Face_adjacency build_face_adjacency(const Mesh& mesh) {
+    Face_adjacency adj;
+    build_face_adjacency(mesh, adj);
+    return adj;
+}
+
+// Counts the edge-connected patches formed by faces sharing a segment ID.
+// A segment that is split into several disconnected patches counts once per
+// patch, so the result is >= the number of segments.
+template <class Mesh, class SegmentMap>
+std::size_t count_segment_patches(const Mesh&, const Face_adjacency& adj, const SegmentMap& segment_map) {
+    typedef typename Mesh::Face_index Face_index;
+    MESH_TRACE_SCOPE("count_segment_patches");
+
+    const std::size_t num_faces = adj.num_faces();
+    std::vector<std::size_t> label(num_faces);
+    for (std::size_t f = 0; f < num_faces; ++f)
+        label[f] = segment_map[Face_index(static_cast<typename Mesh::size_type>(f))];
+
+    std::vector<char> visited(num_faces, 0);
+    std::vector<std::uint32_t> stack;
+    std::size_t patches = 0;
+    for (std::size_t seed = 0; seed < num_faces; ++seed) {
+        if (visited[seed]) continue;
+        ++patches;
+        visited[seed] = 1;
+        stack.push_back(static_cast<std::uint32_t>(seed));
+        while (!stack.empty()) {
+            const std::uint32_t f = stack.back();
+            stack.pop_back();
+            for (std::uint32_t e = adj.begin(f); e < adj.end(f); ++e) {
+                const std::uint32_t g = adj.neighbor[e];
+                if (!visited[g] && label[g] == label[f]) {
+                    visited[g] = 1;
+                    stack.push_back(g);
+                }
+            }
+        }
+    }
+    return patches;
+}
+
+} // namespace mesh_tools
+
+#endif // FACE_ADJACENCY_H
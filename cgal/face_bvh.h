@@ -0,0 +1,321 @@
+#ifndef FACE_BVH_H
+#define FACE_BVH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "memory_stats.h"
+#include "parallel.h"
+#include "trace.h"
+
+namespace mesh_tools {
+
+// Nearest face hit by a ray.
+struct Face_hit {
+    std::uint32_t face = std::numeric_limits<std::uint32_t>::max();
+    float t = std::numeric_limits<float>::infinity();   // distance along the ray, in units of its direction
+    float u = 0, v = 0;                                 // barycentric coordinates of the hit point
+
+    bool hit() const { return face != std::numeric_limits<std::uint32_t>::max(); }
+};
+
+// Bounding volume hierarchy over the triangles of a mesh, for picking and
+// other ray queries. Built once per mesh with binned SAH splits, in a single
+// flat node array; leaf triangles are copied next to each other in traversal
+// order as (vertex, edge, edge), so a query touches a few cache lines per
+// level instead of chasing the mesh. The tree holds float copies of the
+// geometry and does not refer to the mesh after build().
+class Face_bvh {
+public:
+    // 3 coordinates per vertex, 3 corners per triangle. Face IDs reported by
+    // intersect() are triangle indices in tris.
+    template <class TNumber, class TIndex>
+    void build(const TNumber* coords, const TIndex* tris, std::size_t num_faces);
+
+    // Nearest intersection of the ray origin + t * dir, t in [0, max_t),
+    // with any triangle, from either side. False if there is none.
+    bool intersect(const float origin[3], const float dir[3], Face_hit& hit,
+                   float max_t = std::numeric_limits<float>::infinity()) const;
+
+    std::size_t num_faces() const { return m_face_ids.size(); }
+    std::size_t num_nodes() const { return m_nodes.size(); }
+    bool empty() const { return m_nodes.empty(); }
+    void clear();
+
+    std::size_t memory_bytes() const {
+        return m_nodes.capacity() * sizeof(Node) + m_triangles.capacity() * sizeof(Triangle) +
+               m_face_ids.capacity() * sizeof(std::uint32_t);
+    }
+
+private:
+    // Leaves have count > 0 and hold triangles [first, first + count). Inner
+    // nodes have count == 0; their children are first and first + 1.
+    struct Node {
+        float lo[3], hi[3];
+        std::uint32_t first;
+        std::uint32_t count;
+    };
+    struct Triangle {
+        float v0[3], e1[3], e2[3];
+    };
+    struct Build_item {
+        float lo[3], hi[3], centroid[3];
+    };
+
+    static const std::uint32_t max_leaf_size = 4;
+    static const std::uint32_t small_node_size = 32;
+    static const int num_bins = 16;
+    static const int max_depth = 64;
+
+    void subdivide(std::uint32_t node, std::vector<std::uint32_t>& order, const std::vector<Build_item>& items,
+                   int depth);
+
+    counted_vector<Node> m_nodes;
+    counted_vector<Triangle> m_triangles;
+    counted_vector<std::uint32_t> m_face_ids;
+};
+
+namespace detail {
+
+inline void grow_box(float lo[3], float hi[3], const float p_lo[3], const float p_hi[3]) {
+    for (int i = 0; i < 3; ++i) {
+        lo[i] = std::min(lo[i], p_lo[i]);
+        hi[i] = std::max(hi[i], p_hi[i]);
+    }
+}
+
+inline void empty_box(float lo[3], float hi[3]) {
+    for (int i = 0; i < 3; ++i) {
+        lo[i] = std::numeric_limits<float>::max();
+        hi[i] = -std::numeric_limits<float>::max();
+    }
+}
+
+inline float half_area(const float lo[3], const float hi[3]) {
+    const float d[3] = {hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]};
+    if (d[0] < 0) return 0;
+    return d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+}
+
+// Entry distance of the ray into the box, or infinity if it misses it
+// before max_t. inv_dir may contain infinities for axis parallel rays.
+inline float ray_box(const float lo[3], const float hi[3], const float origin[3], const float inv_dir[3],
+                     float max_t) {
+    float t_near = 0, t_far = max_t;
+    for (int i = 0; i < 3; ++i) {
+        float t0 = (lo[i] - origin[i]) * inv_dir[i];
+        float t1 = (hi[i] - origin[i]) * inv_dir[i];
+        if (t0 > t1) std::swap(t0, t1);
+        // NaN from 0 * inf (origin on a slab plane) must not shrink the interval
+        if (t0 > t_near) t_near = t0;
+        if (t1 < t_far) t_far = t1;
+    }
+    return t_near <= t_far ? t_near : std::numeric_limits<float>::infinity();
+}
+
+} // namespace detail
+
+template <class TNumber, class TIndex>
+void Face_bvh::build(const TNumber* coords, const TIndex* tris, std::size_t num_faces) {
+    MESH_TRACE_SCOPE("Face_bvh::build");
+    clear();
+    if (num_faces == 0) return;
+
+    std::vector<Build_item> items(num_faces);
+    parallel_for(num_faces, [&](std::size_t f) {
+        Build_item& item = items[f];
+        detail::empty_box(item.lo, item.hi);
+        for (int c = 0; c < 3; ++c) {
+            float p[3];
+            for (int i = 0; i < 3; ++i) p[i] = static_cast<float>(coords[tris[f * 3 + c] * 3 + i]);
+            detail::grow_box(item.lo, item.hi, p, p);
+        }
+        for (int i = 0; i < 3; ++i) item.centroid[i] = 0.5f * (item.lo[i] + item.hi[i]);
+    });
+
+    std::vector<std::uint32_t> order(num_faces);
+    for (std::size_t f = 0; f < num_faces; ++f) order[f] = static_cast<std::uint32_t>(f);
+
+    m_nodes.reserve(2 * num_faces / max_leaf_size + 1);
+    m_nodes.push_back(Node());
+    m_nodes[0].first = 0;
+    m_nodes[0].count = static_cast<std::uint32_t>(num_faces);
+    subdivide(0, order, items, 0);
+
+    // Triangles in leaf order, so that every leaf is one contiguous block
+    m_face_ids.assign(order.begin(), order.end());
+    m_triangles.resize(num_faces);
+    parallel_for(num_faces, [&](std::size_t i) {
+        const std::size_t f = order[i];
+        float p[3][3];
+        for (int c = 0; c < 3; ++c)
+            for (int j = 0; j < 3; ++j) p[c][j] = static_cast<float>(coords[tris[f * 3 + c] * 3 + j]);
+        Triangle& t = m_triangles[i];
+        for (int j = 0; j < 3; ++j) {
+            t.v0[j] = p[0][j];
+            t.e1[j] = p[1][j] - p[0][j];
+            t.e2[j] = p[2][j] - p[0][j];
+        }
+    });
+}
+
+inline void Face_bvh::subdivide(std::uint32_t node_index, std::vector<std::uint32_t>& order,
+                                const std::vector<Build_item>& items, int depth) {
+    const std::uint32_t first = m_nodes[node_index].first;
+    const std::uint32_t count = m_nodes[node_index].count;
+    {
+        Node& node = m_nodes[node_index];
+        detail::empty_box(node.lo, node.hi);
+        for (std::uint32_t i = first; i < first + count; ++i)
+            detail::grow_box(node.lo, node.hi, items[order[i]].lo, items[order[i]].hi);
+    }
+    if (count <= max_leaf_size || depth >= max_depth - 1) return;
+
+    // Split axis and position from binned centroids
+    float c_lo[3], c_hi[3];
+    detail::empty_box(c_lo, c_hi);
+    for (std::uint32_t i = first; i < first + count; ++i)
+        detail::grow_box(c_lo, c_hi, items[order[i]].centroid, items[order[i]].centroid);
+
+    std::uint32_t left_count = 0;
+    if (count <= small_node_size) {
+        // Object median on the widest centroid axis; the SAH sweeps would cost
+        // more than they save this close to the leaves
+        int axis = 0;
+        for (int i = 1; i < 3; ++i)
+            if (c_hi[i] - c_lo[i] > c_hi[axis] - c_lo[axis]) axis = i;
+        if (!(c_hi[axis] > c_lo[axis])) return;
+        left_count = count / 2;
+        std::nth_element(order.data() + first, order.data() + first + left_count, order.data() + first + count,
+                         [&](std::uint32_t a, std::uint32_t b) { return items[a].centroid[axis] < items[b].centroid[axis]; });
+    } else {
+        float best_cost = std::numeric_limits<float>::max();
+        int best_axis = -1, best_bin = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            const float extent = c_hi[axis] - c_lo[axis];
+            if (!(extent > 0)) continue;
+            const float scale = num_bins / extent;
+            float bin_lo[num_bins][3], bin_hi[num_bins][3];
+            std::uint32_t bin_count[num_bins] = {};
+            for (int b = 0; b < num_bins; ++b) detail::empty_box(bin_lo[b], bin_hi[b]);
+            for (std::uint32_t i = first; i < first + count; ++i) {
+                const Build_item& item = items[order[i]];
+                const int b = std::min(num_bins - 1, static_cast<int>((item.centroid[axis] - c_lo[axis]) * scale));
+                ++bin_count[b];
+                detail::grow_box(bin_lo[b], bin_hi[b], item.lo, item.hi);
+            }
+            // Sweep from the right to get the cost of every right side, then from the left
+            float right_area[num_bins];
+            std::uint32_t right_count[num_bins];
+            float lo[3], hi[3];
+            detail::empty_box(lo, hi);
+            std::uint32_t n = 0;
+            for (int b = num_bins - 1; b > 0; --b) {
+                detail::grow_box(lo, hi, bin_lo[b], bin_hi[b]);
+                n += bin_count[b];
+                right_area[b] = detail::half_area(lo, hi);
+                right_count[b] = n;
+            }
+            detail::empty_box(lo, hi);
+            n = 0;
+            for (int b = 0; b + 1 < num_bins; ++b) {
+                detail::grow_box(lo, hi, bin_lo[b], bin_hi[b]);
+                n += bin_count[b];
+                if (n == 0 || right_count[b + 1] == 0) continue;
+                const float cost = detail::half_area(lo, hi) * n + right_area[b + 1] * right_count[b + 1];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = b;
+                }
+            }
+        }
+        // All centroids coincide, or splitting does not pay off
+        if (best_axis < 0 || best_cost >= detail::half_area(m_nodes[node_index].lo, m_nodes[node_index].hi) * count)
+            return;
+
+        const float scale = num_bins / (c_hi[best_axis] - c_lo[best_axis]);
+        std::uint32_t* middle = std::partition(order.data() + first, order.data() + first + count, [&](std::uint32_t f) {
+            return std::min(num_bins - 1, static_cast<int>((items[f].centroid[best_axis] - c_lo[best_axis]) * scale)) <=
+                   best_bin;
+        });
+        left_count = static_cast<std::uint32_t>(middle - (order.data() + first));
+    }
+
+    const std::uint32_t left = static_cast<std::uint32_t>(m_nodes.size());
+    m_nodes.push_back(Node());
+    m_nodes.push_back(Node());
+    m_nodes[left].first = first;
+    m_nodes[left].count = left_count;
+    m_nodes[left + 1].first = first + left_count;
+    m_nodes[left + 1].count = count - left_count;
+    m_nodes[node_index].first = left;
+    m_nodes[node_index].count = 0;
+    subdivide(left, order, items, depth + 1);
+    subdivide(left + 1, order, items, depth + 1);
+}
+
+inline bool Face_bvh::intersect(const float origin[3], const float dir[3], Face_hit& hit, float max_t) const {
+    hit = Face_hit();
+    if (m_nodes.empty()) return false;
+    hit.t = max_t;
+    const float inv_dir[3] = {1.0f / dir[0], 1.0f / dir[1], 1.0f / dir[2]};
+
+    std::uint32_t stack[max_depth];
+    int top = 0;
+    if (detail::ray_box(m_nodes[0].lo, m_nodes[0].hi, origin, inv_dir, hit.t) < hit.t) stack[top++] = 0;
+    while (top > 0) {
+        const Node& node = m_nodes[stack[--top]];
+        if (node.count > 0) {
+            // Moeller-Trumbore, accepting both orientations
+            for (std::uint32_t i = node.first; i < node.first + node.count; ++i) {
+                const Triangle& tri = m_triangles[i];
+                const float p[3] = {dir[1] * tri.e2[2] - dir[2] * tri.e2[1], dir[2] * tri.e2[0] - dir[0] * tri.e2[2],
+                                    dir[0] * tri.e2[1] - dir[1] * tri.e2[0]};
+                const float det = tri.e1[0] * p[0] + tri.e1[1] * p[1] + tri.e1[2] * p[2];
+                if (std::fabs(det) < 1e-20f) continue;
+                const float inv_det = 1.0f / det;
+                const float s[3] = {origin[0] - tri.v0[0], origin[1] - tri.v0[1], origin[2] - tri.v0[2]};
+                const float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv_det;
+                if (u < 0 || u > 1) continue;
+                const float q[3] = {s[1] * tri.e1[2] - s[2] * tri.e1[1], s[2] * tri.e1[0] - s[0] * tri.e1[2],
+                                    s[0] * tri.e1[1] - s[1] * tri.e1[0]};
+                const float v = (dir[0] * q[0] + dir[1] * q[1] + dir[2] * q[2]) * inv_det;
+                if (v < 0 || u + v > 1) continue;
+                const float t = (tri.e2[0] * q[0] + tri.e2[1] * q[1] + tri.e2[2] * q[2]) * inv_det;
+                if (t >= 0 && t < hit.t) {
+                    hit.t = t;
+                    hit.u = u;
+                    hit.v = v;
+                    hit.face = m_face_ids[i];
+                }
+            }
+            continue;
+        }
+        // Visit the nearer child first; it is pushed last
+        const std::uint32_t left = node.first;
+        const float t_left = detail::ray_box(m_nodes[left].lo, m_nodes[left].hi, origin, inv_dir, hit.t);
+        const float t_right = detail::ray_box(m_nodes[left + 1].lo, m_nodes[left + 1].hi, origin, inv_dir, hit.t);
+        const bool left_first = t_left <= t_right;
+        const float t_far = left_first ? t_right : t_left;
+        const float t_near = left_first ? t_left : t_right;
+        if (t_far < hit.t) stack[top++] = left_first ? left + 1 : left;
+        if (t_near < hit.t) stack[top++] = left_first ? left : left + 1;
+    }
+    if (!hit.hit()) hit = Face_hit();
+    return hit.hit();
+}
+
+inline void Face_bvh::clear() {
+    m_nodes.clear();
+    m_triangles.clear();
+    m_face_ids.clear();
+}
+
+} // namespace mesh_tools
+
+#endif // FACE_BVH_H
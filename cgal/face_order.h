@@ -0,0 +1,288 @@
+#ifndef FACE_ORDER_H
+#define FACE_ORDER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mesh_io.h"
+#include "mesh_reorder.h"
+#include "parallel.h"
+#include "trace.h"
+
+namespace mesh_tools {
+
+// Outcome of optimize_face_order and spatial_sort_mesh.
+struct Face_order_report {
+    bool applied = false;            // false if the mesh was left unchanged
+    double acmr_before = 0;          // average cache miss ratio of the face order
+    double acmr_after = 0;
+    double vertex_span_before = 0;   // mean distance between the lowest and highest vertex index of a face
+    double vertex_span_after = 0;
+};
+
+// Curves for spatial_sort_mesh. Hilbert order has no jumps between
+// neighbouring cells and gives slightly better locality; Morton order is
+// cheaper to compute.
+enum class Space_filling_curve { Morton, Hilbert };
+
+namespace detail {
+
+// Copies the property `name` of type T on elements of type I, if the source
+// mesh has one, so that element i of target gets the value of element
+// order[i] of source.
+template <class I, class T, class Mesh, class TIndex>
+bool copy_property(const Mesh& source, Mesh& target, const std::string& name, const std::vector<TIndex>& order) {
+    auto from = source.template property_map<I, T>(name);
+    if (!from.second) return false;
+    auto to = target.template add_property_map<I, T>(name).first;
+    for (std::size_t i = 0; i < order.size(); ++i)
+        to[I(static_cast<typename Mesh::size_type>(i))] = from.first[I(static_cast<typename Mesh::size_type>(order[i]))];
+    return true;
+}
+
+// Copies all properties on elements of type I of common scalar types. The
+// connectivity, point and removal flags are maintained by the mesh itself.
+template <class I, class Mesh, class TIndex>
+void copy_properties(const Mesh& source, Mesh& target, const std::vector<TIndex>& order) {
+    for (const std::string& name : source.template properties<I>()) {
+        if (name.size() < 2 || name.compare(1, std::string::npos, ":connectivity") == 0 ||
+            name.compare(1, std::string::npos, ":removed") == 0 || name == "v:point")
+            continue;
+        copy_property<I, double>(source, target, name, order) ||
+            copy_property<I, std::size_t>(source, target, name, order) ||
+            copy_property<I, int>(source, target, name, order) ||
+            copy_property<I, float>(source, target, name, order) ||
+            copy_property<I, std::uint32_t>(source, target, name, order) ||
+            copy_property<I, bool>(source, target, name, order);
+    }
+}
+
+// Vertex coordinates and triangle corners of a mesh, indexed like the mesh.
+struct Triangle_arrays {
+    counted_vector<double> coords;
+    counted_vector<std::uint32_t> tris;
+    std::size_t num_vertices = 0;
+    std::size_t num_faces = 0;
+};
+
+// Fills arrays from a triangle mesh; false if the mesh is empty, has garbage
+// or has faces of other degrees.
+template <class Mesh>
+bool extract_triangles(const Mesh& mesh, Triangle_arrays& arrays) {
+    if (mesh.has_garbage() || mesh.is_empty()) return false;
+    arrays.num_vertices = mesh.number_of_vertices();
+    arrays.num_faces = mesh.number_of_faces();
+    arrays.coords.resize(arrays.num_vertices * 3);
+    for (auto v : mesh.vertices()) {
+        const auto& p = mesh.point(v);
+        arrays.coords[v.idx() * 3] = CGAL::to_double(p.x());
+        arrays.coords[v.idx() * 3 + 1] = CGAL::to_double(p.y());
+        arrays.coords[v.idx() * 3 + 2] = CGAL::to_double(p.z());
+    }
+    arrays.tris.clear();
+    arrays.tris.reserve(arrays.num_faces * 3);
+    for (auto f : mesh.faces()) {
+        if (mesh.degree(f) != 3) return false;
+        for (auto v : CGAL::vertices_around_face(mesh.halfedge(f), mesh))
+            arrays.tris.push_back(static_cast<std::uint32_t>(v.idx()));
+    }
+    return true;
+}
+
+template <class Container>
+double mean_vertex_span(const Container& tris) {
+    if (tris.empty()) return 0;
+    double sum = 0;
+    for (std::size_t i = 0; i < tris.size(); i += 3) {
+        const std::uint32_t* t = &tris[i];
+        sum += std::max({t[0], t[1], t[2]}) - std::min({t[0], t[1], t[2]});
+    }
+    return sum / static_cast<double>(tris.size() / 3);
+}
+
+// Rebuilds mesh with face f taken from face tri_order[f] and vertex v moved
+// to new_vrt_index[v], carrying face and vertex properties along. The mesh is
+// left unchanged if the rebuilt mesh would differ.
+template <class Mesh>
+bool rebuild_in_order(Mesh& mesh, const Triangle_arrays& arrays, const std::vector<std::uint32_t>& tri_order,
+                      const std::vector<std::uint32_t>& new_vrt_index, Face_order_report& report) {
+    MESH_TRACE_SCOPE("rebuild_in_order");
+    const std::size_t num_vertices = arrays.num_vertices;
+    const std::size_t num_faces = arrays.num_faces;
+    std::vector<std::uint32_t> vrt_order(num_vertices);
+    counted_vector<double> new_coords(arrays.coords.size());
+    parallel_for(num_vertices, [&](std::size_t v) {
+        vrt_order[new_vrt_index[v]] = static_cast<std::uint32_t>(v);
+        for (int i = 0; i < 3; ++i) new_coords[new_vrt_index[v] * 3 + i] = arrays.coords[v * 3 + i];
+    });
+    counted_vector<std::uint32_t> new_tris(arrays.tris.size());
+    parallel_for(num_faces, [&](std::size_t f) {
+        for (int c = 0; c < 3; ++c) new_tris[f * 3 + c] = new_vrt_index[arrays.tris[tri_order[f] * 3 + c]];
+    });
+
+    Mesh reordered;
+    Mesh_build_report build_report;
+    build_surface_mesh(new_coords.data(), num_vertices, new_tris.data(), num_faces,
+                       [](std::size_t f) { return f * 3; }, reordered, build_report);
+    if (build_report.num_faces != num_faces) return false;
+
+    copy_properties<typename Mesh::Face_index>(mesh, reordered, tri_order);
+    copy_properties<typename Mesh::Vertex_index>(mesh, reordered, vrt_order);
+    mesh = std::move(reordered);
+    report.acmr_after = mesh_reorder::ACMR(new_tris.data(), num_faces, num_vertices);
+    report.vertex_span_after = mean_vertex_span(new_tris);
+    report.applied = true;
+    return true;
+}
+
+// Spreads the low 21 bits of x so that they occupy every third bit.
+inline std::uint64_t spread_bits_3d(std::uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+}
+
+inline std::uint64_t morton_code(std::uint32_t x, std::uint32_t y, std::uint32_t z) {
+    return spread_bits_3d(x) << 2 | spread_bits_3d(y) << 1 | spread_bits_3d(z);
+}
+
+// Hilbert index of a cell of a 2^21 grid, after Skilling, "Programming the
+// Hilbert curve" (2004): the coordinates are transformed in place into the
+// transposed index, whose bits are then interleaved like a Morton code.
+inline std::uint64_t hilbert_code(std::uint32_t x, std::uint32_t y, std::uint32_t z) {
+    const int bits = 21;
+    std::uint32_t X[3] = {x, y, z};
+    for (std::uint32_t q = 1u << (bits - 1); q > 1; q >>= 1) {
+        const std::uint32_t p = q - 1;
+        for (int i = 0; i < 3; ++i) {
+            if (X[i] & q) {
+                X[0] ^= p;
+            } else {
+                const std::uint32_t t = (X[0] ^ X[i]) & p;
+                X[0] ^= t;
+                X[i] ^= t;
+            }
+        }
+    }
+    X[1] ^= X[0];
+    X[2] ^= X[1];
+    std::uint32_t t = 0;
+    for (std::uint32_t q = 1u << (bits - 1); q > 1; q >>= 1)
+        if (X[2] & q) t ^= q - 1;
+    for (int i = 0; i < 3; ++i) X[i] ^= t;
+    return morton_code(X[0], X[1], X[2]);
+}
+
+// Order of points along the curve: order[i] is the index of the i-th point.
+// Points are quantized to a 2^21 grid over the bounding box.
+template <class PointAt>
+std::vector<std::uint32_t> curve_order(std::size_t n, PointAt point_at, const double lo[3], const double hi[3],
+                                       Space_filling_curve curve) {
+    double scale[3];
+    for (int i = 0; i < 3; ++i) scale[i] = hi[i] > lo[i] ? ((1u << 21) - 1) / (hi[i] - lo[i]) : 0;
+    std::vector<std::pair<std::uint64_t, std::uint32_t>> keys(n);
+    parallel_for(n, [&](std::size_t i) {
+        double p[3];
+        point_at(i, p);
+        std::uint32_t q[3];
+        for (int j = 0; j < 3; ++j) q[j] = static_cast<std::uint32_t>((p[j] - lo[j]) * scale[j]);
+        keys[i].first = curve == Space_filling_curve::Hilbert ? hilbert_code(q[0], q[1], q[2])
+                                                              : morton_code(q[0], q[1], q[2]);
+        keys[i].second = static_cast<std::uint32_t>(i);
+    });
+    parallel_sort(keys);
+    std::vector<std::uint32_t> order(n);
+    parallel_for(n, [&](std::size_t i) { order[i] = keys[i].second; });
+    return order;
+}
+
+} // namespace detail
+
+// Reorders the faces of a triangle mesh for vertex cache reuse (Tipsify) and
+// renumbers its vertices in first-use order, see mesh_reorder.h. Surface_mesh
+// indices can't be permuted in place, so the mesh is rebuilt from its arrays;
+// face and vertex properties of common scalar types are carried over, other
+// properties are dropped. Meshes with non-triangle faces or garbage are left
+// unchanged, as are meshes that would not rebuild identically.
+template <class Mesh>
+Face_order_report optimize_face_order(Mesh& mesh, unsigned cache_size = mesh_reorder::DEFAULT_CACHE_SIZE,
+                                      bool overdraw = false) {
+    MESH_TRACE_SCOPE("optimize_face_order");
+    Face_order_report report;
+    detail::Triangle_arrays arrays;
+    if (!detail::extract_triangles(mesh, arrays)) return report;
+
+    mesh_reorder::Reordering<std::uint32_t> reordering = mesh_reorder::ReorderTris(
+        arrays.tris.data(), arrays.num_faces, arrays.num_vertices, static_cast<const std::uint32_t*>(nullptr), 0,
+        cache_size, overdraw, arrays.coords.data());
+    report.acmr_before = reordering.acmrBefore;
+    report.vertex_span_before = detail::mean_vertex_span(arrays.tris);
+    detail::rebuild_in_order(mesh, arrays, reordering.triOrder, reordering.newVrtIndex, report);
+    return report;
+}
+
+// Sorts the vertices of a triangle mesh along a space filling curve through
+// their positions, and the faces along the same curve through their
+// centroids, so that faces and vertices that are close in space are close in
+// memory. Per-face loops and spatial queries (AABB trees, SDF rays, graph cut
+// neighbourhoods) then touch fewer cache lines. Codes and sorting run in
+// parallel; the mesh is rebuilt as in optimize_face_order, with the same
+// conditions and property handling.
+template <class Mesh>
+Face_order_report spatial_sort_mesh(Mesh& mesh, Space_filling_curve curve = Space_filling_curve::Hilbert) {
+    MESH_TRACE_SCOPE("spatial_sort_mesh");
+    Face_order_report report;
+    detail::Triangle_arrays arrays;
+    if (!detail::extract_triangles(mesh, arrays)) return report;
+    const double* coords = arrays.coords.data();
+    const std::uint32_t* tris = arrays.tris.data();
+
+    double lo[3], hi[3];
+    for (int j = 0; j < 3; ++j) {
+        lo[j] = std::numeric_limits<double>::max();
+        hi[j] = -std::numeric_limits<double>::max();
+    }
+    for (std::size_t v = 0; v < arrays.num_vertices; ++v) {
+        for (int j = 0; j < 3; ++j) {
+            lo[j] = std::min(lo[j], coords[v * 3 + j]);
+            hi[j] = std::max(hi[j], coords[v * 3 + j]);
+        }
+    }
+
+    const std::vector<std::uint32_t> tri_order = detail::curve_order(
+        arrays.num_faces, [&](std::size_t f, double p[3]) {
+            for (int j = 0; j < 3; ++j)
+                p[j] = (coords[tris[f * 3] * 3 + j] + coords[tris[f * 3 + 1] * 3 + j] +
+                        coords[tris[f * 3 + 2] * 3 + j]) / 3;
+        }, lo, hi, curve);
+
+    // Vertices follow the curve through the faces: they are numbered in the
+    // order the sorted faces first use them, which keeps the vertices of a
+    // face closer together than sorting them by their own codes would
+    const std::uint32_t unused = std::numeric_limits<std::uint32_t>::max();
+    std::vector<std::uint32_t> new_vrt_index(arrays.num_vertices, unused);
+    std::uint32_t next = 0;
+    for (std::uint32_t f : tri_order)
+        for (int c = 0; c < 3; ++c)
+            if (new_vrt_index[tris[f * 3 + c]] == unused) new_vrt_index[tris[f * 3 + c]] = next++;
+    for (std::uint32_t& index : new_vrt_index)
+        if (index == unused) index = next++;
+
+    report.acmr_before = mesh_reorder::ACMR(tris, arrays.num_faces, arrays.num_vertices);
+    report.vertex_span_before = detail::mean_vertex_span(arrays.tris);
+    detail::rebuild_in_order(mesh, arrays, tri_order, new_vrt_index, report);
+    return report;
+}
+
+} // namespace mesh_tools
+
+#endif // FACE_ORDER_H
@@ -0,0 +1,102 @@
+#ifndef LRU_CACHE_H
+#define LRU_CACHE_H
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace mesh_tools {
+
+struct Lru_cache_stats {
+    std::size_t num_entries = 0;
+    std::size_t bytes = 0;
+    std::size_t hits = 0, misses = 0, evictions = 0;
+};
+
+// Thread-safe cache of shared values by string key, bounded by the sum of the
+// sizes callers report for them. The least recently used entries are dropped
+// once the sum exceeds max_bytes; the entry just used is never dropped, so a
+// single value larger than the bound still stays until the next one comes.
+// Values are held by shared_ptr, so a dropped value lives on for as long as a
+// caller still uses it.
+template <class Value>
+class Lru_cache {
+public:
+    explicit Lru_cache(std::size_t max_bytes) : m_max_bytes(max_bytes) {}
+
+    // Value of key, moved to the front; a default constructed value with a
+    // size of 0 is added if the key is new, so that concurrent callers share
+    // it and can fill it in under a lock of their own.
+    std::shared_ptr<Value> get(const std::string& key, bool* added = nullptr) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find(key);
+        if (it != m_index.end()) {
+            m_entries.splice(m_entries.begin(), m_entries, it->second);
+            ++m_stats.hits;
+            if (added) *added = false;
+            return it->second->value;
+        }
+        m_entries.push_front(Entry{ key, std::make_shared<Value>(), 0 });
+        m_index[key] = m_entries.begin();
+        ++m_stats.misses;
+        if (added) *added = true;
+        return m_entries.front().value;
+    }
+
+    // Records the current size of a value and drops entries until the cache
+    // is within its bound again; no-op if the key has been dropped meanwhile.
+    void resize(const std::string& key, std::size_t bytes) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find(key);
+        if (it == m_index.end()) return;
+        m_bytes = m_bytes - it->second->bytes + bytes;
+        it->second->bytes = bytes;
+        while (m_bytes > m_max_bytes && m_entries.size() > 1) {
+            typename std::list<Entry>::iterator last = std::prev(m_entries.end());
+            if (last == it->second) last = std::prev(last);
+            m_bytes -= last->bytes;
+            m_index.erase(last->key);
+            m_entries.erase(last);
+            ++m_stats.evictions;
+        }
+    }
+
+    void erase(const std::string& key) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find(key);
+        if (it == m_index.end()) return;
+        m_bytes -= it->second->bytes;
+        m_entries.erase(it->second);
+        m_index.erase(it);
+    }
+
+    Lru_cache_stats stats() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Lru_cache_stats stats = m_stats;
+        stats.num_entries = m_entries.size();
+        stats.bytes = m_bytes;
+        return stats;
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<Value> value;
+        std::size_t bytes;
+    };
+
+    mutable std::mutex m_mutex;
+    std::list<Entry> m_entries;     // most recently used first
+    std::unordered_map<std::string, typename std::list<Entry>::iterator> m_index;
+    std::size_t m_max_bytes;
+    std::size_t m_bytes = 0;
+    Lru_cache_stats m_stats;
+};
+
+} // namespace mesh_tools
+
+#endif // LRU_CACHE_H
@@ -5,9 +5,40 @@
 #include <CGAL/mesh_segmentation.h>  // Correct segmentation header [2]
 #include <CGAL/draw_surface_mesh.h>  // Required for viewer
 
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include "face_adjacency.h"
+#include "face_bvh.h"
+#include "face_order.h"
+#include "lru_cache.h"
+#include "merge_tree.h"
+#include "mesh_io.h"
+#include "normal_regions.h"
+#include "out_of_core.h"
+#include "pipeline.h"
+#include "png_writer.h"
+#include "rasterizer.h"
+#include "segment_cleanup.h"
+#include "segment_view.h"
+#include "socket_server.h"
+#include "vertex_curvature.h"
+#include "watch_folder.h"
+#include "worker_pool.h"
+#include "memory_stats.h"
+#include "trace.h"
+
 typedef CGAL::Exact_predicates_inexact_constructions_kernel Kernel;
 typedef CGAL::Surface_mesh<Kernel::Point_3> Surface_mesh;
 typedef boost::graph_traits<Surface_mesh>::face_descriptor face_descriptor;
+typedef boost::graph_traits<Surface_mesh>::vertex_descriptor vertex_descriptor;
 
 namespace PMP = CGAL::Polygon_mesh_processing;
 
@@ -19,30 +50,946 @@ void transform_mesh(Surface_mesh& mesh, const CGAL::Aff_transformation_3<Kernel>
     PMP::transform(trans, mesh);
 }
 
-void segment_mesh(Surface_mesh& mesh, int num_clusters = 5) {
+std::size_t segment_mesh(Surface_mesh& mesh, const mesh_tools::Face_adjacency& adjacency, int num_clusters = 5,
+                         bool merge_tree = false) {
     // Property map for SDF values
-    auto sdf_pmap = mesh.add_property_map<face_descriptor, double>("f:sdf").first;
-    CGAL::sdf_values(mesh, sdf_pmap);
+    Surface_mesh::Property_map<face_descriptor, double> sdf_pmap;
+    {
+        MESH_TRACE_SCOPE("sdf_values");
+        mesh_tools::memory::Stage_scope stage("sdf_values");
+        sdf_pmap = mesh.add_property_map<face_descriptor, double>("f:sdf").first;
+        CGAL::sdf_values(mesh, sdf_pmap);
+    }
     
     // Property map for segment IDs
+    Surface_mesh::Property_map<face_descriptor, std::size_t> segment_pmap;
+    std::size_t num_segments;
+    {
+        MESH_TRACE_SCOPE("segmentation_from_sdf_values");
+        mesh_tools::memory::Stage_scope stage("segmentation_from_sdf_values");
+        segment_pmap = mesh.add_property_map<face_descriptor, std::size_t>("f:segment_id").first;
+        if(merge_tree) {
+            // Connected segments from a cut through the merge tree
+            mesh_tools::Merge_tree tree = mesh_tools::build_merge_tree(mesh, adjacency, sdf_pmap);
+            std::vector<std::uint32_t> labels(mesh.number_of_faces());
+            num_segments = mesh_tools::cut_merge_tree(tree, num_clusters, labels);
+            for(face_descriptor f : mesh.faces())
+                segment_pmap[f] = labels[f.idx()];
+        } else {
+            num_segments = CGAL::segmentation_from_sdf_values(mesh, sdf_pmap, segment_pmap, num_clusters);
+        }
+    }
+
+    std::cout << "Mesh segmented into " << num_segments << " parts ("
+              << mesh_tools::count_segment_patches(mesh, adjacency, segment_pmap)
+              << " connected patches)" << std::endl;
+    return num_segments;
+}
+
+// Regions of faces whose normals fit in a cone of max_cone_angle degrees
+std::size_t segment_mesh_by_normals(Surface_mesh& mesh, const mesh_tools::Face_adjacency& adjacency,
+                                    double max_cone_angle) {
+    MESH_TRACE_SCOPE("grow_normal_regions");
+    mesh_tools::memory::Stage_scope stage("grow_normal_regions");
+    mesh_tools::Normal_region_params params;
+    params.max_cone_angle = max_cone_angle;
+    mesh_tools::Normal_regions regions = mesh_tools::grow_normal_regions(mesh, adjacency, params);
+
+    auto segment_pmap = mesh.add_property_map<face_descriptor, std::size_t>("f:segment_id").first;
+    for(face_descriptor f : mesh.faces())
+        segment_pmap[f] = regions.face_region[f.idx()];
+    std::cout << "Mesh segmented into " << regions.num_regions() << " regions with normal cones up to "
+              << max_cone_angle << " degrees" << std::endl;
+    return regions.num_regions();
+}
+
+// Splits segments into connected components and merges those below
+// min_area_percent of the surface into their neighbours
+std::size_t clean_segmentation(Surface_mesh& mesh, const mesh_tools::Face_adjacency& adjacency,
+                               double min_area_percent) {
+    mesh_tools::memory::Stage_scope stage("clean_segments");
+    auto segment_pmap = mesh.property_map<face_descriptor, std::size_t>("f:segment_id").first;
+    mesh_tools::Segment_cleanup_stats stats;
+    const std::size_t num_segments =
+        mesh_tools::clean_segments(mesh, adjacency, segment_pmap, min_area_percent / 100, &stats);
+    std::cout << "Cleaned up " << stats.num_components << " connected patches into " << num_segments
+              << " segments (" << stats.num_merged << " merged below " << min_area_percent
+              << "% of the area)" << std::endl;
+    return num_segments;
+}
+
+// Principal curvatures and sharp edge counts per vertex, kept as the vertex
+// properties "v:k1", "v:k2" and "v:sharp_edges" for later stages
+void compute_curvature(Surface_mesh& mesh, double sharp_angle) {
+    MESH_TRACE_SCOPE("vertex_curvature");
+    mesh_tools::memory::Stage_scope stage("vertex_curvature");
+    mesh_tools::Vertex_rings rings;
+    mesh_tools::Vertex_curvature curvature;
+    mesh_tools::Curvature_params params;
+    params.sharp_angle = sharp_angle;
+    mesh_tools::compute_vertex_curvature(mesh, rings, curvature, params);
+
+    auto k1_pmap = mesh.add_property_map<vertex_descriptor, float>("v:k1").first;
+    auto k2_pmap = mesh.add_property_map<vertex_descriptor, float>("v:k2").first;
+    auto sharp_pmap = mesh.add_property_map<vertex_descriptor, std::uint8_t>("v:sharp_edges").first;
+    std::size_t num_feature = 0, num_corners = 0;
+    for(vertex_descriptor v : mesh.vertices()) {
+        k1_pmap[v] = curvature.k1[v.idx()];
+        k2_pmap[v] = curvature.k2[v.idx()];
+        sharp_pmap[v] = curvature.sharp_edges[v.idx()];
+        if(curvature.is_feature(v.idx())) ++num_feature;
+        if(curvature.sharp_edges[v.idx()] > 2) ++num_corners;
+    }
+    std::cout << "Curvature of " << curvature.size() << " vertices: " << num_feature
+              << " on sharp edges above " << sharp_angle << " degrees, " << num_corners << " corners" << std::endl;
+}
+
+bool parse_export_format(const std::string& name, mesh_tools::Segment_file_format& format) {
+    if(name != "stl" && name != "off") {
+        std::cerr << "Unknown export format '" << name << "', expected stl or off" << std::endl;
+        return false;
+    }
+    format = name == "off" ? mesh_tools::Segment_file_format::OFF : mesh_tools::Segment_file_format::STL;
+    return true;
+}
+
+// Options of the modes that segment meshes without printing anything per
+// mesh, read from the same flags as --segment
+struct Quiet_segment_options {
+    bool normal_engine = false;
+    double normal_cone = 30;
+    int clusters = 5;
+    bool merge_tree = false;
+    double min_segment_area = 0;
+};
+
+bool parse_quiet_segment_options(int argc, char* argv[], Quiet_segment_options& options) {
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--segment" && i+1 < argc) options.clusters = std::stoi(argv[++i]);
+        if(arg == "--merge-tree") options.merge_tree = true;
+        if(arg == "--engine" && i+1 < argc) {
+            std::string engine = argv[++i];
+            if(engine != "sdf" && engine != "normal") {
+                std::cerr << "Unknown engine '" << engine << "', expected sdf or normal" << std::endl;
+                return false;
+            }
+            options.normal_engine = engine == "normal";
+        }
+        if(arg == "--normal-cone" && i+1 < argc) options.normal_cone = std::stod(argv[++i]);
+        if(arg == "--min-segment-area" && i+1 < argc) options.min_segment_area = std::stod(argv[++i]);
+    }
+    return true;
+}
+
+// Segments a mesh into its "f:segment_id" property. SDF values already in the
+// "f:sdf" property are reused, so segmenting a mesh again with other options
+// skips the ray casting; the property is removed again if they fail.
+std::size_t segment_mesh_faces(Surface_mesh& mesh, const mesh_tools::Face_adjacency& adjacency,
+                               const Quiet_segment_options& options) {
     auto segment_pmap = mesh.add_property_map<face_descriptor, std::size_t>("f:segment_id").first;
-    CGAL::segmentation_from_sdf_values(mesh, sdf_pmap, segment_pmap, num_clusters);
+    std::size_t num_segments;
+    if(options.normal_engine) {
+        mesh_tools::Normal_region_params params;
+        params.max_cone_angle = options.normal_cone;
+        mesh_tools::Normal_regions regions = mesh_tools::grow_normal_regions(mesh, adjacency, params);
+        for(face_descriptor f : mesh.faces())
+            segment_pmap[f] = regions.face_region[f.idx()];
+        num_segments = regions.num_regions();
+    } else {
+        auto sdf = mesh.add_property_map<face_descriptor, double>("f:sdf");
+        auto sdf_pmap = sdf.first;
+        if(sdf.second) {
+            try {
+                CGAL::sdf_values(mesh, sdf_pmap);
+            } catch(...) {
+                mesh.remove_property_map(sdf_pmap);
+                throw;
+            }
+        }
+        if(options.merge_tree) {
+            mesh_tools::Merge_tree tree = mesh_tools::build_merge_tree(mesh, adjacency, sdf_pmap);
+            std::vector<std::uint32_t> face_labels(mesh.number_of_faces());
+            num_segments = mesh_tools::cut_merge_tree(tree, options.clusters, face_labels);
+            for(face_descriptor f : mesh.faces())
+                segment_pmap[f] = face_labels[f.idx()];
+        } else {
+            num_segments = CGAL::segmentation_from_sdf_values(mesh, sdf_pmap, segment_pmap, options.clusters);
+        }
+    }
+    if(options.min_segment_area > 0)
+        num_segments = mesh_tools::clean_segments(mesh, adjacency, segment_pmap, options.min_segment_area / 100);
+    return num_segments;
+}
+
+// Writes the segment of every one of num_input_faces faces the mesh was
+// built from; faces the mesh builder left out get no_segment.
+void write_input_labels(const Surface_mesh& mesh, const mesh_tools::Mesh_build_report& report,
+                        std::size_t num_input_faces, std::uint32_t* labels) {
+    auto segment_pmap = mesh.property_map<face_descriptor, std::size_t>("f:segment_id").first;
+    // Mesh faces are the input faces without the rejected ones, in order
+    std::size_t next_rejected = 0, f = 0;
+    for(std::size_t i = 0; i < num_input_faces; ++i) {
+        if(next_rejected < report.rejected_faces.size() && report.rejected_faces[next_rejected] == i) {
+            labels[i] = mesh_tools::no_segment;
+            ++next_rejected;
+            continue;
+        }
+        labels[i] = static_cast<std::uint32_t>(segment_pmap[face_descriptor(static_cast<Surface_mesh::size_type>(f++))]);
+    }
+}
+
+// Segments a mesh built from num_input_faces faces and writes a label per
+// input face
+std::size_t segment_quietly(Surface_mesh& mesh, const mesh_tools::Mesh_build_report& report,
+                            std::size_t num_input_faces, std::uint32_t* labels, const Quiet_segment_options& options) {
+    mesh_tools::Face_adjacency adjacency;
+    mesh_tools::build_face_adjacency(mesh, adjacency);
+    const std::size_t num_segments = segment_mesh_faces(mesh, adjacency, options);
+    write_input_labels(mesh, report, num_input_faces, labels);
+    return num_segments;
+}
+
+// Segments one tile for --out-of-core
+std::size_t segment_tile(const std::string& path, std::size_t num_tile_faces, std::uint32_t* labels,
+                         const Quiet_segment_options& options) {
+    Surface_mesh mesh;
+    mesh_tools::Mesh_build_report report;
+    if(!mesh_tools::read_STL(path, mesh, &report))
+        throw std::runtime_error("Failed to read tile " + path);
+    return segment_quietly(mesh, report, num_tile_faces, labels, options);
+}
+
+// Segments a mesh handed to a --batch worker in shared memory
+std::size_t segment_shared_mesh(const mesh_tools::Shared_mesh& shared, const Quiet_segment_options& options) {
+    Surface_mesh mesh;
+    mesh_tools::Mesh_build_report report;
+    mesh_tools::build_surface_mesh(shared.coords, shared.num_vertices, shared.face_vrts, shared.num_faces,
+                                   [&](std::size_t f) { return shared.face_offsets[f]; }, mesh, report);
+    return segment_quietly(mesh, report, shared.num_faces, shared.labels, options);
+}
+
+bool export_segments(const Surface_mesh& mesh, std::size_t num_segments,
+                     const std::string& prefix, mesh_tools::Segment_file_format format) {
+    mesh_tools::memory::Stage_scope stage("export_segments");
+    auto segment_pmap = mesh.property_map<face_descriptor, std::size_t>("f:segment_id").first;
+    mesh_tools::Segment_buckets buckets = mesh_tools::bucket_faces_by_segment(mesh, segment_pmap, num_segments);
+    std::vector<mesh_tools::Segment_view> views = mesh_tools::make_segment_views(mesh, buckets);
+
+    std::size_t num_failed = mesh_tools::export_segments(mesh, views, prefix, format);
+    if(num_failed > 0) {
+        std::cerr << "Failed to write " << num_failed << " segment files" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Four views of the mesh in one PNG, colored by segment when the mesh has
+// been segmented. Polygons are fanned around their first corner.
+bool write_thumbnail(const Surface_mesh& mesh, const std::string& path, int cell_size) {
+    mesh_tools::memory::Stage_scope stage("write_thumbnail");
+    std::vector<double> coords(mesh.number_of_vertices() * 3);
+    for(auto v : mesh.vertices()) {
+        const Kernel::Point_3& p = mesh.point(v);
+        coords[v.idx() * 3] = p.x();
+        coords[v.idx() * 3 + 1] = p.y();
+        coords[v.idx() * 3 + 2] = p.z();
+    }
+    auto segment_pmap = mesh.property_map<face_descriptor, std::size_t>("f:segment_id");
+    std::vector<std::uint32_t> tris;
+    std::vector<std::uint8_t> colors;
+    tris.reserve(mesh.number_of_faces() * 3);
+    colors.reserve(mesh.number_of_faces() * 3);
+    for(face_descriptor f : mesh.faces()) {
+        std::uint8_t rgb[3] = { 200, 200, 200 };
+        if(segment_pmap.second) mesh_tools::segment_color(segment_pmap.first[f], rgb);
+        std::vector<std::uint32_t> corners;
+        for(auto v : CGAL::vertices_around_face(mesh.halfedge(f), mesh))
+            corners.push_back(static_cast<std::uint32_t>(v.idx()));
+        for(std::size_t c = 1; c + 1 < corners.size(); ++c) {
+            tris.insert(tris.end(), { corners[0], corners[c], corners[c + 1] });
+            colors.insert(colors.end(), rgb, rgb + 3);
+        }
+    }
+    mesh_tools::Raster_image image = mesh_tools::render_views(
+        coords.data(), mesh.number_of_vertices(), tris.data(), tris.size() / 3, colors.data(),
+        mesh_tools::thumbnail_views(), cell_size);
+    return mesh_tools::write_png(path, image.width, image.height, image.rgb.data());
+}
+
+void report_mesh_build(const mesh_tools::Mesh_build_report& report) {
+    if(report.num_degenerate > 0)
+        std::cerr << "Skipped " << report.num_degenerate << " degenerate faces" << std::endl;
+    if(!report.non_manifold_edges.empty()) {
+        std::cerr << "Skipped " << report.non_manifold_edges.size() << " faces on non-manifold edges:";
+        for(std::size_t i = 0; i < report.non_manifold_edges.size() && i < 10; ++i)
+            std::cerr << " (" << report.non_manifold_edges[i].first << ", " << report.non_manifold_edges[i].second << ")";
+        if(report.non_manifold_edges.size() > 10) std::cerr << " ...";
+        std::cerr << std::endl;
+    }
+    if(report.num_non_manifold_vertices > 0)
+        std::cerr << report.num_non_manifold_vertices << " non-manifold vertices" << std::endl;
+}
+
+// --out-of-core <labels>: segments a binary STL in tiles without loading it
+// as a whole and writes one uint32 segment ID per input face to <labels>.
+// The segmentation options are the same as for --segment.
+int run_out_of_core(const std::string& input, const std::string& labels_output, int argc, char* argv[]) {
+    mesh_tools::memory::Stage_scope stage("segment_out_of_core");
+    Quiet_segment_options options;
+    if(!parse_quiet_segment_options(argc, argv, options)) return EXIT_FAILURE;
+    mesh_tools::Out_of_core_params params;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--tile-faces" && i+1 < argc) params.max_tile_faces = std::stoull(argv[++i]);
+        if(arg == "--tile-workers" && i+1 < argc) params.num_workers = std::stoi(argv[++i]);
+        if(arg == "--work-dir" && i+1 < argc) params.work_dir = argv[++i];
+        if(arg == "--mem-budget" && i+1 < argc) {
+            // Tiles in flight get three quarters; the rest is for the
+            // partitioning buffers and the halo faces
+            params.memory_budget = (std::stoull(argv[++i]) << 20) / 4 * 3;
+        }
+    }
+
+    mesh_tools::Out_of_core_stats stats;
+    auto segment = [&](const std::string& path, std::size_t num_faces, std::uint32_t* labels) {
+        return segment_tile(path, num_faces, labels, options);
+    };
+    if(!mesh_tools::segment_out_of_core(input, labels_output, segment, params, &stats)) {
+        std::cerr << "Out-of-core segmentation failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "Segmented " << stats.num_faces << " faces in " << stats.num_tiles << " tiles (largest "
+              << stats.largest_tile << " faces, " << stats.num_halo_faces << " in halos): "
+              << stats.num_tile_segments << " tile segments reconciled into " << stats.num_segments
+              << " segments" << std::endl;
+    if(stats.num_unlabeled > 0)
+        std::cerr << stats.num_unlabeled << " faces left without a segment" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+// --batch <list>: segments every mesh named in the list file, one path per
+// line, on --workers forked processes, and writes one uint32 segment ID per
+// input face to <mesh>.labels. A mesh that crashes a worker is retried once
+// on a fresh one; the batch goes on either way.
+int run_batch(const std::string& list, int argc, char* argv[]) {
+    mesh_tools::memory::Stage_scope stage("batch");
+    Quiet_segment_options options;
+    if(!parse_quiet_segment_options(argc, argv, options)) return EXIT_FAILURE;
+    mesh_tools::Worker_pool_params params;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--workers" && i+1 < argc) params.num_workers = std::stoi(argv[++i]);
+    }
+
+    std::ifstream in(list);
+    if(!in) {
+        std::cerr << "Failed to read batch list " << list << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::vector<std::string> inputs;
+    for(std::string line; std::getline(in, line);)
+        if(!line.empty() && line[0] != '#') inputs.push_back(line);
+
+    auto load = [&](std::size_t job, mesh_tools::Mesh_arrays& arrays) {
+        return mesh_tools::read_mesh_arrays(inputs[job], arrays.coords, arrays.face_vrts, arrays.face_offsets);
+    };
+    auto segment = [&](const mesh_tools::Shared_mesh& mesh) { return segment_shared_mesh(mesh, options); };
+    auto finish = [&](std::size_t job, const mesh_tools::Worker_job_result& result, const mesh_tools::Shared_mesh* mesh) {
+        if(!result.ok) {
+            std::cerr << inputs[job] << ": failed after " << result.attempts << " attempts: " << result.error << std::endl;
+            return;
+        }
+        const std::string output = inputs[job] + ".labels";
+        std::FILE* out = std::fopen(output.c_str(), "wb");
+        const bool written = out && std::fwrite(mesh->labels, sizeof(std::uint32_t), mesh->num_faces, out) == mesh->num_faces;
+        if(!out || std::fclose(out) != 0 || !written)
+            std::cerr << inputs[job] << ": failed to write " << output << std::endl;
+        else
+            std::cout << inputs[job] << ": " << mesh->num_faces << " faces in " << result.num_segments << " segments"
+                      << std::endl;
+    };
+    mesh_tools::Worker_pool_stats stats = mesh_tools::run_worker_pool(inputs.size(), load, segment, finish, params);
+    std::cout << "Segmented " << stats.num_jobs - stats.num_failed << " of " << stats.num_jobs << " meshes ("
+              << stats.num_restarts << " worker restarts)" << std::endl;
+    return stats.num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// A mesh kept by --daemon between requests, with everything derived from it
+// that is worth keeping: the face adjacency, the picking BVH, the SDF values
+// in the "f:sdf" property and the labels of every segmentation asked for.
+struct Daemon_mesh {
+    std::mutex mutex;       // held while the mesh is loaded, segmented or read
+    bool loaded = false;
+    struct stat file;       // mtime and size of the file when it was read
+    Surface_mesh mesh;
+    mesh_tools::Mesh_build_report report;
+    std::size_t num_input_faces = 0;
+    mesh_tools::Face_adjacency adjacency;
+    mesh_tools::Face_bvh bvh;
+    std::vector<std::uint32_t> bvh_faces;   // mesh face of every BVH triangle
+    // Segment count and input face labels by options key
+    std::map<std::string, std::pair<std::size_t, std::vector<std::uint32_t> > > segmentations;
+
+    // Estimated, since Surface_mesh does not report its allocations
+    std::size_t memory_bytes() const {
+        std::size_t bytes = mesh.number_of_vertices() * (sizeof(Kernel::Point_3) + 4) +
+                            mesh.number_of_halfedges() * 16 + mesh.number_of_faces() * 4 +
+                            adjacency.memory_bytes() + bvh.memory_bytes() +
+                            bvh_faces.capacity() * sizeof(std::uint32_t) +
+                            report.rejected_faces.capacity() * sizeof(std::uint32_t);
+        if(mesh.property_map<face_descriptor, double>("f:sdf").second) bytes += mesh.number_of_faces() * sizeof(double);
+        if(mesh.property_map<face_descriptor, std::size_t>("f:segment_id").second)
+            bytes += mesh.number_of_faces() * sizeof(std::size_t);
+        for(const auto& s : segmentations) bytes += s.first.size() + s.second.second.capacity() * sizeof(std::uint32_t);
+        return bytes;
+    }
+};
+
+typedef mesh_tools::Lru_cache<Daemon_mesh> Daemon_cache;
+
+// Cached mesh for path, locked; read again when the file has changed since
+std::shared_ptr<Daemon_mesh> get_daemon_mesh(Daemon_cache& cache, const std::string& path,
+                                             std::unique_lock<std::mutex>& lock) {
+    struct stat file;
+    if(::stat(path.c_str(), &file) != 0) throw std::runtime_error("cannot stat " + path);
+    std::shared_ptr<Daemon_mesh> entry = cache.get(path);
+    lock = std::unique_lock<std::mutex>(entry->mutex);
+    if(entry->loaded && entry->file.st_mtime == file.st_mtime && entry->file.st_size == file.st_size)
+        return entry;
+
+    entry->loaded = false;
+    entry->mesh = Surface_mesh();
+    entry->segmentations.clear();
+    if(!mesh_tools::read_mesh(path, entry->mesh, &entry->report)) {
+        cache.erase(path);
+        throw std::runtime_error("cannot read mesh " + path);
+    }
+    if(!CGAL::is_triangle_mesh(entry->mesh)) {
+        cache.erase(path);
+        throw std::runtime_error("mesh is not triangulated: " + path);
+    }
+    entry->file = file;
+    entry->num_input_faces = entry->report.num_faces + entry->report.rejected_faces.size();
+    mesh_tools::build_face_adjacency(entry->mesh, entry->adjacency);
+
+    std::vector<double> coords;
+    coords.reserve(entry->mesh.number_of_vertices() * 3);
+    for(vertex_descriptor v : entry->mesh.vertices()) {
+        const Kernel::Point_3& p = entry->mesh.point(v);
+        coords.insert(coords.end(), { p.x(), p.y(), p.z() });
+    }
+    // Polygons are fanned around their first corner
+    std::vector<std::uint32_t> tris, corners;
+    tris.reserve(entry->mesh.number_of_faces() * 3);
+    entry->bvh_faces.clear();
+    for(face_descriptor f : entry->mesh.faces()) {
+        corners.clear();
+        for(vertex_descriptor v : CGAL::vertices_around_face(entry->mesh.halfedge(f), entry->mesh))
+            corners.push_back(static_cast<std::uint32_t>(v.idx()));
+        for(std::size_t c = 1; c + 1 < corners.size(); ++c) {
+            tris.insert(tris.end(), { corners[0], corners[c], corners[c + 1] });
+            entry->bvh_faces.push_back(static_cast<std::uint32_t>(f.idx()));
+        }
+    }
+    entry->bvh.build(coords.data(), tris.data(), entry->bvh_faces.size());
+
+    entry->loaded = true;
+    cache.resize(path, entry->memory_bytes());
+    return entry;
 }
 
+// Segmentation of a locked cached mesh, computed unless already known
+const std::pair<std::size_t, std::vector<std::uint32_t> >& get_daemon_segmentation(
+        Daemon_cache& cache, const std::string& path, Daemon_mesh& entry, const Quiet_segment_options& options) {
+    std::ostringstream key;
+    key << (options.normal_engine ? "normal " : "sdf ") << options.clusters << ' ' << options.merge_tree << ' '
+        << options.normal_cone << ' ' << options.min_segment_area;
+    auto found = entry.segmentations.find(key.str());
+    if(found != entry.segmentations.end()) return found->second;
+
+    // Kept only once complete, so that a failed run is tried again next time
+    std::pair<std::size_t, std::vector<std::uint32_t> > segmentation;
+    segmentation.first = segment_mesh_faces(entry.mesh, entry.adjacency, options);
+    segmentation.second.resize(entry.num_input_faces);
+    write_input_labels(entry.mesh, entry.report, entry.num_input_faces, segmentation.second.data());
+    const auto& kept = entry.segmentations[key.str()] = std::move(segmentation);
+    cache.resize(path, entry.memory_bytes());
+    return kept;
+}
+
+// --daemon <socket>: serves segmentation requests on a Unix domain socket and
+// keeps the meshes it has read in a cache of --cache-mb MB (default 1024),
+// least recently used first out, so that repeated requests skip reading,
+// the BVH, the adjacency and the SDF. --daemon-threads connections are
+// served at once; requests on different meshes run in parallel. Every request
+// is one line, with the same segmentation flags as the command line, and
+// gets one line back starting with OK or ERR; paths cannot contain spaces.
+//
+//     load <mesh>                           OK <faces> <vertices> <ms>
+//     segment <mesh> [--segment N ...]      OK <segments> <ms>
+//     labels <mesh> [--segment N ...]       OK <faces> <segments>, then faces uint32 labels
+//     pick <mesh> ox oy oz dx dy dz         OK <face> <t> | OK none
+//     stats                                 OK <meshes> <bytes> <hits> <misses> <evictions>
+//     shutdown                              OK
+//
+// Labels and picked faces are indices of input faces; faces left out of the
+// mesh get 0xFFFFFFFF.
+int run_daemon(const std::string& socket_path, int argc, char* argv[]) {
+    std::size_t cache_mb = 1024;
+    mesh_tools::Socket_server_params params;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--cache-mb" && i+1 < argc) cache_mb = std::stoull(argv[++i]);
+        if(arg == "--daemon-threads" && i+1 < argc) params.num_threads = std::stoi(argv[++i]);
+    }
+    Daemon_cache cache(cache_mb << 20);
+
+    auto handle = [&](const std::string& request, std::string& reply) {
+        const auto start = std::chrono::steady_clock::now();
+        auto elapsed_ms = [&]() {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        };
+        std::istringstream in(request);
+        std::vector<std::string> words;
+        for(std::string word; in >> word;) words.push_back(word);
+        std::ostringstream out;
+        if(words.empty()) {
+            reply = "ERR empty request\n";
+            return true;
+        }
+        const std::string& command = words[0];
+        if(command == "shutdown") {
+            reply = "OK\n";
+            return false;
+        }
+        if(command == "stats") {
+            const mesh_tools::Lru_cache_stats stats = cache.stats();
+            out << "OK " << stats.num_entries << ' ' << stats.bytes << ' ' << stats.hits << ' ' << stats.misses << ' '
+                << stats.evictions << '\n';
+            reply = out.str();
+            return true;
+        }
+        if(words.size() < 2 || (command != "load" && command != "segment" && command != "labels" && command != "pick")) {
+            reply = "ERR unknown request: " + request + "\n";
+            return true;
+        }
+
+        const std::string& path = words[1];
+        std::unique_lock<std::mutex> lock;
+        std::shared_ptr<Daemon_mesh> entry = get_daemon_mesh(cache, path, lock);
+        if(command == "load") {
+            out << "OK " << entry->num_input_faces << ' ' << entry->mesh.number_of_vertices() << ' ' << elapsed_ms()
+                << '\n';
+        } else if(command == "pick") {
+            float ray[6];
+            if(words.size() != 8) throw std::runtime_error("pick needs an origin and a direction");
+            for(int i = 0; i < 6; ++i) ray[i] = std::stof(words[2 + i]);
+            mesh_tools::Face_hit hit;
+            if(!entry->bvh.intersect(ray, ray + 3, hit)) {
+                out << "OK none\n";
+            } else {
+                // Input face of the mesh face: skip the rejected faces before it
+                std::size_t face = entry->bvh_faces[hit.face];
+                for(std::uint32_t rejected : entry->report.rejected_faces)
+                    if(rejected <= face) ++face;
+                out << "OK " << face << ' ' << hit.t << '\n';
+            }
+        } else {
+            std::vector<char*> args(1, argv[0]);
+            for(std::size_t i = 2; i < words.size(); ++i) args.push_back(&words[i][0]);
+            Quiet_segment_options options;
+            if(!parse_quiet_segment_options(static_cast<int>(args.size()), args.data(), options))
+                throw std::runtime_error("bad segmentation options");
+            const auto& segmentation = get_daemon_segmentation(cache, path, *entry, options);
+            if(command == "segment") {
+                out << "OK " << segmentation.first << ' ' << elapsed_ms() << '\n';
+            } else {
+                out << "OK " << segmentation.second.size() << ' ' << segmentation.first << '\n';
+                out.write(reinterpret_cast<const char*>(segmentation.second.data()),
+                          segmentation.second.size() * sizeof(std::uint32_t));
+            }
+        }
+        reply = out.str();
+        return true;
+    };
+
+    std::cout << "Listening on " << socket_path << std::endl;
+    if(!mesh_tools::run_socket_server(socket_path, handle, params)) return EXIT_FAILURE;
+    const mesh_tools::Lru_cache_stats stats = cache.stats();
+    std::cout << "Served " << stats.hits + stats.misses << " mesh requests (" << stats.hits << " from the cache, "
+              << stats.evictions << " evictions)" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+// State of one file in the --watch pipeline, moved from stage to stage
+struct Watch_job {
+    std::string path, name;     // file name without folder, with extension
+    std::uint64_t hash = 0;
+    bool stl = false;
+    typedef stl_reader::StlReadScratch<float, std::uint32_t> Stl_scratch;
+    std::unique_ptr<Stl_scratch> scratch;       // unwelded STL corners between parse and weld
+    std::vector<float> stl_coords, stl_normals;
+    std::vector<std::uint32_t> stl_tris, stl_solids;
+    std::vector<double> off_coords;
+    std::vector<std::uint32_t> off_face_vrts, off_face_offsets;
+    Surface_mesh mesh;
+    mesh_tools::Mesh_build_report report;
+    mesh_tools::Face_adjacency adjacency;
+    std::size_t num_segments = 0;
+};
+
+volatile std::sig_atomic_t watch_stop = 0;
+void on_watch_signal(int) { watch_stop = 1; }
+
+// --watch <folder>: segments every STL and OFF file that lands in the folder,
+// and again whenever its contents change, until SIGINT or SIGTERM; with
+// --watch-once, only the files already there. A file is taken once it has
+// been left alone for --settle seconds (default 2). Segments and labels go to
+// --watch-output (default <folder>/segmented) as "<name>_<s>.stl" or ".off"
+// per --export-format and "<name>.labels", one uint32 per input face, where
+// <name> is the input file name with its extension, so that foo.stl and
+// foo.off in the same folder do not overwrite each other. The
+// content hash of every exported file is kept in .watch_hashes there, so
+// files saved again unchanged are skipped, across restarts as well.
+//
+// Files run through a pipeline of parse, weld, build (mesh and adjacency),
+// SDF, segment and export stages, each on its own threads, so that different
+// files are in different stages at the same time; the SDF stage, which takes
+// the longest, has --watch-sdf-threads (default half the cores). At most
+// --watch-queue files (default 2) wait between two stages.
+int run_watch(const std::string& folder, int argc, char* argv[]) {
+    mesh_tools::memory::Stage_scope stage("watch");
+    Quiet_segment_options options;
+    if(!parse_quiet_segment_options(argc, argv, options)) return EXIT_FAILURE;
+    mesh_tools::Watch_params params;
+    std::string output = folder + "/segmented";
+    mesh_tools::Segment_file_format format = mesh_tools::Segment_file_format::STL;
+    bool once = false;
+    std::size_t queue_capacity = 2;
+    unsigned sdf_threads = std::max(1u, mesh_tools::num_threads() / 2);
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--watch-once") once = true;
+        if(arg == "--settle" && i+1 < argc) params.settle_seconds = std::stod(argv[++i]);
+        if(arg == "--watch-output" && i+1 < argc) output = argv[++i];
+        if(arg == "--watch-queue" && i+1 < argc) queue_capacity = std::stoull(argv[++i]);
+        if(arg == "--watch-sdf-threads" && i+1 < argc) sdf_threads = std::stoi(argv[++i]);
+        if(arg == "--export-format" && i+1 < argc && !parse_export_format(argv[++i], format)) return EXIT_FAILURE;
+    }
+    if(::mkdir(output.c_str(), 0777) != 0 && errno != EEXIST) {
+        std::cerr << "Failed to create " << output << ": " << std::strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Hashes of the exported files by name, read back from earlier runs
+    std::mutex hashes_mutex;
+    std::map<std::string, std::uint64_t> hashes;
+    const std::string hashes_path = output + "/.watch_hashes";
+    {
+        std::ifstream in(hashes_path);
+        std::uint64_t hash;
+        for(std::string name; in >> std::hex >> hash && std::getline(in >> std::ws, name);) hashes[name] = hash;
+    }
+    std::map<std::string, std::uint64_t> queued;     // watcher thread only
+
+    // STL scratch buffers are reused from file to file. A job holds one from
+    // parse to weld and gives it back on every way out of these two stages.
+    std::mutex scratch_mutex;
+    std::vector<std::unique_ptr<Watch_job::Stl_scratch> > free_scratch;
+    auto give_back_scratch = [&](Watch_job& job) {
+        if(!job.scratch) return;
+        std::lock_guard<std::mutex> lock(scratch_mutex);
+        free_scratch.push_back(std::move(job.scratch));
+    };
+
+    typedef std::unique_ptr<Watch_job> Job;
+    mesh_tools::Pipeline<Job> pipeline(queue_capacity);
+    // Drops a file whose stage throws instead of stopping the whole pipeline;
+    // only an exceeded memory budget ends the run
+    auto guarded = [](mesh_tools::Pipeline<Job>::Stage_fn body) {
+        return [body](Job& job) {
+            try {
+                return body(job);
+            } catch(const mesh_tools::memory::Budget_exceeded&) {
+                throw;
+            } catch(const std::exception& e) {
+                std::cerr << job->path << ": " << e.what() << std::endl;
+                return false;
+            }
+        };
+    };
+    pipeline.add_stage("watch parse", guarded([&](Job& job) {
+        if(!job->stl) {
+            off_reader::ReadOffFile(job->path.c_str(), job->off_coords, job->off_face_vrts, job->off_face_offsets);
+            return true;
+        }
+        {
+            std::lock_guard<std::mutex> lock(scratch_mutex);
+            if(!free_scratch.empty()) {
+                job->scratch = std::move(free_scratch.back());
+                free_scratch.pop_back();
+            }
+        }
+        if(!job->scratch) job->scratch.reset(new Watch_job::Stl_scratch());
+        try {
+            stl_reader::ReadStlFile_Unwelded(job->path.c_str(), job->stl_coords, job->stl_normals, job->stl_tris,
+                                             job->stl_solids, *job->scratch);
+        } catch(...) {
+            give_back_scratch(*job);
+            throw;
+        }
+        if(job->stl_tris.empty()) {
+            give_back_scratch(*job);
+            std::cerr << job->path << ": no triangles" << std::endl;
+            return false;
+        }
+        return true;
+    }));
+    pipeline.add_stage("watch weld", guarded([&](Job& job) {
+        if(!job->stl) return true;
+        try {
+            stl_reader::WeldStlCorners(job->stl_coords, job->stl_normals, job->stl_tris, job->stl_solids,
+                                       *job->scratch);
+        } catch(...) {
+            give_back_scratch(*job);
+            throw;
+        }
+        give_back_scratch(*job);
+        return true;
+    }));
+    pipeline.add_stage("watch build", guarded([&](Job& job) {
+        if(job->stl) {
+            mesh_tools::build_surface_mesh(job->stl_coords.data(), job->stl_coords.size() / 3, job->stl_tris.data(),
+                                           job->stl_tris.size() / 3, [](std::size_t f) { return f * 3; },
+                                           job->mesh, job->report);
+        } else {
+            mesh_tools::build_surface_mesh(job->off_coords, job->off_face_vrts, job->off_face_offsets, job->mesh,
+                                           job->report);
+        }
+        std::vector<float>().swap(job->stl_coords);
+        std::vector<float>().swap(job->stl_normals);
+        std::vector<std::uint32_t>().swap(job->stl_tris);
+        std::vector<double>().swap(job->off_coords);
+        std::vector<std::uint32_t>().swap(job->off_face_vrts);
+        if(job->mesh.number_of_faces() == 0) {
+            std::cerr << job->path << ": no faces left to segment" << std::endl;
+            return false;
+        }
+        if(!CGAL::is_triangle_mesh(job->mesh)) {
+            std::cerr << job->path << ": the mesh is not triangulated" << std::endl;
+            return false;
+        }
+        mesh_tools::build_face_adjacency(job->mesh, job->adjacency);
+        return true;
+    }));
+    pipeline.add_stage("watch sdf", guarded([&](Job& job) {
+        if(!options.normal_engine) {
+            auto sdf_pmap = job->mesh.add_property_map<face_descriptor, double>("f:sdf").first;
+            CGAL::sdf_values(job->mesh, sdf_pmap);
+        }
+        return true;
+    }), sdf_threads);
+    pipeline.add_stage("watch segment", guarded([&](Job& job) {
+        job->num_segments = segment_mesh_faces(job->mesh, job->adjacency, options);
+        return true;
+    }));
+    pipeline.add_stage("watch export", guarded([&](Job& job) {
+        const std::size_t num_input_faces = job->report.num_faces + job->report.rejected_faces.size();
+        std::vector<std::uint32_t> labels(num_input_faces);
+        write_input_labels(job->mesh, job->report, num_input_faces, labels.data());
+        const std::string labels_path = output + "/" + job->name + ".labels";
+        std::FILE* out = std::fopen(labels_path.c_str(), "wb");
+        const bool written = out && std::fwrite(labels.data(), sizeof(std::uint32_t), labels.size(), out) == labels.size();
+        if(!out || std::fclose(out) != 0 || !written) {
+            std::cerr << job->path << ": failed to write " << labels_path << std::endl;
+            return false;
+        }
+        if(!export_segments(job->mesh, job->num_segments, output + "/" + job->name, format)) return false;
+
+        std::lock_guard<std::mutex> lock(hashes_mutex);
+        hashes[job->name] = job->hash;
+        std::ofstream state(hashes_path, std::ios::app);
+        state << std::hex << job->hash << ' ' << job->name << '\n';
+        std::cout << job->path << ": " << num_input_faces << " faces in " << job->num_segments << " segments"
+                  << std::endl;
+        return true;
+    }));
+
+    mesh_tools::Folder_watcher watcher(params);
+    if(!watcher.open(folder)) return EXIT_FAILURE;
+    watch_stop = 0;
+    struct sigaction action, previous_int, previous_term;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = on_watch_signal;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGINT, &action, &previous_int);
+    ::sigaction(SIGTERM, &action, &previous_term);
+
+    std::cout << "Watching " << folder << std::endl;
+    pipeline.start();
+    std::size_t num_skipped = 0;
+    // A stage that rethrows stops the pipeline; finish() then passes the error on
+    while(!pipeline.stopped() && !watch_stop && !(once && watcher.num_pending() == 0)) {
+        for(const std::string& path : watcher.poll(200)) {
+            Job job(new Watch_job());
+            job->path = path;
+            job->name = path.substr(path.find_last_of('/') + 1);
+            job->stl = mesh_tools::file_extension(path) == ".stl";
+            if(!mesh_tools::hash_file(path, job->hash)) {
+                std::cerr << path << ": failed to read" << std::endl;
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock(hashes_mutex);
+                auto done = hashes.find(job->name);
+                auto pushed = queued.find(job->name);
+                if((done != hashes.end() && done->second == job->hash) ||
+                   (pushed != queued.end() && pushed->second == job->hash)) {
+                    ++num_skipped;
+                    continue;
+                }
+            }
+            queued[job->name] = job->hash;
+            if(!pipeline.push(std::move(job))) break;
+        }
+    }
+    ::sigaction(SIGINT, &previous_int, nullptr);
+    ::sigaction(SIGTERM, &previous_term, nullptr);
+    pipeline.finish();
+
+    std::cout << "Skipped " << num_skipped << " unchanged files" << std::endl;
+    for(const mesh_tools::Pipeline_stage_stats& stats : pipeline.stats())
+        std::cout << stats.name << ": " << stats.num_items - stats.num_dropped << " of " << stats.num_items
+                  << " files, " << stats.busy_seconds << " s" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+int run(int argc, char* argv[]);
+
 int main(int argc, char* argv[]) {
+    // Tracing and memory options are handled first so that loading is covered as well
+    std::string trace_output;
+    bool mem_report = false;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--trace" && i+1 < argc) trace_output = argv[i + 1];
+        if(arg == "--mem-report") mem_report = true;
+        if(arg == "--mem-budget" && i+1 < argc) {
+            // Peak RSS in MB; checked at every stage boundary
+            mesh_tools::memory::set_budget(std::stoull(argv[i + 1]) << 20);
+            mem_report = true;
+        }
+    }
+    if(!trace_output.empty()) mesh_tools::trace::start();
+
+    int result;
+    try {
+        result = run(argc, argv);
+        mesh_tools::memory::check_budget("exit");
+    } catch(const mesh_tools::memory::Budget_exceeded& e) {
+        std::cerr << e.what() << std::endl;
+        result = EXIT_FAILURE;
+    }
+
+    if(mem_report) mesh_tools::memory::write_report(std::cerr);
+
+    if(!trace_output.empty() && !mesh_tools::trace::write_chrome_json(trace_output)) {
+        std::cerr << "Failed to write trace file" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return result;
+}
+
+int run(int argc, char* argv[]) {
     Surface_mesh mesh;
     const std::string input = (argc > 1) ? argv[1] : "input.off";
+
+    char** watch = std::find(argv + 1, argv + argc, std::string("--watch"));
+    if(watch != argv + argc && watch + 1 != argv + argc)
+        return run_watch(watch[1], argc, argv);
+
+    char** daemon = std::find(argv + 1, argv + argc, std::string("--daemon"));
+    if(daemon != argv + argc && daemon + 1 != argv + argc)
+        return run_daemon(daemon[1], argc, argv);
+
+    char** batch = std::find(argv + 1, argv + argc, std::string("--batch"));
+    if(batch != argv + argc && batch + 1 != argv + argc)
+        return run_batch(batch[1], argc, argv);
+
+    // Meshes too large for memory are segmented tile by tile instead of loaded
+    char** out_of_core = std::find(argv + 1, argv + argc, std::string("--out-of-core"));
+    if(out_of_core != argv + argc && out_of_core + 1 != argv + argc)
+        return run_out_of_core(input, out_of_core[1], argc, argv);
     
-    if(!CGAL::IO::read_OFF(input, mesh)) {
-        std::cerr << "Failed to read OFF file" << std::endl;
+    // OFF and STL are both built straight into the Surface_mesh
+    mesh_tools::Mesh_build_report report;
+    {
+        mesh_tools::memory::Stage_scope stage("read_mesh");
+        if(!mesh_tools::read_mesh(input, mesh, &report)) {
+            std::cerr << "Failed to read mesh file" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    report_mesh_build(report);
+    if(!CGAL::is_triangle_mesh(mesh)) {
+        std::cerr << "The mesh is not triangulated" << std::endl;
         return EXIT_FAILURE;
     }
 
+    // Spatial order of faces and vertices for the per-face passes and the
+    // AABB tree of the SDF; --reorder below may refine it for vertex caches
+    char** spatial_sort = std::find(argv + 1, argv + argc, std::string("--spatial-sort"));
+    if(spatial_sort != argv + argc && spatial_sort + 1 != argv + argc) {
+        const std::string curve_name = spatial_sort[1];
+        if(curve_name != "morton" && curve_name != "hilbert") {
+            std::cerr << "Unknown curve '" << curve_name << "', expected morton or hilbert" << std::endl;
+            return EXIT_FAILURE;
+        }
+        mesh_tools::memory::Stage_scope stage("spatial_sort_mesh");
+        mesh_tools::Face_order_report order = mesh_tools::spatial_sort_mesh(
+            mesh, curve_name == "morton" ? mesh_tools::Space_filling_curve::Morton
+                                         : mesh_tools::Space_filling_curve::Hilbert);
+        if(order.applied)
+            std::cout << "Sorted faces along " << curve_name << " curve: mean vertex span "
+                      << order.vertex_span_before << " -> " << order.vertex_span_after << std::endl;
+        else
+            std::cerr << "Face order left unchanged (mesh is not a clean triangle mesh)" << std::endl;
+    }
+
+    // Cache friendly face order, before anything depends on face indices
+    if(std::find(argv + 1, argv + argc, std::string("--reorder")) != argv + argc) {
+        mesh_tools::memory::Stage_scope stage("optimize_face_order");
+        mesh_tools::Face_order_report order = mesh_tools::optimize_face_order(mesh);
+        if(order.applied)
+            std::cout << "Reordered faces: ACMR " << order.acmr_before << " -> " << order.acmr_after << std::endl;
+        else
+            std::cerr << "Face order left unchanged (mesh is not a clean triangle mesh)" << std::endl;
+    }
+
+    // Face adjacency is built once here and shared by every stage that walks it
+    mesh_tools::Face_adjacency adjacency;
+    {
+        mesh_tools::memory::Stage_scope stage("build_face_adjacency");
+        mesh_tools::build_face_adjacency(mesh, adjacency);
+    }
+
     // Command-line processing
     bool view_flag = false;
     bool transform_flag = false;
     bool segment_flag = false;
+    bool curvature_flag = false;
+    double sharp_angle = 45;
+    bool merge_tree_flag = false;
+    bool normal_engine = false;
+    double normal_cone = 30;
+    double min_segment_area = 0;
     int clusters = 5;
+    std::string export_prefix;
+    std::string stl_output;
+    std::string thumbnail_output;
+    int thumbnail_size = 256;
+    mesh_tools::Segment_file_format export_format = mesh_tools::Segment_file_format::STL;
     Kernel::Vector_3 translation(0, 0, 0);
 
     for(int i = 1; i < argc; ++i) {
@@ -60,6 +1007,43 @@ int main(int argc, char* argv[]) {
             segment_flag = true;
             if(i+1 < argc) clusters = std::stoi(argv[++i]);
         }
+        if(arg == "--merge-tree") merge_tree_flag = true;
+        if(arg == "--curvature") curvature_flag = true;
+        if(arg == "--sharp-angle" && i+1 < argc) {
+            sharp_angle = std::stod(argv[++i]);
+        }
+        if(arg == "--engine" && i+1 < argc) {
+            std::string engine = argv[++i];
+            if(engine != "sdf" && engine != "normal") {
+                std::cerr << "Unknown engine '" << engine << "', expected sdf or normal" << std::endl;
+                return EXIT_FAILURE;
+            }
+            normal_engine = engine == "normal";
+        }
+        if(arg == "--normal-cone" && i+1 < argc) {
+            normal_cone = std::stod(argv[++i]);
+        }
+        if(arg == "--min-segment-area" && i+1 < argc) {
+            min_segment_area = std::stod(argv[++i]);
+        }
+        if(arg == "--export-segments" && i+1 < argc) {
+            export_prefix = argv[++i];
+        }
+        if((arg == "--trace" || arg == "--mem-budget" || arg == "--spatial-sort") && i+1 < argc) {
+            ++i;  // handled in main or before the face adjacency
+        }
+        if(arg == "--write-stl" && i+1 < argc) {
+            stl_output = argv[++i];
+        }
+        if(arg == "--thumbnail" && i+1 < argc) {
+            thumbnail_output = argv[++i];
+        }
+        if(arg == "--thumbnail-size" && i+1 < argc) {
+            thumbnail_size = std::stoi(argv[++i]);
+        }
+        if(arg == "--export-format" && i+1 < argc) {
+            if(!parse_export_format(argv[++i], export_format)) return EXIT_FAILURE;
+        }
     }
 
     if(transform_flag) {
@@ -67,8 +1051,35 @@ int main(int argc, char* argv[]) {
         CGAL::IO::write_OFF("transformed.off", mesh);
     }
 
+    if(curvature_flag) compute_curvature(mesh, sharp_angle);
+
     if(segment_flag) {
-        segment_mesh(mesh, clusters);
+        std::size_t num_segments = normal_engine
+            ? segment_mesh_by_normals(mesh, adjacency, normal_cone)
+            : segment_mesh(mesh, adjacency, clusters, merge_tree_flag);
+        if(min_segment_area > 0)
+            num_segments = clean_segmentation(mesh, adjacency, min_segment_area);
+        if(!export_prefix.empty() && !export_segments(mesh, num_segments, export_prefix, export_format))
+            return EXIT_FAILURE;
+    }
+
+    if(!stl_output.empty()) {
+        mesh_tools::memory::Stage_scope stage("write_stl");
+        // Segment IDs, when present, go into the attribute field of each record
+        auto segment_pmap = mesh.property_map<face_descriptor, std::size_t>("f:segment_id");
+        bool written = segment_pmap.second
+            ? mesh_tools::write_STL_binary(stl_output, mesh, segment_pmap.first)
+            : mesh_tools::write_STL_binary(stl_output, mesh);
+        if(!written) {
+            std::cerr << "Failed to write STL file" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Headless alternative to --view
+    if(!thumbnail_output.empty() && !write_thumbnail(mesh, thumbnail_output, thumbnail_size)) {
+        std::cerr << "Failed to write thumbnail" << std::endl;
+        return EXIT_FAILURE;
     }
 
     if(view_flag) {
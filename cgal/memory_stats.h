@@ -0,0 +1,248 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace mesh_tools {
+namespace memory {
+
+// Memory accounting per pipeline stage.
+//
+// A stage is entered with a Stage_scope. While it is active, allocations made
+// through Counting_allocator on that thread (and on the workers of
+// parallel_for, which inherit the stage) are charged to it, and the resident
+// set size is sampled when the stage begins and ends. Memory that does not go
+// through the allocator, e.g. CGAL property maps, shows up in the RSS figures.
+struct Stage_stats {
+    std::string name;
+    std::uint64_t calls = 0;
+    std::atomic<std::uint64_t> allocations{0};
+    std::atomic<std::uint64_t> allocated_bytes{0};
+    std::atomic<std::int64_t> peak_live_bytes{0};   // counted bytes alive at any time during the stage
+    // Written under the registry mutex, since threads enter stages of the same name concurrently
+    std::uint64_t rss_before = 0;                    // RSS when the stage was last entered
+    std::uint64_t rss_after = 0;                     // RSS when the stage was last left
+    std::uint64_t peak_rss = 0;                      // process peak RSS when the stage was last left
+};
+
+class Budget_exceeded : public std::runtime_error {
+public:
+    Budget_exceeded(const std::string& stage, std::uint64_t peak, std::uint64_t budget)
+        : std::runtime_error("memory budget of " + std::to_string(budget >> 20) + " MB exceeded at stage '" +
+                             stage + "' (peak RSS " + std::to_string(peak >> 20) + " MB)") {}
+};
+
+// Current resident set size in bytes, from /proc/self/statm.
+inline std::uint64_t current_rss() {
+    std::FILE* f = std::fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long size = 0, resident = 0;
+    int n = std::fscanf(f, "%lu %lu", &size, &resident);
+    std::fclose(f);
+    return n == 2 ? static_cast<std::uint64_t>(resident) * static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE)) : 0;
+}
+
+// Peak resident set size of the process in bytes, from getrusage.
+inline std::uint64_t peak_rss() {
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+}
+
+namespace detail {
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<Stage_stats*> stages;               // in order of first use
+    std::atomic<std::int64_t> live_bytes{0};
+    std::atomic<std::int64_t> peak_live_bytes{0};
+    std::atomic<std::uint64_t> budget{0};           // 0 means no budget
+
+    ~Registry() {
+        for (Stage_stats* s : stages) delete s;
+    }
+};
+
+inline Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+inline Stage_stats*& current() {
+    static thread_local Stage_stats* stage = nullptr;
+    return stage;
+}
+
+inline void update_max(std::atomic<std::int64_t>& target, std::int64_t value) {
+    std::int64_t seen = target.load(std::memory_order_relaxed);
+    while (value > seen && !target.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+}
+
+inline void on_allocate(std::size_t bytes) {
+    Registry& r = registry();
+    const std::int64_t live = r.live_bytes.fetch_add(static_cast<std::int64_t>(bytes), std::memory_order_relaxed) +
+                              static_cast<std::int64_t>(bytes);
+    update_max(r.peak_live_bytes, live);
+    if (Stage_stats* s = current()) {
+        s->allocations.fetch_add(1, std::memory_order_relaxed);
+        s->allocated_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        update_max(s->peak_live_bytes, live);
+    }
+}
+
+inline void on_deallocate(std::size_t bytes) {
+    registry().live_bytes.fetch_sub(static_cast<std::int64_t>(bytes), std::memory_order_relaxed);
+}
+
+} // namespace detail
+
+// Stage the calling thread is charging allocations to, or nullptr.
+inline Stage_stats* current_stage() { return detail::current(); }
+
+// Makes worker threads charge the stage of the thread that started them.
+class Stage_inherit {
+public:
+    explicit Stage_inherit(Stage_stats* stage) : m_previous(detail::current()) { detail::current() = stage; }
+    ~Stage_inherit() { detail::current() = m_previous; }
+
+private:
+    Stage_inherit(const Stage_inherit&) = delete;
+    Stage_inherit& operator=(const Stage_inherit&) = delete;
+
+    Stage_stats* m_previous;
+};
+
+// Peak RSS above which check_budget() throws Budget_exceeded; 0 disables it.
+inline void set_budget(std::uint64_t bytes) { detail::registry().budget.store(bytes); }
+
+// Throws Budget_exceeded if the process peak RSS is above the budget.
+inline void check_budget(const std::string& stage) {
+    const std::uint64_t budget = detail::registry().budget.load();
+    const std::uint64_t peak = peak_rss();
+    if (budget > 0 && peak > budget) throw Budget_exceeded(stage, peak, budget);
+}
+
+// Charges counted allocations of this thread to the named stage and samples
+// RSS at both ends. Stages with the same name accumulate. Entering a stage
+// checks the budget unless check is false, so a batch job stops at the first
+// stage boundary after the budget has been exceeded.
+class Stage_scope {
+public:
+    explicit Stage_scope(const std::string& name, bool check = true) : m_previous(detail::current()) {
+        if (check) check_budget(name);
+        const std::uint64_t rss = current_rss();
+        detail::Registry& r = detail::registry();
+        {
+            std::lock_guard<std::mutex> lock(r.mutex);
+            auto it = std::find_if(r.stages.begin(), r.stages.end(),
+                                   [&](const Stage_stats* s) { return s->name == name; });
+            if (it == r.stages.end()) {
+                r.stages.push_back(new Stage_stats);
+                r.stages.back()->name = name;
+                it = r.stages.end() - 1;
+            }
+            m_stage = *it;
+            ++m_stage->calls;
+            m_stage->rss_before = rss;
+        }
+        detail::current() = m_stage;
+    }
+
+    ~Stage_scope() {
+        const std::uint64_t rss = current_rss(), peak = peak_rss();
+        {
+            std::lock_guard<std::mutex> lock(detail::registry().mutex);
+            m_stage->rss_after = rss;
+            m_stage->peak_rss = peak;
+        }
+        detail::current() = m_previous;
+    }
+
+private:
+    Stage_scope(const Stage_scope&) = delete;
+    Stage_scope& operator=(const Stage_scope&) = delete;
+
+    Stage_stats* m_stage;
+    Stage_stats* m_previous;
+};
+
+// Writes one line per stage: calls, counted allocations, peak counted bytes
+// alive during the stage, RSS before/after and the process peak RSS after it.
+inline void write_report(std::ostream& out) {
+    detail::Registry& r = detail::registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    const double mb = 1.0 / (1 << 20);
+    char line[256];
+    std::snprintf(line, sizeof(line), "%-28s %6s %10s %12s %12s %12s %12s %12s\n", "stage", "calls", "allocs",
+                  "alloc MB", "live MB", "RSS in MB", "RSS out MB", "peak RSS MB");
+    out << line;
+    for (const Stage_stats* s : r.stages) {
+        std::snprintf(line, sizeof(line), "%-28s %6llu %10llu %12.1f %12.1f %12.1f %12.1f %12.1f\n", s->name.c_str(),
+                      static_cast<unsigned long long>(s->calls),
+                      static_cast<unsigned long long>(s->allocations.load()), s->allocated_bytes.load() * mb,
+                      s->peak_live_bytes.load() * mb, s->rss_before * mb, s->rss_after * mb, s->peak_rss * mb);
+        out << line;
+    }
+    std::snprintf(line, sizeof(line), "peak counted %.1f MB, current RSS %.1f MB, peak RSS %.1f MB\n",
+                  r.peak_live_bytes.load() * mb, current_rss() * mb, peak_rss() * mb);
+    out << line;
+}
+
+// std::allocator replacement that feeds the accounting above. Used by the
+// large arrays of the mesh tools; it allocates with malloc, so a replaced
+// global operator new would not count these bytes twice.
+template <class T>
+struct Counting_allocator {
+    typedef T value_type;
+
+    Counting_allocator() = default;
+    template <class U>
+    Counting_allocator(const Counting_allocator<U>&) {}
+
+    T* allocate(std::size_t n) {
+        if (n > static_cast<std::size_t>(-1) / sizeof(T)) throw std::bad_array_new_length();
+        void* p = std::malloc(n * sizeof(T));
+        if (!p) throw std::bad_alloc();
+        detail::on_allocate(n * sizeof(T));
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        detail::on_deallocate(n * sizeof(T));
+        std::free(p);
+    }
+
+    template <class U>
+    bool operator==(const Counting_allocator<U>&) const { return true; }
+    template <class U>
+    bool operator!=(const Counting_allocator<U>&) const { return false; }
+};
+
+} // namespace memory
+
+// Vector whose storage is charged to the current memory stage.
+template <class T>
+using counted_vector = std::vector<T, memory::Counting_allocator<T>>;
+
+} // namespace mesh_tools
+
+// Hook used by stl_reader.h. The budget is not checked there: the reader
+// passes exceptions on as runtime_error, which would hide Budget_exceeded.
+#ifndef STL_READER_MEMORY_STAGE
+  #define STL_READER_MEMORY_STAGE(name) mesh_tools::memory::Stage_scope stl_reader_memory_stage(name, false)
+#endif
+
+#endif // MEMORY_STATS_H
@@ -0,0 +1,281 @@
+#ifndef MERGE_TREE_H
+#define MERGE_TREE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <vector>
+
+#include "face_adjacency.h"
+#include "memory_stats.h"
+#include "trace.h"
+
+namespace mesh_tools {
+
+// Hierarchical segmentation of a mesh as a binary merge tree. Nodes
+// 0 .. num_faces - 1 are the faces; merge i creates node num_faces + i from
+// nodes left[i] and right[i]. Merges are stored in the order they were made,
+// cheapest first, so undoing the last k - 1 merges leaves k segments.
+struct Merge_tree {
+    std::size_t num_faces = 0;
+    counted_vector<std::uint32_t> left;
+    counted_vector<std::uint32_t> right;
+    counted_vector<float> cost;        // infinite for merges of disconnected parts
+
+    std::size_t num_merges() const { return left.size(); }
+    bool empty() const { return num_faces == 0; }
+    // Edge-connected parts of the mesh; cuts into fewer segments than this
+    // join parts that share no edge
+    std::size_t num_parts() const {
+        std::size_t n = 1;
+        while (n <= cost.size() && std::isinf(cost[cost.size() - n])) ++n;
+        return num_faces > 0 ? n : 0;
+    }
+
+    void clear() {
+        num_faces = 0;
+        left.clear();
+        right.clear();
+        cost.clear();
+    }
+};
+
+namespace detail {
+
+// Boundary between the region that owns the link and region `other`. Links
+// may refer to regions that have been merged since; those are resolved with
+// Merge_regions::find().
+struct Merge_link {
+    std::uint32_t other;
+    float length;             // length of the shared boundary
+    float crease;             // integral of the dihedral angle along it
+};
+
+struct Merge_candidate {
+    float cost;
+    std::uint32_t a, b;
+
+    bool operator>(const Merge_candidate& c) const {
+        return cost > c.cost || (cost == c.cost && (a > c.a || (a == c.a && b > c.b)));
+    }
+};
+
+// Regions of the agglomeration, indexed by tree node.
+struct Merge_regions {
+    counted_vector<std::uint32_t> parent;     // union-find forest over nodes
+    counted_vector<double> area;
+    counted_vector<double> value_sum;         // area weighted
+    counted_vector<double> boundary;          // length of the boundary to other regions
+    std::vector<std::vector<Merge_link>> links;
+
+    std::uint32_t find(std::uint32_t n) {
+        std::uint32_t root = n;
+        while (parent[root] != root) root = parent[root];
+        while (parent[n] != root) {
+            const std::uint32_t next = parent[n];
+            parent[n] = root;
+            n = next;
+        }
+        return root;
+    }
+    bool alive(std::uint32_t n) const { return parent[n] == n; }
+    double mean(std::uint32_t n) const { return area[n] > 0 ? value_sum[n] / area[n] : 0; }
+};
+
+// Ward-style cost of joining two regions: the area weighted squared
+// difference of their mean values, plus a boundary term that is small for
+// regions sharing a long, smooth boundary and large across short boundaries
+// and creases.
+inline float merge_cost(const Merge_regions& regions, std::uint32_t a, std::uint32_t b, const Merge_link& link,
+                        double inv_variance, double boundary_weight) {
+    const double area_a = regions.area[a], area_b = regions.area[b];
+    const double weight = area_a + area_b > 0 ? area_a * area_b / (area_a + area_b) : 0;
+    const double d = regions.mean(a) - regions.mean(b);
+    const double min_boundary = std::min(regions.boundary[a], regions.boundary[b]);
+    const double shared = min_boundary > 0 ? std::min(1.0, link.length / min_boundary) : 1;
+    const double crease = link.length > 0 ? link.crease / link.length / 3.14159265358979323846 : 0;
+    return static_cast<float>(weight * (d * d * inv_variance + boundary_weight * (1 - shared + crease)));
+}
+
+} // namespace detail
+
+// Builds the merge tree of a mesh by repeatedly merging the two adjacent
+// regions with the lowest merge cost, starting from single faces.
+// face_values holds one value per face (the SDF), face_areas the face areas;
+// boundary_weight scales the boundary term against the value term.
+//
+// Candidates sit in a binary heap and are never updated in place: merging
+// two regions retires both, so their remaining candidates are skipped when
+// they come up, and the new region pushes fresh ones to all its neighbours.
+// Region boundaries are merged as sorted link lists. Parts of the mesh that
+// share no edge are joined at the end, smallest first, with infinite cost.
+inline Merge_tree build_merge_tree(const Face_adjacency& adj, const float* face_values, const float* face_areas,
+                                   double boundary_weight) {
+    MESH_TRACE_SCOPE("build_merge_tree");
+    const std::size_t num_faces = adj.num_faces();
+    Merge_tree tree;
+    tree.num_faces = num_faces;
+    if (num_faces == 0) return tree;
+    const std::size_t num_nodes = 2 * num_faces - 1;
+
+    // Values are compared relative to their area weighted variance
+    double total_area = 0, mean = 0, variance = 0;
+    for (std::size_t f = 0; f < num_faces; ++f) {
+        total_area += face_areas[f];
+        mean += face_areas[f] * face_values[f];
+    }
+    mean = total_area > 0 ? mean / total_area : 0;
+    for (std::size_t f = 0; f < num_faces; ++f)
+        variance += face_areas[f] * (face_values[f] - mean) * (face_values[f] - mean);
+    variance = total_area > 0 ? variance / total_area : 0;
+    const double inv_variance = variance > 0 ? 1 / variance : 1;
+
+    detail::Merge_regions regions;
+    regions.parent.resize(num_nodes);
+    for (std::size_t n = 0; n < num_nodes; ++n) regions.parent[n] = static_cast<std::uint32_t>(n);
+    regions.area.assign(num_nodes, 0);
+    regions.value_sum.assign(num_nodes, 0);
+    regions.boundary.assign(num_nodes, 0);
+    regions.links.resize(num_nodes);
+    for (std::size_t f = 0; f < num_faces; ++f) {
+        regions.area[f] = face_areas[f];
+        regions.value_sum[f] = static_cast<double>(face_areas[f]) * face_values[f];
+        std::vector<detail::Merge_link>& links = regions.links[f];
+        for (std::uint32_t e = adj.begin(f); e < adj.end(f); ++e) {
+            links.push_back({ adj.neighbor[e], adj.edge_length[e], adj.edge_length[e] * adj.dihedral[e] });
+            regions.boundary[f] += adj.edge_length[e];
+        }
+    }
+
+    std::vector<detail::Merge_candidate> heap_storage;
+    heap_storage.reserve(adj.num_entries() / 2);
+    std::priority_queue<detail::Merge_candidate, std::vector<detail::Merge_candidate>,
+                        std::greater<detail::Merge_candidate>> heap(std::greater<detail::Merge_candidate>(),
+                                                                    std::move(heap_storage));
+    for (std::size_t f = 0; f < num_faces; ++f) {
+        for (const detail::Merge_link& link : regions.links[f]) {
+            if (link.other <= f) continue;
+            const float cost = detail::merge_cost(regions, static_cast<std::uint32_t>(f), link.other, link,
+                                                  inv_variance, boundary_weight);
+            heap.push({ cost, static_cast<std::uint32_t>(f), link.other });
+        }
+    }
+
+    tree.left.reserve(num_faces - 1);
+    tree.right.reserve(num_faces - 1);
+    tree.cost.reserve(num_faces - 1);
+    // Nodes from next on have not been created yet
+    std::uint32_t next = static_cast<std::uint32_t>(num_faces);
+    auto merge = [&](std::uint32_t a, std::uint32_t b, float cost) {
+        const std::uint32_t c = next++;
+        regions.parent[a] = regions.parent[b] = c;
+        regions.area[c] = regions.area[a] + regions.area[b];
+        regions.value_sum[c] = regions.value_sum[a] + regions.value_sum[b];
+
+        // Concatenate both boundaries, resolve merged regions, then sum up the
+        // links to the same neighbour; links between a and b disappear
+        std::vector<detail::Merge_link>& links = regions.links[c];
+        links.reserve(regions.links[a].size() + regions.links[b].size());
+        double internal = 0;
+        for (std::uint32_t r : { a, b }) {
+            for (detail::Merge_link link : regions.links[r]) {
+                link.other = regions.find(link.other);
+                if (link.other == c) internal += link.length;
+                else links.push_back(link);
+            }
+            std::vector<detail::Merge_link>().swap(regions.links[r]);
+        }
+        regions.boundary[c] = std::max(0.0, regions.boundary[a] + regions.boundary[b] - internal);
+        std::sort(links.begin(), links.end(),
+                  [](const detail::Merge_link& x, const detail::Merge_link& y) { return x.other < y.other; });
+        std::size_t out = 0;
+        for (std::size_t i = 0; i < links.size(); ++i) {
+            if (out > 0 && links[out - 1].other == links[i].other) {
+                links[out - 1].length += links[i].length;
+                links[out - 1].crease += links[i].crease;
+            } else {
+                links[out++] = links[i];
+            }
+        }
+        links.resize(out);
+
+        tree.left.push_back(a);
+        tree.right.push_back(b);
+        tree.cost.push_back(cost);
+        return c;
+    };
+
+    while (!heap.empty()) {
+        const detail::Merge_candidate top = heap.top();
+        heap.pop();
+        if (!regions.alive(top.a) || !regions.alive(top.b)) continue;
+        const std::uint32_t c = merge(top.a, top.b, top.cost);
+        for (const detail::Merge_link& link : regions.links[c])
+            heap.push({ detail::merge_cost(regions, c, link.other, link, inv_variance, boundary_weight), c,
+                        link.other });
+    }
+
+    // Disconnected parts, smallest first, so that cutting separates the
+    // largest parts first
+    std::vector<std::uint32_t> roots;
+    for (std::uint32_t n = 0; n < next; ++n)
+        if (regions.alive(n)) roots.push_back(n);
+    std::sort(roots.begin(), roots.end(), [&](std::uint32_t x, std::uint32_t y) {
+        return regions.area[x] < regions.area[y] || (regions.area[x] == regions.area[y] && x < y);
+    });
+    if (!roots.empty()) {
+        std::uint32_t acc = roots[0];
+        for (std::size_t i = 1; i < roots.size(); ++i)
+            acc = merge(acc, roots[i], std::numeric_limits<float>::infinity());
+    }
+    return tree;
+}
+
+// Merge tree of a triangle mesh from per-face values, e.g. SDF values.
+template <class Mesh, class ValueMap>
+Merge_tree build_merge_tree(const Mesh& mesh, const Face_adjacency& adj, const ValueMap& value_map,
+                            double boundary_weight = 0.3) {
+    typedef typename Mesh::Face_index Face_index;
+    const std::size_t num_faces = mesh.number_of_faces();
+    counted_vector<float> values(num_faces), areas(num_faces);
+    parallel_for(num_faces, [&](std::size_t f) {
+        const Face_index fd(static_cast<typename Mesh::size_type>(f));
+        values[f] = static_cast<float>(value_map[fd]);
+        areas[f] = static_cast<float>(detail::face_area(mesh, fd));
+    });
+    return build_merge_tree(adj, values.data(), areas.data(), boundary_weight);
+}
+
+// Labels every face with its segment when the tree is cut into
+// num_segments segments (clamped to [1, num_faces]), and returns the number
+// of segments. One top-down pass over the nodes, O(F). Labels are stable
+// across cuts: going from k to k + 1 segments splits one segment, and only
+// the faces of one half get a new label, k.
+template <class Labels>
+std::size_t cut_merge_tree(const Merge_tree& tree, std::size_t num_segments, Labels& face_labels) {
+    MESH_TRACE_SCOPE("cut_merge_tree");
+    const std::size_t num_faces = tree.num_faces;
+    if (num_faces == 0) return 0;
+    const std::size_t num_merges = tree.num_merges();
+    num_segments = std::max<std::size_t>(1, std::min(num_segments, num_faces));
+    // Merges num_merges - (num_segments - 1) and up are undone
+    const std::size_t first_undone = num_merges - std::min(num_merges, num_segments - 1);
+
+    counted_vector<std::uint32_t> label(num_faces + num_merges);
+    label[num_faces + num_merges - 1] = 0;
+    std::uint32_t next_label = 1;
+    for (std::size_t i = num_merges; i-- > 0;) {
+        const std::uint32_t own = label[num_faces + i];
+        label[tree.left[i]] = own;
+        label[tree.right[i]] = i >= first_undone ? next_label++ : own;
+    }
+    for (std::size_t f = 0; f < num_faces; ++f) face_labels[f] = label[f];
+    return next_label;
+}
+
+} // namespace mesh_tools
+
+#endif // MERGE_TREE_H
@@ -0,0 +1,426 @@
+#ifndef MESH_IO_H
+#define MESH_IO_H
+
+#include <CGAL/Surface_mesh.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "memory_stats.h"
+#include "trace.h"
+#include "off_reader.h"
+#include "mesh_pack.h"
+#include "stl_writer.h"
+
+namespace mesh_tools {
+
+// Extension of a file name with its dot, in lower case, so that "part.Stl"
+// is read as STL; empty if the name has none
+inline std::string file_extension(const std::string& filename) {
+    const std::size_t dot = filename.find_last_of("./");
+    if (dot == std::string::npos || filename[dot] != '.') return std::string();
+    std::string ext = filename.substr(dot);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    return ext;
+}
+
+namespace detail {
+
+template <class Point>
+void point_to_floats(const Point& p, float* out) {
+    out[0] = static_cast<float>(CGAL::to_double(p.x()));
+    out[1] = static_cast<float>(CGAL::to_double(p.y()));
+    out[2] = static_cast<float>(CGAL::to_double(p.z()));
+}
+
+// Fills an stl record (normal followed by three corners) for a triangle face.
+template <class Mesh>
+void face_stl_record(const Mesh& mesh, typename Mesh::Face_index f, float* record) {
+    typename Mesh::Halfedge_index h = mesh.halfedge(f);
+    for (int c = 0; c < 3; ++c) {
+        point_to_floats(mesh.point(mesh.target(h)), record + 3 + c * 3);
+        h = mesh.next(h);
+    }
+    stl_writer::stl_writer_impl::TriNormal(record + 3, record + 6, record + 9, record);
+}
+
+} // namespace detail
+
+// Writes all faces of a triangle mesh to a binary STL file. Like the other
+// helpers here it uses raw face indices, so the mesh must not contain garbage.
+// Errors are printed and false is returned.
+template <class Mesh>
+bool write_STL_binary(const std::string& filename, const Mesh& mesh) {
+    typedef typename Mesh::Face_index Face_index;
+    try {
+        return stl_writer::WriteStlFile_BINARY(filename.c_str(), mesh.number_of_faces(),
+            [&](std::size_t i, float* record, std::uint16_t&) {
+                detail::face_stl_record(mesh, Face_index(static_cast<typename Mesh::size_type>(i)), record);
+            });
+    } catch (const memory::Budget_exceeded&) {
+        throw;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+}
+
+// Writes a triangle mesh to a binary STL file with the segment ID of each face
+// in the attribute field. If only_segment is non-negative, only the faces of
+// that segment are written.
+template <class Mesh, class SegmentMap>
+bool write_STL_binary(const std::string& filename, const Mesh& mesh, const SegmentMap& segment_map,
+                      long only_segment = -1) {
+    typedef typename Mesh::Face_index Face_index;
+
+    std::vector<std::uint32_t> selected;
+    if (only_segment >= 0) {
+        for (std::size_t f = 0; f < mesh.number_of_faces(); ++f) {
+            if (segment_map[Face_index(static_cast<typename Mesh::size_type>(f))] == std::size_t(only_segment))
+                selected.push_back(static_cast<std::uint32_t>(f));
+        }
+    }
+
+    const std::size_t num_tris = only_segment >= 0 ? selected.size() : mesh.number_of_faces();
+    try {
+        return stl_writer::WriteStlFile_BINARY(filename.c_str(), num_tris,
+            [&](std::size_t i, float* record, std::uint16_t& attribute) {
+                const Face_index f(static_cast<typename Mesh::size_type>(only_segment >= 0 ? selected[i] : i));
+                detail::face_stl_record(mesh, f, record);
+                attribute = static_cast<std::uint16_t>(segment_map[f]);
+            });
+    } catch (const memory::Budget_exceeded&) {
+        throw;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+}
+
+// Outcome of building a Surface_mesh from indexed polygons.
+struct Mesh_build_report {
+    std::size_t num_faces = 0;                  // faces added to the mesh
+    std::vector<std::uint32_t> rejected_faces;  // input faces that were left out
+    // For every face rejected because of an edge, the directed edge (u, v) that
+    // was already used in that direction by another face. This happens when more
+    // than two faces share an edge or when neighbouring faces disagree on their
+    // orientation.
+    std::vector<std::pair<std::uint32_t, std::uint32_t> > non_manifold_edges;
+    std::size_t num_degenerate = 0;             // rejected because a corner repeats
+    std::size_t num_non_manifold_vertices = 0;  // vertices where several border fans meet
+
+    bool is_manifold() const { return rejected_faces.empty() && num_non_manifold_vertices == 0; }
+};
+
+namespace detail {
+
+// Open addressing hash map from a directed edge (u, v) to its halfedge index.
+// Sized for at most max_entries keys at a load factor of at most 1/2, which
+// keeps the linear probe chains short.
+class Edge_map {
+public:
+    static constexpr std::uint32_t npos = 0xFFFFFFFFu;
+
+    explicit Edge_map(std::size_t max_entries) {
+        std::size_t capacity = 16;
+        bits = 4;
+        while (capacity < max_entries * 2) {
+            capacity *= 2;
+            ++bits;
+        }
+        keys.assign(capacity, empty_key);
+        values.resize(capacity);
+    }
+
+    std::uint32_t find(std::uint32_t u, std::uint32_t v) const {
+        const std::uint64_t k = key(u, v);
+        for (std::size_t i = slot(k);; i = (i + 1) & (keys.size() - 1)) {
+            if (keys[i] == k) return values[i];
+            if (keys[i] == empty_key) return npos;
+        }
+    }
+
+    void insert(std::uint32_t u, std::uint32_t v, std::uint32_t h) {
+        const std::uint64_t k = key(u, v);
+        std::size_t i = slot(k);
+        while (keys[i] != empty_key) i = (i + 1) & (keys.size() - 1);
+        keys[i] = k;
+        values[i] = h;
+    }
+
+private:
+    static constexpr std::uint64_t empty_key = ~std::uint64_t(0);
+
+    static std::uint64_t key(std::uint32_t u, std::uint32_t v) {
+        return (std::uint64_t(u) << 32) | v;
+    }
+
+    std::size_t slot(std::uint64_t k) const {
+        return static_cast<std::size_t>((k * 0x9E3779B97F4A7C15ull) >> (64 - bits));
+    }
+
+    counted_vector<std::uint64_t> keys;
+    counted_vector<std::uint32_t> values;
+    unsigned bits;
+};
+
+} // namespace detail
+
+// Builds a Surface_mesh from indexed polygons: 3 coordinates per vertex in
+// coords and the corners of face f in face_vrts[face_offset(f) .. face_offset(f + 1)).
+//
+// Unlike calling add_face() per face, the connectivity is assembled directly:
+// all elements are reserved up front, halfedge pairs are found through a hash
+// map keyed by directed edge, and border halfedges are linked in one pass at
+// the end. Faces that would make the mesh non-manifold are not added, but
+// recorded in the report together with the offending edge.
+template <class Mesh, class TNumber, class TIndex, class FaceOffset>
+void build_surface_mesh(const TNumber* coords, std::size_t num_vertices,
+                        const TIndex* face_vrts, std::size_t num_faces, FaceOffset face_offset,
+                        Mesh& mesh, Mesh_build_report& report) {
+    typedef typename Mesh::Point Point;
+    typedef typename Mesh::Vertex_index Vertex_index;
+    typedef typename Mesh::Halfedge_index Halfedge_index;
+    typedef typename Mesh::Face_index Face_index;
+    typedef typename Mesh::size_type size_type;
+    MESH_TRACE_SCOPE("build_surface_mesh");
+
+    const std::size_t num_corners = static_cast<std::size_t>(face_offset(num_faces));
+    report = Mesh_build_report();
+
+    mesh.clear();
+    mesh.reserve(static_cast<size_type>(num_vertices),
+                 static_cast<size_type>((num_corners + 1) / 2),
+                 static_cast<size_type>(num_faces));
+
+    for (std::size_t v = 0; v < num_vertices; ++v)
+        mesh.add_vertex(Point(coords[v * 3], coords[v * 3 + 1], coords[v * 3 + 2]));
+
+    // Every corner may start a new edge, which takes both of its directions,
+    // e.g. in an unwelded triangle soup
+    detail::Edge_map edges(2 * num_corners);
+    counted_vector<Halfedge_index> face_halfedges;
+
+    for (std::size_t f = 0; f < num_faces; ++f) {
+        const std::size_t begin = static_cast<std::size_t>(face_offset(f));
+        const std::size_t n = static_cast<std::size_t>(face_offset(f + 1)) - begin;
+        const TIndex* c = face_vrts + begin;
+
+        // Check the whole face before touching the mesh
+        bool degenerate = n < 3;
+        for (std::size_t i = 0; i < n && !degenerate; ++i) {
+            for (std::size_t j = i + 1; j < n; ++j)
+                degenerate = degenerate || c[i] == c[j];
+        }
+        if (degenerate) {
+            ++report.num_degenerate;
+            report.rejected_faces.push_back(static_cast<std::uint32_t>(f));
+            continue;
+        }
+
+        bool manifold = true;
+        for (std::size_t i = 0; i < n && manifold; ++i) {
+            const std::uint32_t u = static_cast<std::uint32_t>(c[i]);
+            const std::uint32_t v = static_cast<std::uint32_t>(c[(i + 1) % n]);
+            const std::uint32_t h = edges.find(u, v);
+            if (h != detail::Edge_map::npos && !mesh.is_border(Halfedge_index(h))) {
+                report.non_manifold_edges.push_back(std::make_pair(u, v));
+                manifold = false;
+            }
+        }
+        if (!manifold) {
+            report.rejected_faces.push_back(static_cast<std::uint32_t>(f));
+            continue;
+        }
+
+        const Face_index fi = mesh.add_face();
+        face_halfedges.clear();
+        for (std::size_t i = 0; i < n; ++i) {
+            const std::uint32_t u = static_cast<std::uint32_t>(c[i]);
+            const std::uint32_t v = static_cast<std::uint32_t>(c[(i + 1) % n]);
+            std::uint32_t h = edges.find(u, v);
+            if (h == detail::Edge_map::npos) {
+                const Halfedge_index he = mesh.add_edge();
+                const Halfedge_index op = mesh.opposite(he);
+                mesh.set_target(he, Vertex_index(v));
+                mesh.set_target(op, Vertex_index(u));
+                h = static_cast<std::uint32_t>(he.idx());
+                edges.insert(u, v, h);
+                edges.insert(v, u, static_cast<std::uint32_t>(op.idx()));
+            }
+            face_halfedges.push_back(Halfedge_index(h));
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            const Halfedge_index h = face_halfedges[i];
+            mesh.set_face(h, fi);
+            mesh.set_next(h, face_halfedges[(i + 1) % n]);
+            mesh.set_halfedge(mesh.target(h), h);
+        }
+        mesh.set_halfedge(fi, face_halfedges[0]);
+        ++report.num_faces;
+    }
+
+    // Link every border halfedge to the border halfedge leaving its target in
+    // the same fan: rotate around the target through the interior faces until
+    // the border is reached again. Border vertices keep a border halfedge as
+    // their incoming halfedge, as CGAL expects.
+    counted_vector<std::uint8_t> border_fans(num_vertices, 0);
+    const std::size_t num_halfedges = mesh.number_of_halfedges();
+    for (std::size_t hi = 0; hi < num_halfedges; ++hi) {
+        const Halfedge_index h(static_cast<size_type>(hi));
+        if (!mesh.is_border(h)) continue;
+
+        Halfedge_index o = mesh.opposite(h);
+        Halfedge_index p = mesh.opposite(mesh.prev(o));
+        for (std::size_t guard = 0; !mesh.is_border(p) && guard < num_halfedges; ++guard) {
+            o = p;
+            p = mesh.opposite(mesh.prev(o));
+        }
+        mesh.set_next(h, p);
+
+        const Vertex_index v = mesh.target(h);
+        mesh.set_halfedge(v, h);
+        if (border_fans[v.idx()] < 2 && ++border_fans[v.idx()] == 2)
+            ++report.num_non_manifold_vertices;
+    }
+}
+
+// Builds a Surface_mesh from flat polygon arrays as produced by
+// off_reader::ReadOffFile.
+template <class Mesh, class TNumberContainer, class TIndexContainer1, class TIndexContainer2>
+void build_surface_mesh(const TNumberContainer& coords,
+                        const TIndexContainer1& face_vrts,
+                        const TIndexContainer2& face_offsets,
+                        Mesh& mesh, Mesh_build_report& report) {
+    const std::size_t num_faces = face_offsets.empty() ? 0 : face_offsets.size() - 1;
+    build_surface_mesh(coords.data(), coords.size() / 3, face_vrts.data(), num_faces,
+                       [&](std::size_t f) { return face_offsets[f]; }, mesh, report);
+}
+
+// Builds a Surface_mesh directly from the welded vertices and triangles of an
+// StlMesh, without a round trip through a triangle soup or an OFF file.
+template <class Mesh, class TNumber, class TIndex>
+void stl_to_surface_mesh(const stl_reader::StlMesh<TNumber, TIndex>& stl, Mesh& mesh, Mesh_build_report& report) {
+    build_surface_mesh(stl.raw_coords(), stl.num_vrts(), stl.raw_tris(), stl.num_tris(),
+                       [](std::size_t f) { return f * 3; }, mesh, report);
+}
+
+// Reads an OFF file with the parallel off_reader and bulk-builds the mesh.
+// Returns false if the file cannot be read. Faces that could not be added are
+// listed in the report, if one is given.
+template <class Mesh>
+bool read_OFF(const std::string& filename, Mesh& mesh, Mesh_build_report* report = nullptr) {
+    MESH_TRACE_SCOPE("read_OFF");
+    counted_vector<double> coords;
+    counted_vector<std::uint32_t> face_vrts;
+    counted_vector<std::uint32_t> face_offsets;
+    {
+        memory::Stage_scope stage("ReadOffFile");
+        try {
+            off_reader::ReadOffFile(filename.c_str(), coords, face_vrts, face_offsets);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    memory::Stage_scope stage("build_surface_mesh");
+    Mesh_build_report local_report;
+    build_surface_mesh(coords, face_vrts, face_offsets, mesh, report ? *report : local_report);
+    return true;
+}
+
+// Reads an ASCII or binary STL file with stl_reader, which welds coincident
+// corners, and bulk-builds the mesh from the welded arrays.
+template <class Mesh>
+bool read_STL(const std::string& filename, Mesh& mesh, Mesh_build_report* report = nullptr) {
+    MESH_TRACE_SCOPE("read_STL");
+    stl_reader::StlMesh<float, std::uint32_t> stl;
+    {
+        // Parsing and RemoveDoubles; stl_reader does not use the counting
+        // allocator, so this stage is measured by RSS only
+        memory::Stage_scope stage("ReadStlFile");
+        try {
+            stl.read_file(filename);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    memory::Stage_scope stage("build_surface_mesh");
+    Mesh_build_report local_report;
+    stl_to_surface_mesh(stl, mesh, report ? *report : local_report);
+    return true;
+}
+
+// Reads a mesh pack (see mesh_pack.h) and bulk-builds the mesh from the
+// decoded arrays, like read_STL.
+template <class Mesh>
+bool read_mesh_pack(const std::string& filename, Mesh& mesh, Mesh_build_report* report = nullptr) {
+    MESH_TRACE_SCOPE("read_mesh_pack");
+    stl_reader::StlMesh<float, std::uint32_t> stl;
+    {
+        memory::Stage_scope stage("ReadMeshPack");
+        try {
+            stl.read_file_with(filename.c_str(), mesh_pack::MeshPackReader());
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    memory::Stage_scope stage("build_surface_mesh");
+    Mesh_build_report local_report;
+    stl_to_surface_mesh(stl, mesh, report ? *report : local_report);
+    return true;
+}
+
+// Reads an OFF, STL or mesh pack file, chosen by extension, into the flat
+// polygon arrays that build_surface_mesh takes, without building a mesh, e.g.
+// to hand them to another process. STL corners are welded as in read_STL.
+template <class TNumberContainer, class TIndexContainer1, class TIndexContainer2>
+bool read_mesh_arrays(const std::string& filename, TNumberContainer& coords, TIndexContainer1& face_vrts,
+                      TIndexContainer2& face_offsets) {
+    MESH_TRACE_SCOPE("read_mesh_arrays");
+    const std::string ext = file_extension(filename);
+    try {
+        if (ext != ".stl" && ext != ".mpk") {
+            off_reader::ReadOffFile(filename.c_str(), coords, face_vrts, face_offsets);
+            return true;
+        }
+        stl_reader::StlMesh<float, std::uint32_t> stl;
+        if (ext == ".mpk") stl.read_file_with(filename.c_str(), mesh_pack::MeshPackReader());
+        else stl.read_file(filename);
+        coords.assign(stl.raw_coords(), stl.raw_coords() + stl.num_vrts() * 3);
+        face_vrts.assign(stl.raw_tris(), stl.raw_tris() + stl.num_tris() * 3);
+        face_offsets.resize(stl.num_tris() + 1);
+        for (std::size_t f = 0; f <= stl.num_tris(); ++f)
+            face_offsets[f] = static_cast<typename TIndexContainer2::value_type>(f * 3);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Reads an OFF, STL or mesh pack file, chosen by extension.
+template <class Mesh>
+bool read_mesh(const std::string& filename, Mesh& mesh, Mesh_build_report* report = nullptr) {
+    const std::string ext = file_extension(filename);
+    if (ext == ".stl")
+        return read_STL(filename, mesh, report);
+    if (ext == ".mpk")
+        return read_mesh_pack(filename, mesh, report);
+    return read_OFF(filename, mesh, report);
+}
+
+} // namespace mesh_tools
+
+#endif // MESH_IO_H
@@ -0,0 +1,586 @@
+
+
+#ifndef __H__MESH_PACK
+#define __H__MESH_PACK
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mesh_reorder.h"
+#include "off_reader.h"
+#include "parallel.h"
+#include "stl_reader.h"
+
+#ifdef MESH_PACK_NO_EXCEPTIONS
+  #define MESH_PACK_THROW(msg) return false;
+  #define MESH_PACK_COND_THROW(cond, msg) if(cond) return false;
+#else
+  /// Throws an std::runtime_error with the given message.
+  #define MESH_PACK_THROW(msg) {std::stringstream ss; ss << msg; throw(std::runtime_error(ss.str()));}
+
+  /// Throws an std::runtime_error with the given message, if the given condition evaluates to true.
+  #define MESH_PACK_COND_THROW(cond, msg)  if(cond){std::stringstream ss; ss << msg; throw(std::runtime_error(ss.str()));}
+#endif
+
+
+/// Compressed container for welded triangle meshes (`.mpk`)
+/** A mesh pack stores the arrays of a welded triangle mesh, as produced by
+ * stl_reader::ReadStlFile, in a compact form which can be decoded in
+ * parallel:
+ *
+ * - Triangles are reordered within their solid for a post-transform vertex
+ *   cache with mesh_reorder::ReorderTris, unless PackOptions::reorder is
+ *   false. The solid ranges stay valid, but per triangle data of the input,
+ *   e.g. labels, no longer lines up with the packed triangles.
+ * - Vertices are renumbered in the order in which the triangles first
+ *   reference them.
+ * - Every triangle corner is stored as the distance between the next unused
+ *   vertex index and the corner index, as a LEB128 varint. New vertices are
+ *   encoded as 0, recently used ones as small numbers.
+ * - Positions are quantized to `positionBits` bits per axis relative to the
+ *   bounding box, and each vertex is stored as the zigzag varint delta to
+ *   its predecessor.
+ * - Normals are not stored. They are recomputed from the decoded triangles,
+ *   which matches the normals of virtually all STL exporters.
+ *
+ * Triangles and vertices are split into chunks which are encoded
+ * independently of each other, so decoding runs chunk-parallel. The varints
+ * are byte aligned rather than entropy coded, which keeps decoding at memory
+ * speed; packs compress further with general purpose compressors if needed.
+ *
+ * All numbers are stored little endian.
+ */
+namespace mesh_pack {
+
+/// Parameters of WriteMeshPack
+struct PackOptions {
+  PackOptions () : positionBits (20), chunkTris (1 << 16), chunkVrts (1 << 16), reorder (true) {}
+
+  /// bits per quantized coordinate, in [1, 31]. 20 bits keep an error below 1e-6 of the extent.
+  unsigned positionBits;
+  /// triangles per index chunk
+  unsigned chunkTris;
+  /// vertices per position chunk
+  unsigned chunkVrts;
+  /// reorder the triangles of each solid for vertex cache locality, so that
+  /// decoded meshes come out cache friendly. Packs get slightly larger, as
+  /// positions delta-code less well along the new vertex order.
+  bool reorder;
+};
+
+/// Writes welded mesh arrays to a mesh pack
+/** \param coords  [in] 3 coordinates per vertex
+ * \param tris    [in] 3 corner indices per triangle
+ * \param solids  [in] Triangle ranges of the solids, as returned by ReadStlFile.
+ *                     May be empty, in which case one solid is written.
+ * \returns true if the file was written successfully.
+ */
+template <class TNumberContainer, class TIndexContainer1, class TIndexContainer2>
+bool WriteMeshPack(const char* filename,
+                   const TNumberContainer& coords,
+                   const TIndexContainer1& tris,
+                   const TIndexContainer2& solids,
+                   const PackOptions& options = PackOptions());
+
+/// Writes an StlMesh to a mesh pack
+template <class TNumber, class TIndex, class TStorage>
+bool WriteMeshPack(const char* filename,
+                   const stl_reader::StlMesh<TNumber, TIndex, TStorage>& mesh,
+                   const PackOptions& options = PackOptions());
+
+/// Reads a mesh pack into the arrays used by stl_reader::ReadStlFile
+/** Chunks are decoded in parallel. The arguments have the same meaning as
+ * the ones of stl_reader::ReadStlFile.
+ * \returns true if the file was successfully read into the provided containers.
+ */
+template <class TNumberContainer1, class TNumberContainer2,
+          class TIndexContainer1, class TIndexContainer2>
+bool ReadMeshPack(const char* filename,
+                  TNumberContainer1& coordsOut,
+                  TNumberContainer2& normalsOut,
+                  TIndexContainer1& trisOut,
+                  TIndexContainer2& solidRangesOut);
+
+/// Reader for stl_reader::StlMesh::read_file_with
+/** \code
+ *    stl_reader::StlMesh<float, unsigned int> mesh;
+ *    mesh.read_file_with ("part.mpk", mesh_pack::MeshPackReader ());
+ *  \endcode
+ */
+struct MeshPackReader {
+  template <class TNumberContainer1, class TNumberContainer2,
+            class TIndexContainer1, class TIndexContainer2>
+  bool operator () (const char* filename,
+                    TNumberContainer1& coordsOut,
+                    TNumberContainer2& normalsOut,
+                    TIndexContainer1& trisOut,
+                    TIndexContainer2& solidRangesOut) const
+  {
+    return ReadMeshPack (filename, coordsOut, normalsOut, trisOut, solidRangesOut);
+  }
+};
+
+/// Determines whether a file starts with the mesh pack signature
+inline bool FileHasMeshPackFormat(const char* filename);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//  IMPLEMENTATION
+////////////////////////////////////////////////////////////////////////////////
+
+
+namespace mesh_pack_impl {
+
+  const char MAGIC[4] = {'M', 'P', 'K', '1'};
+  const uint32_t VERSION = 1;
+
+  // byte sizes of the fixed header and of the chunk table entries
+  const size_t HEADER_SIZE = 4 + 4 * 4 + 3 * 8 + 6 * 8 + 2 * 8;
+  const size_t INDEX_CHUNK_ENTRY_SIZE = 3 * 8;
+  const size_t VERTEX_CHUNK_ENTRY_SIZE = 2 * 8;
+
+  template <class T>
+  inline void Put (std::vector<char>& out, const T& value)
+  {
+    const char* p = reinterpret_cast<const char*> (&value);
+    out.insert (out.end(), p, p + sizeof(T));
+  }
+
+  template <class T>
+  inline T Get (const char*& p)
+  {
+    T value;
+    memcpy (&value, p, sizeof(T));
+    p += sizeof(T);
+    return value;
+  }
+
+  inline void PutVarint (std::vector<char>& out, uint64_t v)
+  {
+    while (v >= 0x80) {
+      out.push_back (static_cast<char> ((v & 0x7f) | 0x80));
+      v >>= 7;
+    }
+    out.push_back (static_cast<char> (v));
+  }
+
+  // decodes a varint; returns NULL if it runs past end
+  inline const char* GetVarint (const char* p, const char* end, uint64_t& v)
+  {
+    v = 0;
+    for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+      const uint8_t byte = static_cast<uint8_t> (*p++);
+      v |= static_cast<uint64_t> (byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return p;
+    }
+    return NULL;
+  }
+
+  inline uint64_t ZigZag (int64_t v)
+  {
+    return (static_cast<uint64_t> (v) << 1) ^ static_cast<uint64_t> (v >> 63);
+  }
+
+  inline int64_t UnZigZag (uint64_t v)
+  {
+    return static_cast<int64_t> (v >> 1) ^ -static_cast<int64_t> (v & 1);
+  }
+
+  struct Header {
+    uint32_t positionBits;
+    uint32_t chunkTris;
+    uint32_t chunkVrts;
+    uint64_t numVrts;
+    uint64_t numTris;
+    uint64_t numSolidRanges;
+    double   minCoord[3];
+    double   scale[3];
+    uint64_t numIndexChunks;
+    uint64_t numVertexChunks;
+  };
+
+  struct IndexChunk {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t firstNew;  // next unused vertex index at the start of the chunk
+  };
+
+  struct VertexChunk {
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  inline bool WriteAll (const char* filename, const std::vector<char>& data)
+  {
+    const int fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    MESH_PACK_COND_THROW(fd < 0, "Couldn't open file " << filename << " for writing");
+    size_t numWritten = 0;
+    while (numWritten < data.size()) {
+      const ssize_t n = write (fd, &data[numWritten], data.size() - numWritten);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      numWritten += static_cast<size_t> (n);
+    }
+    const bool closed = close (fd) == 0;
+    MESH_PACK_COND_THROW(numWritten != data.size() || !closed, "Error while writing file " << filename);
+    return true;
+  }
+
+  template <class TNumber1, class TNumber2>
+  inline void TriNormal (const TNumber1* a, const TNumber1* b, const TNumber1* c, TNumber2* n)
+  {
+    const double u[3] = {double(b[0]) - a[0], double(b[1]) - a[1], double(b[2]) - a[2]};
+    const double v[3] = {double(c[0]) - a[0], double(c[1]) - a[1], double(c[2]) - a[2]};
+    double d[3] = {u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0]};
+    const double len = std::sqrt (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    for (size_t i = 0; i < 3; ++i)
+      n[i] = static_cast<TNumber2> (len > 0 ? d[i] / len : 0);
+  }
+
+}// end of namespace mesh_pack_impl
+
+
+template <class TNumberContainer, class TIndexContainer1, class TIndexContainer2>
+bool WriteMeshPack(const char* filename,
+                   const TNumberContainer& coords,
+                   const TIndexContainer1& tris,
+                   const TIndexContainer2& solids,
+                   const PackOptions& options)
+{
+  using namespace std;
+  using namespace mesh_pack_impl;
+  MESH_TRACE_SCOPE("WriteMeshPack");
+
+  MESH_PACK_COND_THROW(options.positionBits < 1 || options.positionBits > 31,
+    "Invalid number of position bits (" << options.positionBits << ") for " << filename);
+  MESH_PACK_COND_THROW(options.chunkTris == 0 || options.chunkVrts == 0,
+    "Invalid chunk size for " << filename);
+
+  typedef typename TIndexContainer1::value_type TIndex;
+  const size_t numVrts = coords.size() / 3;
+  const size_t numTris = tris.size() / 3;
+
+  for (size_t i = 0; i < numTris * 3; ++i) {
+    MESH_PACK_COND_THROW(static_cast<uint64_t> (tris[i]) >= numVrts,
+      "Invalid corner index " << static_cast<uint64_t> (tris[i]) << " while writing " << filename);
+  }
+
+  vector<uint64_t> solidRanges (solids.begin(), solids.end());
+  if (solidRanges.empty()) {
+    solidRanges.push_back (0);
+    solidRanges.push_back (numTris);
+  }
+  bool validSolids = solidRanges.front() == 0 && solidRanges.back() == numTris;
+  for (size_t i = 1; i < solidRanges.size(); ++i)
+    validSolids = validSolids && solidRanges[i - 1] <= solidRanges[i];
+  MESH_PACK_COND_THROW(!validSolids, "Invalid solid ranges while writing " << filename);
+
+//  cache friendly triangle order within each solid; triOrder[t] is the input
+//  triangle written at position t
+  vector<TIndex> triOrder;
+  if (options.reorder && numTris > 0) {
+    const vector<TIndex> ranges (solidRanges.begin(), solidRanges.end());
+    triOrder = mesh_reorder::ReorderTris<TIndex, double> (&tris[0], numTris, numVrts, &ranges[0],
+                                                          ranges.size()).triOrder;
+  }
+  const bool reordered = !triOrder.empty();
+  auto corner = [&](size_t i) {
+    return static_cast<uint64_t> (tris[reordered ? static_cast<size_t> (triOrder[i / 3]) * 3 + i % 3 : i]);
+  };
+
+//  renumber vertices in order of first use; unreferenced ones go last
+  const uint64_t unused = ~uint64_t(0);
+  vector<uint64_t> newIndex (numVrts, unused);
+  vector<uint64_t> oldIndex;
+  oldIndex.reserve (numVrts);
+  for (size_t i = 0; i < numTris * 3; ++i) {
+    const uint64_t vi = corner (i);
+    if (newIndex[vi] == unused) {
+      newIndex[vi] = oldIndex.size();
+      oldIndex.push_back (vi);
+    }
+  }
+  for (size_t vi = 0; vi < numVrts; ++vi) {
+    if (newIndex[vi] == unused) {
+      newIndex[vi] = oldIndex.size();
+      oldIndex.push_back (vi);
+    }
+  }
+
+  Header header;
+  header.positionBits = options.positionBits;
+  header.chunkTris = options.chunkTris;
+  header.chunkVrts = options.chunkVrts;
+  header.numVrts = numVrts;
+  header.numTris = numTris;
+  header.numIndexChunks = (numTris + options.chunkTris - 1) / options.chunkTris;
+  header.numVertexChunks = (numVrts + options.chunkVrts - 1) / options.chunkVrts;
+
+//  quantization grid over the bounding box
+  const double maxQ = static_cast<double> ((uint64_t(1) << options.positionBits) - 1);
+  for (size_t i = 0; i < 3; ++i) {
+    double lo = numVrts ? static_cast<double> (coords[i]) : 0;
+    double hi = lo;
+    for (size_t vi = 0; vi < numVrts; ++vi) {
+      lo = min (lo, static_cast<double> (coords[vi * 3 + i]));
+      hi = max (hi, static_cast<double> (coords[vi * 3 + i]));
+    }
+    header.minCoord[i] = lo;
+    header.scale[i] = (hi - lo) / maxQ;
+  }
+
+  vector<IndexChunk> indexChunks (header.numIndexChunks);
+  vector<VertexChunk> vertexChunks (header.numVertexChunks);
+  vector<char> payload;
+
+  uint64_t nextNew = 0;
+  for (size_t c = 0; c < indexChunks.size(); ++c) {
+    indexChunks[c].offset = payload.size();
+    indexChunks[c].firstNew = nextNew;
+    const size_t end = min<size_t> (numTris, (c + 1) * options.chunkTris) * 3;
+    for (size_t i = c * options.chunkTris * 3; i < end; ++i) {
+      const uint64_t vi = newIndex[corner (i)];
+      PutVarint (payload, nextNew - vi);
+      if (vi == nextNew)
+        ++nextNew;
+    }
+    indexChunks[c].size = payload.size() - indexChunks[c].offset;
+  }
+
+  for (size_t c = 0; c < vertexChunks.size(); ++c) {
+    vertexChunks[c].offset = payload.size();
+    int64_t prev[3] = {0, 0, 0};
+    const size_t end = min<size_t> (numVrts, (c + 1) * options.chunkVrts);
+    for (size_t v = c * options.chunkVrts; v < end; ++v) {
+      const uint64_t vi = oldIndex[v];
+      for (size_t i = 0; i < 3; ++i) {
+        const double t = header.scale[i] > 0
+                         ? (static_cast<double> (coords[vi * 3 + i]) - header.minCoord[i]) / header.scale[i]
+                         : 0;
+        const int64_t q = static_cast<int64_t> (min (maxQ, floor (t + 0.5)));
+        PutVarint (payload, ZigZag (q - prev[i]));
+        prev[i] = q;
+      }
+    }
+    vertexChunks[c].size = payload.size() - vertexChunks[c].offset;
+  }
+
+  header.numSolidRanges = solidRanges.size();
+
+  vector<char> out;
+  out.reserve (HEADER_SIZE + solidRanges.size() * 8 + indexChunks.size() * INDEX_CHUNK_ENTRY_SIZE
+               + vertexChunks.size() * VERTEX_CHUNK_ENTRY_SIZE + payload.size());
+  out.insert (out.end(), MAGIC, MAGIC + 4);
+  Put (out, VERSION);
+  Put (out, header.positionBits);
+  Put (out, header.chunkTris);
+  Put (out, header.chunkVrts);
+  Put (out, header.numVrts);
+  Put (out, header.numTris);
+  Put (out, header.numSolidRanges);
+  for (size_t i = 0; i < 3; ++i)
+    Put (out, header.minCoord[i]);
+  for (size_t i = 0; i < 3; ++i)
+    Put (out, header.scale[i]);
+  Put (out, header.numIndexChunks);
+  Put (out, header.numVertexChunks);
+  for (size_t i = 0; i < solidRanges.size(); ++i)
+    Put (out, solidRanges[i]);
+  for (size_t c = 0; c < indexChunks.size(); ++c) {
+    Put (out, indexChunks[c].offset);
+    Put (out, indexChunks[c].size);
+    Put (out, indexChunks[c].firstNew);
+  }
+  for (size_t c = 0; c < vertexChunks.size(); ++c) {
+    Put (out, vertexChunks[c].offset);
+    Put (out, vertexChunks[c].size);
+  }
+  out.insert (out.end(), payload.begin(), payload.end());
+
+  return WriteAll (filename, out);
+}
+
+
+template <class TNumber, class TIndex, class TStorage>
+bool WriteMeshPack(const char* filename,
+                   const stl_reader::StlMesh<TNumber, TIndex, TStorage>& mesh,
+                   const PackOptions& options)
+{
+  std::vector<TNumber> coords (mesh.num_vrts() * 3);
+  if (!coords.empty())
+    mesh.decode_vrt_coords (0, mesh.num_vrts(), &coords[0]);
+  std::vector<TIndex> tris (mesh.raw_tris(), mesh.raw_tris() + mesh.num_tris() * 3);
+  std::vector<TIndex> solids (mesh.raw_solids(), mesh.raw_solids() + mesh.num_solids() + 1);
+  return WriteMeshPack (filename, coords, tris, solids, options);
+}
+
+
+template <class TNumberContainer1, class TNumberContainer2,
+          class TIndexContainer1, class TIndexContainer2>
+bool ReadMeshPack(const char* filename,
+                  TNumberContainer1& coordsOut,
+                  TNumberContainer2& normalsOut,
+                  TIndexContainer1& trisOut,
+                  TIndexContainer2& solidRangesOut)
+{
+  using namespace std;
+  using namespace mesh_pack_impl;
+  MESH_TRACE_SCOPE("ReadMeshPack");
+
+  typedef typename TNumberContainer1::value_type  number_t;
+  typedef typename TIndexContainer1::value_type index_t;
+
+  coordsOut.clear();
+  normalsOut.clear();
+  trisOut.clear();
+  solidRangesOut.clear();
+
+  off_reader::off_reader_impl::MappedFile file (filename);
+  MESH_PACK_COND_THROW(!file.is_open(), "Couldn't open file " << filename);
+  const char* p = file.data();
+  const char* const fileEnd = p + file.size();
+
+  MESH_PACK_COND_THROW(!p || file.size() < HEADER_SIZE || memcmp (p, MAGIC, 4) != 0,
+    "File " << filename << " is not a mesh pack");
+  p += 4;
+  const uint32_t version = Get<uint32_t> (p);
+  MESH_PACK_COND_THROW(version != VERSION,
+    "Unsupported mesh pack version " << version << " in file " << filename);
+
+  Header header;
+  header.positionBits = Get<uint32_t> (p);
+  header.chunkTris = Get<uint32_t> (p);
+  header.chunkVrts = Get<uint32_t> (p);
+  header.numVrts = Get<uint64_t> (p);
+  header.numTris = Get<uint64_t> (p);
+  header.numSolidRanges = Get<uint64_t> (p);
+  for (size_t i = 0; i < 3; ++i)
+    header.minCoord[i] = Get<double> (p);
+  for (size_t i = 0; i < 3; ++i)
+    header.scale[i] = Get<double> (p);
+  header.numIndexChunks = Get<uint64_t> (p);
+  header.numVertexChunks = Get<uint64_t> (p);
+
+  const uint64_t tableSize = header.numSolidRanges * 8
+                             + header.numIndexChunks * INDEX_CHUNK_ENTRY_SIZE
+                             + header.numVertexChunks * VERTEX_CHUNK_ENTRY_SIZE;
+  MESH_PACK_COND_THROW(header.chunkTris == 0 || header.chunkVrts == 0
+                       || header.numIndexChunks != (header.numTris + header.chunkTris - 1) / header.chunkTris
+                       || header.numVertexChunks != (header.numVrts + header.chunkVrts - 1) / header.chunkVrts
+                       || tableSize > static_cast<uint64_t> (fileEnd - p),
+    "Corrupt header in mesh pack " << filename);
+
+  for (uint64_t i = 0; i < header.numSolidRanges; ++i)
+    solidRangesOut.push_back (static_cast<index_t> (Get<uint64_t> (p)));
+
+  vector<IndexChunk> indexChunks (header.numIndexChunks);
+  for (size_t c = 0; c < indexChunks.size(); ++c) {
+    indexChunks[c].offset = Get<uint64_t> (p);
+    indexChunks[c].size = Get<uint64_t> (p);
+    indexChunks[c].firstNew = Get<uint64_t> (p);
+  }
+  vector<VertexChunk> vertexChunks (header.numVertexChunks);
+  for (size_t c = 0; c < vertexChunks.size(); ++c) {
+    vertexChunks[c].offset = Get<uint64_t> (p);
+    vertexChunks[c].size = Get<uint64_t> (p);
+  }
+
+  const char* const payload = p;
+  const uint64_t payloadSize = static_cast<uint64_t> (fileEnd - p);
+  for (size_t c = 0; c < indexChunks.size(); ++c)
+    MESH_PACK_COND_THROW(indexChunks[c].offset > payloadSize || indexChunks[c].size > payloadSize - indexChunks[c].offset,
+      "Corrupt chunk table in mesh pack " << filename);
+  for (size_t c = 0; c < vertexChunks.size(); ++c)
+    MESH_PACK_COND_THROW(vertexChunks[c].offset > payloadSize || vertexChunks[c].size > payloadSize - vertexChunks[c].offset,
+      "Corrupt chunk table in mesh pack " << filename);
+
+  coordsOut.resize (header.numVrts * 3);
+  trisOut.resize (header.numTris * 3);
+
+//  index and position chunks are independent tasks. Errors are collected
+//  in a flag, so that the decoding loops themselves don't throw.
+  const size_t numTasks = indexChunks.size() + vertexChunks.size();
+  vector<char> failed (numTasks, 0);
+  mesh_tools::parallel_for (numTasks, [&](size_t task) {
+    if (task < indexChunks.size()) {
+      const IndexChunk& chunk = indexChunks[task];
+      const char* q = payload + chunk.offset;
+      const char* const end = q + chunk.size;
+      uint64_t nextNew = chunk.firstNew;
+      const size_t last = min<uint64_t> (header.numTris, (task + 1) * uint64_t(header.chunkTris)) * 3;
+      for (size_t i = task * size_t(header.chunkTris) * 3; i < last; ++i) {
+        uint64_t d;
+        q = GetVarint (q, end, d);
+        if (!q || d > nextNew || (d == 0 && nextNew >= header.numVrts)) {
+          failed[task] = 1;
+          return;
+        }
+        trisOut[i] = static_cast<index_t> (nextNew - d);
+        if (d == 0)
+          ++nextNew;
+      }
+    }
+    else {
+      const size_t c = task - indexChunks.size();
+      const char* q = payload + vertexChunks[c].offset;
+      const char* const end = q + vertexChunks[c].size;
+      int64_t prev[3] = {0, 0, 0};
+      const size_t last = min<uint64_t> (header.numVrts, (c + 1) * uint64_t(header.chunkVrts));
+      for (size_t v = c * size_t(header.chunkVrts); v < last; ++v) {
+        for (size_t i = 0; i < 3; ++i) {
+          uint64_t z;
+          q = GetVarint (q, end, z);
+          if (!q) {
+            failed[task] = 1;
+            return;
+          }
+          prev[i] += UnZigZag (z);
+          coordsOut[v * 3 + i] = static_cast<number_t> (header.minCoord[i] + header.scale[i] * static_cast<double> (prev[i]));
+        }
+      }
+    }
+  }, 1);
+
+  MESH_PACK_COND_THROW(find (failed.begin(), failed.end(), 1) != failed.end(),
+    "Corrupt chunk data in mesh pack " << filename);
+
+//  normals are recomputed from the decoded geometry
+  normalsOut.resize (header.numTris * 3);
+  mesh_tools::parallel_for_chunks (header.numTris, [&](size_t begin, size_t end) {
+    for (size_t t = begin; t < end; ++t) {
+      TriNormal (&coordsOut[trisOut[t * 3] * 3], &coordsOut[trisOut[t * 3 + 1] * 3],
+                 &coordsOut[trisOut[t * 3 + 2] * 3], &normalsOut[t * 3]);
+    }
+  });
+
+  return true;
+}
+
+
+inline bool FileHasMeshPackFormat(const char* filename)
+{
+  char magic[4] = {0, 0, 0, 0};
+  const int fd = open (filename, O_RDONLY);
+  if (fd < 0)
+    return false;
+  const ssize_t n = read (fd, magic, 4);
+  close (fd);
+  return n == 4 && memcmp (magic, mesh_pack_impl::MAGIC, 4) == 0;
+}
+
+}// end of namespace mesh_pack
+
+#endif  //__H__MESH_PACK
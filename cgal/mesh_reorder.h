@@ -0,0 +1,346 @@
+
+
+#ifndef __H__MESH_REORDER
+#define __H__MESH_REORDER
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "stl_reader.h"
+
+
+/// Reordering of indexed triangles for GPU vertex reuse and memory locality
+/** The triangle order is optimized for a post-transform vertex cache with
+ * Tipsify (Sander, Nehab, Barczak: "Fast Triangle Reordering for Vertex
+ * Locality and Reduced Overdraw", 2007). Optionally, the resulting clusters
+ * are sorted so that outward facing ones are drawn first, which reduces
+ * overdraw. Vertices are then renumbered in the order in which the new
+ * triangle sequence first uses them, which makes vertex fetches sequential.
+ *
+ * Triangles are only reordered within their solid, so the solid ranges of
+ * stl_reader stay valid. The permutations are returned, so that other per
+ * triangle or per vertex data (labels, properties) can be remapped.
+ *
+ * This header is shared by the CGAL tools and the viewer and must stay C++11
+ * compatible.
+ */
+namespace mesh_reorder {
+
+/// Default size of the simulated FIFO vertex cache
+const unsigned DEFAULT_CACHE_SIZE = 16;
+
+/// Average cache miss ratio: transformed vertices per triangle with a FIFO cache
+/** 0.5 is the optimum for large regular meshes, 3 the worst case.*/
+template <class TIndex>
+double ACMR(const TIndex* tris, size_t numTris, size_t numVrts,
+            unsigned cacheSize = DEFAULT_CACHE_SIZE);
+
+/// Result of ReorderTris
+template <class TIndex>
+struct Reordering {
+  /// triOrder[newTri] is the old index of the triangle at position newTri
+  std::vector<TIndex> triOrder;
+  /// newVrtIndex[oldVrt] is the new index of a vertex
+  std::vector<TIndex> newVrtIndex;
+  double acmrBefore;
+  double acmrAfter;
+};
+
+/// Computes a triangle order and a vertex numbering for the given mesh
+/** \param tris      [in] 3 corner indices per triangle
+ * \param solids    [in] Triangle ranges, as returned by stl_reader::ReadStlFile.
+ *                       May be NULL, in which case all triangles form one range.
+ * \param numSolidRanges  [in] number of entries in solids
+ * \param overdraw  [in] If true, the Tipsify clusters are sorted outward
+ *                       facing first. Requires coords.
+ * \param coords    [in] 3 coordinates per vertex, only used if overdraw is true.
+ */
+template <class TIndex, class TNumber>
+Reordering<TIndex> ReorderTris(const TIndex* tris, size_t numTris, size_t numVrts,
+                               const TIndex* solids, size_t numSolidRanges,
+                               unsigned cacheSize = DEFAULT_CACHE_SIZE,
+                               bool overdraw = false,
+                               const TNumber* coords = NULL);
+
+/// Reorders the triangles and vertices of an StlMesh in place
+/** Triangle normals and the quantized data of compressed storage policies are
+ * permuted along. \returns the applied reordering.*/
+template <class TNumber, class TIndex, class TStorage>
+Reordering<TIndex> ReorderStlMesh(stl_reader::StlMesh<TNumber, TIndex, TStorage>& mesh,
+                                  unsigned cacheSize = DEFAULT_CACHE_SIZE,
+                                  bool overdraw = false);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//  IMPLEMENTATION
+////////////////////////////////////////////////////////////////////////////////
+
+
+namespace mesh_reorder_impl {
+
+  // triangles around each vertex, in compressed row storage
+  template <class TIndex>
+  void VertexTriangles (const TIndex* tris, size_t firstTri, size_t endTri, size_t numVrts,
+                        std::vector<size_t>& offsets, std::vector<TIndex>& triangles)
+  {
+    offsets.assign (numVrts + 1, 0);
+    for (size_t i = firstTri * 3; i < endTri * 3; ++i)
+      ++offsets[tris[i] + 1];
+    for (size_t v = 0; v < numVrts; ++v)
+      offsets[v + 1] += offsets[v];
+    triangles.resize (offsets[numVrts]);
+    std::vector<size_t> fill (offsets.begin(), offsets.end() - 1);
+    for (size_t t = firstTri; t < endTri; ++t) {
+      for (size_t c = 0; c < 3; ++c)
+        triangles[fill[tris[t * 3 + c]]++] = static_cast<TIndex> (t);
+    }
+  }
+
+  // Tipsify on the triangles [firstTri, endTri). Appends the new order to
+  // triOrder and the start of every cluster to clusterStarts. Clusters
+  // begin at dead ends of the fanning, where the cache has to be refilled.
+  template <class TIndex>
+  void Tipsify (const TIndex* tris, size_t firstTri, size_t endTri, size_t numVrts,
+                unsigned cacheSize, std::vector<TIndex>& triOrder,
+                std::vector<size_t>& clusterStarts)
+  {
+    using namespace std;
+    if (firstTri == endTri)
+      return;
+
+    vector<size_t> offsets;
+    vector<TIndex> vrtTris;
+    VertexTriangles (tris, firstTri, endTri, numVrts, offsets, vrtTris);
+
+    vector<unsigned> live (numVrts);
+    for (size_t v = 0; v < numVrts; ++v)
+      live[v] = static_cast<unsigned> (offsets[v + 1] - offsets[v]);
+
+    vector<size_t> cacheTime (numVrts, 0);
+    vector<char> emitted (endTri - firstTri, 0);
+    vector<TIndex> deadEnd;
+    vector<TIndex> candidates;
+
+    const size_t k = cacheSize;
+    size_t time = k + 1;
+    size_t cursor = 0;
+    long long fanning = tris[firstTri * 3];
+    clusterStarts.push_back (triOrder.size());
+
+    while (fanning >= 0) {
+      candidates.clear ();
+      const size_t f = static_cast<size_t> (fanning);
+      for (size_t i = offsets[f]; i < offsets[f + 1]; ++i) {
+        const size_t t = vrtTris[i];
+        if (emitted[t - firstTri])
+          continue;
+        for (size_t c = 0; c < 3; ++c) {
+          const TIndex v = tris[t * 3 + c];
+          deadEnd.push_back (v);
+          candidates.push_back (v);
+          --live[v];
+          if (time - cacheTime[v] > k)
+            cacheTime[v] = time++;
+        }
+        emitted[t - firstTri] = 1;
+        triOrder.push_back (static_cast<TIndex> (t));
+      }
+
+    //  the candidate which is still in the cache and has the fewest live
+    //  triangles left, i.e. the one which ends a fan soonest
+      long long next = -1;
+      long long best = -1;
+      for (size_t i = 0; i < candidates.size(); ++i) {
+        const TIndex v = candidates[i];
+        if (live[v] == 0)
+          continue;
+        long long priority = 0;
+        if (time - cacheTime[v] + 2 * live[v] <= k)
+          priority = static_cast<long long> (time - cacheTime[v]);
+        if (priority > best) {
+          best = priority;
+          next = v;
+        }
+      }
+
+      if (next < 0) {
+      //  dead end: back track through recently used vertices, then continue
+      //  with the next vertex in input order. Dead ends break clusters, as
+      //  long as the cluster is large enough not to hurt the cache.
+        if (triOrder.size() - clusterStarts.back() >= k)
+          clusterStarts.push_back (triOrder.size());
+        while (!deadEnd.empty () && next < 0) {
+          const TIndex v = deadEnd.back ();
+          deadEnd.pop_back ();
+          if (live[v] > 0)
+            next = v;
+        }
+        while (next < 0 && cursor < (endTri - firstTri) * 3) {
+          const TIndex v = tris[firstTri * 3 + cursor++];
+          if (live[v] > 0)
+            next = v;
+        }
+      }
+      fanning = next;
+    }
+  }
+
+  template <class TIndex, class TNumber>
+  double ClusterOcclusion (const TIndex* tris, const TNumber* coords, const TIndex* order,
+                           size_t numTris, const double* center)
+  {
+    double centroid[3] = {0, 0, 0};
+    double normal[3] = {0, 0, 0};
+    double area = 0;
+    for (size_t i = 0; i < numTris; ++i) {
+      const TIndex* t = tris + order[i] * 3;
+      const TNumber* a = coords + t[0] * 3;
+      const TNumber* b = coords + t[1] * 3;
+      const TNumber* c = coords + t[2] * 3;
+      const double u[3] = {double(b[0]) - a[0], double(b[1]) - a[1], double(b[2]) - a[2]};
+      const double w[3] = {double(c[0]) - a[0], double(c[1]) - a[1], double(c[2]) - a[2]};
+      const double n[3] = {u[1] * w[2] - u[2] * w[1], u[2] * w[0] - u[0] * w[2], u[0] * w[1] - u[1] * w[0]};
+      const double triArea = std::sqrt (n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+      for (size_t j = 0; j < 3; ++j) {
+        centroid[j] += triArea * (double(a[j]) + b[j] + c[j]) / 3;
+        normal[j] += n[j];
+      }
+      area += triArea;
+    }
+    if (area <= 0)
+      return 0;
+    double occlusion = 0;
+    for (size_t j = 0; j < 3; ++j)
+      occlusion += (centroid[j] / area - center[j]) * normal[j];
+    return occlusion;
+  }
+
+}// end of namespace mesh_reorder_impl
+
+
+template <class TIndex>
+double ACMR(const TIndex* tris, size_t numTris, size_t numVrts, unsigned cacheSize)
+{
+  if (numTris == 0)
+    return 0;
+//  FIFO cache, vertices are in the cache while their stamp is within the
+//  last cacheSize insertions
+  std::vector<size_t> stamp (numVrts, 0);
+  size_t insertions = 0;
+  size_t misses = 0;
+  for (size_t i = 0; i < numTris * 3; ++i) {
+    const TIndex v = tris[i];
+    if (stamp[v] == 0 || insertions - stamp[v] >= cacheSize) {
+      stamp[v] = ++insertions;
+      ++misses;
+    }
+  }
+  return static_cast<double> (misses) / static_cast<double> (numTris);
+}
+
+
+template <class TIndex, class TNumber>
+Reordering<TIndex> ReorderTris(const TIndex* tris, size_t numTris, size_t numVrts,
+                               const TIndex* solids, size_t numSolidRanges,
+                               unsigned cacheSize, bool overdraw, const TNumber* coords)
+{
+  using namespace std;
+  using namespace mesh_reorder_impl;
+  STL_READER_TRACE_SCOPE("ReorderTris");
+
+  Reordering<TIndex> result;
+  result.acmrBefore = ACMR (tris, numTris, numVrts, cacheSize);
+  result.triOrder.reserve (numTris);
+
+  vector<size_t> ranges;
+  if (solids && numSolidRanges > 1)
+    ranges.assign (solids, solids + numSolidRanges);
+  else {
+    ranges.push_back (0);
+    ranges.push_back (numTris);
+  }
+
+  double center[3] = {0, 0, 0};
+  if (overdraw && coords && numVrts > 0) {
+    for (size_t v = 0; v < numVrts; ++v)
+      for (size_t j = 0; j < 3; ++j)
+        center[j] += coords[v * 3 + j];
+    for (size_t j = 0; j < 3; ++j)
+      center[j] /= static_cast<double> (numVrts);
+  }
+
+  vector<size_t> clusterStarts;
+  vector<TIndex> solidOrder;
+  for (size_t s = 0; s + 1 < ranges.size(); ++s) {
+    solidOrder.clear ();
+    clusterStarts.clear ();
+    Tipsify (tris, ranges[s], ranges[s + 1], numVrts, cacheSize, solidOrder, clusterStarts);
+
+    if (overdraw && coords && clusterStarts.size() > 1) {
+    //  stable sort of the clusters, most outward facing first
+      clusterStarts.push_back (solidOrder.size());
+      vector<pair<double, size_t> > clusters;
+      for (size_t c = 0; c + 1 < clusterStarts.size(); ++c) {
+        const double occlusion = ClusterOcclusion (tris, coords, &solidOrder[clusterStarts[c]],
+                                                   clusterStarts[c + 1] - clusterStarts[c], center);
+        clusters.push_back (make_pair (-occlusion, c));
+      }
+      stable_sort (clusters.begin(), clusters.end());
+      for (size_t i = 0; i < clusters.size(); ++i) {
+        const size_t c = clusters[i].second;
+        result.triOrder.insert (result.triOrder.end(), solidOrder.begin() + clusterStarts[c],
+                                solidOrder.begin() + clusterStarts[c + 1]);
+      }
+    }
+    else
+      result.triOrder.insert (result.triOrder.end(), solidOrder.begin(), solidOrder.end());
+  }
+
+//  vertex fetch order: first use in the new triangle order, unused vertices last
+  const TIndex unused = static_cast<TIndex> (-1);
+  result.newVrtIndex.assign (numVrts, unused);
+  TIndex next = 0;
+  for (size_t i = 0; i < numTris; ++i) {
+    for (size_t c = 0; c < 3; ++c) {
+      const TIndex v = tris[result.triOrder[i] * 3 + c];
+      if (result.newVrtIndex[v] == unused)
+        result.newVrtIndex[v] = next++;
+    }
+  }
+  for (size_t v = 0; v < numVrts; ++v) {
+    if (result.newVrtIndex[v] == unused)
+      result.newVrtIndex[v] = next++;
+  }
+
+  vector<TIndex> newTris (numTris * 3);
+  for (size_t i = 0; i < numTris; ++i)
+    for (size_t c = 0; c < 3; ++c)
+      newTris[i * 3 + c] = result.newVrtIndex[tris[result.triOrder[i] * 3 + c]];
+  result.acmrAfter = ACMR (newTris.empty() ? NULL : &newTris[0], numTris, numVrts, cacheSize);
+  return result;
+}
+
+
+template <class TNumber, class TIndex, class TStorage>
+Reordering<TIndex> ReorderStlMesh(stl_reader::StlMesh<TNumber, TIndex, TStorage>& mesh,
+                                  unsigned cacheSize, bool overdraw)
+{
+  std::vector<TNumber> coords;
+  if (overdraw) {
+    coords.resize (mesh.num_vrts() * 3);
+    if (!coords.empty())
+      mesh.decode_vrt_coords (0, mesh.num_vrts(), &coords[0]);
+  }
+  Reordering<TIndex> reordering =
+    ReorderTris (mesh.raw_tris(), mesh.num_tris(), mesh.num_vrts(),
+                 mesh.raw_solids(), mesh.num_solids() + 1, cacheSize,
+                 overdraw, coords.empty() ? static_cast<const TNumber*> (NULL) : &coords[0]);
+  mesh.reorder (reordering.triOrder, reordering.newVrtIndex);
+  return reordering;
+}
+
+}// end of namespace mesh_reorder
+
+#endif  //__H__MESH_REORDER
@@ -0,0 +1,258 @@
+#ifndef NORMAL_REGIONS_H
+#define NORMAL_REGIONS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "face_adjacency.h"
+#include "memory_stats.h"
+#include "parallel.h"
+#include "trace.h"
+#include "union_find.h"
+
+namespace mesh_tools {
+
+// Cone that contains the unit normals of a set of faces.
+struct Normal_cone {
+    float axis[3] = {0, 0, 1};
+    float half_angle = 0;        // radians; pi if the set has degenerate faces
+};
+
+struct Normal_region_params {
+    double bin_angle = 10;        // degrees; faces are first grouped in direction bins about this wide
+    double max_cone_angle = 30;   // degrees; no region's normal cone grows beyond this half-angle
+};
+
+// Segmentation into regions of faces whose normals fit in a narrow cone, so
+// each region can be reached from one direction. face_region[f] is the
+// region of face f; regions are numbered in order of their first face.
+struct Normal_regions {
+    counted_vector<std::uint32_t> face_region;
+    std::vector<Normal_cone> cones;          // one per region
+
+    std::size_t num_regions() const { return cones.size(); }
+};
+
+namespace detail {
+
+// Normals are binned on the six faces of a cube, each split into n x n cells.
+struct Direction_bins {
+    int n = 1;
+
+    std::size_t size() const { return 6 * static_cast<std::size_t>(n) * n; }
+    // Index of the cell hit by a unit normal; size() for a zero normal
+    std::uint32_t bin(const float* normal) const {
+        int k = 0;
+        for (int i = 1; i < 3; ++i)
+            if (std::fabs(normal[i]) > std::fabs(normal[k])) k = i;
+        const float major = std::fabs(normal[k]);
+        if (!(major > 0)) return static_cast<std::uint32_t>(size());
+        const int side = k * 2 + (normal[k] < 0 ? 1 : 0);
+        const float u = normal[(k + 1) % 3] / major, v = normal[(k + 2) % 3] / major;
+        const int i = std::min(n - 1, std::max(0, static_cast<int>((u + 1) * 0.5f * n)));
+        const int j = std::min(n - 1, std::max(0, static_cast<int>((v + 1) * 0.5f * n)));
+        return static_cast<std::uint32_t>((side * n + i) * n + j);
+    }
+    // Smallest cone around the cell's center direction that contains the cell
+    Normal_cone cone(std::uint32_t b) const {
+        Normal_cone cone;
+        if (b >= size()) {
+            cone.half_angle = static_cast<float>(3.14159265358979323846);
+            return cone;
+        }
+        const int j = static_cast<int>(b % n), i = static_cast<int>(b / n % n), side = static_cast<int>(b / n / n);
+        const int k = side / 2;
+        const double sign = side % 2 ? -1 : 1;
+        auto direction = [&](double u, double v, double d[3]) {
+            d[k] = sign;
+            d[(k + 1) % 3] = u;
+            d[(k + 2) % 3] = v;
+            const double len = std::sqrt(1 + u * u + v * v);
+            for (int c = 0; c < 3; ++c) d[c] /= len;
+        };
+        double center[3];
+        direction((i + 0.5) * 2.0 / n - 1, (j + 0.5) * 2.0 / n - 1, center);
+        double max_angle = 0;
+        for (int corner = 0; corner < 4; ++corner) {
+            double d[3];
+            direction((i + corner % 2) * 2.0 / n - 1, (j + corner / 2) * 2.0 / n - 1, d);
+            const double c = center[0] * d[0] + center[1] * d[1] + center[2] * d[2];
+            max_angle = std::max(max_angle, std::acos(std::min(1.0, c)));
+        }
+        for (int c = 0; c < 3; ++c) cone.axis[c] = static_cast<float>(center[c]);
+        cone.half_angle = static_cast<float>(max_angle);
+        return cone;
+    }
+};
+
+inline double cone_axis_angle(const Normal_cone& a, const Normal_cone& b) {
+    const double c = a.axis[0] * b.axis[0] + a.axis[1] * b.axis[1] + a.axis[2] * b.axis[2];
+    return std::acos(std::max(-1.0, std::min(1.0, c)));
+}
+
+// Smallest cone containing both cones.
+inline Normal_cone merge_cones(const Normal_cone& a, const Normal_cone& b) {
+    const double delta = cone_axis_angle(a, b);
+    if (delta + b.half_angle <= a.half_angle) return a;
+    if (delta + a.half_angle <= b.half_angle) return b;
+    const double half_angle = (delta + a.half_angle + b.half_angle) / 2;
+    Normal_cone cone;
+    cone.half_angle = static_cast<float>(half_angle);
+    if (half_angle >= 3.14159265358979323846 || delta < 1e-9) {
+        cone = a;
+        cone.half_angle = static_cast<float>(std::min(half_angle, 3.14159265358979323846));
+        return cone;
+    }
+    // Rotate a's axis towards b's by the angle that centers the union
+    const double t = (half_angle - a.half_angle) / delta;
+    const double wa = std::sin((1 - t) * delta) / std::sin(delta), wb = std::sin(t * delta) / std::sin(delta);
+    for (int c = 0; c < 3; ++c) cone.axis[c] = static_cast<float>(wa * a.axis[c] + wb * b.axis[c]);
+    return cone;
+}
+
+} // namespace detail
+
+// Grows regions of faces with similar normals, in two phases.
+//
+// Faces are first binned by normal direction, and every pair of adjacent
+// faces in the same bin is united, in parallel over faces with a lock-free
+// union-find. Each of these patches fits in the cone of its bin. Then
+// neighbouring patches are merged as long as the smallest cone containing
+// both stays within max_cone_angle, most similar axes first; this phase
+// works on the patch graph only. Both phases and the final numbering are
+// linear in the number of faces apart from sorting the patch boundaries,
+// and the result does not depend on the number of threads.
+//
+// The merge itself runs on one thread. Whether a boundary merges depends on
+// the cones left by every merge before it in the sorted order, so doing
+// several at once would make the regions depend on the thread count. It is
+// kept short instead: boundaries whose patch axes are too far apart to ever
+// merge are dropped while they are gathered in parallel, and the rest are
+// sorted in parallel, so the loop does only finds and cone merges.
+//
+// normals holds a unit normal per face, zero for degenerate faces, which
+// stay regions of their own.
+inline Normal_regions grow_normal_regions(const Face_adjacency& adj, const float* normals,
+                                          const Normal_region_params& params = Normal_region_params()) {
+    MESH_TRACE_SCOPE("grow_normal_regions");
+    const std::size_t num_faces = adj.num_faces();
+    Normal_regions regions;
+    if (num_faces == 0) return regions;
+
+    detail::Direction_bins bins;
+    // Bins no wider than the largest cone, so that every patch fits in one
+    const double bin_angle = std::max(0.5, std::min(params.bin_angle, params.max_cone_angle)) *
+                             3.14159265358979323846 / 180;
+    bins.n = std::max(1, static_cast<int>(std::ceil(2 / bin_angle)));
+    const double max_cone_angle = params.max_cone_angle * 3.14159265358979323846 / 180;
+
+    counted_vector<std::uint32_t> face_bin(num_faces);
+    parallel_for(num_faces, [&](std::size_t f) { face_bin[f] = bins.bin(normals + f * 3); });
+
+    // Patches of adjacent faces in the same bin
+    Concurrent_union_find faces(num_faces);
+    {
+        MESH_TRACE_SCOPE("unite same bin");
+        parallel_for(num_faces, [&](std::size_t f) {
+            if (face_bin[f] == bins.size()) return;
+            for (std::uint32_t e = adj.begin(f); e < adj.end(f); ++e) {
+                const std::uint32_t g = adj.neighbor[e];
+                if (g > f && face_bin[g] == face_bin[f]) faces.unite(static_cast<std::uint32_t>(f), g);
+            }
+        });
+    }
+    counted_vector<std::uint32_t> patch_label;
+    const std::uint32_t num_patches = number_roots(faces, patch_label);
+    counted_vector<std::uint32_t> face_patch(num_faces);
+    std::vector<Normal_cone> cones(num_patches);
+    parallel_for(num_faces, [&](std::size_t f) {
+        const std::uint32_t root = faces.find(static_cast<std::uint32_t>(f));
+        face_patch[f] = patch_label[root];
+        if (root == f) cones[patch_label[root]] = bins.cone(face_bin[f]);
+    });
+
+    // Patch boundaries, one entry per pair of patches, most similar first
+    struct Boundary {
+        float angle;
+        std::uint32_t a, b;
+    };
+    std::vector<Boundary> boundaries;
+    {
+        MESH_TRACE_SCOPE("patch boundaries");
+        parallel_gather(num_faces, boundaries, [&](std::size_t begin, std::size_t end, std::vector<Boundary>& out) {
+            for (std::size_t f = begin; f < end; ++f) {
+                for (std::uint32_t e = adj.begin(f); e < adj.end(f); ++e) {
+                    const std::uint32_t a = face_patch[f], b = face_patch[adj.neighbor[e]];
+                    if (a >= b) continue;
+                    // Cones with axes more than twice the limit apart never fit in one
+                    const float angle = static_cast<float>(detail::cone_axis_angle(cones[a], cones[b]));
+                    if (angle <= max_cone_angle * 2) out.push_back({ angle, a, b });
+                }
+            }
+        });
+        parallel_sort(boundaries, [](const Boundary& x, const Boundary& y) {
+            return x.angle < y.angle || (x.angle == y.angle && (x.a < y.a || (x.a == y.a && x.b < y.b)));
+        });
+        boundaries.erase(std::unique(boundaries.begin(), boundaries.end(), [](const Boundary& x, const Boundary& y) {
+            return x.a == y.a && x.b == y.b;
+        }), boundaries.end());
+    }
+
+    // Merge patches while their cones allow it; cones are kept at the roots
+    Concurrent_union_find patches(num_patches);
+    {
+        MESH_TRACE_SCOPE("merge patches");
+        for (const Boundary& boundary : boundaries) {
+            const std::uint32_t a = patches.find(boundary.a), b = patches.find(boundary.b);
+            if (a == b) continue;
+            const Normal_cone merged = detail::merge_cones(cones[a], cones[b]);
+            if (merged.half_angle > max_cone_angle) continue;
+            patches.unite(a, b);
+            cones[patches.find(a)] = merged;
+        }
+    }
+
+    counted_vector<std::uint32_t> region_label;
+    const std::uint32_t num_regions = number_roots(patches, region_label);
+    regions.cones.resize(num_regions);
+    for (std::uint32_t p = 0; p < num_patches; ++p)
+        if (patches.is_root(p)) regions.cones[region_label[p]] = cones[p];
+    regions.face_region.resize(num_faces);
+    parallel_for(num_faces, [&](std::size_t f) {
+        regions.face_region[f] = region_label[patches.find(face_patch[f])];
+    });
+    return regions;
+}
+
+// Normal regions of a mesh, with Newell normals per face.
+template <class Mesh>
+Normal_regions grow_normal_regions(const Mesh& mesh, const Face_adjacency& adj,
+                                   const Normal_region_params& params = Normal_region_params()) {
+    typedef typename Mesh::Face_index Face_index;
+    counted_vector<float> normals(mesh.number_of_faces() * 3);
+    parallel_for(mesh.number_of_faces(), [&](std::size_t f) {
+        detail::face_normal(mesh, Face_index(static_cast<typename Mesh::size_type>(f)), &normals[f * 3]);
+    });
+    return grow_normal_regions(adj, normals.data(), params);
+}
+
+// Angle in degrees between each face normal and the cone axis of its region.
+template <class Mesh, class ValueMap>
+void normal_deviation(const Mesh& mesh, const Normal_regions& regions, ValueMap& value_map) {
+    typedef typename Mesh::Face_index Face_index;
+    parallel_for(mesh.number_of_faces(), [&](std::size_t f) {
+        const Face_index fd(static_cast<typename Mesh::size_type>(f));
+        float n[3];
+        detail::face_normal(mesh, fd, n);
+        const Normal_cone& cone = regions.cones[regions.face_region[f]];
+        const double c = n[0] * cone.axis[0] + n[1] * cone.axis[1] + n[2] * cone.axis[2];
+        value_map[fd] = std::acos(std::max(-1.0, std::min(1.0, c))) * 180 / 3.14159265358979323846;
+    });
+}
+
+} // namespace mesh_tools
+
+#endif // NORMAL_REGIONS_H
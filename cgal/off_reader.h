@@ -0,0 +1,427 @@
+
+
+#ifndef __H__OFF_READER
+#define __H__OFF_READER
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+#ifdef OFF_READER_NO_EXCEPTIONS
+  #define OFF_READER_THROW(msg) return false;
+  #define OFF_READER_COND_THROW(cond, msg) if(cond) return false;
+#else
+  /// Throws an std::runtime_error with the given message.
+  #define OFF_READER_THROW(msg) {std::stringstream ss; ss << msg; throw(std::runtime_error(ss.str()));}
+
+  /// Throws an std::runtime_error with the given message, if the given condition evaluates to true.
+  #define OFF_READER_COND_THROW(cond, msg)  if(cond){std::stringstream ss; ss << msg; throw(std::runtime_error(ss.str()));}
+#endif
+
+
+namespace off_reader {
+
+/// Reads an OFF file into flat coordinate and polygon arrays
+/** The file is memory mapped and split into line aligned chunks, which are
+ * parsed in parallel. Every vertex and every face has to be on a line of its
+ * own, which is the case for virtually all OFF files in the wild. Blank lines
+ * and `#` comments are skipped. Additional values on vertex lines (colors,
+ * normals) and on face lines (colors) are ignored.
+ *
+ * \param filename  [in] The name of the file which shall be read
+ *
+ * \param coordsOut [out] Coordinates are written to this container. On termination,
+ *                        it has size numVertices * 3. The type TNumberContainer
+ *                        should have the same interface as std::vector<float>.
+ *
+ * \param faceVrtsOut [out] Corner indices of all faces, face after face.
+ *
+ * \param faceOffsetsOut  [out] On termination, it has size numFaces + 1. The corners
+ *                              of face fi are the entries
+ *                              `faceVrtsOut[faceOffsetsOut[fi] .. faceOffsetsOut[fi+1])`.
+ *
+ * \returns true if the file was successfully read into the provided containers.
+ */
+template <class TNumberContainer, class TIndexContainer1, class TIndexContainer2>
+bool ReadOffFile(const char* filename,
+                 TNumberContainer& coordsOut,
+                 TIndexContainer1& faceVrtsOut,
+                 TIndexContainer2& faceOffsetsOut);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//  IMPLEMENTATION
+////////////////////////////////////////////////////////////////////////////////
+
+
+namespace off_reader_impl {
+
+  // read-only memory mapping of a whole file
+  class MappedFile {
+  public:
+    explicit MappedFile (const char* filename) : m_data (NULL), m_size (0), m_fd (-1)
+    {
+      m_fd = open (filename, O_RDONLY);
+      if (m_fd < 0)
+        return;
+      struct stat st;
+      if (fstat (m_fd, &st) != 0 || st.st_size <= 0)
+        return;
+      void* p = mmap (NULL, static_cast<size_t> (st.st_size), PROT_READ, MAP_PRIVATE, m_fd, 0);
+      if (p == MAP_FAILED)
+        return;
+      madvise (p, static_cast<size_t> (st.st_size), MADV_SEQUENTIAL);
+      m_data = static_cast<const char*> (p);
+      m_size = static_cast<size_t> (st.st_size);
+    }
+
+    ~MappedFile ()
+    {
+      if (m_data)
+        munmap (const_cast<char*> (m_data), m_size);
+      if (m_fd >= 0)
+        close (m_fd);
+    }
+
+    bool is_open () const     {return m_fd >= 0;}
+    const char* data () const {return m_data;}
+    size_t size () const      {return m_size;}
+
+  private:
+    MappedFile (const MappedFile&);
+    MappedFile& operator = (const MappedFile&);
+
+    const char* m_data;
+    size_t      m_size;
+    int         m_fd;
+  };
+
+  inline bool IsSpace (char c)
+  {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+  }
+
+  inline const char* SkipSpaces (const char* p, const char* end)
+  {
+    while (p < end && IsSpace (*p))
+      ++p;
+    return p;
+  }
+
+  inline const char* NextLine (const char* p, const char* end)
+  {
+    const void* nl = memchr (p, '\n', static_cast<size_t> (end - p));
+    return nl ? static_cast<const char*> (nl) + 1 : end;
+  }
+
+  // true if the line starting at p carries data (it is neither blank nor a comment)
+  inline bool IsDataLine (const char* p, const char* end)
+  {
+    p = SkipSpaces (p, end);
+    return p < end && *p != '\n' && *p != '#';
+  }
+
+  // parses an unsigned decimal integer. Returns NULL if there is none.
+  inline const char* ParseUInt (const char* p, const char* end, uint64_t& value)
+  {
+    p = SkipSpaces (p, end);
+    if (p == end || *p < '0' || *p > '9')
+      return NULL;
+    value = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+      value = value * 10 + static_cast<uint64_t> (*p++ - '0');
+    return p;
+  }
+
+  // parses a decimal floating point number such as -1.25e-3. Returns NULL if
+  // there is none. Up to 19 significant digits are accumulated in an integer
+  // and scaled by a single power of ten, which is exact to within an ulp of
+  // double precision and therefore exact for float output.
+  inline const char* ParseReal (const char* p, const char* end, double& value)
+  {
+    static const double powersOf10[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    p = SkipSpaces (p, end);
+    if (p == end)
+      return NULL;
+
+    bool negative = false;
+    if (*p == '-' || *p == '+') {
+      negative = (*p == '-');
+      ++p;
+    }
+
+    uint64_t mantissa = 0;
+    int numDigits = 0;
+    int exponent = 0;
+    bool anyDigit = false;
+
+    while (p < end && *p >= '0' && *p <= '9') {
+      if (numDigits < 19) {
+        mantissa = mantissa * 10 + static_cast<uint64_t> (*p - '0');
+        if (mantissa) ++numDigits;
+      }
+      else
+        ++exponent;
+      anyDigit = true;
+      ++p;
+    }
+
+    if (p < end && *p == '.') {
+      ++p;
+      while (p < end && *p >= '0' && *p <= '9') {
+        if (numDigits < 19) {
+          mantissa = mantissa * 10 + static_cast<uint64_t> (*p - '0');
+          if (mantissa) ++numDigits;
+          --exponent;
+        }
+        anyDigit = true;
+        ++p;
+      }
+    }
+
+    if (!anyDigit)
+      return NULL;
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+      const char* q = p + 1;
+      bool negExp = false;
+      if (q < end && (*q == '-' || *q == '+')) {
+        negExp = (*q == '-');
+        ++q;
+      }
+      if (q < end && *q >= '0' && *q <= '9') {
+        int e = 0;
+        while (q < end && *q >= '0' && *q <= '9') {
+          if (e < 10000) e = e * 10 + (*q - '0');
+          ++q;
+        }
+        exponent += negExp ? -e : e;
+        p = q;
+      }
+    }
+
+    double v = static_cast<double> (mantissa);
+    while (exponent > 22)   {v *= 1e22; exponent -= 22;}
+    while (exponent < -22)  {v /= 1e22; exponent += 22;}
+    v = exponent >= 0 ? v * powersOf10[exponent] : v / powersOf10[-exponent];
+
+    value = negative ? -v : v;
+    return p;
+  }
+
+  // data lines of one line aligned chunk of the body and the faces parsed from it
+  struct Chunk {
+    const char* begin;
+    const char* end;
+    size_t      firstLine;    // index of the first data line in the chunk
+    size_t      numLines;
+    size_t      firstFace;
+    std::vector<uint32_t> faceSizes;
+    std::vector<uint32_t> faceVrts;
+  };
+}// end of namespace off_reader_impl
+
+
+template <class TNumberContainer, class TIndexContainer1, class TIndexContainer2>
+bool ReadOffFile(const char* filename,
+                 TNumberContainer& coordsOut,
+                 TIndexContainer1& faceVrtsOut,
+                 TIndexContainer2& faceOffsetsOut)
+{
+  using namespace std;
+  using namespace off_reader_impl;
+  MESH_TRACE_SCOPE("ReadOffFile");
+
+  typedef typename TNumberContainer::value_type  number_t;
+  typedef typename TIndexContainer1::value_type  index_t;
+
+  coordsOut.clear();
+  faceVrtsOut.clear();
+  faceOffsetsOut.clear();
+
+  MappedFile file (filename);
+  OFF_READER_COND_THROW(!file.is_open(), "Couldnt open file " << filename);
+  OFF_READER_COND_THROW(!file.data(), "Couldnt map file " << filename);
+
+  const char* p = file.data();
+  const char* const end = p + file.size();
+
+//  header: optional comments, the keyword and the element counts
+  while (p < end && !IsDataLine (p, end))
+    p = NextLine (p, end);
+  p = SkipSpaces (p, end);
+  {
+  //  accept the keyword variants (COFF, NOFF, STOFF, ...) whose vertex lines
+  //  start with plain 3d coordinates
+    const char* k = p;
+    while (k < end && ((*k >= 'A' && *k <= 'Z') || (*k >= 'a' && *k <= 'z') || (*k >= '0' && *k <= '9')))
+      ++k;
+    OFF_READER_COND_THROW(k - p < 3 || strncmp (k - 3, "OFF", 3) != 0
+                          || memchr (p, '4', static_cast<size_t> (k - p))
+                          || memchr (p, 'n', static_cast<size_t> (k - p)),
+      "ERROR while reading from " << filename << ": missing or unsupported OFF keyword");
+    p = k;
+  }
+
+  uint64_t counts[3] = {0, 0, 0};
+  for (int i = 0; i < 3; ++i) {
+    const char* q = NULL;
+    while (p < end) {
+      q = ParseUInt (p, end, counts[i]);
+      if (q || i == 2)
+        break;
+    //  counts may follow on a later line
+      p = SkipSpaces (p, end);
+      OFF_READER_COND_THROW(p < end && *p != '\n' && *p != '#',
+        "ERROR while reading from " << filename << ": bad element counts");
+      p = NextLine (p, end);
+    }
+    OFF_READER_COND_THROW(!q && i < 2,
+      "ERROR while reading from " << filename << ": missing element counts");
+    if (q)
+      p = q;
+  }
+  p = NextLine (p, end);
+
+  const size_t numVrts = static_cast<size_t> (counts[0]);
+  const size_t numFaces = static_cast<size_t> (counts[1]);
+  const size_t numLines = numVrts + numFaces;
+
+//  split the body into line aligned chunks and count the data lines of each
+  const size_t bodySize = static_cast<size_t> (end - p);
+  const size_t numChunks = max<size_t> (1, min<size_t> (mesh_tools::num_threads() * 4,
+                                                         bodySize / (256 * 1024)));
+  vector<Chunk> chunks (numChunks);
+  {
+    const char* c = p;
+    for (size_t i = 0; i < numChunks; ++i) {
+      chunks[i].begin = c;
+      if (i + 1 == numChunks)
+        c = end;
+      else {
+        c = p + bodySize * (i + 1) / numChunks;
+        c = max (c, chunks[i].begin);
+        c = c > p && c[-1] == '\n' ? c : NextLine (c, end);
+      }
+      chunks[i].end = c;
+    }
+  }
+
+  mesh_tools::parallel_for (numChunks, [&](size_t ci) {
+    Chunk& chunk = chunks[ci];
+    chunk.numLines = 0;
+    for (const char* l = chunk.begin; l < chunk.end; l = NextLine (l, chunk.end)) {
+      if (IsDataLine (l, chunk.end))
+        ++chunk.numLines;
+    }
+  }, 1);
+
+  size_t totalLines = 0;
+  for (size_t i = 0; i < numChunks; ++i) {
+    chunks[i].firstLine = totalLines;
+    totalLines += chunks[i].numLines;
+  }
+  OFF_READER_COND_THROW(totalLines < numLines,
+    "ERROR while reading from " << filename << ": expected " << numVrts << " vertices and "
+    << numFaces << " faces, but found only " << totalLines << " lines of data");
+
+//  parse vertices straight into their final place, faces into per chunk buffers
+  coordsOut.resize (numVrts * 3);
+  vector<char> chunkError (numChunks, 0);
+
+  mesh_tools::parallel_for (numChunks, [&](size_t ci) {
+    Chunk& chunk = chunks[ci];
+    size_t line = chunk.firstLine;
+    for (const char* l = chunk.begin; l < chunk.end && line < numLines; l = NextLine (l, chunk.end)) {
+      if (!IsDataLine (l, chunk.end))
+        continue;
+
+      if (line < numVrts) {
+        const char* q = l;
+        for (size_t i = 0; i < 3; ++i) {
+          double v = 0;
+          q = q ? ParseReal (q, chunk.end, v) : NULL;
+          coordsOut[line * 3 + i] = static_cast<number_t> (v);
+        }
+        if (!q) {
+          chunkError[ci] = 1;
+          return;
+        }
+      }
+      else {
+        uint64_t degree = 0;
+        const char* q = ParseUInt (l, chunk.end, degree);
+        if (!q || degree < 3) {
+          chunkError[ci] = 1;
+          return;
+        }
+        for (uint64_t i = 0; i < degree; ++i) {
+          uint64_t vi = 0;
+          q = ParseUInt (q, chunk.end, vi);
+          if (!q || vi >= numVrts) {
+            chunkError[ci] = 1;
+            return;
+          }
+          chunk.faceVrts.push_back (static_cast<uint32_t> (vi));
+        }
+        chunk.faceSizes.push_back (static_cast<uint32_t> (degree));
+      }
+      ++line;
+    }
+  }, 1);
+
+  for (size_t i = 0; i < numChunks; ++i) {
+    OFF_READER_COND_THROW(chunkError[i],
+      "ERROR while reading from " << filename << ": malformed vertex or face in lines "
+      << chunks[i].firstLine + 1 << " to " << chunks[i].firstLine + chunks[i].numLines
+      << " of the data section");
+  }
+
+//  concatenate the faces of all chunks
+  size_t numFaceVrts = 0;
+  size_t faceCount = 0;
+  for (size_t i = 0; i < numChunks; ++i) {
+    chunks[i].firstFace = faceCount;
+    faceCount += chunks[i].faceSizes.size();
+    numFaceVrts += chunks[i].faceVrts.size();
+  }
+
+  faceVrtsOut.resize (numFaceVrts);
+  faceOffsetsOut.resize (numFaces + 1);
+  faceOffsetsOut[0] = 0;
+  {
+    size_t offset = 0;
+    for (size_t i = 0; i < numChunks; ++i) {
+      for (size_t j = 0; j < chunks[i].faceSizes.size(); ++j) {
+        offset += chunks[i].faceSizes[j];
+        faceOffsetsOut[chunks[i].firstFace + j + 1] = static_cast<index_t> (offset);
+      }
+    }
+  }
+
+  mesh_tools::parallel_for (numChunks, [&](size_t ci) {
+    const Chunk& chunk = chunks[ci];
+    copy (chunk.faceVrts.begin(), chunk.faceVrts.end(),
+          faceVrtsOut.begin() + static_cast<ptrdiff_t> (faceOffsetsOut[chunk.firstFace]));
+  }, 1);
+
+  return true;
+}
+
+} // end of namespace off_reader
+
+#endif  //__H__OFF_READER
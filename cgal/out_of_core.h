@@ -0,0 +1,635 @@
+#ifndef OUT_OF_CORE_H
+#define OUT_OF_CORE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "memory_stats.h"
+#include "parallel.h"
+#include "stl_reader.h"
+#include "stl_writer.h"
+#include "trace.h"
+#include "union_find.h"
+
+namespace mesh_tools {
+
+// Label of a face that has no segment, in tile labels and in the output.
+constexpr std::uint32_t no_segment = 0xFFFFFFFFu;
+
+struct Out_of_core_params {
+    std::size_t max_tile_faces = 1 << 20;   // faces owned by one tile, unless a single grid cell has more
+    int grid_resolution = 128;              // grid cells along the longest side of the bounding box
+    double halo = 1;                        // width of the overlap around each tile, in grid cells
+    std::uint64_t memory_budget = 0;        // bytes for the tiles segmented at once; 0 for no limit
+    std::size_t bytes_per_face = 1024;      // estimated peak memory to segment one face
+    unsigned num_workers = 0;               // tiles segmented at once; 0 for num_threads()
+    std::string work_dir = ".";             // where tiles are spilled while they wait
+};
+
+struct Out_of_core_stats {
+    std::size_t num_faces = 0;
+    std::size_t num_tiles = 0;
+    std::size_t num_halo_faces = 0;       // copies of faces in the halos of other tiles
+    std::size_t largest_tile = 0;         // faces, halo included
+    std::size_t num_tile_segments = 0;    // over all tiles, before reconciling
+    std::size_t num_segments = 0;
+    std::size_t num_unlabeled = 0;        // faces no tile gave a segment
+};
+
+namespace detail {
+
+// Cubic cells over the bounding box of the input.
+struct Tile_grid {
+    double min[3] = { 0, 0, 0 };
+    double cell = 1;
+    int dims[3] = { 1, 1, 1 };
+
+    std::size_t size() const { return static_cast<std::size_t>(dims[0]) * dims[1] * dims[2]; }
+    std::size_t index(const int* c) const { return (static_cast<std::size_t>(c[2]) * dims[1] + c[1]) * dims[0] + c[0]; }
+    int coord(double x, int axis) const {
+        const double t = (x - min[axis]) / cell;
+        return t > 0 ? static_cast<int>(std::min(t, dims[axis] - 1.0)) : 0;
+    }
+};
+
+// Box of grid cells [lo, hi) and the number of face centroids in it.
+struct Tile_box {
+    int lo[3], hi[3];
+    std::uint64_t num_faces;
+};
+
+// Global face and owning tile of a face of a tile, in the order of its stl file.
+struct Tile_face {
+    std::uint32_t face, owner;
+};
+
+// Label of a face in the tile that owns it, stored in face order per tile.
+struct Face_label {
+    std::uint32_t face, label;
+};
+
+// Face that tile `tile` labelled in its halo, owned by tile `owner`.
+struct Halo_face {
+    std::uint32_t owner, face, tile, label;
+
+    bool operator<(const Halo_face& h) const {
+        return owner < h.owner || (owner == h.owner && (face < h.face || (face == h.face && tile < h.tile)));
+    }
+};
+
+inline void triangle_centroid(const float* tri, double* c) {
+    for (int k = 0; k < 3; ++k) c[k] = (double(tri[k]) + tri[3 + k] + tri[6 + k]) / 3;
+}
+
+// Splits the occupied part of the grid kd-tree style, along the longest side
+// at the median face, until no box holds more than max_faces faces or a box
+// is a single cell. Empty boxes are dropped; the tiles come out in
+// depth-first order, so neighbouring tiles tend to have close indices.
+inline std::vector<Tile_box> split_tiles(const Tile_grid& grid, const std::vector<std::uint32_t>& counts,
+                                         std::uint64_t max_faces) {
+    std::vector<Tile_box> tiles, stack(1);
+    for (int k = 0; k < 3; ++k) {
+        stack[0].lo[k] = 0;
+        stack[0].hi[k] = grid.dims[k];
+    }
+    std::vector<std::uint64_t> slices;
+    while (!stack.empty()) {
+        Tile_box box = stack.back();
+        stack.pop_back();
+        int axis = 0;
+        for (int k = 1; k < 3; ++k)
+            if (box.hi[k] - box.lo[k] > box.hi[axis] - box.lo[axis]) axis = k;
+        const int width = box.hi[axis] - box.lo[axis];
+        slices.assign(width, 0);
+        int c[3];
+        for (c[2] = box.lo[2]; c[2] < box.hi[2]; ++c[2])
+            for (c[1] = box.lo[1]; c[1] < box.hi[1]; ++c[1])
+                for (c[0] = box.lo[0]; c[0] < box.hi[0]; ++c[0])
+                    slices[c[axis] - box.lo[axis]] += counts[grid.index(c)];
+        box.num_faces = 0;
+        for (std::uint64_t n : slices) box.num_faces += n;
+        if (box.num_faces == 0) continue;
+        if (box.num_faces <= max_faces || width == 1) {
+            tiles.push_back(box);
+            continue;
+        }
+        // Slices up to and including `split` hold at least half of the faces
+        int split = 0;
+        for (std::uint64_t below = 0; split < width - 1 && (below + slices[split]) * 2 < box.num_faces; ++split)
+            below += slices[split];
+        Tile_box upper = box;
+        box.hi[axis] = upper.lo[axis] = box.lo[axis] + std::min(split + 1, width - 1);
+        stack.push_back(upper);
+        stack.push_back(box);
+    }
+    return tiles;
+}
+
+inline bool append_to_file(const std::string& path, const void* data, std::size_t bytes) {
+    std::FILE* out = std::fopen(path.c_str(), "ab");
+    if (!out) return false;
+    const bool written = std::fwrite(data, 1, bytes, out) == bytes;
+    return std::fclose(out) == 0 && written;
+}
+
+// Sequential reader of a file of fixed size records, which can be closed and
+// reopened where it stopped, so that only one file per thread needs to be open.
+template <class Record>
+class Record_reader {
+public:
+    Record_reader(const std::string& path, std::uint64_t first) : m_in(std::fopen(path.c_str(), "rb")), m_next(first) {
+        if (!m_in || std::fseek(m_in, static_cast<long>(first * sizeof(Record)), SEEK_SET) != 0)
+            throw std::runtime_error("Couldn't read temporary file " + path);
+        m_buffer.resize(1 << 14);
+    }
+    ~Record_reader() { std::fclose(m_in); }
+
+    // Next record, or nullptr at the end of the file
+    const Record* peek() {
+        if (m_pos == m_size) {
+            m_size = std::fread(m_buffer.data(), sizeof(Record), m_buffer.size(), m_in);
+            m_pos = 0;
+            if (m_size == 0) return nullptr;
+        }
+        return &m_buffer[m_pos];
+    }
+    void pop() {
+        ++m_pos;
+        ++m_next;
+    }
+    // Records consumed since the start of the file
+    std::uint64_t position() const { return m_next; }
+
+private:
+    Record_reader(const Record_reader&) = delete;
+    Record_reader& operator=(const Record_reader&) = delete;
+
+    std::FILE* m_in;
+    std::vector<Record> m_buffer;
+    std::size_t m_pos = 0, m_size = 0;
+    std::uint64_t m_next;
+};
+
+// Removes the spilled files however the run ends.
+struct Temporary_files {
+    std::vector<std::string> paths;
+
+    ~Temporary_files() {
+        for (const std::string& path : paths) std::remove(path.c_str());
+    }
+};
+
+} // namespace detail
+
+// Segments a binary STL file that may be too large to be held in memory as a
+// mesh, and writes one little-endian uint32 label per input face, in input
+// order, to labels_output; faces without a segment get no_segment.
+//
+// The input is streamed three times with stl_reader::StlBinaryStream: for
+// the bounding box, for a histogram of face centroids over a grid, and to
+// spill every face to the tile that owns its centroid and to every other tile
+// whose box, grown by the halo, contains it. Tiles come from a median split
+// of the histogram and own at most max_tile_faces faces each. Every tile is
+// segmented on its own by
+//
+//     std::size_t segment_tile(const std::string& tile_stl, std::size_t num_faces, std::uint32_t* labels)
+//
+// which loads the tile, writes a label below its return value, or no_segment,
+// for each of its faces in file order and returns the number of segments. A
+// pool of num_workers threads, however many cores there are, segments the
+// largest tiles first and only starts a tile while the estimated memory of
+// all tiles in flight stays within memory_budget, so segment_tile must be
+// safe to call from several threads. The parallel loops inside segment_tile
+// share the cores, num_threads() / num_workers for each worker.
+//
+// Segments of different tiles are then joined through the faces they share:
+// a union-find over all tile segments unites each segment with the segment
+// of the owning tile that labelled the majority of its halo faces. Only sets
+// with faces in their own tile become output segments, numbered in tile
+// order. The labels are written in windows of faces, gathered from the tiles
+// in a merge over their face-sorted records. Memory apart from the tiles
+// being segmented is bounded by the histogram, the halo faces and one
+// window. Returns false, with a message on std::cerr, on I/O errors.
+template <class SegmentTile>
+bool segment_out_of_core(const std::string& input, const std::string& labels_output, SegmentTile segment_tile,
+                         const Out_of_core_params& params = Out_of_core_params(),
+                         Out_of_core_stats* stats = nullptr) {
+    MESH_TRACE_SCOPE("segment_out_of_core");
+    Out_of_core_stats local_stats;
+    Out_of_core_stats& st = stats ? *stats : local_stats;
+    st = Out_of_core_stats();
+    detail::Temporary_files temporary;
+    const std::string prefix = params.work_dir + "/ooc_tile_";
+
+    try {
+        stl_reader::StlBinaryStream<float> stream;
+        stream.open(input);
+        if (stream.num_tris() > std::numeric_limits<std::uint32_t>::max() - 1)
+            throw std::runtime_error("Too many faces for 32 bit face indices in " + input);
+        const std::uint32_t num_faces = static_cast<std::uint32_t>(stream.num_tris());
+        const std::size_t chunk = stl_reader::StlBinaryStream<float>::chunk_size();
+        counted_vector<float> coords(chunk * 9);
+        st.num_faces = num_faces;
+
+        detail::Tile_grid grid;
+        {
+            MESH_TRACE_SCOPE("bounding box");
+            double lo[3], hi[3];
+            std::fill(lo, lo + 3, std::numeric_limits<double>::max());
+            std::fill(hi, hi + 3, std::numeric_limits<double>::lowest());
+            while (std::size_t n = stream.read(chunk, coords.data())) {
+                for (std::size_t i = 0; i < n * 3; ++i) {
+                    for (int k = 0; k < 3; ++k) {
+                        lo[k] = std::min<double>(lo[k], coords[i * 3 + k]);
+                        hi[k] = std::max<double>(hi[k], coords[i * 3 + k]);
+                    }
+                }
+            }
+            double longest = 0;
+            for (int k = 0; k < 3; ++k) {
+                if (lo[k] > hi[k]) lo[k] = hi[k] = 0;
+                longest = std::max(longest, hi[k] - lo[k]);
+            }
+            const int resolution = std::max(1, params.grid_resolution);
+            grid.cell = longest > 0 ? longest / resolution : 1;
+            for (int k = 0; k < 3; ++k) {
+                grid.min[k] = lo[k];
+                grid.dims[k] = std::min(resolution, std::max(1, static_cast<int>(std::ceil((hi[k] - lo[k]) / grid.cell))));
+            }
+        }
+
+        // Face cell of every face of a chunk, in parallel
+        counted_vector<std::uint32_t> face_cell(chunk);
+        auto chunk_cells = [&](std::size_t n) {
+            parallel_for(n, [&](std::size_t i) {
+                double c[3];
+                detail::triangle_centroid(&coords[i * 9], c);
+                int cell[3];
+                for (int k = 0; k < 3; ++k) cell[k] = grid.coord(c[k], k);
+                face_cell[i] = static_cast<std::uint32_t>(grid.index(cell));
+            });
+        };
+
+        std::vector<std::uint32_t> counts(grid.size(), 0);
+        {
+            MESH_TRACE_SCOPE("centroid histogram");
+            stream.rewind();
+            while (std::size_t n = stream.read(chunk, coords.data())) {
+                chunk_cells(n);
+                for (std::size_t i = 0; i < n; ++i) ++counts[face_cell[i]];
+            }
+        }
+
+        std::uint64_t max_tile_faces = std::max<std::size_t>(1, params.max_tile_faces);
+        if (params.memory_budget > 0)
+            max_tile_faces = std::min<std::uint64_t>(max_tile_faces,
+                std::max<std::uint64_t>(1, params.memory_budget / std::max<std::size_t>(1, params.bytes_per_face)));
+        const std::vector<detail::Tile_box> tiles = detail::split_tiles(grid, counts, max_tile_faces);
+        std::vector<std::uint32_t>().swap(counts);
+        const std::size_t num_tiles = tiles.size();
+        st.num_tiles = num_tiles;
+
+        std::vector<std::uint32_t> cell_tile(grid.size(), no_segment);
+        for (std::size_t t = 0; t < num_tiles; ++t) {
+            int c[3];
+            for (c[2] = tiles[t].lo[2]; c[2] < tiles[t].hi[2]; ++c[2])
+                for (c[1] = tiles[t].lo[1]; c[1] < tiles[t].hi[1]; ++c[1])
+                    for (c[0] = tiles[t].lo[0]; c[0] < tiles[t].hi[0]; ++c[0])
+                        cell_tile[grid.index(c)] = static_cast<std::uint32_t>(t);
+        }
+        auto stl_path = [&](std::size_t t) { return prefix + std::to_string(t) + ".stl"; };
+        auto ids_path = [&](std::size_t t) { return prefix + std::to_string(t) + ".ids"; };
+        auto owned_path = [&](std::size_t t) { return prefix + std::to_string(t) + ".owned"; };
+
+        // Spill every face to its owner and to the tiles whose halo contains it
+        std::vector<std::uint32_t> tile_faces(num_tiles, 0);
+        {
+            MESH_TRACE_SCOPE("partition tiles");
+            struct Tile_buffer {
+                std::vector<char> records;
+                std::vector<detail::Tile_face> faces;
+            };
+            std::vector<Tile_buffer> buffers(num_tiles);
+            // About 64 MB of buffers in all
+            const std::size_t capacity = std::max<std::size_t>(256, std::min<std::size_t>(1 << 16,
+                (std::size_t(64) << 20) / (std::max<std::size_t>(1, num_tiles) * 58)));
+            const char header[84] = {};
+            for (std::size_t t = 0; t < num_tiles; ++t) {
+                temporary.paths.push_back(stl_path(t));
+                temporary.paths.push_back(ids_path(t));
+                temporary.paths.push_back(owned_path(t));
+                std::remove(ids_path(t).c_str());
+                std::remove(owned_path(t).c_str());
+                std::FILE* out = std::fopen(stl_path(t).c_str(), "wb");
+                const bool written = out && std::fwrite(header, 1, 84, out) == 84;
+                if (!out || std::fclose(out) != 0 || !written)
+                    throw std::runtime_error("Couldn't create tile file " + stl_path(t));
+            }
+            auto flush = [&](std::size_t t) {
+                Tile_buffer& buffer = buffers[t];
+                if (!detail::append_to_file(stl_path(t), buffer.records.data(), buffer.records.size()) ||
+                    !detail::append_to_file(ids_path(t), buffer.faces.data(),
+                                            buffer.faces.size() * sizeof(detail::Tile_face)))
+                    throw std::runtime_error("Couldn't write tile file " + stl_path(t));
+                buffer.records.clear();
+                buffer.faces.clear();
+            };
+            auto add = [&](std::size_t t, const float* tri, std::uint32_t face, std::uint32_t owner) {
+                Tile_buffer& buffer = buffers[t];
+                float record[12];
+                std::copy(tri, tri + 9, record + 3);
+                stl_writer::stl_writer_impl::TriNormal(record + 3, record + 6, record + 9, record);
+                const std::size_t offset = buffer.records.size();
+                buffer.records.resize(offset + 50, 0);
+                std::memcpy(&buffer.records[offset], record, 48);
+                buffer.faces.push_back({ face, owner });
+                ++tile_faces[t];
+                if (buffer.faces.size() >= capacity) flush(t);
+            };
+
+            const double halo = std::max(0.0, params.halo) * grid.cell;
+            const int reach = static_cast<int>(std::ceil(std::max(0.0, params.halo)));
+            std::vector<std::uint32_t> near;
+            stream.rewind();
+            std::uint32_t first = 0;
+            while (std::size_t n = stream.read(chunk, coords.data())) {
+                chunk_cells(n);
+                for (std::size_t i = 0; i < n; ++i) {
+                    const std::uint32_t face = first + static_cast<std::uint32_t>(i);
+                    const float* tri = &coords[i * 9];
+                    const std::uint32_t owner = cell_tile[face_cell[i]];
+                    add(owner, tri, face, owner);
+                    if (halo <= 0) continue;
+
+                    // Only faces within the halo width of their own box can be in another
+                    double c[3];
+                    detail::triangle_centroid(tri, c);
+                    const detail::Tile_box& own = tiles[owner];
+                    bool inside = true;
+                    int cell[3];
+                    for (int k = 0; k < 3; ++k) {
+                        cell[k] = grid.coord(c[k], k);
+                        inside = inside && c[k] - halo >= grid.min[k] + own.lo[k] * grid.cell &&
+                                 c[k] + halo < grid.min[k] + own.hi[k] * grid.cell;
+                    }
+                    if (inside) continue;
+                    near.clear();
+                    int d[3];
+                    for (d[2] = std::max(0, cell[2] - reach); d[2] <= std::min(grid.dims[2] - 1, cell[2] + reach); ++d[2])
+                        for (d[1] = std::max(0, cell[1] - reach); d[1] <= std::min(grid.dims[1] - 1, cell[1] + reach); ++d[1])
+                            for (d[0] = std::max(0, cell[0] - reach); d[0] <= std::min(grid.dims[0] - 1, cell[0] + reach); ++d[0]) {
+                                const std::uint32_t t = cell_tile[grid.index(d)];
+                                if (t != no_segment && t != owner && std::find(near.begin(), near.end(), t) == near.end())
+                                    near.push_back(t);
+                            }
+                    for (std::uint32_t t : near) {
+                        bool in_halo = true;
+                        for (int k = 0; k < 3 && in_halo; ++k)
+                            in_halo = c[k] >= grid.min[k] + tiles[t].lo[k] * grid.cell - halo &&
+                                      c[k] <= grid.min[k] + tiles[t].hi[k] * grid.cell + halo;
+                        if (in_halo) {
+                            add(t, tri, face, owner);
+                            ++st.num_halo_faces;
+                        }
+                    }
+                }
+                first += static_cast<std::uint32_t>(n);
+            }
+            stream.close();
+            for (std::size_t t = 0; t < num_tiles; ++t) {
+                flush(t);
+                std::FILE* out = std::fopen(stl_path(t).c_str(), "r+b");
+                const bool written = out && std::fseek(out, 80, SEEK_SET) == 0 &&
+                                     std::fwrite(&tile_faces[t], 4, 1, out) == 1;
+                if (!out || std::fclose(out) != 0 || !written)
+                    throw std::runtime_error("Couldn't write tile file " + stl_path(t));
+                st.largest_tile = std::max<std::size_t>(st.largest_tile, tile_faces[t]);
+            }
+        }
+
+        // Segment the tiles, largest first, while their estimates fit in the budget
+        std::vector<std::uint32_t> tile_segments(num_tiles, 0);
+        std::vector<std::vector<std::uint8_t>> has_owned_faces(num_tiles);
+        std::vector<detail::Halo_face> halo_faces;
+        halo_faces.reserve(st.num_halo_faces);
+        {
+            MESH_TRACE_SCOPE("segment tiles");
+            std::vector<std::uint32_t> order(num_tiles);
+            for (std::size_t t = 0; t < num_tiles; ++t) order[t] = static_cast<std::uint32_t>(t);
+            std::stable_sort(order.begin(), order.end(),
+                             [&](std::uint32_t a, std::uint32_t b) { return tile_faces[a] > tile_faces[b]; });
+
+            std::mutex mutex;
+            std::condition_variable admitted;
+            std::uint64_t in_flight = 0;
+            std::atomic<std::size_t> next(0);
+            const unsigned num_workers = static_cast<unsigned>(std::min<std::size_t>(
+                std::max<std::size_t>(1, num_tiles), params.num_workers > 0 ? params.num_workers : num_threads()));
+
+            Thread_limit_scope per_tile(std::max(1u, num_threads() / num_workers));
+            run_on_threads(num_workers, [&](std::size_t) {
+                for (std::size_t i = next++; i < num_tiles; i = next++) {
+                    const std::uint32_t t = order[i];
+                    const std::uint64_t cost = std::uint64_t(tile_faces[t]) * params.bytes_per_face;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        admitted.wait(lock, [&] {
+                            return in_flight == 0 || params.memory_budget == 0 || in_flight + cost <= params.memory_budget;
+                        });
+                        in_flight += cost;
+                    }
+                    struct Release {
+                        std::mutex& mutex;
+                        std::condition_variable& admitted;
+                        std::uint64_t& in_flight;
+                        std::uint64_t cost;
+                        ~Release() {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            in_flight -= cost;
+                            admitted.notify_all();
+                        }
+                    } release{ mutex, admitted, in_flight, cost };
+
+                    counted_vector<std::uint32_t> labels(tile_faces[t], no_segment);
+                    const std::size_t num_segments = segment_tile(stl_path(t), labels.size(), labels.data());
+                    std::remove(stl_path(t).c_str());
+
+                    std::vector<detail::Tile_face> faces(tile_faces[t]);
+                    std::FILE* in = std::fopen(ids_path(t).c_str(), "rb");
+                    const bool read = in && std::fread(faces.data(), sizeof(detail::Tile_face), faces.size(), in) == faces.size();
+                    if (in) std::fclose(in);
+                    std::remove(ids_path(t).c_str());
+                    if (!read) throw std::runtime_error("Couldn't read tile file " + ids_path(t));
+
+                    // Owned faces go back to disk as (face, label) pairs, halo faces are kept
+                    std::vector<std::uint8_t> owned(num_segments, 0);
+                    std::vector<detail::Face_label> records;
+                    std::vector<detail::Halo_face> halo;
+                    records.reserve(faces.size());
+                    for (std::size_t f = 0; f < faces.size(); ++f) {
+                        const std::uint32_t label = labels[f];
+                        if (label != no_segment && label >= num_segments)
+                            throw std::runtime_error("Tile segmentation returned an invalid label");
+                        if (faces[f].owner == t) {
+                            records.push_back({ faces[f].face, label });
+                            if (label != no_segment) owned[label] = 1;
+                        } else if (label != no_segment) {
+                            halo.push_back({ faces[f].owner, faces[f].face, t, label });
+                        }
+                    }
+                    if (!detail::append_to_file(owned_path(t), records.data(), records.size() * sizeof(detail::Face_label)))
+                        throw std::runtime_error("Couldn't write tile file " + owned_path(t));
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    tile_segments[t] = static_cast<std::uint32_t>(num_segments);
+                    has_owned_faces[t].swap(owned);
+                    halo_faces.insert(halo_faces.end(), halo.begin(), halo.end());
+                }
+            });
+        }
+
+        // Global numbering of the tile segments
+        std::vector<std::uint64_t> first_label(num_tiles + 1, 0);
+        for (std::size_t t = 0; t < num_tiles; ++t) first_label[t + 1] = first_label[t] + tile_segments[t];
+        const std::uint64_t num_labels = first_label[num_tiles];
+        if (num_labels >= no_segment) throw std::runtime_error("Too many tile segments");
+        st.num_tile_segments = static_cast<std::size_t>(num_labels);
+
+        Concurrent_union_find segments(static_cast<std::size_t>(num_labels));
+        counted_vector<std::uint32_t> final_label;
+        std::uint32_t num_segments = 0;
+        {
+            MESH_TRACE_SCOPE("reconcile halos");
+            // Pairs (halo segment, owner segment) from a merge of the sorted halo
+            // faces with the face-sorted records of their owners
+            std::sort(halo_faces.begin(), halo_faces.end());
+            std::vector<std::pair<std::uint32_t, std::uint32_t>> pairs;
+            pairs.reserve(halo_faces.size());
+            for (std::size_t i = 0; i < halo_faces.size();) {
+                const std::uint32_t owner = halo_faces[i].owner;
+                detail::Record_reader<detail::Face_label> records(owned_path(owner), 0);
+                for (; i < halo_faces.size() && halo_faces[i].owner == owner; ++i) {
+                    const detail::Halo_face& h = halo_faces[i];
+                    const detail::Face_label* r;
+                    while ((r = records.peek()) && r->face < h.face) records.pop();
+                    if (r && r->face == h.face && r->label != no_segment)
+                        pairs.push_back({ static_cast<std::uint32_t>(first_label[h.tile] + h.label),
+                                          static_cast<std::uint32_t>(first_label[owner] + r->label) });
+                }
+            }
+            std::vector<detail::Halo_face>().swap(halo_faces);
+
+            // Two segments of different tiles are joined when each of them has
+            // most of its overlap with the other tile on the other one. Faces
+            // of both halos count, so the relation is symmetric, and a segment
+            // that only touches the halo of a neighbour is not pulled in.
+            std::vector<std::uint32_t> label_tile(static_cast<std::size_t>(num_labels));
+            for (std::size_t t = 0; t < num_tiles; ++t)
+                std::fill(label_tile.begin() + first_label[t], label_tile.begin() + first_label[t + 1],
+                          static_cast<std::uint32_t>(t));
+            for (std::pair<std::uint32_t, std::uint32_t>& pair : pairs)
+                if (pair.first > pair.second) std::swap(pair.first, pair.second);
+            std::sort(pairs.begin(), pairs.end());
+            struct Match {
+                std::size_t overlap;
+                std::uint32_t a, b;
+            };
+            std::vector<Match> matches;
+            for (std::size_t i = 0; i < pairs.size();) {
+                const std::size_t begin = i;
+                while (i < pairs.size() && pairs[i] == pairs[begin]) ++i;
+                matches.push_back({ i - begin, pairs[begin].first, pairs[begin].second });
+            }
+            // Overlap of each segment with each other tile, sorted by (segment, tile)
+            struct Overlap {
+                std::uint32_t segment, tile;
+                std::size_t faces;
+                bool operator<(const Overlap& o) const { return segment < o.segment || (segment == o.segment && tile < o.tile); }
+            };
+            std::vector<Overlap> overlaps;
+            overlaps.reserve(matches.size() * 2);
+            for (const Match& match : matches) {
+                overlaps.push_back({ match.a, label_tile[match.b], match.overlap });
+                overlaps.push_back({ match.b, label_tile[match.a], match.overlap });
+            }
+            std::sort(overlaps.begin(), overlaps.end());
+            std::size_t out = 0;
+            for (std::size_t i = 0; i < overlaps.size(); ++i) {
+                if (out > 0 && !(overlaps[out - 1] < overlaps[i])) overlaps[out - 1].faces += overlaps[i].faces;
+                else overlaps[out++] = overlaps[i];
+            }
+            overlaps.resize(out);
+            auto overlap = [&](std::uint32_t segment, std::uint32_t tile) {
+                const Overlap key = { segment, tile, 0 };
+                return std::lower_bound(overlaps.begin(), overlaps.end(), key)->faces;
+            };
+            matches.erase(std::remove_if(matches.begin(), matches.end(), [&](const Match& m) {
+                return m.overlap * 2 < overlap(m.a, label_tile[m.b]) || m.overlap * 2 < overlap(m.b, label_tile[m.a]);
+            }), matches.end());
+            for (const Match& match : matches) segments.unite(match.a, match.b);
+
+            counted_vector<std::uint8_t> root_has_owned(static_cast<std::size_t>(num_labels), 0);
+            for (std::size_t t = 0; t < num_tiles; ++t)
+                for (std::uint32_t s = 0; s < tile_segments[t]; ++s)
+                    if (has_owned_faces[t][s])
+                        root_has_owned[segments.find(static_cast<std::uint32_t>(first_label[t] + s))] = 1;
+            final_label.assign(static_cast<std::size_t>(num_labels), no_segment);
+            for (std::uint32_t s = 0; s < num_labels; ++s)
+                if (segments.is_root(s) && root_has_owned[s]) final_label[s] = num_segments++;
+            st.num_segments = num_segments;
+        }
+
+        {
+            MESH_TRACE_SCOPE("write labels");
+            std::FILE* out = std::fopen(labels_output.c_str(), "wb");
+            if (!out) throw std::runtime_error("Couldn't open " + labels_output + " for writing");
+            const std::size_t window = std::size_t(1) << 22;
+            counted_vector<std::uint32_t> labels(std::min<std::size_t>(window, num_faces));
+            std::vector<std::uint64_t> position(num_tiles, 0);
+            std::vector<std::uint32_t> next_face(num_tiles, 0);
+            bool written = true;
+            for (std::uint64_t begin = 0; begin < num_faces && written; begin += window) {
+                const std::uint32_t end = static_cast<std::uint32_t>(std::min<std::uint64_t>(num_faces, begin + window));
+                std::fill(labels.begin(), labels.end(), no_segment);
+                for (std::size_t t = 0; t < num_tiles; ++t) {
+                    if (next_face[t] >= end) continue;
+                    detail::Record_reader<detail::Face_label> records(owned_path(t), position[t]);
+                    const detail::Face_label* r;
+                    for (; (r = records.peek()) && r->face < end; records.pop())
+                        if (r->label != no_segment)
+                            labels[r->face - begin] = final_label[segments.find(static_cast<std::uint32_t>(first_label[t] + r->label))];
+                    position[t] = records.position();
+                    next_face[t] = r ? r->face : no_segment;
+                }
+                const std::size_t n = end - begin;
+                st.num_unlabeled += std::count(labels.begin(), labels.begin() + n, no_segment);
+                written = std::fwrite(labels.data(), sizeof(std::uint32_t), n, out) == n;
+            }
+            if (std::fclose(out) != 0 || !written)
+                throw std::runtime_error("Error while writing " + labels_output);
+        }
+    } catch (const memory::Budget_exceeded&) {
+        throw;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace mesh_tools
+
+#endif // OUT_OF_CORE_H
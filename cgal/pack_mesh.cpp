@@ -0,0 +1,80 @@
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "mesh_pack.h"        // for WriteMeshPack, ReadMeshPack
+#include "off_reader.h"
+#include "stl_reader.h"
+
+static double file_size(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? static_cast<double>(st.st_size) : 0;
+}
+
+// Converts an STL or OFF file to a mesh pack and reports the size against the
+// equivalent binary STL and the decode speed of the written pack.
+int main(int argc, char** argv) {
+    if (argc != 3 && !(argc == 5 && std::string(argv[3]) == "--bits")) {
+        std::cerr << "Usage: pack_mesh <input.stl|input.off> <output.mpk> [--bits <1-31>]\n";
+        return 1;
+    }
+    const std::string input = argv[1];
+    const char* output = argv[2];
+
+    mesh_pack::PackOptions options;
+    if (argc == 5) options.positionBits = static_cast<unsigned>(std::stoul(argv[4]));
+
+    std::vector<float> coords, normals;
+    std::vector<unsigned> tris, solids;
+    try {
+        const std::string ext = input.size() >= 4 ? input.substr(input.size() - 4) : std::string();
+        if (ext == ".off" || ext == ".OFF") {
+            // Polygons are fanned around their first corner
+            std::vector<unsigned> face_vrts, face_offsets;
+            off_reader::ReadOffFile(input.c_str(), coords, face_vrts, face_offsets);
+            for (std::size_t f = 0; f + 1 < face_offsets.size(); ++f) {
+                for (unsigned c = face_offsets[f] + 1; c + 1 < face_offsets[f + 1]; ++c) {
+                    tris.push_back(face_vrts[face_offsets[f]]);
+                    tris.push_back(face_vrts[c]);
+                    tris.push_back(face_vrts[c + 1]);
+                }
+            }
+        } else {
+            stl_reader::ReadStlFile(input.c_str(), coords, normals, tris, solids);
+        }
+        mesh_pack::WriteMeshPack(output, coords, tris, solids, options);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+    // Decode the pack a few times and keep the fastest run
+    double best_seconds = 0;
+    try {
+        for (int run = 0; run < 5; ++run) {
+            const auto start = std::chrono::steady_clock::now();
+            mesh_pack::ReadMeshPack(output, coords, normals, tris, solids);
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (run == 0 || seconds < best_seconds) best_seconds = seconds;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: cannot read back '" << output << "': " << e.what() << "\n";
+        return 1;
+    }
+
+    const double num_tris = static_cast<double>(tris.size() / 3);
+    const double stl_bytes = 84 + 50 * num_tris;
+    const double pack_bytes = file_size(output);
+    const double decoded_bytes = static_cast<double>((coords.size() + normals.size()) * sizeof(float) +
+                                                     tris.size() * sizeof(unsigned));
+    std::printf("%s: %zu vertices, %zu triangles\n", output, coords.size() / 3, tris.size() / 3);
+    std::printf("size %.0f bytes, %.2fx smaller than binary STL (%.0f bytes), %.2f bytes/triangle\n",
+                pack_bytes, stl_bytes / pack_bytes, stl_bytes, pack_bytes / num_tris);
+    std::printf("decode %.3f ms, %.2f GB/s decoded arrays, %.2f GB/s binary STL equivalent\n",
+                best_seconds * 1e3, decoded_bytes / best_seconds * 1e-9, stl_bytes / best_seconds * 1e-9);
+    return 0;
+}
@@ -0,0 +1,178 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "memory_stats.h"
+#include "trace.h"
+
+namespace mesh_tools {
+
+namespace detail {
+
+inline unsigned& thread_limit() {
+    static unsigned limit = 0;
+    return limit;
+}
+
+} // namespace detail
+
+// Caps the threads of the parallel loops below, e.g. in one of several
+// processes sharing the machine; 0 restores the hardware concurrency.
+inline void set_num_threads(unsigned n) { detail::thread_limit() = n; }
+
+// Number of worker threads used by the parallel loops below.
+inline unsigned num_threads() {
+    if (detail::thread_limit() > 0) return detail::thread_limit();
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+// Sets the thread cap for its lifetime and restores the previous one after,
+// e.g. to share the cores among workers that each run parallel loops.
+class Thread_limit_scope {
+public:
+    explicit Thread_limit_scope(unsigned n) : m_previous(detail::thread_limit()) { set_num_threads(n); }
+    ~Thread_limit_scope() { set_num_threads(m_previous); }
+
+private:
+    Thread_limit_scope(const Thread_limit_scope&) = delete;
+    Thread_limit_scope& operator=(const Thread_limit_scope&) = delete;
+
+    unsigned m_previous;
+};
+
+// Splits [0, n) into contiguous chunks and calls fn(begin, end) for each chunk
+// on its own thread. Small ranges run inline on the calling thread. The first
+// exception thrown by any chunk is rethrown once all threads have joined.
+template <class Fn>
+void parallel_for_chunks(std::size_t n, Fn fn, std::size_t min_chunk = 4096) {
+    const std::size_t max_chunks = (n + min_chunk - 1) / std::max<std::size_t>(min_chunk, 1);
+    const std::size_t num_chunks = std::min<std::size_t>(num_threads(), max_chunks);
+    if (num_chunks <= 1) {
+        if (n > 0) fn(std::size_t(0), n);
+        return;
+    }
+
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    std::vector<std::thread> threads;
+    threads.reserve(num_chunks - 1);
+
+    memory::Stage_stats* stage = memory::current_stage();
+    auto run = [&](std::size_t begin, std::size_t end) {
+        MESH_TRACE_SCOPE("parallel chunk");
+        memory::Stage_inherit inherit(stage);
+        try {
+            fn(begin, end);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) error = std::current_exception();
+        }
+    };
+
+    const std::size_t chunk = (n + num_chunks - 1) / num_chunks;
+    for (std::size_t c = 1; c < num_chunks; ++c) {
+        const std::size_t begin = c * chunk;
+        const std::size_t end = std::min(n, begin + chunk);
+        if (begin < end) threads.emplace_back(run, begin, end);
+    }
+    run(0, std::min(n, chunk));
+
+    for (std::thread& t : threads) t.join();
+    if (error) std::rethrow_exception(error);
+}
+
+// Calls fn(t) for every t in [0, n), each on a thread of its own (t = 0 on the
+// calling thread), however many threads num_threads() allows: for a number of
+// workers the user asked for, which may mostly wait. Exceptions are handled
+// as by parallel_for_chunks.
+template <class Fn>
+void run_on_threads(std::size_t n, Fn fn) {
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    std::vector<std::thread> threads;
+    threads.reserve(n > 0 ? n - 1 : 0);
+
+    memory::Stage_stats* stage = memory::current_stage();
+    auto run = [&](std::size_t t) {
+        MESH_TRACE_SCOPE("worker thread");
+        memory::Stage_inherit inherit(stage);
+        try {
+            fn(t);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) error = std::current_exception();
+        }
+    };
+
+    for (std::size_t t = 1; t < n; ++t) threads.emplace_back(run, t);
+    if (n > 0) run(0);
+
+    for (std::thread& t : threads) t.join();
+    if (error) std::rethrow_exception(error);
+}
+
+// Calls fn(i) for every i in [0, n), distributing the indices over threads.
+template <class Fn>
+void parallel_for(std::size_t n, Fn fn, std::size_t min_chunk = 4096) {
+    parallel_for_chunks(n, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) fn(i);
+    }, min_chunk);
+}
+
+// Calls fn(begin, end, out) for contiguous chunks of [0, n) in parallel,
+// each chunk pushing its items to a vector of its own, and appends these to
+// result in chunk order. The items thus come out in the order of a serial
+// loop over [0, n), whatever the number of threads.
+template <class Container, class Fn>
+void parallel_gather(std::size_t n, Container& result, Fn fn, std::size_t min_chunk = 65536) {
+    typedef typename Container::value_type Item;
+    const std::size_t num_chunks = std::max<std::size_t>(1, std::min<std::size_t>(num_threads(), n / std::max<std::size_t>(min_chunk, 1)));
+    const std::size_t chunk = (n + num_chunks - 1) / num_chunks;
+    std::vector<std::vector<Item>> per_chunk(num_chunks);
+    parallel_for(num_chunks, [&](std::size_t c) {
+        fn(std::min(n, c * chunk), std::min(n, (c + 1) * chunk), per_chunk[c]);
+    }, 1);
+    std::size_t total = result.size();
+    for (const std::vector<Item>& part : per_chunk) total += part.size();
+    result.reserve(total);
+    for (const std::vector<Item>& part : per_chunk) result.insert(result.end(), part.begin(), part.end());
+}
+
+// Sorts keys with one chunk per thread, then merges the chunks pairwise.
+// With a strict total order the result does not depend on the thread count.
+template <class T, class Less>
+void parallel_sort(std::vector<T>& keys, Less less) {
+    const std::size_t n = keys.size();
+    const std::size_t num_chunks = std::max<std::size_t>(1, std::min<std::size_t>(num_threads(), n / 4096));
+    std::vector<std::size_t> bounds(num_chunks + 1);
+    for (std::size_t c = 0; c <= num_chunks; ++c) bounds[c] = n * c / num_chunks;
+    parallel_for(num_chunks, [&](std::size_t c) {
+        std::sort(keys.begin() + bounds[c], keys.begin() + bounds[c + 1], less);
+    }, 1);
+    for (std::size_t width = 1; width < num_chunks; width *= 2) {
+        parallel_for((num_chunks + 2 * width - 1) / (2 * width), [&](std::size_t pair) {
+            const std::size_t first = pair * 2 * width;
+            const std::size_t middle = std::min(num_chunks, first + width);
+            const std::size_t last = std::min(num_chunks, first + 2 * width);
+            std::inplace_merge(keys.begin() + bounds[first], keys.begin() + bounds[middle],
+                               keys.begin() + bounds[last], less);
+        }, 1);
+    }
+}
+
+template <class T>
+void parallel_sort(std::vector<T>& keys) {
+    parallel_sort(keys, std::less<T>());
+}
+
+} // namespace mesh_tools
+
+#endif // PARALLEL_H
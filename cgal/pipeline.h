@@ -0,0 +1,216 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "memory_stats.h"
+#include "trace.h"
+
+namespace mesh_tools {
+
+// FIFO of at most capacity items between two threads. push() blocks while
+// the queue is full and pop() while it is empty; after close(), push() fails
+// and pop() drains what is left before it fails as well.
+template <class T>
+class Bounded_queue {
+public:
+    explicit Bounded_queue(std::size_t capacity) : m_capacity(std::max<std::size_t>(capacity, 1)) {}
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_full.wait(lock, [&]() { return m_closed || m_items.size() < m_capacity; });
+        if (m_closed) return false;
+        m_items.push_back(std::move(item));
+        m_not_empty.notify_one();
+        return true;
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_empty.wait(lock, [&]() { return m_closed || !m_items.empty(); });
+        if (m_items.empty()) return false;
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        m_not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_not_full.notify_all();
+        m_not_empty.notify_all();
+    }
+
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_items.size();
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    std::condition_variable m_not_full, m_not_empty;
+    std::deque<T> m_items;
+    std::size_t m_capacity;
+    bool m_closed = false;
+};
+
+struct Pipeline_stage_stats {
+    std::string name;
+    std::size_t num_items = 0;      // items the stage was called with
+    std::size_t num_dropped = 0;    // of which the stage rejected
+    double busy_seconds = 0;        // summed over the stage's threads
+};
+
+// Passes items through a fixed sequence of stages. Every stage has its own
+// threads and reads from a bounded queue filled by the stage before it, so
+// the stages work on different items at the same time, while the number of
+// items in flight, and with it the memory they hold, stays bounded: a full
+// queue stalls the stage before it, back to push(). An item leaves the
+// pipeline after the last stage or when a stage returns false for it.
+//
+// Items are moved from stage to stage, so Item is typically a unique_ptr to
+// the state of one job. An exception escaping a stage stops the pipeline;
+// the first one is rethrown by finish().
+template <class Item>
+class Pipeline {
+public:
+    typedef std::function<bool(Item&)> Stage_fn;
+
+    explicit Pipeline(std::size_t queue_capacity = 2) : m_queue_capacity(queue_capacity) {}
+    ~Pipeline() {
+        try {
+            finish();
+        } catch (...) {
+        }
+    }
+
+    // Appends a stage run by num_threads threads; only before start(). The
+    // name is kept for tracing, so it has to be a string literal.
+    void add_stage(const char* name, Stage_fn fn, unsigned num_threads = 1) {
+        Stage stage;
+        stage.name = name;
+        stage.fn = fn;
+        stage.num_threads = std::max(num_threads, 1u);
+        stage.input.reset(new Bounded_queue<Item>(m_queue_capacity));
+        stage.num_items.reset(new std::atomic<std::size_t>(0));
+        stage.num_dropped.reset(new std::atomic<std::size_t>(0));
+        stage.busy_ns.reset(new std::atomic<std::uint64_t>(0));
+        m_stages.push_back(std::move(stage));
+    }
+
+    void start() {
+        memory::Stage_stats* memory_stage = memory::current_stage();
+        for (std::size_t s = 0; s < m_stages.size(); ++s) {
+            m_stages[s].running.reset(new std::atomic<unsigned>(m_stages[s].num_threads));
+            for (unsigned t = 0; t < m_stages[s].num_threads; ++t)
+                m_threads.emplace_back([this, s, memory_stage]() {
+                    memory::Stage_inherit inherit(memory_stage);
+                    run_stage(s);
+                });
+        }
+    }
+
+    // Hands an item to the first stage; blocks while its queue is full.
+    // False once the pipeline has stopped.
+    bool push(Item item) {
+        if (m_stages.empty() || m_error_flag) return false;
+        ++m_in_flight;
+        if (m_stages.front().input->push(std::move(item))) return true;
+        --m_in_flight;
+        return false;
+    }
+
+    // Whether a stage threw; push() takes no more items and finish()
+    // rethrows the exception
+    bool stopped() const { return m_error_flag; }
+
+    // Number of items pushed but not yet out of the pipeline
+    std::size_t in_flight() const { return m_in_flight; }
+
+    // Lets the items in flight run through, then joins all threads
+    void finish() {
+        if (!m_stages.empty()) m_stages.front().input->close();
+        for (std::thread& thread : m_threads) thread.join();
+        m_threads.clear();
+        if (m_error) {
+            std::exception_ptr error = m_error;
+            m_error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    std::vector<Pipeline_stage_stats> stats() const {
+        std::vector<Pipeline_stage_stats> stats(m_stages.size());
+        for (std::size_t s = 0; s < m_stages.size(); ++s) {
+            stats[s].name = m_stages[s].name;
+            stats[s].num_items = *m_stages[s].num_items;
+            stats[s].num_dropped = *m_stages[s].num_dropped;
+            stats[s].busy_seconds = *m_stages[s].busy_ns * 1e-9;
+        }
+        return stats;
+    }
+
+private:
+    struct Stage {
+        const char* name;
+        Stage_fn fn;
+        unsigned num_threads;
+        std::unique_ptr<Bounded_queue<Item> > input;
+        std::unique_ptr<std::atomic<unsigned> > running;
+        std::unique_ptr<std::atomic<std::size_t> > num_items, num_dropped;
+        std::unique_ptr<std::atomic<std::uint64_t> > busy_ns;
+    };
+
+    void run_stage(std::size_t s) {
+        Stage& stage = m_stages[s];
+        Bounded_queue<Item>* output = s + 1 < m_stages.size() ? m_stages[s + 1].input.get() : nullptr;
+        Item item;
+        while (stage.input->pop(item)) {
+            ++*stage.num_items;
+            bool keep = false;
+            const auto begin = std::chrono::steady_clock::now();
+            try {
+                MESH_TRACE_SCOPE(stage.name);
+                keep = stage.fn(item);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(m_error_mutex);
+                if (!m_error) m_error = std::current_exception();
+                m_error_flag = true;
+                for (Stage& other : m_stages) other.input->close();
+            }
+            *stage.busy_ns += static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+            if (!keep) ++*stage.num_dropped;
+            if (!keep || !output || !output->push(std::move(item))) --m_in_flight;
+            item = Item();
+        }
+        // The last thread of a stage closes the queue of the next one
+        if (--*stage.running == 0 && output) output->close();
+    }
+
+    std::size_t m_queue_capacity;
+    std::vector<Stage> m_stages;
+    std::vector<std::thread> m_threads;
+    std::atomic<std::size_t> m_in_flight{ 0 };
+    std::atomic<bool> m_error_flag{ false };
+    std::mutex m_error_mutex;
+    std::exception_ptr m_error;
+};
+
+} // namespace mesh_tools
+
+#endif // PIPELINE_H
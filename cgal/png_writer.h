@@ -0,0 +1,184 @@
+#ifndef PNG_WRITER_H
+#define PNG_WRITER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "trace.h"
+
+namespace mesh_tools {
+
+namespace detail {
+
+inline std::uint32_t png_crc32(const std::uint8_t* data, std::size_t size, std::uint32_t crc = 0) {
+    static const std::vector<std::uint32_t> table = [] {
+        std::vector<std::uint32_t> t(256);
+        for (std::uint32_t n = 0; n < 256; ++n) {
+            std::uint32_t c = n;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (std::size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+inline void put_u32_be(std::vector<std::uint8_t>& out, std::uint32_t value) {
+    out.push_back(static_cast<std::uint8_t>(value >> 24));
+    out.push_back(static_cast<std::uint8_t>(value >> 16));
+    out.push_back(static_cast<std::uint8_t>(value >> 8));
+    out.push_back(static_cast<std::uint8_t>(value));
+}
+
+// LSB-first bit stream, as deflate wants it.
+class Bit_writer {
+public:
+    explicit Bit_writer(std::vector<std::uint8_t>& out) : m_out(out) {}
+
+    void put(std::uint32_t bits, int count) {
+        m_bits |= static_cast<std::uint64_t>(bits) << m_count;
+        m_count += count;
+        while (m_count >= 8) {
+            m_out.push_back(static_cast<std::uint8_t>(m_bits));
+            m_bits >>= 8;
+            m_count -= 8;
+        }
+    }
+    void flush() {
+        if (m_count > 0) m_out.push_back(static_cast<std::uint8_t>(m_bits));
+        m_bits = 0;
+        m_count = 0;
+    }
+
+private:
+    std::vector<std::uint8_t>& m_out;
+    std::uint64_t m_bits = 0;
+    int m_count = 0;
+};
+
+// Fixed Huffman code of a literal/length symbol, bit reversed, since
+// Huffman codes go out most significant bit first.
+struct Fixed_code {
+    std::uint16_t bits;
+    std::uint8_t length;
+};
+
+inline const Fixed_code* fixed_codes() {
+    static const std::vector<Fixed_code> table = [] {
+        std::vector<Fixed_code> t(288);
+        for (unsigned symbol = 0; symbol < 288; ++symbol) {
+            unsigned code, length;
+            if (symbol < 144) code = 0x30 + symbol, length = 8;
+            else if (symbol < 256) code = 0x190 + symbol - 144, length = 9;
+            else if (symbol < 280) code = symbol - 256, length = 7;
+            else code = 0xc0 + symbol - 280, length = 8;
+            unsigned reversed = 0;
+            for (unsigned i = 0; i < length; ++i) reversed |= ((code >> i) & 1) << (length - 1 - i);
+            t[symbol].bits = static_cast<std::uint16_t>(reversed);
+            t[symbol].length = static_cast<std::uint8_t>(length);
+        }
+        return t;
+    }();
+    return table.data();
+}
+
+inline void put_fixed_symbol(Bit_writer& bits, unsigned symbol) {
+    const Fixed_code& code = fixed_codes()[symbol];
+    bits.put(code.bits, code.length);
+}
+
+// Match of the given length (3..258) at distance 1, with the fixed codes.
+inline void put_run(Bit_writer& bits, unsigned length) {
+    static const unsigned base[] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const int extra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    int code = 28;
+    while (base[code] > length) --code;
+    put_fixed_symbol(bits, 257 + code);
+    bits.put(length - base[code], extra[code]);
+    bits.put(0, 5);   // distance code 0: distance 1
+}
+
+} // namespace detail
+
+// Writes 8 bit RGB pixels, row by row from the top, as a PNG file. Rows are
+// stored with the Sub filter, which turns flat colored areas into runs of
+// zeros, and deflated with the fixed Huffman codes and run matches only.
+// That is all the compression flat shaded thumbnails need, and it keeps the
+// writer free of zlib.
+inline bool write_png(const std::string& path, int width, int height, const std::uint8_t* rgb) {
+    MESH_TRACE_SCOPE("write_png");
+    if (width <= 0 || height <= 0) return false;
+    const std::size_t stride = static_cast<std::size_t>(width) * 3;
+
+    // Filtered scanlines, each with its filter type byte
+    std::vector<std::uint8_t> filtered((stride + 1) * height);
+    for (int y = 0; y < height; ++y) {
+        const std::uint8_t* row = rgb + y * stride;
+        std::uint8_t* out = filtered.data() + y * (stride + 1);
+        out[0] = 1;
+        for (std::size_t i = 0; i < stride; ++i)
+            out[i + 1] = static_cast<std::uint8_t>(row[i] - (i >= 3 ? row[i - 3] : 0));
+    }
+
+    std::vector<std::uint8_t> idat = {'I', 'D', 'A', 'T', 0x78, 0x01};
+    {
+        detail::Bit_writer bits(idat);
+        bits.put(1, 1);   // final block
+        bits.put(1, 2);   // fixed Huffman codes
+        std::size_t i = 0;
+        while (i < filtered.size()) {
+            std::size_t run = 0;
+            if (i > 0)
+                while (run < 258 && i + run < filtered.size() && filtered[i + run] == filtered[i - 1]) ++run;
+            if (run >= 3) {
+                detail::put_run(bits, static_cast<unsigned>(run));
+                i += run;
+            } else {
+                detail::put_fixed_symbol(bits, filtered[i]);
+                ++i;
+            }
+        }
+        detail::put_fixed_symbol(bits, 256);
+        bits.flush();
+    }
+    // Adler-32, reduced every 5552 bytes, the most that cannot overflow
+    std::uint32_t a = 1, b = 0;
+    for (std::size_t begin = 0; begin < filtered.size(); begin += 5552) {
+        const std::size_t end = std::min(filtered.size(), begin + 5552);
+        for (std::size_t i = begin; i < end; ++i) {
+            a += filtered[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    detail::put_u32_be(idat, (b << 16) | a);
+
+    std::vector<std::uint8_t> ihdr = {'I', 'H', 'D', 'R'};
+    detail::put_u32_be(ihdr, static_cast<std::uint32_t>(width));
+    detail::put_u32_be(ihdr, static_cast<std::uint32_t>(height));
+    ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0});   // 8 bit RGB, no interlacing
+    std::vector<std::uint8_t> iend = {'I', 'E', 'N', 'D'};
+
+    std::vector<std::uint8_t> file = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    for (std::vector<std::uint8_t>* chunk : {&ihdr, &idat, &iend}) {
+        detail::put_u32_be(file, static_cast<std::uint32_t>(chunk->size() - 4));
+        file.insert(file.end(), chunk->begin(), chunk->end());
+        detail::put_u32_be(file, detail::png_crc32(chunk->data(), chunk->size()));
+    }
+
+    std::FILE* fp = std::fopen(path.c_str(), "wb");
+    if (!fp) return false;
+    const bool written = std::fwrite(file.data(), 1, file.size(), fp) == file.size();
+    return std::fclose(fp) == 0 && written;
+}
+
+} // namespace mesh_tools
+
+#endif // PNG_WRITER_H
@@ -0,0 +1,562 @@
+#ifndef POLYGON_OFFSET_H
+#define POLYGON_OFFSET_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "memory_stats.h"
+#include "parallel.h"
+#include "trace.h"
+
+namespace mesh_tools {
+
+// Point on the integer grid, e.g. in micrometres. Coordinates must fit in 31
+// bits, so that all predicates below are exact in 128 bit arithmetic; the
+// functions below clamp them to max_int_coordinate.
+struct Int_point {
+    std::int64_t x, y;
+
+    bool operator==(const Int_point& p) const { return x == p.x && y == p.y; }
+    bool operator!=(const Int_point& p) const { return !(*this == p); }
+    // Sweep order: by y, then by x
+    bool operator<(const Int_point& p) const { return y < p.y || (y == p.y && x < p.x); }
+};
+
+const std::int64_t max_int_coordinate = (std::int64_t(1) << 31) - 1;
+
+// Closed polygons in compressed sparse row form. Ring r is the points
+// [offsets[r], offsets[r + 1]), without repeating the first one; level[r] is
+// the offset it belongs to, 0 for input contours. Material is on the left of
+// every ring: outer boundaries run counterclockwise, holes clockwise.
+struct Contour_set {
+    counted_vector<Int_point> points;
+    counted_vector<std::uint32_t> offsets{ 0 };     // num_rings() + 1 entries
+    counted_vector<std::uint32_t> level;            // one per ring
+
+    std::size_t num_rings() const { return level.size(); }
+    std::size_t ring_size(std::size_t r) const { return offsets[r + 1] - offsets[r]; }
+    const Int_point* ring(std::size_t r) const { return points.data() + offsets[r]; }
+    bool empty() const { return level.empty(); }
+
+    void add_ring(const Int_point* ring_points, std::size_t n, std::uint32_t ring_level = 0) {
+        points.insert(points.end(), ring_points, ring_points + n);
+        offsets.push_back(static_cast<std::uint32_t>(points.size()));
+        level.push_back(ring_level);
+    }
+
+    void clear() {
+        points.clear();
+        offsets.assign(1, 0);
+        level.clear();
+    }
+};
+
+enum class Offset_join { round, miter };
+
+struct Offset_params {
+    double first = -1;              // distance of the first ring; negative shrinks the material
+    double step = -1;               // from one ring to the next
+    std::size_t max_rings = 1;      // fewer if the material runs out before
+    Offset_join join = Offset_join::round;
+    double arc_tolerance = 0.25;    // largest deviation of round joins from the arc
+    double miter_limit = 2;         // longest miter in distances; longer ones are cut square
+};
+
+// Buffers of offset_contours and union_contours, which only grow. Reusing one
+// per thread across layers saves the allocations after the first few layers.
+struct Offset_scratch {
+    struct Segment {
+        Int_point a, b;
+        int multiplicity;       // number of paths running a -> b
+    };
+    struct Split {
+        std::uint32_t segment;
+        Int_point point;
+        __int128 key;           // position along the segment
+    };
+    struct Edge {
+        Int_point lo, hi;       // lo < hi in sweep order
+        int multiplicity;       // paths running lo -> hi minus those running hi -> lo
+    };
+    struct Directed_edge {
+        Int_point from, to;
+    };
+
+    Contour_set raw;                        // untrimmed offset paths of one distance
+    Contour_set previous;                   // last ring set, moved again for the next one
+    std::vector<Segment> segments;
+    std::vector<std::uint32_t> order, active;
+    std::vector<Split> splits;
+    std::vector<Edge> edges;
+    std::vector<Directed_edge> boundary;
+    std::vector<std::uint8_t> used;
+    std::vector<Int_point> ring;
+};
+
+namespace detail {
+
+typedef __int128 int128;
+
+inline int128 cross(const Int_point& o, const Int_point& a, const Int_point& b) {
+    return int128(a.x - o.x) * (b.y - o.y) - int128(a.y - o.y) * (b.x - o.x);
+}
+
+inline int128 dot(const Int_point& o, const Int_point& a, const Int_point& b) {
+    return int128(a.x - o.x) * (b.x - o.x) + int128(a.y - o.y) * (b.y - o.y);
+}
+
+inline int sign(int128 v) { return v > 0 ? 1 : (v < 0 ? -1 : 0); }
+
+inline Int_point clamp_point(const Int_point& p) {
+    return Int_point{ std::max(-max_int_coordinate, std::min(max_int_coordinate, p.x)),
+                      std::max(-max_int_coordinate, std::min(max_int_coordinate, p.y)) };
+}
+
+// num / den rounded to the nearest integer, halves away from zero
+inline std::int64_t round_div(int128 num, int128 den) {
+    if (den < 0) {
+        num = -num;
+        den = -den;
+    }
+    int128 q = num / den, r = num % den;
+    if (2 * (r < 0 ? -r : r) >= den) q += num < 0 ? -1 : 1;
+    return static_cast<std::int64_t>(q);
+}
+
+inline void add_split(Offset_scratch& s, std::uint32_t segment, const Int_point& p) {
+    const Offset_scratch::Segment& seg = s.segments[segment];
+    s.splits.push_back({ segment, p, dot(seg.a, seg.b, p) });
+}
+
+// Splits segment i at an end point p of another segment that lies in its interior
+inline void split_at_touch(Offset_scratch& s, std::uint32_t i, const Int_point& p, int128 orientation) {
+    const Offset_scratch::Segment& seg = s.segments[i];
+    if (orientation != 0) return;
+    const int128 along = dot(seg.a, seg.b, p);
+    if (along > 0 && along < dot(seg.a, seg.b, seg.b)) add_split(s, i, p);
+}
+
+// Intersections of all segments with a sweep along x: segments are taken in
+// order of their left end, and each one is tested against the active ones
+// still overlapping it in x and y. Crossings split both segments at the
+// rounded crossing point; end points touching the interior of another
+// segment, which includes collinear overlaps, split it exactly.
+//
+// This is not a Bentley-Ottmann sweep with an ordered status structure: the
+// active list is unordered, so the cost is O(n log n + n k) for n segments
+// of which at most k overlap any one in x, O(n^2) in the worst case, e.g.
+// for many long horizontal edges. Offset paths are short edges along the
+// contours, where k stays small, and the exact pairwise tests keep working
+// with the snapped crossings that an ordered status would have to repair.
+inline void split_segments(Offset_scratch& s) {
+    MESH_TRACE_SCOPE("split_segments");
+    typedef Offset_scratch::Segment Segment;
+    const std::size_t n = s.segments.size();
+    s.order.resize(n);
+    for (std::size_t i = 0; i < n; ++i) s.order[i] = static_cast<std::uint32_t>(i);
+    auto min_x = [&](std::uint32_t i) { return std::min(s.segments[i].a.x, s.segments[i].b.x); };
+    std::sort(s.order.begin(), s.order.end(), [&](std::uint32_t i, std::uint32_t j) { return min_x(i) < min_x(j); });
+
+    s.splits.clear();
+    s.active.clear();
+    for (std::uint32_t i : s.order) {
+        const Segment& si = s.segments[i];
+        const std::int64_t x0 = min_x(i);
+        const std::int64_t y0 = std::min(si.a.y, si.b.y), y1 = std::max(si.a.y, si.b.y);
+        for (std::size_t k = 0; k < s.active.size();) {
+            const std::uint32_t j = s.active[k];
+            const Segment& sj = s.segments[j];
+            if (std::max(sj.a.x, sj.b.x) < x0) {
+                s.active[k] = s.active.back();
+                s.active.pop_back();
+                continue;
+            }
+            ++k;
+            if (std::max(sj.a.y, sj.b.y) < y0 || std::min(sj.a.y, sj.b.y) > y1) continue;
+
+            const int128 o1 = cross(si.a, si.b, sj.a), o2 = cross(si.a, si.b, sj.b);
+            const int128 o3 = cross(sj.a, sj.b, si.a), o4 = cross(sj.a, sj.b, si.b);
+            if (sign(o1) * sign(o2) < 0 && sign(o3) * sign(o4) < 0) {
+                // si.a + t (si.b - si.a) with t = o3 / (o3 - o4)
+                const int128 den = o3 - o4;
+                const Int_point p = { si.a.x + round_div(int128(si.b.x - si.a.x) * o3, den),
+                                      si.a.y + round_div(int128(si.b.y - si.a.y) * o3, den) };
+                if (p != si.a && p != si.b) add_split(s, i, p);
+                if (p != sj.a && p != sj.b) add_split(s, j, p);
+                continue;
+            }
+            split_at_touch(s, i, sj.a, o1);
+            split_at_touch(s, i, sj.b, o2);
+            split_at_touch(s, j, si.a, o3);
+            split_at_touch(s, j, si.b, o4);
+        }
+        s.active.push_back(i);
+    }
+}
+
+// Cuts the segments at their splits into edges in sweep orientation, and
+// merges coincident edges into one with the net number of paths along it
+inline void build_edges(Offset_scratch& s) {
+    MESH_TRACE_SCOPE("build_edges");
+    std::sort(s.splits.begin(), s.splits.end(), [](const Offset_scratch::Split& a, const Offset_scratch::Split& b) {
+        return a.segment < b.segment || (a.segment == b.segment && a.key < b.key);
+    });
+    s.edges.clear();
+    auto add_edge = [&](const Int_point& from, const Int_point& to, int multiplicity) {
+        if (from == to) return;
+        if (from < to) s.edges.push_back({ from, to, multiplicity });
+        else s.edges.push_back({ to, from, -multiplicity });
+    };
+    std::size_t next = 0;
+    for (std::uint32_t i = 0; i < s.segments.size(); ++i) {
+        const Offset_scratch::Segment& seg = s.segments[i];
+        Int_point from = seg.a;
+        for (; next < s.splits.size() && s.splits[next].segment == i; ++next) {
+            add_edge(from, s.splits[next].point, seg.multiplicity);
+            from = s.splits[next].point;
+        }
+        add_edge(from, seg.b, seg.multiplicity);
+    }
+
+    std::sort(s.edges.begin(), s.edges.end(), [](const Offset_scratch::Edge& a, const Offset_scratch::Edge& b) {
+        return a.lo < b.lo || (a.lo == b.lo && a.hi < b.hi);
+    });
+    std::size_t out = 0;
+    for (std::size_t i = 0; i < s.edges.size();) {
+        Offset_scratch::Edge e = s.edges[i];
+        for (++i; i < s.edges.size() && s.edges[i].lo == e.lo && s.edges[i].hi == e.hi; ++i)
+            e.multiplicity += s.edges[i].multiplicity;
+        if (e.multiplicity != 0) s.edges[out++] = e;
+    }
+    s.edges.resize(out);
+}
+
+// Winding numbers on both sides of every edge, with a sweep along y. Each
+// edge is queried at its midpoint, in doubled coordinates to stay on the
+// grid, by summing the paths that cross the horizontal line through it to
+// the right. An edge is active for the half-open range [lo.y, hi.y), so end
+// points on the line are counted once and horizontal edges not at all. Edges
+// with material (winding > 0) on one side only are kept, directed so that
+// the material is on their left.
+inline void select_boundary(Offset_scratch& s) {
+    MESH_TRACE_SCOPE("select_boundary");
+    const std::size_t n = s.edges.size();
+    s.order.resize(n);
+    for (std::size_t i = 0; i < n; ++i) s.order[i] = static_cast<std::uint32_t>(i);
+    auto mid_y = [&](std::uint32_t i) { return s.edges[i].lo.y + s.edges[i].hi.y; };
+    std::sort(s.order.begin(), s.order.end(), [&](std::uint32_t i, std::uint32_t j) { return mid_y(i) < mid_y(j); });
+
+    s.boundary.clear();
+    s.active.clear();
+    std::size_t next_insert = 0;    // edges are sorted by lo, so by lo.y
+    for (std::uint32_t e : s.order) {
+        const Offset_scratch::Edge& edge = s.edges[e];
+        const std::int64_t qy = mid_y(e), qx = edge.lo.x + edge.hi.x;
+        for (; next_insert < n && 2 * s.edges[next_insert].lo.y <= qy; ++next_insert)
+            if (s.edges[next_insert].lo.y < s.edges[next_insert].hi.y)
+                s.active.push_back(static_cast<std::uint32_t>(next_insert));
+
+        int winding = 0;
+        const Int_point q = { qx, qy };
+        for (std::size_t k = 0; k < s.active.size();) {
+            const std::uint32_t f = s.active[k];
+            const Offset_scratch::Edge& other = s.edges[f];
+            if (2 * other.hi.y <= qy) {
+                s.active[k] = s.active.back();
+                s.active.pop_back();
+                continue;
+            }
+            ++k;
+            if (f == e) continue;
+            const Int_point lo = { 2 * other.lo.x, 2 * other.lo.y }, hi = { 2 * other.hi.x, 2 * other.hi.y };
+            if (cross(lo, hi, q) > 0) winding += other.multiplicity;
+        }
+
+        // Going from the right of an edge to its left adds its multiplicity.
+        // The sum is taken right of the midpoint, which is the right side of
+        // an upward edge; for a horizontal one it is above, on its left.
+        const bool horizontal = edge.lo.y == edge.hi.y;
+        const int left = horizontal ? winding : winding + edge.multiplicity;
+        const int right = left - edge.multiplicity;
+        if ((left > 0) == (right > 0)) continue;
+        if (left > 0) s.boundary.push_back({ edge.lo, edge.hi });
+        else s.boundary.push_back({ edge.hi, edge.lo });
+    }
+}
+
+// Angle of b relative to a is larger (further counterclockwise, up to a
+// U-turn), comparing exactly by half plane and then by cross product
+inline bool turns_further_left(const Int_point& a, const Int_point& b1, const Int_point& b2) {
+    const Int_point origin = { 0, 0 };
+    auto upper = [&](const Int_point& b) {
+        const int128 c = cross(origin, a, b);
+        return c > 0 || (c == 0 && dot(origin, a, b) < 0);
+    };
+    const bool u1 = upper(b1), u2 = upper(b2);
+    if (u1 != u2) return u2;
+    return cross(origin, b1, b2) > 0;
+}
+
+// Links the boundary edges into rings. Where rings touch, a walk takes the
+// sharpest left turn, which keeps the material on its left in a ring of its
+// own. Collinear points are dropped; chains that do not close, which rounding
+// can cause in rare cases, and rings without area are discarded.
+inline void link_boundary(Offset_scratch& s, Contour_set& out, std::uint32_t level) {
+    MESH_TRACE_SCOPE("link_boundary");
+    typedef Offset_scratch::Directed_edge Directed_edge;
+    std::sort(s.boundary.begin(), s.boundary.end(),
+              [](const Directed_edge& a, const Directed_edge& b) { return a.from < b.from; });
+    const std::size_t n = s.boundary.size();
+    s.used.assign(n, 0);
+
+    for (std::size_t start = 0; start < n; ++start) {
+        if (s.used[start]) continue;
+        s.ring.clear();
+        s.ring.push_back(s.boundary[start].from);
+        s.used[start] = 1;
+        std::size_t current = start;
+        bool closed = false;
+        for (;;) {
+            const Int_point v = s.boundary[current].to;
+            if (v == s.boundary[start].from) {
+                closed = true;
+                break;
+            }
+            const Directed_edge key = { v, v };
+            std::size_t i = static_cast<std::size_t>(
+                std::lower_bound(s.boundary.begin(), s.boundary.end(), key,
+                                 [](const Directed_edge& a, const Directed_edge& b) { return a.from < b.from; }) -
+                s.boundary.begin());
+            const Int_point in = { v.x - s.boundary[current].from.x, v.y - s.boundary[current].from.y };
+            std::size_t best = n;
+            Int_point best_dir = { 0, 0 };
+            for (; i < n && s.boundary[i].from == v; ++i) {
+                if (s.used[i]) continue;
+                const Int_point dir = { s.boundary[i].to.x - v.x, s.boundary[i].to.y - v.y };
+                if (best == n || turns_further_left(in, best_dir, dir)) {
+                    best = i;
+                    best_dir = dir;
+                }
+            }
+            if (best == n) break;
+            s.ring.push_back(v);
+            s.used[best] = 1;
+            current = best;
+        }
+        if (!closed) continue;
+
+        // Drop collinear points, going round until none is left
+        std::size_t m = s.ring.size();
+        for (bool changed = true; changed && m >= 3;) {
+            changed = false;
+            std::size_t kept = 0;
+            for (std::size_t i = 0; i < m; ++i) {
+                const Int_point& prev = kept > 0 ? s.ring[kept - 1] : s.ring[m - 1];
+                const Int_point& next = s.ring[(i + 1) % m];
+                if (cross(prev, s.ring[i], next) == 0) {
+                    changed = true;
+                    continue;
+                }
+                s.ring[kept++] = s.ring[i];
+            }
+            m = kept;
+        }
+        if (m < 3) continue;
+        int128 area = 0;
+        for (std::size_t i = 0; i < m; ++i) area += cross(Int_point{ 0, 0 }, s.ring[i], s.ring[(i + 1) % m]);
+        if (area == 0) continue;
+        out.add_ring(s.ring.data(), m, level);
+    }
+}
+
+// The region of positive winding number of the paths in s.raw, as rings
+// appended to out. Moving a crossing to the grid bends the two edges through
+// it slightly, which can make them cross an edge passing close by, so the
+// edges are split again until no crossing is left; this settles in a pass or
+// two. Returns false if crossings were still left after the last pass
+// allowed; the rings are then linked anyway, and may cross each other.
+inline bool trim_paths(Offset_scratch& s, Contour_set& out, std::uint32_t level) {
+    s.segments.clear();
+    for (std::size_t r = 0; r < s.raw.num_rings(); ++r) {
+        const Int_point* p = s.raw.ring(r);
+        const std::size_t m = s.raw.ring_size(r);
+        for (std::size_t i = 0; i < m; ++i)
+            if (p[i] != p[(i + 1) % m]) s.segments.push_back({ p[i], p[(i + 1) % m], 1 });
+    }
+    const int max_passes = 8;
+    bool settled = false;
+    for (int pass = 1;; ++pass) {
+        split_segments(s);
+        settled = s.splits.empty();
+        build_edges(s);
+        if (settled || pass == max_passes) break;
+        s.segments.clear();
+        for (const Offset_scratch::Edge& e : s.edges) s.segments.push_back({ e.lo, e.hi, e.multiplicity });
+    }
+    select_boundary(s);
+    link_boundary(s, out, level);
+    return settled;
+}
+
+inline Int_point round_point(double x, double y) {
+    const double limit = double(max_int_coordinate);
+    return Int_point{ static_cast<std::int64_t>(std::llround(std::max(-limit, std::min(limit, x)))),
+                      static_cast<std::int64_t>(std::llround(std::max(-limit, std::min(limit, y)))) };
+}
+
+// Untrimmed offset of every contour by delta, into s.raw. Edges move along
+// their right hand normal, away from the material for delta > 0. Where the
+// moved edges leave a gap, it is closed by a round or miter join; where they
+// overlap, the path runs through the original corner, and the loop this
+// leaves is removed by the trimming, as is every other self-intersection.
+inline void offset_paths(const Contour_set& contours, double delta, const Offset_params& params,
+                         Offset_scratch& s) {
+    MESH_TRACE_SCOPE("offset_paths");
+    s.raw.clear();
+    const double radius = std::fabs(delta);
+    const double tolerance = std::min(std::max(params.arc_tolerance, 1e-3), radius);
+    const double steps_per_radian = tolerance < radius ? 1 / std::acos(1 - tolerance / radius) : 1;
+    std::vector<Int_point>& ring = s.ring;
+
+    for (std::size_t r = 0; r < contours.num_rings(); ++r) {
+        const Int_point* p = contours.ring(r);
+        const std::size_t m = contours.ring_size(r);
+        ring.clear();
+        if (m < 3) continue;
+        // Unit direction of edge i, from p[i] to the next point
+        auto direction = [&](std::size_t i, double& dx, double& dy) {
+            const Int_point& a = p[i];
+            const Int_point& b = p[(i + 1) % m];
+            dx = double(b.x - a.x);
+            dy = double(b.y - a.y);
+            const double length = std::sqrt(dx * dx + dy * dy);
+            if (length > 0) {
+                dx /= length;
+                dy /= length;
+            }
+        };
+        for (std::size_t i = 0; i < m; ++i) {
+            double ux, uy, vx, vy;
+            direction((i + m - 1) % m, ux, uy);
+            direction(i, vx, vy);
+            if ((ux == 0 && uy == 0) || (vx == 0 && vy == 0)) continue;   // repeated point
+            const double px = double(p[i].x), py = double(p[i].y);
+            // Right hand normals of the edges before and after p[i]
+            const double n0x = uy, n0y = -ux, n1x = vy, n1y = -vx;
+            const double turn = ux * vy - uy * vx, along = ux * vx + uy * vy;
+
+            if (std::fabs(turn) < 1e-12 && along > 0) {
+                ring.push_back(round_point(px + n1x * delta, py + n1y * delta));
+            } else if (turn * delta < 0) {
+                ring.push_back(round_point(px + n0x * delta, py + n0y * delta));
+                ring.push_back(clamp_point(p[i]));
+                ring.push_back(round_point(px + n1x * delta, py + n1y * delta));
+            } else if (params.join == Offset_join::miter && 1 + along > 2 / (params.miter_limit * params.miter_limit)) {
+                const double scale = delta / (1 + along);
+                ring.push_back(round_point(px + (n0x + n1x) * scale, py + (n0y + n1y) * scale));
+            } else if (params.join == Offset_join::miter) {
+                ring.push_back(round_point(px + n0x * delta, py + n0y * delta));
+                ring.push_back(round_point(px + n1x * delta, py + n1y * delta));
+            } else {
+                // Arc from n0 to n1 around p[i], turning the same way as the path.
+                // A turn that fits in one step gets its miter point, which is
+                // closer to the arc than the chord; this keeps the fine arcs of
+                // a previous ring from doubling their points at every step.
+                const double angle = std::atan2(turn, along);
+                const std::size_t steps = std::max<std::size_t>(1, static_cast<std::size_t>(
+                    std::ceil(std::fabs(angle) * steps_per_radian)));
+                if (steps == 1 && along > 0) {
+                    const double scale = delta / (1 + along);
+                    ring.push_back(round_point(px + (n0x + n1x) * scale, py + (n0y + n1y) * scale));
+                    continue;
+                }
+                const double c = std::cos(angle / steps), sn = std::sin(angle / steps);
+                double nx = n0x, ny = n0y;
+                for (std::size_t k = 0; k <= steps; ++k) {
+                    ring.push_back(round_point(px + nx * delta, py + ny * delta));
+                    const double rx = nx * c - ny * sn;
+                    ny = nx * sn + ny * c;
+                    nx = rx;
+                }
+            }
+        }
+        if (ring.size() >= 3) s.raw.add_ring(ring.data(), ring.size());
+    }
+}
+
+} // namespace detail
+
+// Removes the self-intersections and overlaps of a set of rings: the result
+// is the region where the rings wind around positively, as non-intersecting
+// rings with the material on their left, appended to out with the given level.
+// Returns false if the trimming gave up with crossings left (see trim_paths).
+inline bool union_contours(const Contour_set& contours, Contour_set& out, Offset_scratch& scratch,
+                           std::uint32_t level = 0) {
+    MESH_TRACE_SCOPE("union_contours");
+    scratch.raw.clear();
+    for (std::size_t r = 0; r < contours.num_rings(); ++r)
+        scratch.raw.add_ring(contours.ring(r), contours.ring_size(r));
+    for (Int_point& p : scratch.raw.points) p = detail::clamp_point(p);
+    return detail::trim_paths(scratch, out, level);
+}
+
+// Offset rings of one layer: for k = 0, 1, ... up to max_rings, the contours
+// moved by first + k * step, with level k + 1. Stops at the first distance at
+// which no material is left.
+//
+// When first and step have the same sign, each ring set is the previous one
+// moved by step, which is the same region (shrinking by a then by b is
+// shrinking by a + b, and likewise for growing) but keeps the untrimmed paths
+// short: moving a detailed contour far at once folds every small feature into
+// loops that cross many others. The round joins of the steps add up to at most
+// k times arc_tolerance. Otherwise every ring set is computed from the
+// contours themselves.
+//
+// Returns the number of ring sets whose trimming gave up with crossings left
+// (see trim_paths), 0 if all of them are clean.
+inline std::size_t offset_contours(const Contour_set& contours, const Offset_params& params, Contour_set& out,
+                                   Offset_scratch& scratch) {
+    MESH_TRACE_SCOPE("offset_contours");
+    out.clear();
+    std::size_t num_unsettled = 0;
+    const bool chained = params.first * params.step > 0;
+    std::size_t previous = 0;   // first ring of the last level
+    for (std::size_t k = 0; k < params.max_rings; ++k) {
+        const std::size_t before = out.num_rings();
+        if (k == 0 || !chained) {
+            detail::offset_paths(contours, params.first + double(k) * params.step, params, scratch);
+        } else {
+            scratch.previous.clear();
+            for (std::size_t r = previous; r < before; ++r) scratch.previous.add_ring(out.ring(r), out.ring_size(r));
+            detail::offset_paths(scratch.previous, params.step, params, scratch);
+        }
+        if (!detail::trim_paths(scratch, out, static_cast<std::uint32_t>(k + 1))) ++num_unsettled;
+        if (out.num_rings() == before) break;
+        previous = before;
+    }
+    return num_unsettled;
+}
+
+// offset_contours for many layers, spread over the threads. Each thread
+// takes the next layer from a shared counter, so that large and small layers
+// balance out, and keeps one scratch for all of its layers. Returns the sum of
+// what offset_contours returns for the layers.
+inline std::size_t offset_layers(const Contour_set* layers, std::size_t num_layers, const Offset_params& params,
+                                 Contour_set* out) {
+    MESH_TRACE_SCOPE("offset_layers");
+    std::atomic<std::size_t> next_layer(0), num_unsettled(0);
+    const std::size_t num_workers = std::max<std::size_t>(1, std::min<std::size_t>(num_threads(), num_layers));
+    parallel_for(num_workers, [&](std::size_t) {
+        Offset_scratch scratch;
+        for (std::size_t layer = next_layer++; layer < num_layers; layer = next_layer++)
+            num_unsettled += offset_contours(layers[layer], params, out[layer], scratch);
+    }, 1);
+    return num_unsettled;
+}
+
+} // namespace mesh_tools
+
+#endif // POLYGON_OFFSET_H
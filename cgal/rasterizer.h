@@ -0,0 +1,355 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "memory_stats.h"
+#include "parallel.h"
+#include "trace.h"
+
+namespace mesh_tools {
+
+// 8 bit RGB pixels, row by row from the top.
+struct Raster_image {
+    int width = 0;
+    int height = 0;
+    counted_vector<std::uint8_t> rgb;
+};
+
+// Orthographic view of the whole model from a direction given in degrees:
+// azimuth around +z from +x, elevation above the xy plane. +z is up on
+// screen unless the view looks straight along it.
+struct Raster_view {
+    float azimuth = 0;
+    float elevation = 0;
+};
+
+// Front, side, back three-quarter and top views.
+inline std::vector<Raster_view> thumbnail_views() {
+    return { {-60.f, 25.f}, {30.f, 25.f}, {150.f, 25.f}, {-90.f, 90.f} };
+}
+
+// Well separated colors for consecutive segment IDs, hue stepped by the
+// golden ratio.
+inline void segment_color(std::size_t segment, std::uint8_t rgb[3]) {
+    const double hue = std::fmod(static_cast<double>(segment) * 0.618033988749895, 1.0) * 6;
+    const double s = 0.6, v = 0.95;
+    const int sector = static_cast<int>(hue);
+    const double f = hue - sector;
+    const double p = v * (1 - s), q = v * (1 - s * f), t = v * (1 - s * (1 - f));
+    const double table[6][3] = { {v, t, p}, {q, v, p}, {p, v, t}, {p, q, v}, {t, p, v}, {v, p, q} };
+    for (int i = 0; i < 3; ++i) rgb[i] = static_cast<std::uint8_t>(table[sector % 6][i] * 255 + 0.5);
+}
+
+namespace detail {
+
+const int raster_tile_size = 32;
+
+// A triangle in image space, ready for the tile loop. Edge i is
+// a[i] * x + b[i] * y + c[i], positive inside; pixels exactly on an edge are
+// drawn if the edge function is above bias[i], which is 0 for one of the two
+// triangles sharing the edge and slightly negative for the other, so shared
+// edges have neither gaps nor double coverage.
+struct Raster_triangle {
+    float a[3], b[3], c[3], bias[3];
+    float za, zb, zc;   // depth plane
+    std::int32_t x0, y0, x1, y1;   // pixel bounds, inclusive
+    std::uint32_t color;
+};
+
+inline float edge_bias(float a, float b) {
+    return (a > 0 || (a == 0 && b > 0)) ? -std::numeric_limits<float>::min() : 0.f;
+}
+
+// Rasterizes the binned triangles of one tile into a tile-sized depth and
+// color buffer. Both are tile_size * tile_size, rows from the top.
+inline void rasterize_tile(const Raster_triangle* triangles, const std::uint32_t* ids, std::size_t count,
+                           int tx, int ty, float* depth, std::uint32_t* color) {
+    const int ts = raster_tile_size;
+    for (std::size_t k = 0; k < count; ++k) {
+        const Raster_triangle& tri = triangles[ids[k]];
+        const int y_begin = std::max(tri.y0, ty), y_end = std::min(tri.y1, ty + ts - 1);
+        const int x_begin = tx + ((std::max(tri.x0, tx) - tx) & ~3), x_end = std::min(tri.x1, tx + ts - 1);
+        for (int y = y_begin; y <= y_end; ++y) {
+            const float py = static_cast<float>(y) + 0.5f;
+            const float row[3] = { tri.b[0] * py + tri.c[0], tri.b[1] * py + tri.c[1], tri.b[2] * py + tri.c[2] };
+            const float z_row = tri.zb * py + tri.zc;
+            float* depth_row = depth + (y - ty) * ts - tx;
+            std::uint32_t* color_row = color + (y - ty) * ts - tx;
+#if defined(__SSE2__)
+            // Four pixels per step
+            const __m128 lanes = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+            const __m128 color4 = _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(tri.color)));
+            for (int x = x_begin; x <= x_end; x += 4) {
+                const __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), lanes);
+                __m128 inside = _mm_cmpgt_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.a[0]), px), _mm_set1_ps(row[0])),
+                                             _mm_set1_ps(tri.bias[0]));
+                inside = _mm_and_ps(inside, _mm_cmpgt_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.a[1]), px),
+                                                                    _mm_set1_ps(row[1])),
+                                                         _mm_set1_ps(tri.bias[1])));
+                inside = _mm_and_ps(inside, _mm_cmpgt_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.a[2]), px),
+                                                                    _mm_set1_ps(row[2])),
+                                                         _mm_set1_ps(tri.bias[2])));
+                if (_mm_movemask_ps(inside) == 0) continue;
+                const __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.za), px), _mm_set1_ps(z_row));
+                const __m128 old_z = _mm_loadu_ps(depth_row + x);
+                const __m128 write = _mm_and_ps(inside, _mm_cmplt_ps(z, old_z));
+                _mm_storeu_ps(depth_row + x, _mm_or_ps(_mm_and_ps(write, z), _mm_andnot_ps(write, old_z)));
+                const __m128 old_color = _mm_loadu_ps(reinterpret_cast<const float*>(color_row + x));
+                _mm_storeu_ps(reinterpret_cast<float*>(color_row + x),
+                              _mm_or_ps(_mm_and_ps(write, color4), _mm_andnot_ps(write, old_color)));
+            }
+#else
+            for (int x = x_begin; x <= x_end; ++x) {
+                const float px = static_cast<float>(x) + 0.5f;
+                if (!(tri.a[0] * px + row[0] > tri.bias[0]) || !(tri.a[1] * px + row[1] > tri.bias[1]) ||
+                    !(tri.a[2] * px + row[2] > tri.bias[2]))
+                    continue;
+                const float z = tri.za * px + z_row;
+                if (z < depth_row[x]) {
+                    depth_row[x] = z;
+                    color_row[x] = tri.color;
+                }
+            }
+#endif
+        }
+    }
+}
+
+} // namespace detail
+
+// Renders one orthographic, flat shaded view per entry of views into a grid
+// of square cells, `columns` cells wide. Faces are drawn from both sides in
+// face_rgb (3 bytes per face), or in gray if face_rgb is null.
+//
+// Triangles of all views are set up and binned into 32x32 pixel tiles first,
+// then tiles are rasterized independently on all threads, each with its own
+// depth buffer, four pixels at a time with SSE2 edge functions where
+// available. Each tile draws its triangles in face order, so the output does
+// not depend on the number of threads.
+template <class TNumber, class TIndex>
+Raster_image render_views(const TNumber* coords, std::size_t num_vertices, const TIndex* tris, std::size_t num_faces,
+                          const std::uint8_t* face_rgb, const std::vector<Raster_view>& views, int cell_size,
+                          int columns = 2) {
+    MESH_TRACE_SCOPE("render_views");
+    const int ts = detail::raster_tile_size;
+    const std::uint32_t background = 0xf0f0f0u;
+
+    Raster_image image;
+    columns = std::max(1, std::min<int>(columns, static_cast<int>(views.size())));
+    const int rows = static_cast<int>((views.size() + columns - 1) / columns);
+    image.width = columns * cell_size;
+    image.height = rows * cell_size;
+    image.rgb.assign(static_cast<std::size_t>(image.width) * image.height * 3, 0xf0);
+    if (views.empty() || num_faces == 0 || cell_size <= 0) return image;
+
+    // One scale for all views: the bounding sphere around the box center fills
+    // 90% of a cell
+    double lo[3], hi[3];
+    for (int i = 0; i < 3; ++i) {
+        lo[i] = std::numeric_limits<double>::max();
+        hi[i] = std::numeric_limits<double>::lowest();
+    }
+    for (std::size_t v = 0; v < num_vertices; ++v) {
+        for (int i = 0; i < 3; ++i) {
+            lo[i] = std::min(lo[i], static_cast<double>(coords[v * 3 + i]));
+            hi[i] = std::max(hi[i], static_cast<double>(coords[v * 3 + i]));
+        }
+    }
+    const double center[3] = { (lo[0] + hi[0]) / 2, (lo[1] + hi[1]) / 2, (lo[2] + hi[2]) / 2 };
+    double radius = 0;
+    for (std::size_t v = 0; v < num_vertices; ++v) {
+        double d2 = 0;
+        for (int i = 0; i < 3; ++i) d2 += (coords[v * 3 + i] - center[i]) * (coords[v * 3 + i] - center[i]);
+        radius = std::max(radius, d2);
+    }
+    radius = std::sqrt(radius);
+    const double scale = radius > 0 ? 0.45 * cell_size / radius : 1;
+
+    const std::size_t num_views = views.size();
+    counted_vector<detail::Raster_triangle> triangles(num_views * num_faces);
+    counted_vector<float> screen(num_vertices * 3);
+    for (std::size_t view_index = 0; view_index < num_views; ++view_index) {
+        MESH_TRACE_SCOPE("setup view");
+        // Camera basis: forward points from the model towards the eye
+        const double radians = 3.14159265358979323846 / 180;
+        const double az = views[view_index].azimuth * radians, el = views[view_index].elevation * radians;
+        const double forward[3] = { std::cos(el) * std::cos(az), std::cos(el) * std::sin(az), std::sin(el) };
+        double right[3] = { -forward[1], forward[0], 0 };
+        double length = std::sqrt(right[0] * right[0] + right[1] * right[1]);
+        if (length < 1e-6) {
+            right[0] = 1;
+            right[1] = 0;
+            length = 1;
+        }
+        for (double& r : right) r /= length;
+        const double up[3] = { forward[1] * right[2] - forward[2] * right[1],
+                               forward[2] * right[0] - forward[0] * right[2],
+                               forward[0] * right[1] - forward[1] * right[0] };
+        double light[3];
+        double light_length = 0;
+        for (int i = 0; i < 3; ++i) {
+            light[i] = forward[i] + 0.4 * up[i] + 0.3 * right[i];
+            light_length += light[i] * light[i];
+        }
+        for (double& l : light) l /= std::sqrt(light_length);
+
+        const double cell_x = static_cast<double>(view_index % columns) * cell_size + cell_size * 0.5;
+        const double cell_y = static_cast<double>(view_index / columns) * cell_size + cell_size * 0.5;
+        parallel_for(num_vertices, [&](std::size_t v) {
+            double p[3];
+            for (int i = 0; i < 3; ++i) p[i] = coords[v * 3 + i] - center[i];
+            screen[v * 3] = static_cast<float>(cell_x + scale * (p[0] * right[0] + p[1] * right[1] + p[2] * right[2]));
+            screen[v * 3 + 1] = static_cast<float>(cell_y - scale * (p[0] * up[0] + p[1] * up[1] + p[2] * up[2]));
+            screen[v * 3 + 2] = static_cast<float>(-(p[0] * forward[0] + p[1] * forward[1] + p[2] * forward[2]));
+        });
+
+        const int cell_x0 = static_cast<int>(view_index % columns) * cell_size;
+        const int cell_y0 = static_cast<int>(view_index / columns) * cell_size;
+        parallel_for(num_faces, [&](std::size_t f) {
+            detail::Raster_triangle& tri = triangles[view_index * num_faces + f];
+            std::size_t corner[3] = { static_cast<std::size_t>(tris[f * 3]), static_cast<std::size_t>(tris[f * 3 + 1]),
+                                      static_cast<std::size_t>(tris[f * 3 + 2]) };
+            const float* s[3] = { &screen[corner[0] * 3], &screen[corner[1] * 3], &screen[corner[2] * 3] };
+            float area = (s[1][0] - s[0][0]) * (s[2][1] - s[0][1]) - (s[1][1] - s[0][1]) * (s[2][0] - s[0][0]);
+            if (area < 0) {
+                std::swap(s[1], s[2]);
+                std::swap(corner[1], corner[2]);
+                area = -area;
+            }
+            tri.x0 = tri.y0 = 0;
+            tri.x1 = tri.y1 = -1;   // empty unless set below
+            if (!(area > 0)) return;
+
+            // Edge i runs from corner i to corner i + 1 and is zero on both;
+            // it equals area at the opposite corner
+            for (int i = 0; i < 3; ++i) {
+                const float* p = s[i];
+                const float* q = s[(i + 1) % 3];
+                tri.a[i] = p[1] - q[1];
+                tri.b[i] = q[0] - p[0];
+                tri.c[i] = p[0] * q[1] - q[0] * p[1];
+                tri.bias[i] = detail::edge_bias(tri.a[i], tri.b[i]);
+            }
+            // z = (e0 * z2 + e1 * z0 + e2 * z1) / area
+            const float inv_area = 1 / area;
+            tri.za = (tri.a[0] * s[2][2] + tri.a[1] * s[0][2] + tri.a[2] * s[1][2]) * inv_area;
+            tri.zb = (tri.b[0] * s[2][2] + tri.b[1] * s[0][2] + tri.b[2] * s[1][2]) * inv_area;
+            tri.zc = (tri.c[0] * s[2][2] + tri.c[1] * s[0][2] + tri.c[2] * s[1][2]) * inv_area;
+
+            const float min_x = std::min({ s[0][0], s[1][0], s[2][0] }), max_x = std::max({ s[0][0], s[1][0], s[2][0] });
+            const float min_y = std::min({ s[0][1], s[1][1], s[2][1] }), max_y = std::max({ s[0][1], s[1][1], s[2][1] });
+            tri.x0 = std::max(cell_x0, static_cast<int>(std::floor(min_x)));
+            tri.y0 = std::max(cell_y0, static_cast<int>(std::floor(min_y)));
+            tri.x1 = std::min(cell_x0 + cell_size - 1, static_cast<int>(std::ceil(max_x)));
+            tri.y1 = std::min(cell_y0 + cell_size - 1, static_cast<int>(std::ceil(max_y)));
+
+            // Flat shading, lit from both sides
+            double n[3], e1[3], e2[3];
+            for (int i = 0; i < 3; ++i) {
+                e1[i] = coords[corner[1] * 3 + i] - coords[corner[0] * 3 + i];
+                e2[i] = coords[corner[2] * 3 + i] - coords[corner[0] * 3 + i];
+            }
+            n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+            n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+            n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+            const double n_length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            const double lambert = n_length > 0 ? std::fabs(n[0] * light[0] + n[1] * light[1] + n[2] * light[2]) / n_length : 0;
+            const double intensity = 0.3 + 0.7 * lambert;
+            const std::uint8_t gray[3] = { 200, 200, 200 };
+            const std::uint8_t* rgb = face_rgb ? face_rgb + f * 3 : gray;
+            tri.color = 0;
+            for (int i = 0; i < 3; ++i)
+                tri.color |= static_cast<std::uint32_t>(std::min(255.0, rgb[i] * intensity + 0.5)) << (8 * i);
+        }, 1024);
+    }
+
+    // Bin triangles into tiles: count per chunk of triangles and tile, then
+    // scatter, so each tile lists its triangles in order
+    const int tiles_x = (image.width + ts - 1) / ts;
+    const int tiles_y = (image.height + ts - 1) / ts;
+    const std::size_t num_tiles = static_cast<std::size_t>(tiles_x) * tiles_y;
+    const std::size_t num_triangles = triangles.size();
+    const std::size_t num_chunks = std::min<std::size_t>(num_threads(), (num_triangles + 4095) / 4096);
+    const std::size_t chunk_size = (num_triangles + num_chunks - 1) / num_chunks;
+    counted_vector<std::uint32_t> tile_offsets(num_tiles + 1, 0);
+    counted_vector<std::uint32_t> binned;
+    {
+        MESH_TRACE_SCOPE("bin triangles");
+        counted_vector<std::uint32_t> cursor(num_chunks * num_tiles, 0);
+        auto for_each_tile = [&](std::size_t chunk, auto fn) {
+            const std::size_t end = std::min(num_triangles, (chunk + 1) * chunk_size);
+            for (std::size_t t = chunk * chunk_size; t < end; ++t) {
+                const detail::Raster_triangle& tri = triangles[t];
+                for (int y = tri.y0 / ts; y <= tri.y1 / ts && tri.y1 >= tri.y0; ++y)
+                    for (int x = tri.x0 / ts; x <= tri.x1 / ts && tri.x1 >= tri.x0; ++x)
+                        fn(t, static_cast<std::size_t>(y) * tiles_x + x);
+            }
+        };
+        parallel_for(num_chunks, [&](std::size_t chunk) {
+            std::uint32_t* counts = &cursor[chunk * num_tiles];
+            for_each_tile(chunk, [&](std::size_t, std::size_t tile) { ++counts[tile]; });
+        }, 1);
+        // Turn counts into write positions, tile major and chunk minor
+        std::uint32_t total = 0;
+        for (std::size_t tile = 0; tile < num_tiles; ++tile) {
+            tile_offsets[tile] = total;
+            for (std::size_t chunk = 0; chunk < num_chunks; ++chunk) {
+                const std::uint32_t count = cursor[chunk * num_tiles + tile];
+                cursor[chunk * num_tiles + tile] = total;
+                total += count;
+            }
+        }
+        tile_offsets[num_tiles] = total;
+        binned.resize(total);
+        parallel_for(num_chunks, [&](std::size_t chunk) {
+            std::uint32_t* positions = &cursor[chunk * num_tiles];
+            for_each_tile(chunk, [&](std::size_t t, std::size_t tile) {
+                binned[positions[tile]++] = static_cast<std::uint32_t>(t);
+            });
+        }, 1);
+    }
+
+    // Tiles are handed out one at a time, so threads that get cheap tiles
+    // take more of them
+    {
+        MESH_TRACE_SCOPE("rasterize tiles");
+        std::atomic<std::size_t> next_tile(0);
+        parallel_for(num_threads(), [&](std::size_t) {
+            float depth[ts * ts];
+            std::uint32_t color[ts * ts];
+            for (std::size_t tile = next_tile++; tile < num_tiles; tile = next_tile++) {
+                if (tile_offsets[tile] == tile_offsets[tile + 1]) continue;
+                const int tx = static_cast<int>(tile % tiles_x) * ts, ty = static_cast<int>(tile / tiles_x) * ts;
+                std::fill(depth, depth + ts * ts, std::numeric_limits<float>::infinity());
+                std::fill(color, color + ts * ts, background);
+                detail::rasterize_tile(triangles.data(), binned.data() + tile_offsets[tile],
+                                       tile_offsets[tile + 1] - tile_offsets[tile], tx, ty, depth, color);
+                for (int y = ty; y < std::min(ty + ts, image.height); ++y) {
+                    std::uint8_t* out = &image.rgb[(static_cast<std::size_t>(y) * image.width + tx) * 3];
+                    for (int x = 0; x < std::min(ts, image.width - tx); ++x) {
+                        const std::uint32_t c = color[(y - ty) * ts + x];
+                        out[x * 3] = static_cast<std::uint8_t>(c);
+                        out[x * 3 + 1] = static_cast<std::uint8_t>(c >> 8);
+                        out[x * 3 + 2] = static_cast<std::uint8_t>(c >> 16);
+                    }
+                }
+            }
+        }, 1);
+    }
+    return image;
+}
+
+} // namespace mesh_tools
+
+#endif // RASTERIZER_H
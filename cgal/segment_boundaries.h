@@ -0,0 +1,199 @@
+#ifndef SEGMENT_BOUNDARIES_H
+#define SEGMENT_BOUNDARIES_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "memory_stats.h"
+#include "parallel.h"
+#include "trace.h"
+
+namespace mesh_tools {
+
+// Mesh edge between two faces with different segments; segment[0] < segment[1].
+struct Boundary_edge {
+    std::uint32_t v[2];
+    std::uint32_t segment[2];
+};
+
+// Boundaries between segments as polylines of vertex IDs. Polyline p is
+// vertices[offsets[p] .. offsets[p + 1]); a closed polyline does not repeat
+// its first vertex. Polylines end where three or more segments meet, at the
+// mesh border, and where the pair of segments on both sides changes, so every
+// polyline separates exactly the two segments segments[2p] < segments[2p + 1].
+struct Segment_boundaries {
+    counted_vector<std::uint32_t> vertices;
+    counted_vector<std::uint32_t> offsets;     // num_polylines() + 1 entries
+    counted_vector<std::uint32_t> segments;    // two per polyline
+    counted_vector<std::uint8_t> closed;       // one per polyline
+
+    std::size_t num_polylines() const { return closed.size(); }
+    std::size_t num_edges() const {
+        std::size_t n = 0;
+        for (std::size_t p = 0; p < num_polylines(); ++p) n += offsets[p + 1] - offsets[p] - 1 + closed[p];
+        return n;
+    }
+    bool empty() const { return closed.empty(); }
+
+    void clear() {
+        vertices.clear();
+        offsets.clear();
+        segments.clear();
+        closed.clear();
+    }
+};
+
+namespace detail {
+
+// Open addressing hash map from a vertex ID to a dense index, in order of
+// insertion; only vertices on a boundary are stored.
+class Vertex_slot_map {
+public:
+    static constexpr std::uint32_t npos = 0xFFFFFFFFu;
+
+    explicit Vertex_slot_map(std::size_t expected) {
+        std::size_t capacity = 16;
+        bits = 4;
+        while (capacity < expected * 2) {
+            capacity *= 2;
+            ++bits;
+        }
+        keys.assign(capacity, npos);
+        values.resize(capacity);
+    }
+
+    std::size_t size() const { return count; }
+
+    // Dense index of v, added if v is new
+    std::uint32_t insert(std::uint32_t v) {
+        std::size_t i = slot(v);
+        while (keys[i] != npos) {
+            if (keys[i] == v) return values[i];
+            i = (i + 1) & (keys.size() - 1);
+        }
+        keys[i] = v;
+        values[i] = static_cast<std::uint32_t>(count);
+        return static_cast<std::uint32_t>(count++);
+    }
+
+private:
+    std::size_t slot(std::uint32_t v) const {
+        return static_cast<std::size_t>((v * 0x9E3779B97F4A7C15ull) >> (64 - bits));
+    }
+
+    counted_vector<std::uint32_t> keys;
+    counted_vector<std::uint32_t> values;
+    std::size_t count = 0;
+    unsigned bits;
+};
+
+} // namespace detail
+
+// Links boundary edges into polylines. Both ends of every edge are chained
+// into a list per vertex, found through a hash map keyed by vertex ID, so
+// that a walk can step from one edge to the next at a vertex where exactly
+// two edges of the same pair of segments meet. Walks start at the other
+// vertices first, which gives the open polylines; the edges left over form
+// closed loops. Linear in the number of edges, and the result only depends
+// on the order of the edges.
+inline Segment_boundaries link_boundary_edges(const Boundary_edge* edges, std::size_t num_edges) {
+    MESH_TRACE_SCOPE("link_boundary_edges");
+    Segment_boundaries boundaries;
+    boundaries.offsets.push_back(0);
+    if (num_edges == 0) return boundaries;
+
+    // End 2e + i is end i of edge e; ends at the same vertex are chained
+    const std::uint32_t none = detail::Vertex_slot_map::npos;
+    detail::Vertex_slot_map vertex_slots(num_edges);
+    counted_vector<std::uint32_t> end_slot(num_edges * 2), next_end(num_edges * 2);
+    counted_vector<std::uint32_t> first_end, degree;
+    first_end.reserve(num_edges);
+    degree.reserve(num_edges);
+    for (std::size_t end = 0; end < num_edges * 2; ++end) {
+        const std::uint32_t s = vertex_slots.insert(edges[end / 2].v[end % 2]);
+        if (s == first_end.size()) {
+            first_end.push_back(none);
+            degree.push_back(0);
+        }
+        end_slot[end] = s;
+        next_end[end] = first_end[s];
+        first_end[s] = static_cast<std::uint32_t>(end);
+        ++degree[s];
+    }
+
+    auto same_pair = [&](std::uint32_t a, std::uint32_t b) {
+        return edges[a].segment[0] == edges[b].segment[0] && edges[a].segment[1] == edges[b].segment[1];
+    };
+    // Vertex where a walk along edge e continues, with the end it leaves by
+    auto continues = [&](std::uint32_t s, std::uint32_t e, std::uint32_t& leave) {
+        if (degree[s] != 2) return false;
+        const std::uint32_t a = first_end[s], b = next_end[a];
+        leave = a / 2 == e ? b : a;
+        return same_pair(e, leave / 2);
+    };
+
+    counted_vector<std::uint8_t> used(num_edges, 0);
+    auto walk = [&](std::uint32_t start_end) {
+        const std::uint32_t start = end_slot[start_end];
+        std::uint32_t end = start_end, e = start_end / 2;
+        boundaries.segments.push_back(edges[e].segment[0]);
+        boundaries.segments.push_back(edges[e].segment[1]);
+        boundaries.vertices.push_back(edges[e].v[end % 2]);
+        bool closed = false;
+        for (;;) {
+            used[e] = 1;
+            const std::uint32_t arrive = end ^ 1;
+            const std::uint32_t s = end_slot[arrive];
+            if (s == start) {
+                closed = true;
+                break;
+            }
+            boundaries.vertices.push_back(edges[e].v[arrive % 2]);
+            std::uint32_t leave;
+            if (!continues(s, e, leave) || used[leave / 2]) break;
+            end = leave;
+            e = leave / 2;
+        }
+        boundaries.offsets.push_back(static_cast<std::uint32_t>(boundaries.vertices.size()));
+        boundaries.closed.push_back(closed ? 1 : 0);
+    };
+
+    std::uint32_t leave;
+    for (std::uint32_t end = 0; end < num_edges * 2; ++end)
+        if (!used[end / 2] && !continues(end_slot[end], end / 2, leave)) walk(end);
+    for (std::uint32_t e = 0; e < num_edges; ++e)
+        if (!used[e]) walk(e * 2);
+    return boundaries;
+}
+
+// Boundaries between the segments of a mesh: label-changing edges are found
+// in one parallel sweep over the edges, then linked into polylines.
+template <class Mesh, class SegmentMap>
+Segment_boundaries extract_segment_boundaries(const Mesh& mesh, const SegmentMap& segment_map) {
+    typedef typename Mesh::Edge_index Edge_index;
+    MESH_TRACE_SCOPE("extract_segment_boundaries");
+    const std::size_t num_edges = mesh.number_of_edges();
+    std::vector<Boundary_edge> edges;
+    parallel_gather(num_edges, edges, [&](std::size_t begin, std::size_t end, std::vector<Boundary_edge>& out) {
+        for (std::size_t i = begin; i < end; ++i) {
+            const auto h = mesh.halfedge(Edge_index(static_cast<typename Mesh::size_type>(i)));
+            const auto o = mesh.opposite(h);
+            if (mesh.is_border(h) || mesh.is_border(o)) continue;
+            const std::uint32_t a = static_cast<std::uint32_t>(segment_map[mesh.face(h)]);
+            const std::uint32_t b = static_cast<std::uint32_t>(segment_map[mesh.face(o)]);
+            if (a == b) continue;
+            Boundary_edge edge;
+            edge.v[0] = static_cast<std::uint32_t>(mesh.source(h).idx());
+            edge.v[1] = static_cast<std::uint32_t>(mesh.target(h).idx());
+            edge.segment[0] = std::min(a, b);
+            edge.segment[1] = std::max(a, b);
+            out.push_back(edge);
+        }
+    });
+    return link_boundary_edges(edges.data(), edges.size());
+}
+
+} // namespace mesh_tools
+
+#endif // SEGMENT_BOUNDARIES_H
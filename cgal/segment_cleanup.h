@@ -0,0 +1,223 @@
+#ifndef SEGMENT_CLEANUP_H
+#define SEGMENT_CLEANUP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <queue>
+#include <vector>
+
+#include "face_adjacency.h"
+#include "memory_stats.h"
+#include "parallel.h"
+#include "trace.h"
+#include "union_find.h"
+
+namespace mesh_tools {
+
+struct Segment_cleanup_stats {
+    std::size_t num_components = 0;    // connected components of the input labels
+    std::size_t num_merged = 0;        // components merged into a neighbour
+    std::size_t num_segments = 0;      // segments left
+};
+
+namespace detail {
+
+// Boundary between a small component and component `other`, which may have
+// been merged since; see Merge_link.
+struct Cleanup_link {
+    std::uint32_t other;
+    double length;
+};
+
+// Merge of component `from` into `into`; versions tell stale entries apart.
+struct Cleanup_candidate {
+    double length;
+    std::uint32_t from, into, version;
+
+    bool operator<(const Cleanup_candidate& c) const {
+        return length < c.length || (length == c.length && (from > c.from || (from == c.from && into > c.into)));
+    }
+};
+
+} // namespace detail
+
+// Splits every segment of face_labels into its edge-connected components and
+// merges the components with an area below min_area into neighbours, then
+// renumbers the segments in order of their first face. Returns the number of
+// segments.
+//
+// Components are found with a lock-free union-find over faces, uniting
+// neighbours with the same label in parallel. Each small component is merged
+// into the neighbour it shares the longest boundary with; a priority queue
+// over those boundary lengths does the longest first, so slivers attach where
+// they are most clearly part of a segment. A small component that stays
+// small after a merge goes back into the queue with its combined boundary.
+// Small components with no neighbour are kept. Only boundaries of small
+// components are collected, so a clean segmentation costs two parallel
+// passes over the faces.
+inline std::size_t clean_segments(const Face_adjacency& adj, const float* face_areas, std::uint32_t* face_labels,
+                                  double min_area, Segment_cleanup_stats* stats = nullptr) {
+    MESH_TRACE_SCOPE("clean_segments");
+    const std::size_t num_faces = adj.num_faces();
+    if (stats) *stats = Segment_cleanup_stats();
+    if (num_faces == 0) return 0;
+
+    Concurrent_union_find faces(num_faces);
+    {
+        MESH_TRACE_SCOPE("split components");
+        parallel_for(num_faces, [&](std::size_t f) {
+            for (std::uint32_t e = adj.begin(f); e < adj.end(f); ++e) {
+                const std::uint32_t g = adj.neighbor[e];
+                if (g > f && face_labels[g] == face_labels[f]) faces.unite(static_cast<std::uint32_t>(f), g);
+            }
+        });
+    }
+    counted_vector<std::uint32_t> component_label;
+    const std::uint32_t num_components = number_roots(faces, component_label);
+    counted_vector<std::uint32_t> face_component(num_faces);
+    parallel_for(num_faces, [&](std::size_t f) {
+        face_component[f] = component_label[faces.find(static_cast<std::uint32_t>(f))];
+    });
+
+    counted_vector<double> area(num_components, 0.0);
+    for (std::size_t f = 0; f < num_faces; ++f) area[face_component[f]] += face_areas[f];
+    counted_vector<char> small(num_components);
+    std::size_t num_small = 0;
+    for (std::uint32_t c = 0; c < num_components; ++c) {
+        small[c] = area[c] < min_area;
+        num_small += small[c];
+    }
+
+    Concurrent_union_find components(num_components);
+    std::size_t num_merged = 0;
+    if (num_small > 0) {
+        // Boundaries of small components, one entry per pair after summing
+        struct Boundary {
+            std::uint32_t a, b;
+            double length;
+        };
+        std::vector<Boundary> boundaries;
+        {
+            MESH_TRACE_SCOPE("small component boundaries");
+            parallel_gather(num_faces, boundaries, [&](std::size_t begin, std::size_t end, std::vector<Boundary>& out) {
+                for (std::size_t f = begin; f < end; ++f) {
+                    const std::uint32_t a = face_component[f];
+                    for (std::uint32_t e = adj.begin(f); e < adj.end(f); ++e) {
+                        const std::uint32_t b = face_component[adj.neighbor[e]];
+                        if (a < b && (small[a] || small[b])) out.push_back({ a, b, adj.edge_length[e] });
+                    }
+                }
+            });
+            std::sort(boundaries.begin(), boundaries.end(), [](const Boundary& x, const Boundary& y) {
+                return x.a < y.a || (x.a == y.a && x.b < y.b);
+            });
+        }
+
+        std::vector<std::vector<detail::Cleanup_link>> links(num_components);
+        for (std::size_t i = 0; i < boundaries.size();) {
+            const Boundary& first = boundaries[i];
+            double length = 0;
+            for (; i < boundaries.size() && boundaries[i].a == first.a && boundaries[i].b == first.b; ++i)
+                length += boundaries[i].length;
+            if (small[first.a]) links[first.a].push_back({ first.b, length });
+            if (small[first.b]) links[first.b].push_back({ first.a, length });
+        }
+        std::vector<Boundary>().swap(boundaries);
+
+        MESH_TRACE_SCOPE("merge small components");
+        counted_vector<std::uint32_t> version(num_components, 0);
+        // Resolves and sums up the links of c and queues its longest boundary
+        std::priority_queue<detail::Cleanup_candidate> heap;
+        auto push_best = [&](std::uint32_t c) {
+            std::vector<detail::Cleanup_link>& list = links[c];
+            std::size_t out = 0;
+            for (detail::Cleanup_link link : list) {
+                link.other = components.find(link.other);
+                if (link.other != c) list[out++] = link;
+            }
+            list.resize(out);
+            std::sort(list.begin(), list.end(),
+                      [](const detail::Cleanup_link& x, const detail::Cleanup_link& y) { return x.other < y.other; });
+            out = 0;
+            for (std::size_t i = 0; i < list.size(); ++i) {
+                if (out > 0 && list[out - 1].other == list[i].other) list[out - 1].length += list[i].length;
+                else list[out++] = list[i];
+            }
+            list.resize(out);
+            const detail::Cleanup_link* best = nullptr;
+            for (const detail::Cleanup_link& link : list)
+                if (!best || link.length > best->length) best = &link;
+            if (best) heap.push({ best->length, c, best->other, version[c] });
+        };
+        for (std::uint32_t c = 0; c < num_components; ++c)
+            if (small[c]) push_best(c);
+
+        while (!heap.empty()) {
+            const detail::Cleanup_candidate top = heap.top();
+            heap.pop();
+            const std::uint32_t c = top.from;
+            if (!components.is_root(c) || version[c] != top.version || area[c] >= min_area) continue;
+            const std::uint32_t target = components.find(top.into);
+            if (target != top.into || target == c) {
+                // The neighbour was merged since; look again
+                push_best(c);
+                continue;
+            }
+            components.unite(c, target);
+            const std::uint32_t root = components.find(c), other = root == c ? target : c;
+            area[root] = area[c] + area[target];
+            ++num_merged;
+            if (area[root] < min_area) {
+                // Both were small, so both have their links
+                links[root].insert(links[root].end(), links[other].begin(), links[other].end());
+                std::vector<detail::Cleanup_link>().swap(links[other]);
+                ++version[root];
+                push_best(root);
+            } else {
+                std::vector<detail::Cleanup_link>().swap(links[c]);
+                std::vector<detail::Cleanup_link>().swap(links[target]);
+            }
+        }
+    }
+
+    counted_vector<std::uint32_t> segment_label;
+    const std::uint32_t num_segments = number_roots(components, segment_label);
+    parallel_for(num_faces, [&](std::size_t f) {
+        face_labels[f] = segment_label[components.find(face_component[f])];
+    });
+    if (stats) {
+        stats->num_components = num_components;
+        stats->num_merged = num_merged;
+        stats->num_segments = num_segments;
+    }
+    return num_segments;
+}
+
+// Cleans up the segment IDs of a mesh in place; components smaller than
+// min_area_fraction of the total surface area are merged into neighbours.
+template <class Mesh, class SegmentMap>
+std::size_t clean_segments(const Mesh& mesh, const Face_adjacency& adj, SegmentMap& segment_map,
+                           double min_area_fraction, Segment_cleanup_stats* stats = nullptr) {
+    typedef typename Mesh::Face_index Face_index;
+    const std::size_t num_faces = mesh.number_of_faces();
+    counted_vector<float> areas(num_faces);
+    counted_vector<std::uint32_t> labels(num_faces);
+    parallel_for(num_faces, [&](std::size_t f) {
+        const Face_index fd(static_cast<typename Mesh::size_type>(f));
+        areas[f] = static_cast<float>(detail::face_area(mesh, fd));
+        labels[f] = static_cast<std::uint32_t>(segment_map[fd]);
+    });
+    double total_area = 0;
+    for (std::size_t f = 0; f < num_faces; ++f) total_area += areas[f];
+
+    const std::size_t num_segments =
+        clean_segments(adj, areas.data(), labels.data(), min_area_fraction * total_area, stats);
+    parallel_for(num_faces, [&](std::size_t f) {
+        segment_map[Face_index(static_cast<typename Mesh::size_type>(f))] = labels[f];
+    });
+    return num_segments;
+}
+
+} // namespace mesh_tools
+
+#endif // SEGMENT_CLEANUP_H
@@ -0,0 +1,254 @@
+#ifndef SEGMENT_VIEW_H
+#define SEGMENT_VIEW_H
+
+#include <CGAL/Surface_mesh.h>
+#include <CGAL/boost/graph/helpers.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "memory_stats.h"
+#include "mesh_io.h"
+#include "parallel.h"
+
+namespace mesh_tools {
+
+// Faces of a mesh grouped by segment ID. The faces of segment s are
+// faces[offsets[s] .. offsets[s + 1]), in increasing face index order.
+struct Segment_buckets {
+    counted_vector<std::uint32_t> offsets;   // num_segments() + 1 entries
+    counted_vector<std::uint32_t> faces;
+
+    std::size_t num_segments() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+    std::size_t size(std::size_t s) const { return offsets[s + 1] - offsets[s]; }
+    const std::uint32_t* begin(std::size_t s) const { return faces.data() + offsets[s]; }
+};
+
+// A segment of a triangle mesh seen through its parent, without copying any
+// geometry. Local vertex i is parent vertex vertices[i]; corners holds three
+// local vertex indices per face, in the order of the face span.
+struct Segment_view {
+    std::size_t segment_id = 0;
+    const std::uint32_t* faces = nullptr;   // points into Segment_buckets::faces
+    std::size_t num_faces = 0;
+    counted_vector<std::uint32_t> vertices;
+    counted_vector<std::uint32_t> corners;
+    CGAL::Bbox_3 bbox;
+
+    std::size_t num_vertices() const { return vertices.size(); }
+    bool empty() const { return num_faces == 0; }
+};
+
+// Groups all faces by segment ID with a counting sort: one pass to count, a
+// prefix sum and one pass to scatter, so O(F + num_segments) overall.
+// Faces whose ID is >= num_segments are ignored.
+template <class Mesh, class SegmentMap>
+Segment_buckets bucket_faces_by_segment(const Mesh& mesh, const SegmentMap& segment_map, std::size_t num_segments) {
+    typedef typename Mesh::Face_index Face_index;
+    MESH_TRACE_SCOPE("bucket_faces_by_segment");
+
+    const std::size_t num_faces = mesh.number_of_faces();
+    Segment_buckets buckets;
+    buckets.offsets.assign(num_segments + 1, 0);
+
+    counted_vector<std::uint32_t> label(num_faces);
+    for (std::size_t f = 0; f < num_faces; ++f) {
+        const std::size_t s = segment_map[Face_index(static_cast<typename Mesh::size_type>(f))];
+        label[f] = static_cast<std::uint32_t>(s);
+        if (s < num_segments) ++buckets.offsets[s + 1];
+    }
+    for (std::size_t s = 0; s < num_segments; ++s)
+        buckets.offsets[s + 1] += buckets.offsets[s];
+
+    buckets.faces.resize(buckets.offsets[num_segments]);
+    std::vector<std::uint32_t> cursor(buckets.offsets.begin(), buckets.offsets.end() - 1);
+    for (std::size_t f = 0; f < num_faces; ++f) {
+        if (label[f] < num_segments)
+            buckets.faces[cursor[label[f]]++] = static_cast<std::uint32_t>(f);
+    }
+    return buckets;
+}
+
+// Builds one view per segment, in parallel over segments. Each thread keeps a
+// parent-to-local vertex table that is reset only at the entries it touched,
+// so the cost per segment is proportional to the segment, not to the mesh.
+// Throws std::invalid_argument if the mesh has faces other than triangles,
+// whose corners past the third would be lost.
+template <class Mesh>
+std::vector<Segment_view> make_segment_views(const Mesh& mesh, const Segment_buckets& buckets) {
+    typedef typename Mesh::Face_index Face_index;
+    typedef typename Mesh::Halfedge_index Halfedge_index;
+    MESH_TRACE_SCOPE("make_segment_views");
+    if (!CGAL::is_triangle_mesh(mesh)) throw std::invalid_argument("segment views need a triangle mesh");
+
+    const std::uint32_t unset = std::numeric_limits<std::uint32_t>::max();
+    const std::size_t num_vertices = mesh.number_of_vertices();
+    std::vector<Segment_view> views(buckets.num_segments());
+
+    parallel_for_chunks(views.size(), [&](std::size_t begin, std::size_t end) {
+        counted_vector<std::uint32_t> local(num_vertices, unset);
+        for (std::size_t s = begin; s < end; ++s) {
+            Segment_view& view = views[s];
+            view.segment_id = s;
+            view.faces = buckets.begin(s);
+            view.num_faces = buckets.size(s);
+            view.corners.resize(view.num_faces * 3);
+
+            for (std::size_t i = 0; i < view.num_faces; ++i) {
+                Halfedge_index h = mesh.halfedge(Face_index(static_cast<typename Mesh::size_type>(view.faces[i])));
+                for (int c = 0; c < 3; ++c) {
+                    const std::uint32_t v = static_cast<std::uint32_t>(mesh.target(h).idx());
+                    if (local[v] == unset) {
+                        local[v] = static_cast<std::uint32_t>(view.vertices.size());
+                        view.vertices.push_back(v);
+                        view.bbox = view.bbox + mesh.point(mesh.target(h)).bbox();
+                    }
+                    view.corners[i * 3 + c] = local[v];
+                    h = mesh.next(h);
+                }
+            }
+
+            for (std::uint32_t v : view.vertices) local[v] = unset;
+        }
+    }, 1);
+    return views;
+}
+
+// Size, value range and orientation of one segment, for display.
+struct Segment_stats {
+    std::size_t num_faces = 0;
+    double area = 0;
+    double value_min = 0;             // range of the per-face values, e.g. SDF
+    double value_max = 0;
+    double normal[3] = {0, 0, 0};     // area weighted mean face normal, unit length unless it cancels out
+};
+
+// Computes the stats of every segment from its bucket, in parallel over
+// segments. value_map gives a scalar per face, usually the SDF values the
+// segmentation was computed from.
+template <class Mesh, class ValueMap>
+std::vector<Segment_stats> compute_segment_stats(const Mesh& mesh, const Segment_buckets& buckets,
+                                                 const ValueMap& value_map) {
+    typedef typename Mesh::Face_index Face_index;
+    MESH_TRACE_SCOPE("compute_segment_stats");
+
+    std::vector<Segment_stats> stats(buckets.num_segments());
+    parallel_for(stats.size(), [&](std::size_t s) {
+        Segment_stats& st = stats[s];
+        st.num_faces = buckets.size(s);
+        st.value_min = std::numeric_limits<double>::max();
+        st.value_max = -std::numeric_limits<double>::max();
+        for (std::size_t i = 0; i < st.num_faces; ++i) {
+            const Face_index f(static_cast<typename Mesh::size_type>(buckets.begin(s)[i]));
+            const double value = value_map[f];
+            st.value_min = std::min(st.value_min, value);
+            st.value_max = std::max(st.value_max, value);
+
+            // Twice the area times the unit normal, summed over a fan of the face
+            auto h = mesh.halfedge(f);
+            const auto& a = mesh.point(mesh.target(h));
+            double face_normal[3] = {0, 0, 0};
+            for (h = mesh.next(h); mesh.next(h) != mesh.halfedge(f); h = mesh.next(h)) {
+                const auto& b = mesh.point(mesh.target(h));
+                const auto& c = mesh.point(mesh.target(mesh.next(h)));
+                const double u[3] = {CGAL::to_double(b.x() - a.x()), CGAL::to_double(b.y() - a.y()),
+                                     CGAL::to_double(b.z() - a.z())};
+                const double w[3] = {CGAL::to_double(c.x() - a.x()), CGAL::to_double(c.y() - a.y()),
+                                     CGAL::to_double(c.z() - a.z())};
+                face_normal[0] += u[1] * w[2] - u[2] * w[1];
+                face_normal[1] += u[2] * w[0] - u[0] * w[2];
+                face_normal[2] += u[0] * w[1] - u[1] * w[0];
+            }
+            st.area += 0.5 * std::sqrt(face_normal[0] * face_normal[0] + face_normal[1] * face_normal[1] +
+                                       face_normal[2] * face_normal[2]);
+            for (int j = 0; j < 3; ++j) st.normal[j] += face_normal[j];
+        }
+        if (st.num_faces == 0) st.value_min = st.value_max = 0;
+        const double len = std::sqrt(st.normal[0] * st.normal[0] + st.normal[1] * st.normal[1] +
+                                     st.normal[2] * st.normal[2]);
+        if (len > 0)
+            for (int j = 0; j < 3; ++j) st.normal[j] /= len;
+    }, 1);
+    return stats;
+}
+
+enum class Segment_file_format { STL, OFF };
+
+namespace detail {
+
+template <class Mesh>
+bool write_segment_stl(const Mesh& mesh, const Segment_view& view, const std::string& filename) {
+    typedef typename Mesh::Face_index Face_index;
+
+    const std::string header = "segment " + std::to_string(view.segment_id);
+    try {
+        return stl_writer::WriteStlFile_BINARY(filename.c_str(), view.num_faces,
+            [&](std::size_t i, float* record, std::uint16_t& attribute) {
+                face_stl_record(mesh, Face_index(static_cast<typename Mesh::size_type>(view.faces[i])), record);
+                attribute = static_cast<std::uint16_t>(view.segment_id);
+            }, header.c_str());
+    } catch (const memory::Budget_exceeded&) {
+        throw;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+template <class Mesh>
+bool write_segment_off(const Mesh& mesh, const Segment_view& view, const std::string& filename) {
+    typedef typename Mesh::Vertex_index Vertex_index;
+
+    std::FILE* out = std::fopen(filename.c_str(), "w");
+    if (!out) return false;
+
+    bool ok = std::fprintf(out, "OFF\n%zu %zu 0\n", view.num_vertices(), view.num_faces) > 0;
+    for (std::size_t i = 0; ok && i < view.num_vertices(); ++i) {
+        const auto& p = mesh.point(Vertex_index(view.vertices[i]));
+        ok = std::fprintf(out, "%.17g %.17g %.17g\n", CGAL::to_double(p.x()), CGAL::to_double(p.y()),
+                          CGAL::to_double(p.z())) > 0;
+    }
+    for (std::size_t i = 0; ok && i < view.num_faces; ++i) {
+        ok = std::fprintf(out, "3 %u %u %u\n",
+                          view.corners[i * 3], view.corners[i * 3 + 1], view.corners[i * 3 + 2]) > 0;
+    }
+    return std::fclose(out) == 0 && ok;
+}
+
+} // namespace detail
+
+// File name used for segment s by export_segments: "<prefix>_<s>.stl" or ".off".
+inline std::string segment_filename(const std::string& prefix, std::size_t s, Segment_file_format format) {
+    return prefix + "_" + std::to_string(s) + (format == Segment_file_format::STL ? ".stl" : ".off");
+}
+
+// Writes every non-empty segment to its own file, one segment per thread.
+// Returns the number of segments that could not be written.
+template <class Mesh>
+std::size_t export_segments(const Mesh& mesh, const std::vector<Segment_view>& views,
+                            const std::string& prefix, Segment_file_format format) {
+    MESH_TRACE_SCOPE("export_segments");
+    std::vector<char> failed(views.size(), 0);
+    parallel_for(views.size(), [&](std::size_t s) {
+        if (views[s].empty()) return;
+        const std::string filename = segment_filename(prefix, views[s].segment_id, format);
+        const bool ok = format == Segment_file_format::STL
+            ? detail::write_segment_stl(mesh, views[s], filename)
+            : detail::write_segment_off(mesh, views[s], filename);
+        failed[s] = !ok;
+    }, 1);
+
+    std::size_t num_failed = 0;
+    for (char f : failed) num_failed += f;
+    return num_failed;
+}
+
+} // namespace mesh_tools
+
+#endif // SEGMENT_VIEW_H
@@ -0,0 +1,221 @@
+#ifndef SOCKET_SERVER_H
+#define SOCKET_SERVER_H
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "memory_stats.h"
+#include "parallel.h"
+
+namespace mesh_tools {
+
+struct Socket_server_params {
+    unsigned num_threads = 0;       // connections served at once, 0 for num_threads()
+    int poll_interval_ms = 200;     // how often idle threads look for a stop request
+    std::size_t max_request = 1 << 16;   // longest request line in bytes
+};
+
+namespace detail {
+
+inline volatile std::sig_atomic_t& stop_signal() {
+    static volatile std::sig_atomic_t signal = 0;
+    return signal;
+}
+
+inline void on_stop_signal(int) { stop_signal() = 1; }
+
+inline bool send_all(int fd, const char* data, std::size_t size) {
+    while (size > 0) {
+        const ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+} // namespace detail
+
+// Serves line based requests on a Unix domain socket until the handler asks
+// to stop or the process gets SIGINT or SIGTERM. handler(request, reply) is
+// called with each request line, without its newline, and fills in the reply,
+// which is sent as is and may hold binary data; it returns false to stop the
+// server once the reply is sent. Exceptions other than Budget_exceeded become
+// an "ERR" reply.
+//
+// Accepted connections are queued for a fixed pool of threads, and each one
+// is served by a single thread until the client closes it, so requests on one
+// connection are answered in order while up to num_threads connections are
+// served at once. A stale socket file at path is replaced, but not one that a
+// running server still accepts connections on.
+template <class Handler>
+bool run_socket_server(const std::string& path, Handler handler,
+                       const Socket_server_params& params = Socket_server_params()) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path must have 1 to " << sizeof(address.sun_path) - 1 << " characters: " << path
+                  << std::endl;
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+
+    const int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        std::cerr << "Failed to create socket: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (::stat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+        const int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        const bool in_use = probe >= 0 &&
+                            ::connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+        if (probe >= 0) ::close(probe);
+        if (in_use) {
+            std::cerr << "Socket " << path << " is in use by another server" << std::endl;
+            ::close(listener);
+            return false;
+        }
+        ::unlink(path.c_str());
+    }
+    if (::bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+        ::listen(listener, SOMAXCONN) != 0) {
+        std::cerr << "Failed to listen on " << path << ": " << std::strerror(errno) << std::endl;
+        ::close(listener);
+        return false;
+    }
+
+    std::atomic<bool> stop(false);
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<int> connections;
+    std::exception_ptr error;
+
+    auto serve = [&](int fd) {
+        std::string buffer, reply;
+        char chunk[4096];
+        std::size_t scanned = 0;
+        while (!stop) {
+            const std::size_t newline = buffer.find('\n', scanned);
+            if (newline != std::string::npos) {
+                std::string request = buffer.substr(0, newline);
+                buffer.erase(0, newline + 1);
+                scanned = 0;
+                if (!request.empty() && request.back() == '\r') request.pop_back();
+                reply.clear();
+                bool keep_running = true;
+                try {
+                    keep_running = handler(request, reply);
+                } catch (const memory::Budget_exceeded&) {
+                    throw;
+                } catch (const std::exception& e) {
+                    reply = std::string("ERR ") + e.what() + "\n";
+                }
+                if (!detail::send_all(fd, reply.data(), reply.size())) break;
+                if (!keep_running) stop = true;
+                continue;
+            }
+            scanned = buffer.size();
+            if (buffer.size() > params.max_request) {
+                const char* message = "ERR request too long\n";
+                detail::send_all(fd, message, std::strlen(message));
+                break;
+            }
+            pollfd p = { fd, POLLIN, 0 };
+            const int n = ::poll(&p, 1, params.poll_interval_ms);
+            if (n < 0 && errno != EINTR) break;
+            if (n <= 0) continue;
+            const ssize_t received = ::recv(fd, chunk, sizeof(chunk), 0);
+            if (received < 0 && errno == EINTR) continue;
+            if (received <= 0) break;
+            buffer.append(chunk, static_cast<std::size_t>(received));
+        }
+        ::close(fd);
+    };
+
+    const unsigned pool_size = params.num_threads > 0 ? params.num_threads : num_threads();
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < pool_size; ++t) {
+        pool.emplace_back([&]() {
+            for (;;) {
+                int fd;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ready.wait(lock, [&]() { return stop || !connections.empty(); });
+                    if (stop) return;
+                    fd = connections.front();
+                    connections.pop_front();
+                }
+                try {
+                    serve(fd);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error) error = std::current_exception();
+                    stop = true;
+                }
+            }
+        });
+    }
+
+    detail::stop_signal() = 0;
+    struct sigaction action, previous_int, previous_term;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = detail::on_stop_signal;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGINT, &action, &previous_int);
+    ::sigaction(SIGTERM, &action, &previous_term);
+
+    bool ok = true;
+    while (!stop && !detail::stop_signal()) {
+        pollfd p = { listener, POLLIN, 0 };
+        const int n = ::poll(&p, 1, params.poll_interval_ms);
+        if (n < 0 && errno != EINTR) {
+            std::cerr << "Failed to wait for connections: " << std::strerror(errno) << std::endl;
+            ok = false;
+            break;
+        }
+        if (n <= 0) continue;
+        const int fd = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+        std::lock_guard<std::mutex> lock(mutex);
+        connections.push_back(fd);
+        ready.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+        for (int fd : connections) ::close(fd);
+        connections.clear();
+    }
+    ready.notify_all();
+    for (std::thread& thread : pool) thread.join();
+    ::close(listener);
+    ::unlink(path.c_str());
+    ::sigaction(SIGINT, &previous_int, nullptr);
+    ::sigaction(SIGTERM, &previous_term, nullptr);
+    if (error) std::rethrow_exception(error);
+    return ok;
+}
+
+} // namespace mesh_tools
+
+#endif // SOCKET_SERVER_H
@@ -1,12 +1,11 @@
 #include <CGAL/Simple_cartesian.h>
 #include <CGAL/Surface_mesh.h>
-#include <CGAL/IO/STL.h>      // for read_STL
 #include <CGAL/IO/OFF.h>      // for write_OFF
-#include <vector>
-#include <array>
 #include <fstream>
 #include <iostream>
 
+#include "mesh_io.h"          // for read_STL
+
 int main(int argc, char** argv) {
     if (argc != 3) {
         std::cerr << "Usage: stl_to_off <input.stl> <output.off>\n";
@@ -19,24 +18,19 @@ int main(int argc, char** argv) {
     typedef Kernel::Point_3 Point;
     CGAL::Surface_mesh<Point> mesh;
 
-    // Read STL into a list of points and triangles
-    std::vector<Point> points;
-    std::vector<std::array<int,3>> triangles;
-    if (!CGAL::IO::read_STL(stl_file, points, triangles)) {
+    // Read and weld the STL, then build the surface mesh from the welded arrays
+    mesh_tools::Mesh_build_report report;
+    if (!mesh_tools::read_STL(stl_file, mesh, &report)) {
         std::cerr << "Error: cannot read STL file '" << stl_file << "'\n";
         return 1;
     }
 
-    // Build the surface mesh from the triangle soup
-    std::vector<CGAL::Surface_mesh<Point>::Vertex_index> vmap;
-    vmap.reserve(points.size());
-    for (const auto& p : points) {
-        // Add each point as a vertex in the mesh
-        vmap.push_back(mesh.add_vertex(p));
+    // Faces that could not be added are reported instead of silently dropped
+    for (const auto& e : report.non_manifold_edges) {
+        std::cerr << "Warning: face skipped on non-manifold edge (" << e.first << ", " << e.second << ")\n";
     }
-    for (const auto& tri : triangles) {
-        // Add each triangle as a face (indices assume 0-based)
-        mesh.add_face(vmap[tri[0]], vmap[tri[1]], vmap[tri[2]]);
+    if (report.num_non_manifold_vertices > 0) {
+        std::cerr << "Warning: " << report.num_non_manifold_vertices << " non-manifold vertices\n";
     }
 
     // Write the mesh to OFF
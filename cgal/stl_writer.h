@@ -0,0 +1,297 @@
+
+
+#ifndef __H__STL_WRITER
+#define __H__STL_WRITER
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "parallel.h"
+#include "stl_reader.h"
+
+#ifdef STL_WRITER_NO_EXCEPTIONS
+  #define STL_WRITER_THROW(msg) return false;
+  #define STL_WRITER_COND_THROW(cond, msg) if(cond) return false;
+#else
+  /// Throws an std::runtime_error with the given message.
+  #define STL_WRITER_THROW(msg) {std::stringstream ss; ss << msg; throw(std::runtime_error(ss.str()));}
+
+  /// Throws an std::runtime_error with the given message, if the given condition evaluates to true.
+  #define STL_WRITER_COND_THROW(cond, msg)  if(cond){std::stringstream ss; ss << msg; throw(std::runtime_error(ss.str()));}
+#endif
+
+
+namespace stl_writer {
+
+/// Size of a single triangle record in a binary stl file
+const size_t STL_RECORD_SIZE = 50;
+
+/// Number of records which are encoded in memory before being written with a single call
+const size_t STL_RECORDS_PER_CHUNK = 1 << 17;
+
+/// Writes triangles provided by a callback to a binary stl file
+/** The callback is invoked as `getTri(i, record, attribute)` for every
+ * `0 <= i < numTris`, where `record` points to 12 floats which have to be
+ * filled with the normal followed by the three corner coordinates, and
+ * `attribute` is the 16 bit value stored in the 'attribute byte count' field
+ * of the record (it is initialized to 0).
+ *
+ * Records are encoded chunk by chunk into a page-aligned buffer, each chunk in
+ * parallel, and each chunk is written with a single pwrite call. The callback
+ * therefore has to be safe to call from several threads at once.
+ *
+ * \param filename  [in] The name of the file which shall be written
+ * \param numTris   [in] The number of triangles which will be written
+ * \param getTri    [in] Callback which provides the data of the i-th triangle
+ * \param header    [in] Optional text for the 80 byte header. Must not start with "solid".
+ *
+ * \returns true if the file was written successfully.
+ * \todo  support systems with big endianess
+ */
+template <class TTriangleCallback>
+bool WriteStlFile_BINARY(const char* filename,
+                         size_t numTris,
+                         TTriangleCallback getTri,
+                         const char* header = NULL);
+
+/// Writes the given arrays to a binary stl file
+/** The arrays use the layout produced by stl_reader::ReadStlFile.
+ *
+ * \param coords  [in] 3 coordinates per vertex
+ * \param normals [in] 3 coordinates per triangle
+ * \param tris    [in] 3 corner indices per triangle
+ * \param attributes  [in] Optional 16 bit value per triangle, e.g. a segment ID.
+ *                         May be NULL, in which case 0 is written.
+ */
+template <class TNumberContainer1, class TNumberContainer2, class TIndexContainer>
+bool WriteStlFile_BINARY(const char* filename,
+                         const TNumberContainer1& coords,
+                         const TNumberContainer2& normals,
+                         const TIndexContainer& tris,
+                         const uint16_t* attributes = NULL);
+
+/// Writes an StlMesh or a subset of its triangles to a binary stl file
+/** \param mesh        [in] The mesh which shall be written.
+ * \param triLabels   [in] Optional 16 bit label per triangle (e.g. a segment ID),
+ *                         which is stored in the attribute field. May be NULL.
+ * \param onlyLabel   [in] If non-negative, only triangles whose label equals
+ *                         onlyLabel are written. Requires triLabels.
+ */
+template <class TNumber, class TIndex, class TStorage>
+bool WriteStlMesh_BINARY(const char* filename,
+                         const stl_reader::StlMesh<TNumber, TIndex, TStorage>& mesh,
+                         const uint16_t* triLabels = NULL,
+                         int onlyLabel = -1);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//  IMPLEMENTATION
+////////////////////////////////////////////////////////////////////////////////
+
+
+namespace stl_writer_impl {
+
+  // page aligned scratch buffer for encoded records
+  class AlignedBuffer {
+  public:
+    explicit AlignedBuffer (size_t size) : m_data (NULL)
+    {
+      void* p = NULL;
+      if (posix_memalign (&p, 4096, std::max<size_t> (size, 1)) == 0)
+        m_data = static_cast<char*> (p);
+    }
+
+    ~AlignedBuffer ()  {free (m_data);}
+
+    char* data ()  {return m_data;}
+
+  private:
+    AlignedBuffer (const AlignedBuffer&);
+    AlignedBuffer& operator = (const AlignedBuffer&);
+
+    char* m_data;
+  };
+
+  // closes a file descriptor on every exit path, also when a triangle
+  // callback throws; Close() reports whether the final close succeeded
+  class FileCloser {
+  public:
+    explicit FileCloser (int fd) : m_fd (fd)  {}
+
+    ~FileCloser ()  {if (m_fd >= 0) close (m_fd);}
+
+    bool Close ()
+    {
+      const int fd = m_fd;
+      m_fd = -1;
+      return fd >= 0 && close (fd) == 0;
+    }
+
+  private:
+    FileCloser (const FileCloser&);
+    FileCloser& operator = (const FileCloser&);
+
+    int m_fd;
+  };
+
+  // writes all of data at the given offset, retrying on partial writes
+  inline bool PWriteAll (int fd, const char* data, size_t size, off_t offset)
+  {
+    while (size > 0) {
+      const ssize_t written = pwrite (fd, data, size, offset);
+      if (written < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      data += written;
+      size -= static_cast<size_t> (written);
+      offset += written;
+    }
+    return true;
+  }
+
+  // normal of the triangle abc, or the zero vector for degenerate triangles
+  inline void TriNormal (const float* a, const float* b, const float* c, float* n)
+  {
+    const float u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    const float v[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    n[0] = u[1] * v[2] - u[2] * v[1];
+    n[1] = u[2] * v[0] - u[0] * v[2];
+    n[2] = u[0] * v[1] - u[1] * v[0];
+    const float len = std::sqrt (n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    for (int i = 0; i < 3; ++i)
+      n[i] = len > 0 ? n[i] / len : 0;
+  }
+}// end of namespace stl_writer_impl
+
+
+template <class TTriangleCallback>
+bool WriteStlFile_BINARY(const char* filename,
+                         size_t numTris,
+                         TTriangleCallback getTri,
+                         const char* header)
+{
+  using namespace std;
+  using namespace stl_writer_impl;
+  MESH_TRACE_SCOPE("WriteStlFile_BINARY");
+
+  STL_WRITER_COND_THROW(numTris > 0xFFFFFFFFu,
+    "Too many triangles for a binary stl file " << filename << ": " << numTris);
+
+  const int fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  STL_WRITER_COND_THROW(fd < 0, "Couldnt open file " << filename);
+  FileCloser closer (fd);
+
+  char head[84];
+  memset (head, 0, sizeof(head));
+  if (header)
+    strncpy (head, header, 80);
+  const uint32_t numTris32 = static_cast<uint32_t> (numTris);
+  memcpy (head + 80, &numTris32, 4);
+
+  bool ok = PWriteAll (fd, head, sizeof(head), 0);
+
+  const size_t chunkRecords = min (numTris, STL_RECORDS_PER_CHUNK);
+  AlignedBuffer buffer (chunkRecords * STL_RECORD_SIZE);
+  ok = ok && (buffer.data() != NULL || chunkRecords == 0);
+
+  for (size_t first = 0; ok && first < numTris; first += chunkRecords) {
+    const size_t count = min (chunkRecords, numTris - first);
+    char* chunk = buffer.data();
+
+    mesh_tools::parallel_for_chunks (count, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        float record[12];
+        uint16_t attribute = 0;
+        getTri (first + i, record, attribute);
+        char* dest = chunk + i * STL_RECORD_SIZE;
+        memcpy (dest, record, 48);
+        memcpy (dest + 48, &attribute, 2);
+      }
+    }, 8192);
+
+    ok = PWriteAll (fd, chunk, count * STL_RECORD_SIZE,
+                    static_cast<off_t> (84 + first * STL_RECORD_SIZE));
+  }
+
+  ok = closer.Close() && ok;
+  STL_WRITER_COND_THROW(!ok, "Error while writing binary stl file " << filename);
+  return ok;
+}
+
+
+template <class TNumberContainer1, class TNumberContainer2, class TIndexContainer>
+bool WriteStlFile_BINARY(const char* filename,
+                         const TNumberContainer1& coords,
+                         const TNumberContainer2& normals,
+                         const TIndexContainer& tris,
+                         const uint16_t* attributes)
+{
+  return WriteStlFile_BINARY (filename, tris.size() / 3,
+    [&](size_t itri, float* record, uint16_t& attribute) {
+      for (size_t i = 0; i < 3; ++i)
+        record[i] = static_cast<float> (normals[itri * 3 + i]);
+      for (size_t icorner = 0; icorner < 3; ++icorner) {
+        const size_t ci = static_cast<size_t> (tris[itri * 3 + icorner]) * 3;
+        for (size_t i = 0; i < 3; ++i)
+          record[3 + icorner * 3 + i] = static_cast<float> (coords[ci + i]);
+      }
+      if (attributes)
+        attribute = attributes[itri];
+    });
+}
+
+
+template <class TNumber, class TIndex, class TStorage>
+bool WriteStlMesh_BINARY(const char* filename,
+                         const stl_reader::StlMesh<TNumber, TIndex, TStorage>& mesh,
+                         const uint16_t* triLabels,
+                         int onlyLabel)
+{
+  using namespace std;
+
+  STL_WRITER_COND_THROW(onlyLabel >= 0 && !triLabels,
+    "A label filter requires triangle labels when writing " << filename);
+
+//  collect the selected triangles first, so that records can be encoded
+//  independently of each other.
+  vector<TIndex> selected;
+  if (onlyLabel >= 0) {
+    for (size_t itri = 0; itri < mesh.num_tris(); ++itri) {
+      if (triLabels[itri] == onlyLabel)
+        selected.push_back (static_cast<TIndex> (itri));
+    }
+  }
+
+  const size_t numTris = onlyLabel >= 0 ? selected.size() : mesh.num_tris();
+  return WriteStlFile_BINARY (filename, numTris,
+    [&](size_t i, float* record, uint16_t& attribute) {
+      const size_t itri = onlyLabel >= 0 ? static_cast<size_t> (selected[i]) : i;
+      const typename TStorage::coord_t n = mesh.tri_normal (itri);
+      for (size_t j = 0; j < 3; ++j)
+        record[j] = static_cast<float> (n[j]);
+      for (size_t icorner = 0; icorner < 3; ++icorner) {
+        const typename TStorage::coord_t c = mesh.tri_corner_coords (itri, icorner);
+        for (size_t j = 0; j < 3; ++j)
+          record[3 + icorner * 3 + j] = static_cast<float> (c[j]);
+      }
+      if (triLabels)
+        attribute = triLabels[itri];
+    });
+}
+
+} // end of namespace stl_writer
+
+#endif  //__H__STL_WRITER
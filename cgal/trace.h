@@ -0,0 +1,212 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Scoped tracing of pipeline stages. Each thread records complete spans
+// (name, start, duration) into its own fixed size ring buffer, so recording
+// takes no lock; when a buffer is full the oldest spans are overwritten.
+// Recording is off until trace::start() is called, and the whole layer is
+// compiled out when MESH_TRACE_DISABLED is defined. Spans are exported as
+// Chrome trace event JSON, which chrome://tracing and Perfetto can open.
+//
+//     MESH_TRACE_SCOPE("sdf_values");   // span until the end of the block
+//
+// Span names must outlive the trace, i.e. be string literals. This header is
+// shared by the CGAL tools and the viewer and must stay C++11 compatible.
+// Include it before stl_reader.h to trace the reader stages as well.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mesh_tools {
+namespace trace {
+
+// Number of spans kept per thread.
+const std::size_t RING_CAPACITY = 1 << 15;
+
+struct Event {
+    const char* name;
+    std::uint64_t begin_ns;
+    std::uint64_t duration_ns;
+};
+
+namespace detail {
+
+inline std::uint64_t now_ns() {
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Ring buffer of one thread. Only the owning thread writes, into storage that
+// is reserved up front; the count is published with release semantics so
+// that export sees complete events.
+// Buffers are returned to the registry when their thread exits and reused by
+// the next new thread, so short-lived workers share a bounded set of lanes.
+struct Thread_buffer {
+    explicit Thread_buffer(unsigned id) : tid(id), count(0) {}
+
+    void push(const Event& e) {
+        const std::uint64_t n = count.load(std::memory_order_relaxed);
+        if (events.capacity() < RING_CAPACITY) events.reserve(RING_CAPACITY);
+        if (events.size() < RING_CAPACITY) events.push_back(e);
+        else events[n % RING_CAPACITY] = e;
+        count.store(n + 1, std::memory_order_release);
+    }
+
+    unsigned tid;
+    std::vector<Event> events;
+    std::atomic<std::uint64_t> count;
+};
+
+class Registry {
+public:
+    Registry() : enabled(false), epoch_ns(now_ns()) {}
+
+    std::shared_ptr<Thread_buffer> acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!free_buffers.empty()) {
+            std::shared_ptr<Thread_buffer> buffer = free_buffers.back();
+            free_buffers.pop_back();
+            return buffer;
+        }
+        buffers.push_back(std::make_shared<Thread_buffer>(static_cast<unsigned>(buffers.size() + 1)));
+        return buffers.back();
+    }
+
+    void release(const std::shared_ptr<Thread_buffer>& buffer) {
+        std::lock_guard<std::mutex> lock(mutex);
+        free_buffers.push_back(buffer);
+    }
+
+    std::atomic<bool> enabled;
+    std::uint64_t epoch_ns;
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Thread_buffer>> buffers;
+    std::vector<std::shared_ptr<Thread_buffer>> free_buffers;
+};
+
+inline Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+struct Thread_slot {
+    Thread_slot() : buffer(registry().acquire()) {}
+    ~Thread_slot() { registry().release(buffer); }
+    std::shared_ptr<Thread_buffer> buffer;
+};
+
+inline Thread_buffer& thread_buffer() {
+    static thread_local Thread_slot slot;
+    return *slot.buffer;
+}
+
+inline void write_json_string(std::FILE* out, const char* s) {
+    std::fputc('"', out);
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') std::fputc('\\', out);
+        if (static_cast<unsigned char>(*s) >= 0x20) std::fputc(*s, out);
+    }
+    std::fputc('"', out);
+}
+
+} // namespace detail
+
+inline bool enabled() {
+    return detail::registry().enabled.load(std::memory_order_relaxed);
+}
+
+// Starts or stops recording. Spans already recorded are kept.
+inline void start() { detail::registry().enabled.store(true, std::memory_order_relaxed); }
+inline void stop() { detail::registry().enabled.store(false, std::memory_order_relaxed); }
+
+// Discards all recorded spans. Must not run concurrently with traced code.
+inline void clear() {
+    detail::Registry& r = detail::registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (std::size_t i = 0; i < r.buffers.size(); ++i) {
+        r.buffers[i]->events.clear();
+        r.buffers[i]->count.store(0, std::memory_order_relaxed);
+    }
+}
+
+// Records a span for the lifetime of the object, if tracing is enabled when
+// the scope is entered.
+class Scope {
+public:
+    explicit Scope(const char* name) : m_name(name), m_begin(enabled() ? detail::now_ns() : 0) {}
+
+    ~Scope() {
+        if (m_begin == 0) return;
+        Event e;
+        e.name = m_name;
+        e.begin_ns = m_begin;
+        e.duration_ns = detail::now_ns() - m_begin;
+        detail::thread_buffer().push(e);
+    }
+
+private:
+    Scope(const Scope&);
+    Scope& operator=(const Scope&);
+
+    const char* m_name;
+    std::uint64_t m_begin;
+};
+
+// Writes all recorded spans as Chrome trace event JSON. Should be called while
+// no traced code runs, otherwise spans recorded meanwhile may be missing.
+inline bool write_chrome_json(const std::string& filename) {
+    detail::Registry& r = detail::registry();
+    std::FILE* out = std::fopen(filename.c_str(), "w");
+    if (!out) return false;
+
+    std::lock_guard<std::mutex> lock(r.mutex);
+    std::fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    bool first = true;
+    for (std::size_t b = 0; b < r.buffers.size(); ++b) {
+        const detail::Thread_buffer& buffer = *r.buffers[b];
+        const std::uint64_t count = buffer.count.load(std::memory_order_acquire);
+        const std::size_t size = static_cast<std::size_t>(std::min<std::uint64_t>(count, RING_CAPACITY));
+        std::fprintf(out, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+                          "\"args\": {\"name\": \"%s %u\"}}",
+                     first ? "" : ",", buffer.tid, buffer.tid == 1 ? "main" : "thread", buffer.tid);
+        first = false;
+        for (std::size_t i = 0; i < size; ++i) {
+            const Event& e = buffer.events[i];
+            std::fprintf(out, ",\n{\"name\": ");
+            detail::write_json_string(out, e.name);
+            std::fprintf(out, ", \"cat\": \"mesh\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, "
+                              "\"ts\": %.3f, \"dur\": %.3f}",
+                         buffer.tid, (e.begin_ns - r.epoch_ns) * 1e-3, e.duration_ns * 1e-3);
+        }
+    }
+    std::fprintf(out, "\n]}\n");
+    return std::fclose(out) == 0;
+}
+
+} // namespace trace
+} // namespace mesh_tools
+
+#define MESH_TRACE_CONCAT_(a, b) a##b
+#define MESH_TRACE_CONCAT(a, b) MESH_TRACE_CONCAT_(a, b)
+
+#ifdef MESH_TRACE_DISABLED
+  #define MESH_TRACE_SCOPE(name)
+#else
+  // Records a span named name until the end of the enclosing block.
+  #define MESH_TRACE_SCOPE(name) \
+      ::mesh_tools::trace::Scope MESH_TRACE_CONCAT(mesh_trace_scope_, __LINE__)(name)
+#endif
+
+// Hook used by stl_reader.h
+#ifndef STL_READER_TRACE_SCOPE
+  #define STL_READER_TRACE_SCOPE(name) MESH_TRACE_SCOPE(name)
+#endif
+
+#endif // TRACE_H
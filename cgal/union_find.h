@@ -0,0 +1,94 @@
+#ifndef UNION_FIND_H
+#define UNION_FIND_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "memory_stats.h"
+#include "parallel.h"
+
+namespace mesh_tools {
+
+// Disjoint sets over 0 .. size() - 1 that any number of threads may find and
+// unite concurrently without locks. Every root is the smallest element of its
+// set: unite() hangs the larger root below the smaller one with a single
+// compare-and-swap and retries if another thread got there first. find()
+// halves paths as it goes, also with compare-and-swap, so a lost race only
+// costs a shortcut. Because the final roots do not depend on the order of
+// the unions, the result is the same for any number of threads.
+class Concurrent_union_find {
+public:
+    Concurrent_union_find() = default;
+    explicit Concurrent_union_find(std::size_t n) { reset(n); }
+
+    // n singleton sets
+    void reset(std::size_t n) {
+        if (n != m_parent.size()) counted_vector<std::atomic<std::uint32_t>>(n).swap(m_parent);
+        for (std::size_t i = 0; i < n; ++i) m_parent[i].store(static_cast<std::uint32_t>(i), std::memory_order_relaxed);
+    }
+
+    std::size_t size() const { return m_parent.size(); }
+
+    std::uint32_t find(std::uint32_t x) {
+        std::uint32_t parent = m_parent[x].load(std::memory_order_relaxed);
+        while (parent != x) {
+            const std::uint32_t grandparent = m_parent[parent].load(std::memory_order_relaxed);
+            if (grandparent != parent)
+                m_parent[x].compare_exchange_weak(parent, grandparent, std::memory_order_relaxed);
+            x = parent;
+            parent = m_parent[x].load(std::memory_order_relaxed);
+        }
+        return x;
+    }
+
+    // True if a and b were in different sets.
+    bool unite(std::uint32_t a, std::uint32_t b) {
+        for (;;) {
+            a = find(a);
+            b = find(b);
+            if (a == b) return false;
+            if (a < b) std::swap(a, b);
+            std::uint32_t expected = a;
+            if (m_parent[a].compare_exchange_strong(expected, b, std::memory_order_acq_rel)) return true;
+        }
+    }
+
+    bool same(std::uint32_t a, std::uint32_t b) {
+        for (;;) {
+            a = find(a);
+            b = find(b);
+            if (a == b) return true;
+            // a may have been linked below another root since find(a)
+            if (m_parent[a].load(std::memory_order_acquire) == a) return false;
+        }
+    }
+
+    // Whether x is currently a root; only meaningful when no thread unites.
+    bool is_root(std::uint32_t x) const { return m_parent[x].load(std::memory_order_relaxed) == x; }
+
+private:
+    counted_vector<std::atomic<std::uint32_t>> m_parent;
+};
+
+// Numbers the sets of uf in order of their smallest element, in parallel,
+// and returns their count. label[r] is the number of the set with root r and
+// is left unspecified for other elements. No thread may unite meanwhile.
+inline std::uint32_t number_roots(Concurrent_union_find& uf, counted_vector<std::uint32_t>& label) {
+    const std::size_t n = uf.size();
+    label.resize(n);
+    counted_vector<std::uint32_t> roots;
+    parallel_gather(n, roots, [&](std::size_t begin, std::size_t end, std::vector<std::uint32_t>& out) {
+        for (std::size_t i = begin; i < end; ++i)
+            if (uf.is_root(static_cast<std::uint32_t>(i))) out.push_back(static_cast<std::uint32_t>(i));
+    });
+    parallel_for(roots.size(), [&](std::size_t r) { label[roots[r]] = static_cast<std::uint32_t>(r); });
+    return static_cast<std::uint32_t>(roots.size());
+}
+
+} // namespace mesh_tools
+
+#endif // UNION_FIND_H
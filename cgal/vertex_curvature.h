@@ -0,0 +1,255 @@
+#ifndef VERTEX_CURVATURE_H
+#define VERTEX_CURVATURE_H
+
+#include <CGAL/Surface_mesh.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "memory_stats.h"
+#include "parallel.h"
+#include "trace.h"
+
+namespace mesh_tools {
+
+// One-ring neighbourhoods of all vertices in compressed sparse row form.
+//
+// The ring of vertex v is the entries [offsets[v], offsets[v + 1]), in
+// counterclockwise order: face[i] is the face between neighbor[i] and the
+// next neighbour, which wraps around to the first one. A border vertex has
+// its gap last, with face no_face in its final entry.
+struct Vertex_rings {
+    static constexpr std::uint32_t no_face = 0xFFFFFFFFu;
+
+    counted_vector<std::uint32_t> offsets;     // num_vertices() + 1 entries
+    counted_vector<std::uint32_t> neighbor;    // index of the adjacent vertex
+    counted_vector<std::uint32_t> face;        // face after the neighbour, or no_face
+
+    std::size_t num_vertices() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+    std::size_t num_entries() const { return neighbor.size(); }
+    bool empty() const { return offsets.empty(); }
+
+    std::uint32_t begin(std::size_t v) const { return offsets[v]; }
+    std::uint32_t end(std::size_t v) const { return offsets[v + 1]; }
+    bool is_border(std::size_t v) const { return end(v) > begin(v) && face[end(v) - 1] == no_face; }
+
+    void clear() {
+        offsets.clear();
+        neighbor.clear();
+        face.clear();
+    }
+};
+
+// Differential quantities per vertex, as structure of arrays.
+struct Vertex_curvature {
+    counted_vector<float> k1, k2;                  // principal curvatures, k1 >= k2, positive where convex
+    counted_vector<float> normal_x, normal_y, normal_z;   // angle weighted unit normals
+    counted_vector<std::uint8_t> sharp_edges;      // incident edges sharper than the threshold
+
+    std::size_t size() const { return k1.size(); }
+    float mean(std::size_t v) const { return 0.5f * (k1[v] + k2[v]); }
+    float gaussian(std::size_t v) const { return k1[v] * k2[v]; }
+    // On a feature line when two sharp edges meet, a corner with more
+    bool is_feature(std::size_t v) const { return sharp_edges[v] > 0; }
+
+    void resize(std::size_t n) {
+        k1.resize(n);
+        k2.resize(n);
+        normal_x.resize(n);
+        normal_y.resize(n);
+        normal_z.resize(n);
+        sharp_edges.resize(n);
+    }
+};
+
+struct Curvature_params {
+    double sharp_angle = 45;    // degrees between face normals above which an edge is sharp
+};
+
+namespace detail {
+
+// First outgoing halfedge of a vertex's ring: the one after the border for a
+// border vertex, so the border gap comes last.
+template <class Mesh>
+typename Mesh::Halfedge_index first_outgoing(const Mesh& mesh, typename Mesh::Vertex_index v) {
+    const typename Mesh::Halfedge_index h0 = mesh.opposite(mesh.halfedge(v));
+    typename Mesh::Halfedge_index h = h0;
+    do {
+        if (mesh.is_border(h)) return mesh.opposite(mesh.prev(h));
+        h = mesh.opposite(mesh.prev(h));
+    } while (h != h0);
+    return h0;
+}
+
+} // namespace detail
+
+// Builds the one-ring CSR of all vertices. Degrees and entries are each
+// computed in a parallel pass; only the prefix sum over the degrees is serial.
+template <class Mesh>
+void build_vertex_rings(const Mesh& mesh, Vertex_rings& rings) {
+    typedef typename Mesh::Vertex_index Vertex_index;
+    typedef typename Mesh::Halfedge_index Halfedge_index;
+    MESH_TRACE_SCOPE("build_vertex_rings");
+
+    const std::size_t num_vertices = mesh.number_of_vertices();
+    rings.clear();
+    rings.offsets.resize(num_vertices + 1, 0);
+
+    parallel_for(num_vertices, [&](std::size_t v) {
+        const Vertex_index vd(static_cast<typename Mesh::size_type>(v));
+        if (mesh.is_isolated(vd)) return;
+        std::uint32_t degree = 0;
+        const Halfedge_index h0 = mesh.opposite(mesh.halfedge(vd));
+        Halfedge_index h = h0;
+        do {
+            ++degree;
+            h = mesh.opposite(mesh.prev(h));
+        } while (h != h0);
+        rings.offsets[v + 1] = degree;
+    });
+
+    for (std::size_t v = 0; v < num_vertices; ++v)
+        rings.offsets[v + 1] += rings.offsets[v];
+
+    const std::size_t num_entries = rings.offsets[num_vertices];
+    rings.neighbor.resize(num_entries);
+    rings.face.resize(num_entries);
+
+    parallel_for(num_vertices, [&](std::size_t v) {
+        const Vertex_index vd(static_cast<typename Mesh::size_type>(v));
+        if (mesh.is_isolated(vd)) return;
+        std::uint32_t e = rings.offsets[v];
+        const Halfedge_index h0 = detail::first_outgoing(mesh, vd);
+        Halfedge_index h = h0;
+        do {
+            rings.neighbor[e] = static_cast<std::uint32_t>(mesh.target(h).idx());
+            rings.face[e] = mesh.is_border(h) ? Vertex_rings::no_face : static_cast<std::uint32_t>(mesh.face(h).idx());
+            ++e;
+            h = mesh.opposite(mesh.prev(h));
+        } while (h != h0);
+    });
+}
+
+// Principal curvatures, normals and sharp edges of all vertices, in one
+// parallel pass over the rings; coords holds 3 floats per vertex.
+//
+// Each corner of the ring contributes to the cotangent Laplacian, whose
+// normal part over four times the mixed Voronoi area is the mean curvature,
+// and to the angle defect, which over the same area is the Gaussian
+// curvature (Meyer et al. 2003). Border vertices have no angle defect and get k1 = k2 = H. Ring
+// corners are the triangles (v, neighbor[i], neighbor[i + 1]), so polygonal
+// faces are fanned around v. Nothing is allocated per vertex.
+inline void compute_vertex_curvature(const Vertex_rings& rings, const float* coords, Vertex_curvature& out,
+                                     const Curvature_params& params = Curvature_params()) {
+    MESH_TRACE_SCOPE("compute_vertex_curvature");
+    const std::size_t num_vertices = rings.num_vertices();
+    out.resize(num_vertices);
+    const double pi = 3.14159265358979323846;
+    const double cos_sharp = std::cos(params.sharp_angle * pi / 180);
+
+    parallel_for(num_vertices, [&](std::size_t v) {
+        const float* p = coords + v * 3;
+        const std::uint32_t begin = rings.begin(v), end = rings.end(v);
+        double laplacian[3] = { 0, 0, 0 }, normal[3] = { 0, 0, 0 };
+        double area = 0, angle_sum = 0;
+        double first_n[3] = { 0, 0, 0 }, prev_n[3] = { 0, 0, 0 };
+        bool has_first = false, has_prev = false;
+        unsigned sharp = 0;
+        auto is_sharp = [&](const double* a, const double* b) {
+            return a[0] * b[0] + a[1] * b[1] + a[2] * b[2] < cos_sharp;
+        };
+
+        for (std::uint32_t i = begin; i < end; ++i) {
+            if (rings.face[i] == Vertex_rings::no_face) {
+                has_prev = false;
+                continue;
+            }
+            const float* a = coords + std::size_t(rings.neighbor[i]) * 3;
+            const float* b = coords + std::size_t(rings.neighbor[i + 1 < end ? i + 1 : begin]) * 3;
+            const double u[3] = { a[0] - p[0], a[1] - p[1], a[2] - p[2] };   // v -> a
+            const double w[3] = { b[0] - p[0], b[1] - p[1], b[2] - p[2] };   // v -> b
+            const double t[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };   // a -> b
+            const double n[3] = { u[1] * w[2] - u[2] * w[1], u[2] * w[0] - u[0] * w[2], u[0] * w[1] - u[1] * w[0] };
+            const double twice_area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if (!(twice_area > 0)) {
+                has_prev = false;
+                continue;
+            }
+            const double uu = u[0] * u[0] + u[1] * u[1] + u[2] * u[2];
+            const double ww = w[0] * w[0] + w[1] * w[1] + w[2] * w[2];
+            const double dot_v = u[0] * w[0] + u[1] * w[1] + u[2] * w[2];
+            const double dot_a = -(u[0] * t[0] + u[1] * t[1] + u[2] * t[2]);    // (v - a) . (b - a)
+            const double dot_b = w[0] * t[0] + w[1] * t[1] + w[2] * t[2];       // (v - b) . (a - b)
+            const double cot_a = dot_a / twice_area, cot_b = dot_b / twice_area;
+
+            // Edge v-a is weighted by the cotangent at b, edge v-b by the one at a
+            for (int c = 0; c < 3; ++c) laplacian[c] += cot_b * u[c] + cot_a * w[c];
+
+            // Mixed Voronoi area: the Voronoi cell for non-obtuse triangles
+            if (dot_v < 0) area += twice_area / 4;
+            else if (dot_a < 0 || dot_b < 0) area += twice_area / 8;
+            else area += (uu * cot_b + ww * cot_a) / 8;
+
+            const double angle = std::atan2(twice_area, dot_v);
+            angle_sum += angle;
+            const double unit[3] = { n[0] / twice_area, n[1] / twice_area, n[2] / twice_area };
+            for (int c = 0; c < 3; ++c) normal[c] += angle * unit[c];
+
+            // Edge v-a lies between this corner and the previous one
+            if (has_prev && is_sharp(prev_n, unit)) ++sharp;
+            if (i == begin) {
+                std::copy(unit, unit + 3, first_n);
+                has_first = true;
+            }
+            std::copy(unit, unit + 3, prev_n);
+            has_prev = true;
+        }
+        // Edge v-neighbor[begin] closes the ring of an interior vertex
+        const bool border = rings.is_border(v);
+        if (!border && has_first && has_prev && end - begin > 1 && is_sharp(prev_n, first_n)) ++sharp;
+
+        const double len = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (len > 0)
+            for (int c = 0; c < 3; ++c) normal[c] /= len;
+        double k1 = 0, k2 = 0;
+        if (area > 0) {
+            // The Laplacian points inwards on convex parts, against the normal.
+            // Only its normal part counts, which at the border is not all of it.
+            const double h = -(laplacian[0] * normal[0] + laplacian[1] * normal[1] + laplacian[2] * normal[2]) /
+                             (4 * area);
+            const double k = border ? h * h : (2 * pi - angle_sum) / area;
+            const double d = std::sqrt(std::max(0.0, h * h - k));
+            k1 = h + d;
+            k2 = h - d;
+        }
+        out.k1[v] = static_cast<float>(k1);
+        out.k2[v] = static_cast<float>(k2);
+        out.normal_x[v] = static_cast<float>(normal[0]);
+        out.normal_y[v] = static_cast<float>(normal[1]);
+        out.normal_z[v] = static_cast<float>(normal[2]);
+        out.sharp_edges[v] = static_cast<std::uint8_t>(std::min(sharp, 255u));
+    }, 1024);
+}
+
+// Curvature of all vertices of a mesh; the rings are built if empty.
+template <class Mesh>
+void compute_vertex_curvature(const Mesh& mesh, Vertex_rings& rings, Vertex_curvature& out,
+                              const Curvature_params& params = Curvature_params()) {
+    typedef typename Mesh::Vertex_index Vertex_index;
+    if (rings.empty()) build_vertex_rings(mesh, rings);
+    const std::size_t num_vertices = mesh.number_of_vertices();
+    counted_vector<float> coords(num_vertices * 3);
+    parallel_for(num_vertices, [&](std::size_t v) {
+        const auto& p = mesh.point(Vertex_index(static_cast<typename Mesh::size_type>(v)));
+        coords[v * 3] = static_cast<float>(CGAL::to_double(p.x()));
+        coords[v * 3 + 1] = static_cast<float>(CGAL::to_double(p.y()));
+        coords[v * 3 + 2] = static_cast<float>(CGAL::to_double(p.z()));
+    });
+    compute_vertex_curvature(rings, coords.data(), out, params);
+}
+
+} // namespace mesh_tools
+
+#endif // VERTEX_CURVATURE_H
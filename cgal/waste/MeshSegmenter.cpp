@@ -1,15 +1,14 @@
 // MeshSegmenter.cpp
 #include "MeshSegmenter.h"
+#include "SdfClustering.h"
 
-#include <CGAL/Surface_mesh_segmentation.h>
+#include <CGAL/mesh_segmentation.h>
 #include <CGAL/Surface_mesh.h>
 #include <CGAL/Polygon_mesh_processing/measure.h>
 #include <CGAL/property_map.h>
 #include <CGAL/IO/Color.h>
 #include <iostream>
 #include <vector>
-#include <limits>
-#include <cmath>
 
 bool segmentMesh(Mesh& mesh) {
     if (!CGAL::is_triangle_mesh(mesh)) {
@@ -32,82 +31,9 @@ bool segmentMesh(Mesh& mesh) {
     for (auto f : mesh.faces()) sdf_values.push_back(sdf_map[f]);
 
     // Try k from 2 to 10 and use silhouette score
-    int best_k = 2;
+    std::vector<int> labels;
     double best_sil = -1.0;
-    std::vector<int> labels(sdf_values.size(), 0);
-    int N = (int)sdf_values.size();
-
-    for (int k = 2; k <= std::min(10, N); ++k) {
-        std::vector<double> centers(k);
-        for (int i = 0; i < k; ++i) centers[i] = (2 * i + 1) / (2.0 * k);
-
-        std::vector<int> curr_labels(N);
-        for (int iter = 0; iter < 50; ++iter) {
-            bool changed = false;
-            for (int i = 0; i < N; ++i) {
-                double dmin = std::abs(sdf_values[i] - centers[0]);
-                int bestc = 0;
-                for (int j = 1; j < k; ++j) {
-                    double d = std::abs(sdf_values[i] - centers[j]);
-                    if (d < dmin) {
-                        dmin = d;
-                        bestc = j;
-                    }
-                }
-                if (curr_labels[i] != bestc) {
-                    curr_labels[i] = bestc;
-                    changed = true;
-                }
-            }
-            if (!changed) break;
-            std::vector<double> sum(k, 0.0);
-            std::vector<int> count(k, 0);
-            for (int i = 0; i < N; ++i) {
-                sum[curr_labels[i]] += sdf_values[i];
-                count[curr_labels[i]]++;
-            }
-            for (int j = 0; j < k; ++j) {
-                if (count[j]) centers[j] = sum[j] / count[j];
-            }
-        }
-
-        // Compute silhouette
-        double sil_sum = 0.0;
-        int valid = 0;
-        for (int i = 0; i < N; ++i) {
-            double a = 0.0; int ac = 0;
-            for (int j = 0; j < N; ++j) {
-                if (j != i && curr_labels[i] == curr_labels[j]) {
-                    a += std::abs(sdf_values[i] - sdf_values[j]); ac++;
-                }
-            }
-            if (ac > 0) a /= ac; else continue;
-
-            double b = std::numeric_limits<double>::infinity();
-            for (int c = 0; c < k; ++c) {
-                if (c == curr_labels[i]) continue;
-                double bsum = 0.0; int bc = 0;
-                for (int j = 0; j < N; ++j) {
-                    if (curr_labels[j] == c) {
-                        bsum += std::abs(sdf_values[i] - sdf_values[j]); bc++;
-                    }
-                }
-                if (bc > 0) b = std::min(b, bsum / bc);
-            }
-
-            double sil = (b - a) / std::max(a, b);
-            sil_sum += sil; valid++;
-        }
-
-        if (valid > 0) {
-            double avg_sil = sil_sum / valid;
-            if (avg_sil > best_sil) {
-                best_sil = avg_sil;
-                best_k = k;
-                labels = curr_labels;
-            }
-        }
-    }
+    int best_k = chooseClusterCount(sdf_values, 10, labels, best_sil);
 
     std::cout << "Optimal number of segments: " << best_k << " (silhouette=" << best_sil << ")\n";
 
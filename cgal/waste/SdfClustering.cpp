@@ -0,0 +1,93 @@
+// SdfClustering.cpp
+#include "SdfClustering.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+std::vector<int> kmeansSdf(const std::vector<double>& values, int k, int maxIterations) {
+    int N = (int)values.size();
+    std::vector<double> centers(k);
+    for (int i = 0; i < k; ++i) centers[i] = (2 * i + 1) / (2.0 * k);
+
+    std::vector<int> labels(N);
+    for (int iter = 0; iter < maxIterations; ++iter) {
+        bool changed = false;
+        for (int i = 0; i < N; ++i) {
+            double dmin = std::abs(values[i] - centers[0]);
+            int bestc = 0;
+            for (int j = 1; j < k; ++j) {
+                double d = std::abs(values[i] - centers[j]);
+                if (d < dmin) {
+                    dmin = d;
+                    bestc = j;
+                }
+            }
+            if (labels[i] != bestc) {
+                labels[i] = bestc;
+                changed = true;
+            }
+        }
+        if (!changed) break;
+        std::vector<double> sum(k, 0.0);
+        std::vector<int> count(k, 0);
+        for (int i = 0; i < N; ++i) {
+            sum[labels[i]] += values[i];
+            count[labels[i]]++;
+        }
+        for (int j = 0; j < k; ++j) {
+            if (count[j]) centers[j] = sum[j] / count[j];
+        }
+    }
+    return labels;
+}
+
+double silhouetteScore(const std::vector<double>& values, const std::vector<int>& labels, int k) {
+    int N = (int)values.size();
+    double sil_sum = 0.0;
+    int valid = 0;
+    for (int i = 0; i < N; ++i) {
+        double a = 0.0; int ac = 0;
+        for (int j = 0; j < N; ++j) {
+            if (j != i && labels[i] == labels[j]) {
+                a += std::abs(values[i] - values[j]); ac++;
+            }
+        }
+        if (ac > 0) a /= ac; else continue;
+
+        double b = std::numeric_limits<double>::infinity();
+        for (int c = 0; c < k; ++c) {
+            if (c == labels[i]) continue;
+            double bsum = 0.0; int bc = 0;
+            for (int j = 0; j < N; ++j) {
+                if (labels[j] == c) {
+                    bsum += std::abs(values[i] - values[j]); bc++;
+                }
+            }
+            if (bc > 0) b = std::min(b, bsum / bc);
+        }
+
+        double sil = (b - a) / std::max(a, b);
+        sil_sum += sil; valid++;
+    }
+    return valid > 0 ? sil_sum / valid : -1.0;
+}
+
+int chooseClusterCount(const std::vector<double>& values, int maxK,
+                       std::vector<int>& labels, double& silhouette) {
+    int best_k = 2;
+    silhouette = -1.0;
+    labels.assign(values.size(), 0);
+    int N = (int)values.size();
+
+    for (int k = 2; k <= std::min(maxK, N); ++k) {
+        std::vector<int> curr_labels = kmeansSdf(values, k);
+        double avg_sil = silhouetteScore(values, curr_labels, k);
+        if (avg_sil > silhouette) {
+            silhouette = avg_sil;
+            best_k = k;
+            labels = curr_labels;
+        }
+    }
+    return best_k;
+}
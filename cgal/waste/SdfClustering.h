@@ -0,0 +1,17 @@
+#ifndef SDFCLUSTERING_H
+#define SDFCLUSTERING_H
+
+#include <vector>
+
+// 1-D k-means over normalized SDF values, with centers seeded evenly in [0, 1].
+std::vector<int> kmeansSdf(const std::vector<double>& values, int k, int maxIterations = 50);
+
+// Mean silhouette of a clustering; points alone in their cluster are skipped.
+// Returns -1 if no point has a valid silhouette.
+double silhouetteScore(const std::vector<double>& values, const std::vector<int>& labels, int k);
+
+// Tries k = 2..maxK and keeps the clustering with the best silhouette.
+int chooseClusterCount(const std::vector<double>& values, int maxK,
+                       std::vector<int>& labels, double& silhouette);
+
+#endif // SDFCLUSTERING_H
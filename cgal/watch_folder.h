@@ -0,0 +1,211 @@
+#ifndef WATCH_FOLDER_H
+#define WATCH_FOLDER_H
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mesh_tools {
+
+struct Watch_params {
+    double settle_seconds = 2;      // quiet time after the last change before a file is taken
+    std::vector<std::string> extensions = { ".stl", ".off" };   // matched without case
+};
+
+// 64 bit hash of the contents of a file, 8 bytes per step, to tell a file
+// that was saved again unchanged from one with new contents. False if the
+// file cannot be read.
+inline bool hash_file(const std::string& path, std::uint64_t& hash) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    std::vector<char> buffer(1 << 20);
+    std::uint64_t h = 0xCBF29CE484222325ull, size = 0;
+    bool ok = true;
+    for (;;) {
+        const ssize_t n = ::read(fd, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) ok = false;
+        if (n <= 0) break;
+        // The tail of a read is zero padded to whole words; the length is
+        // mixed in at the end, so padding cannot collide with real zeros
+        const std::size_t bytes = static_cast<std::size_t>(n);
+        const std::size_t padded = (bytes + 7) / 8 * 8;
+        std::fill(buffer.begin() + bytes, buffer.begin() + padded, 0);
+        for (std::size_t i = 0; i < padded; i += 8) {
+            std::uint64_t word;
+            std::memcpy(&word, buffer.data() + i, 8);
+            h = (h ^ word) * 0x9E3779B97F4A7C15ull;
+            h ^= h >> 29;
+        }
+        size += bytes;
+    }
+    ::close(fd);
+    h = (h ^ size) * 0x9E3779B97F4A7C15ull;
+    hash = h ^ (h >> 32);
+    return ok;
+}
+
+// Reports the mesh files in a folder once they are complete: the files there
+// at open(), then every file created, written or moved in. Partial writes
+// are debounced: a file is only reported after it has seen no inotify event
+// and kept its size and mtime for settle_seconds, so a slow copy or a writer
+// that reopens the file is picked up once, at the end. Names starting with a
+// dot are ignored, which skips the temporary files of rsync and of most
+// uploaders until they are renamed into place.
+class Folder_watcher {
+public:
+    explicit Folder_watcher(const Watch_params& params = Watch_params()) : m_params(params) {}
+    ~Folder_watcher() { close(); }
+
+    bool open(const std::string& folder) {
+        close();
+        m_folder = folder;
+        m_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (m_fd < 0 || ::inotify_add_watch(m_fd, folder.c_str(), IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE |
+                                                                     IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0) {
+            std::cerr << "Failed to watch " << folder << ": " << std::strerror(errno) << std::endl;
+            close();
+            return false;
+        }
+        return scan();
+    }
+
+    void close() {
+        if (m_fd >= 0) ::close(m_fd);
+        m_fd = -1;
+        m_pending.clear();
+    }
+
+    // Waits up to timeout_ms for changes and returns the paths of the files
+    // that have settled, in order of name
+    std::vector<std::string> poll(int timeout_ms) {
+        std::vector<std::string> ready;
+        if (m_fd < 0) return ready;
+        const Clock::time_point now = Clock::now();
+        for (const auto& p : m_pending) {
+            const Clock::time_point due = p.second.changed + settle_time();
+            const long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count();
+            timeout_ms = static_cast<int>(std::max(0LL, std::min<long long>(timeout_ms, ms + 1)));
+        }
+
+        pollfd p = { m_fd, POLLIN, 0 };
+        if (::poll(&p, 1, timeout_ms) > 0) read_events();
+
+        const Clock::time_point later = Clock::now();
+        for (auto it = m_pending.begin(); it != m_pending.end();) {
+            Pending& pending = it->second;
+            if (later - pending.changed < settle_time()) {
+                ++it;
+                continue;
+            }
+            struct stat info;
+            const std::string path = m_folder + "/" + it->first;
+            if (::stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+                it = m_pending.erase(it);
+                continue;
+            }
+            // Written to without events, e.g. on a network file system
+            if (info.st_size != pending.size || info.st_mtime != pending.mtime) {
+                pending.size = info.st_size;
+                pending.mtime = info.st_mtime;
+                pending.changed = later;
+                ++it;
+                continue;
+            }
+            ready.push_back(path);
+            it = m_pending.erase(it);
+        }
+        return ready;
+    }
+
+    std::size_t num_pending() const { return m_pending.size(); }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Pending {
+        Clock::time_point changed;
+        off_t size = -1;
+        time_t mtime = 0;
+    };
+
+    Clock::duration settle_time() const {
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(m_params.settle_seconds));
+    }
+
+    bool matches(const std::string& name) const {
+        if (name.empty() || name[0] == '.') return false;
+        std::string lower(name);
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+        for (const std::string& ext : m_params.extensions)
+            if (lower.size() > ext.size() && lower.compare(lower.size() - ext.size(), ext.size(), ext) == 0) return true;
+        return false;
+    }
+
+    void touch(const std::string& name) {
+        if (!matches(name)) return;
+        Pending& pending = m_pending[name];
+        pending.changed = Clock::now();
+        struct stat info;
+        if (::stat((m_folder + "/" + name).c_str(), &info) == 0) {
+            pending.size = info.st_size;
+            pending.mtime = info.st_mtime;
+        }
+    }
+
+    // Queues every matching file in the folder, e.g. after events were lost
+    bool scan() {
+        DIR* dir = ::opendir(m_folder.c_str());
+        if (!dir) {
+            std::cerr << "Failed to list " << m_folder << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        while (dirent* entry = ::readdir(dir)) touch(entry->d_name);
+        ::closedir(dir);
+        return true;
+    }
+
+    void read_events() {
+        alignas(inotify_event) char buffer[1 << 16];
+        for (;;) {
+            const ssize_t n = ::read(m_fd, buffer, sizeof(buffer));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            for (const char* p = buffer; p < buffer + n;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+                p += sizeof(inotify_event) + event->len;
+                if (event->mask & IN_Q_OVERFLOW) {
+                    scan();
+                    continue;
+                }
+                if (event->len == 0) continue;
+                const std::string name(event->name);
+                if (event->mask & (IN_DELETE | IN_MOVED_FROM)) m_pending.erase(name);
+                else touch(name);
+            }
+        }
+    }
+
+    Watch_params m_params;
+    std::string m_folder;
+    int m_fd = -1;
+    std::map<std::string, Pending> m_pending;   // by file name
+};
+
+} // namespace mesh_tools
+
+#endif // WATCH_FOLDER_H
@@ -0,0 +1,425 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "memory_stats.h"
+#include "parallel.h"
+#include "trace.h"
+
+namespace mesh_tools {
+
+// A polygon mesh in a shared memory segment, laid out as the arrays that
+// build_surface_mesh takes, followed by one label per face for the result:
+//
+//     Shared_mesh_header
+//     double        coords[num_vertices * 3]
+//     std::uint32_t face_offsets[num_faces + 1]
+//     std::uint32_t face_vrts[num_corners]
+//     std::uint32_t labels[num_faces]
+//
+// Every array starts at a multiple of 8 bytes.
+struct Shared_mesh_header {
+    static constexpr std::uint64_t magic_value = 0x4853454D52414853ull;   // "SHARMESH"
+
+    std::uint64_t magic;
+    std::uint64_t num_vertices, num_faces, num_corners;
+};
+
+// View of a shared mesh; only the labels are written by the worker.
+struct Shared_mesh {
+    std::size_t num_vertices = 0, num_faces = 0;
+    const double* coords = nullptr;
+    const std::uint32_t* face_offsets = nullptr;
+    const std::uint32_t* face_vrts = nullptr;
+    std::uint32_t* labels = nullptr;
+};
+
+// Flat polygon arrays of a mesh loaded by the coordinator, see read_mesh_arrays.
+struct Mesh_arrays {
+    counted_vector<double> coords;
+    counted_vector<std::uint32_t> face_vrts;
+    counted_vector<std::uint32_t> face_offsets;
+
+    std::size_t num_faces() const { return face_offsets.empty() ? 0 : face_offsets.size() - 1; }
+};
+
+struct Worker_pool_params {
+    unsigned num_workers = 0;       // processes; 0 for num_threads()
+    unsigned max_attempts = 2;      // runs of a job before a crash counts as its failure
+    std::string shm_prefix = "/mesh_tools";
+};
+
+// Outcome of one job, as passed to the finish callback.
+struct Worker_job_result {
+    bool ok = false;
+    unsigned attempts = 0;          // worker runs, more than one after crashes
+    std::size_t num_segments = 0;
+    std::string error;              // why the job failed
+};
+
+struct Worker_pool_stats {
+    std::size_t num_jobs = 0;
+    std::size_t num_failed = 0;
+    std::size_t num_restarts = 0;   // workers forked again after a crash
+};
+
+namespace detail {
+
+inline std::size_t shared_align(std::size_t bytes) { return (bytes + 7) & ~std::size_t(7); }
+
+inline std::size_t shared_mesh_bytes(std::size_t num_vertices, std::size_t num_faces, std::size_t num_corners) {
+    return shared_align(sizeof(Shared_mesh_header)) + shared_align(num_vertices * 3 * sizeof(double)) +
+           shared_align((num_faces + 1) * 4) + shared_align(num_corners * 4) + shared_align(num_faces * 4);
+}
+
+// Points the arrays of a view into a mapped segment; false if the header is not valid.
+inline bool shared_mesh_view(void* base, std::size_t bytes, Shared_mesh& mesh) {
+    const Shared_mesh_header* header = static_cast<const Shared_mesh_header*>(base);
+    if (bytes < sizeof(Shared_mesh_header) || header->magic != Shared_mesh_header::magic_value ||
+        shared_mesh_bytes(header->num_vertices, header->num_faces, header->num_corners) > bytes)
+        return false;
+    char* p = static_cast<char*>(base) + shared_align(sizeof(Shared_mesh_header));
+    mesh.num_vertices = header->num_vertices;
+    mesh.num_faces = header->num_faces;
+    mesh.coords = reinterpret_cast<const double*>(p);
+    p += shared_align(mesh.num_vertices * 3 * sizeof(double));
+    mesh.face_offsets = reinterpret_cast<const std::uint32_t*>(p);
+    p += shared_align((mesh.num_faces + 1) * 4);
+    mesh.face_vrts = reinterpret_cast<const std::uint32_t*>(p);
+    p += shared_align(header->num_corners * 4);
+    mesh.labels = reinterpret_cast<std::uint32_t*>(p);
+    return true;
+}
+
+// Messages on the pipes between the coordinator and a worker.
+struct Job_message {
+    std::uint64_t job, bytes;
+};
+
+struct Reply_message {
+    std::uint64_t job;
+    std::int64_t num_segments;      // negative if the job threw
+    char error[240];
+};
+
+inline bool write_all(int fd, const void* data, std::size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        const ssize_t n = ::write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+// False at the end of the pipe, i.e. when the other side has exited.
+inline bool read_all(int fd, void* data, std::size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        const ssize_t n = ::read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+// Worker process: maps the segment of its slot for every job, runs the
+// segmentation and replies. Never returns.
+template <class SegmentJob>
+[[noreturn]] void worker_main(int jobs, int replies, const std::string& shm_name, SegmentJob& segment) {
+    Job_message message;
+    while (read_all(jobs, &message, sizeof(message))) {
+        Reply_message reply;
+        std::memset(&reply, 0, sizeof(reply));
+        reply.job = message.job;
+        reply.num_segments = -1;
+        const int fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+        void* base = fd >= 0 ? mmap(nullptr, message.bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        if (fd >= 0) close(fd);
+        Shared_mesh mesh;
+        if (base == MAP_FAILED || !shared_mesh_view(base, message.bytes, mesh)) {
+            std::snprintf(reply.error, sizeof(reply.error), "cannot map shared mesh %s", shm_name.c_str());
+        } else {
+            try {
+                reply.num_segments = static_cast<std::int64_t>(segment(mesh));
+            } catch (const std::exception& e) {
+                std::snprintf(reply.error, sizeof(reply.error), "%s", e.what());
+            }
+        }
+        if (base != MAP_FAILED) munmap(base, message.bytes);
+        std::cout.flush();
+        std::cerr.flush();
+        if (!write_all(replies, &reply, sizeof(reply))) break;
+    }
+    _exit(0);
+}
+
+} // namespace detail
+
+// Runs num_jobs segmentation jobs on a pool of forked worker processes, so
+// that a crash, or code that is not safe to run on several threads, only
+// ever affects one job.
+//
+// For every job, the coordinator calls
+//
+//     bool load(std::size_t job, Mesh_arrays& arrays)
+//
+// and copies the arrays into the POSIX shared memory segment of an idle
+// worker, which maps it and calls
+//
+//     std::size_t segment(const Shared_mesh& mesh)
+//
+// writing a label per face into mesh.labels and returning the number of
+// segments. The coordinator then calls
+//
+//     void finish(std::size_t job, const Worker_job_result& result, const Shared_mesh* mesh)
+//
+// with the labels still in the segment, or with mesh == nullptr if the job
+// failed. Nothing is serialized: the segment holds the binary arrays, and the
+// pipes to each worker only carry fixed size messages.
+//
+// A worker that dies is forked again, and its job is run again up to
+// max_attempts times in all before it fails. An exception thrown by segment
+// fails the job without a restart. load and finish run in the coordinator,
+// one at a time; each worker's parallel loops get an even share of the
+// threads. Jobs are handed out in order, but finish in any order.
+template <class LoadJob, class SegmentJob, class FinishJob>
+Worker_pool_stats run_worker_pool(std::size_t num_jobs, LoadJob load, SegmentJob segment, FinishJob finish,
+                                  const Worker_pool_params& params = Worker_pool_params()) {
+    MESH_TRACE_SCOPE("run_worker_pool");
+    Worker_pool_stats stats;
+    stats.num_jobs = num_jobs;
+    if (num_jobs == 0) return stats;
+
+    const std::size_t none = static_cast<std::size_t>(-1);
+    struct Worker {
+        pid_t pid = -1;
+        int jobs = -1, replies = -1;   // coordinator ends of the pipes
+        int shm = -1;
+        void* base = nullptr;
+        std::size_t capacity = 0;      // bytes mapped
+        std::size_t bytes = 0;         // bytes of the current job
+        std::string shm_name;
+        std::size_t job;
+    };
+    const unsigned num_workers = static_cast<unsigned>(std::min<std::size_t>(
+        num_jobs, params.num_workers > 0 ? params.num_workers : num_threads()));
+    const unsigned worker_threads = std::max(1u, num_threads() / num_workers);
+    std::vector<Worker> workers(num_workers);
+    std::vector<unsigned> attempts(num_jobs, 0);
+
+    // A write to a worker that has just died must not end the coordinator
+    void (*previous_sigpipe)(int) = std::signal(SIGPIPE, SIG_IGN);
+
+    auto close_pipes = [](Worker& w) {
+        if (w.jobs >= 0) close(w.jobs);
+        if (w.replies >= 0) close(w.replies);
+        w.jobs = w.replies = -1;
+    };
+    auto spawn = [&](std::size_t i) {
+        Worker& w = workers[i];
+        int to_worker[2], from_worker[2];
+        if (pipe(to_worker) != 0) throw std::runtime_error("Couldn't create a pipe for a worker");
+        if (pipe(from_worker) != 0) {
+            close(to_worker[0]);
+            close(to_worker[1]);
+            throw std::runtime_error("Couldn't create a pipe for a worker");
+        }
+        std::cout.flush();
+        std::cerr.flush();
+        std::fflush(nullptr);
+        const pid_t pid = fork();
+        if (pid < 0) throw std::runtime_error("Couldn't fork a worker");
+        if (pid == 0) {
+            // The worker keeps only its own pipe ends
+            for (Worker& other : workers) close_pipes(other);
+            close(to_worker[1]);
+            close(from_worker[0]);
+            std::signal(SIGPIPE, SIG_DFL);
+            set_num_threads(worker_threads);
+            detail::worker_main(to_worker[0], from_worker[1], w.shm_name, segment);
+        }
+        close(to_worker[0]);
+        close(from_worker[1]);
+        fcntl(to_worker[1], F_SETFD, FD_CLOEXEC);
+        fcntl(from_worker[0], F_SETFD, FD_CLOEXEC);
+        w.pid = pid;
+        w.jobs = to_worker[1];
+        w.replies = from_worker[0];
+        w.job = none;
+    };
+    auto shutdown = [&] {
+        for (Worker& w : workers) {
+            close_pipes(w);
+            if (w.pid > 0) {
+                int status;
+                while (waitpid(w.pid, &status, 0) < 0 && errno == EINTR) {}
+                w.pid = -1;
+            }
+            if (w.base) munmap(w.base, w.capacity);
+            if (w.shm >= 0) close(w.shm);
+            if (!w.shm_name.empty()) shm_unlink(w.shm_name.c_str());
+        }
+        std::signal(SIGPIPE, previous_sigpipe);
+    };
+
+    std::deque<std::size_t> pending;
+    for (std::size_t job = 0; job < num_jobs; ++job) pending.push_back(job);
+    std::size_t num_done = 0;
+    auto fail = [&](std::size_t job, const std::string& error) {
+        Worker_job_result result;
+        result.attempts = attempts[job];
+        result.error = error;
+        ++stats.num_failed;
+        ++num_done;
+        finish(job, result, static_cast<const Shared_mesh*>(nullptr));
+    };
+
+    try {
+        for (unsigned i = 0; i < num_workers; ++i) {
+            workers[i].shm_name = params.shm_prefix + "." + std::to_string(getpid()) + "." + std::to_string(i);
+            shm_unlink(workers[i].shm_name.c_str());
+            workers[i].shm = shm_open(workers[i].shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+            if (workers[i].shm < 0) throw std::runtime_error("Couldn't create shared memory " + workers[i].shm_name);
+            fcntl(workers[i].shm, F_SETFD, FD_CLOEXEC);
+        }
+        for (unsigned i = 0; i < num_workers; ++i) spawn(i);
+
+        Mesh_arrays arrays;
+        std::vector<pollfd> fds;
+        std::vector<unsigned> polled;
+        while (num_done < num_jobs) {
+            // Hand out jobs to idle workers
+            for (Worker& w : workers) {
+                while (w.job == none && !pending.empty()) {
+                    const std::size_t job = pending.front();
+                    pending.pop_front();
+                    arrays = Mesh_arrays();
+                    if (!load(job, arrays)) {
+                        fail(job, "cannot load mesh");
+                        continue;
+                    }
+                    // The segment keeps the arrays for a retry after a crash
+                    const std::size_t bytes = detail::shared_mesh_bytes(arrays.coords.size() / 3, arrays.num_faces(),
+                                                                        arrays.face_vrts.size());
+                    if (bytes > w.capacity) {
+                        if (w.base) munmap(w.base, w.capacity);
+                        w.base = nullptr;
+                        w.capacity = 0;
+                        if (ftruncate(w.shm, static_cast<off_t>(bytes)) != 0)
+                            throw std::runtime_error("Couldn't grow shared memory " + w.shm_name);
+                        void* base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, w.shm, 0);
+                        if (base == MAP_FAILED) throw std::runtime_error("Couldn't map shared memory " + w.shm_name);
+                        w.base = base;
+                        w.capacity = bytes;
+                    }
+                    Shared_mesh_header* header = static_cast<Shared_mesh_header*>(w.base);
+                    header->magic = Shared_mesh_header::magic_value;
+                    header->num_vertices = arrays.coords.size() / 3;
+                    header->num_faces = arrays.num_faces();
+                    header->num_corners = arrays.face_vrts.size();
+                    Shared_mesh mesh;
+                    detail::shared_mesh_view(w.base, bytes, mesh);
+                    std::copy(arrays.coords.begin(), arrays.coords.end(), const_cast<double*>(mesh.coords));
+                    std::copy(arrays.face_offsets.begin(), arrays.face_offsets.end(),
+                              const_cast<std::uint32_t*>(mesh.face_offsets));
+                    std::copy(arrays.face_vrts.begin(), arrays.face_vrts.end(), const_cast<std::uint32_t*>(mesh.face_vrts));
+                    w.bytes = bytes;
+                    ++attempts[job];
+                    w.job = job;
+                    const detail::Job_message message = { job, w.bytes };
+                    // A failed write shows up as the end of the reply pipe below
+                    detail::write_all(w.jobs, &message, sizeof(message));
+                }
+            }
+
+            fds.clear();
+            polled.clear();
+            for (unsigned i = 0; i < num_workers; ++i) {
+                if (workers[i].job == none) continue;
+                fds.push_back({ workers[i].replies, POLLIN, 0 });
+                polled.push_back(i);
+            }
+            if (fds.empty()) continue;
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("poll failed while waiting for workers");
+            }
+
+            for (std::size_t k = 0; k < fds.size(); ++k) {
+                if (fds[k].revents == 0) continue;
+                Worker& w = workers[polled[k]];
+                const std::size_t job = w.job;
+                detail::Reply_message reply;
+                if (detail::read_all(w.replies, &reply, sizeof(reply)) && reply.job == job) {
+                    w.job = none;
+                    ++num_done;
+                    Worker_job_result result;
+                    result.attempts = attempts[job];
+                    if (reply.num_segments < 0) {
+                        result.error = reply.error;
+                        ++stats.num_failed;
+                        finish(job, result, static_cast<const Shared_mesh*>(nullptr));
+                    } else {
+                        result.ok = true;
+                        result.num_segments = static_cast<std::size_t>(reply.num_segments);
+                        Shared_mesh mesh;
+                        detail::shared_mesh_view(w.base, w.bytes, mesh);
+                        finish(job, result, &mesh);
+                    }
+                    continue;
+                }
+
+                // The worker died: reap it, fork a new one and retry or fail the job
+                close_pipes(w);
+                int status = 0;
+                while (waitpid(w.pid, &status, 0) < 0 && errno == EINTR) {}
+                w.pid = -1;
+                w.job = none;
+                spawn(polled[k]);
+                ++stats.num_restarts;
+                if (attempts[job] < std::max(1u, params.max_attempts)) {
+                    // Runs again on the new worker, whose segment still holds the mesh
+                    ++attempts[job];
+                    w.job = job;
+                    const detail::Job_message message = { job, w.bytes };
+                    detail::write_all(w.jobs, &message, sizeof(message));
+                } else {
+                    fail(job, WIFSIGNALED(status) ? "worker killed by signal " + std::to_string(WTERMSIG(status))
+                                                  : "worker exited with status " + std::to_string(WEXITSTATUS(status)));
+                }
+            }
+        }
+    } catch (...) {
+        shutdown();
+        throw;
+    }
+    shutdown();
+    return stats;
+}
+
+} // namespace mesh_tools
+
+#endif // WORKER_POOL_H
@@ -14,6 +14,7 @@
 #include <QApplication>
 #include <QMainWindow>
 #include <QAction>
+#include <QMenu>
 #include <QMenuBar>
 #include <QFileDialog>
 #include <QGraphicsScene>
@@ -35,14 +36,31 @@
 #include <QComboBox>
 #include <QSpinBox>
 #include <QDoubleSpinBox>
+#include <QOpenGLFunctions>
 
+#include <algorithm>
+#include <functional>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <vector>
 #include <string>
 #include <random>
 #include <cmath>
 
+#include "face_adjacency.h"
+#include "face_bvh.h"
+#include "face_order.h"
+#include "memory_stats.h"
+#include "merge_tree.h"
+#include "mesh_io.h"
+#include "normal_regions.h"
+#include "segment_boundaries.h"
+#include "segment_cleanup.h"
+#include "segment_view.h"
+#include "trace.h"
+#include "vertex_curvature.h"
+
 typedef CGAL::Exact_predicates_inexact_constructions_kernel Kernel;
 typedef Kernel::Point_3 Point;
 typedef Kernel::Vector_3 Vector;
@@ -71,13 +89,63 @@ std::vector<QColor> generate_random_colors(int n) {
     return colors;
 }
 
-// Mesh viewer widget
-class MeshViewerWidget : public QGLViewer {
+// Blue through white to red for values in [-scale, scale], one RGB triple
+// per value
+std::vector<unsigned char> diverging_colors(const float* values, std::size_t n, float scale) {
+    std::vector<unsigned char> rgb(n * 3);
+    for (std::size_t i = 0; i < n; ++i) {
+        const float t = scale > 0 ? std::max(-1.0f, std::min(1.0f, values[i] / scale)) : 0.0f;
+        const float fade = 1.0f - std::fabs(t);
+        rgb[i * 3] = static_cast<unsigned char>(255 * (t > 0 ? 1.0f : fade));
+        rgb[i * 3 + 1] = static_cast<unsigned char>(255 * fade);
+        rgb[i * 3 + 2] = static_cast<unsigned char>(255 * (t < 0 ? 1.0f : fade));
+    }
+    return rgb;
+}
+
+// Result of picking a face in the viewer
+struct Pick_result {
+    face_descriptor face;
+    std::size_t segment;        // segment of the face, or no_segment
+    Point point;                // hit point on the face
+};
+
+// Mesh viewer widget. The mesh is drawn from vertex buffers that hold three
+// corners per face, ordered by segment, so that each segment is one
+// contiguous range: selecting a segment rewrites only its range of the color
+// buffer. Picking casts the click ray against a BVH built once per mesh.
+// Segment boundaries are extracted once per segmentation and drawn from a
+// line buffer of their own. A per-vertex overlay, e.g. curvature, replaces
+// the segment colors of all but the selected segment.
+class MeshViewerWidget : public QGLViewer, protected QOpenGLFunctions {
 public:
-    MeshViewerWidget(QWidget* parent = nullptr) : QGLViewer(parent), mesh(nullptr), show_segments(true) {}
+    static const std::size_t no_segment = std::size_t(-1);
+
+    MeshViewerWidget(QWidget* parent = nullptr)
+        : QGLViewer(parent), mesh(nullptr), show_segments(true), has_segments(false), num_segments(0),
+          selected_segment(no_segment), geometry_dirty(false), colors_dirty(false),
+          boundaries_dirty(false), position_vbo(0), normal_vbo(0), color_vbo(0), boundary_vbo(0),
+          num_boundary_points(0), gl_ready(false) {}
+    
+    ~MeshViewerWidget() {
+        if (gl_ready) {
+            makeCurrent();
+            GLuint buffers[] = { position_vbo, normal_vbo, color_vbo, boundary_vbo };
+            glDeleteBuffers(4, buffers);
+            doneCurrent();
+        }
+    }
     
     void setMesh(Mesh* mesh_ptr) {
         mesh = mesh_ptr;
+        has_segments = false;
+        num_segments = 0;
+        selected_segment = no_segment;
+        segment_offsets.clear();
+        vertex_overlay.clear();
+        boundaries.clear();
+        boundaries_dirty = true;
+        bvh.clear();
         if (mesh) {
             // Use a collection of points to compute the bounding box
             std::vector<Point> points;
@@ -96,28 +164,100 @@ public:
             );
             camera()->showEntireScene();
             
-            // Update display
-            update();
+            // Picking structure, built once per mesh
+            {
+                mesh_tools::memory::Stage_scope stage("build_face_bvh");
+                std::vector<double> coords;
+                coords.reserve(mesh->number_of_vertices() * 3);
+                for (vertex_descriptor vd : mesh->vertices()) {
+                    const Point& p = mesh->point(vd);
+                    coords.insert(coords.end(), { p.x(), p.y(), p.z() });
+                }
+                std::vector<std::uint32_t> tris;
+                tris.reserve(mesh->number_of_faces() * 3);
+                for (face_descriptor fd : mesh->faces())
+                    for (vertex_descriptor vd : CGAL::vertices_around_face(mesh->halfedge(fd), *mesh))
+                        tris.push_back(static_cast<std::uint32_t>(vd.idx()));
+                bvh.build(coords.data(), tris.data(), mesh->number_of_faces());
+            }
         }
+        draw_order.clear();
+        if (mesh)
+            for (face_descriptor fd : mesh->faces())
+                draw_order.push_back(static_cast<std::uint32_t>(fd.idx()));
+        geometry_dirty = true;
+        update();
     }
     
-    void setSegmentColors(const std::vector<QColor>& colors) {
+    // Segment IDs and colors; faces are regrouped by segment in the buffers.
+    // Property maps are handles, so the map is kept by value.
+    void setSegmentation(const Face_index_map& map, const mesh_tools::Segment_buckets& buckets,
+                         const std::vector<QColor>& colors) {
+        if (!mesh) return;
+        segment_map = map;
         segment_colors = colors;
+        has_segments = true;
+        num_segments = buckets.num_segments();
+        selected_segment = no_segment;
+        
+        segment_offsets.assign(buckets.offsets.begin(), buckets.offsets.end());
+        draw_order.assign(buckets.faces.begin(), buckets.faces.end());
+        boundaries = mesh_tools::extract_segment_boundaries(*mesh, segment_map);
+        boundaries_dirty = true;
+        geometry_dirty = true;
         update();
     }
     
-    void setSegmentMap(Face_index_map* map) {
-        segment_map = map;
+    // One RGB triple per vertex drawn instead of the segment colors; empty
+    // to show the segments again
+    void setVertexOverlay(const std::vector<unsigned char>& rgb) {
+        vertex_overlay = rgb;
+        colors_dirty = true;
         update();
     }
     
     void toggleSegments(bool show) {
         show_segments = show;
+        colors_dirty = true;
+        update();
+    }
+    
+    // Highlights one segment, or none with no_segment. Only the color ranges
+    // of the previous and the new selection are uploaded.
+    void selectSegment(std::size_t segment) {
+        if (segment == selected_segment) return;
+        const std::size_t previous = selected_segment;
+        selected_segment = segment < num_segments ? segment : no_segment;
+        if (gl_ready && !geometry_dirty && !colors_dirty) {
+            makeCurrent();
+            uploadSegmentColors(previous);
+            uploadSegmentColors(selected_segment);
+            doneCurrent();
+        }
         update();
     }
     
+    std::size_t selectedSegment() const { return selected_segment; }
+    
+    // Polylines between the segments of the current segmentation
+    const mesh_tools::Segment_boundaries& segmentBoundaries() const { return boundaries; }
+    
+    using QGLViewer::select;
+    
+    // Called with the result of every pick; not called for clicks that miss.
+    void setPickHandler(std::function<void(const Pick_result&)> handler) {
+        pick_handler = handler;
+    }
+    
 protected:
     void init() override {
+        initializeOpenGLFunctions();
+        glGenBuffers(1, &position_vbo);
+        glGenBuffers(1, &normal_vbo);
+        glGenBuffers(1, &color_vbo);
+        glGenBuffers(1, &boundary_vbo);
+        gl_ready = true;
+        
         // Set background color
         setBackgroundColor(QColor(240, 240, 240));
         
@@ -152,71 +292,219 @@ protected:
     }
     
     void draw() override {
-        if (!mesh || !segment_map) return;
+        if (!mesh) return;
+        MESH_TRACE_SCOPE("draw");
+        if (geometry_dirty) uploadGeometry();
+        if (colors_dirty) uploadColors();
+        if (boundaries_dirty) uploadBoundaries();
+        const GLsizei num_corners = static_cast<GLsizei>(draw_order.size() * 3);
         
         glEnable(GL_LIGHTING);
         glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
         
         // Draw the mesh with segments colored
-        glBegin(GL_TRIANGLES);
-        for (face_descriptor fd : mesh->faces()) {
-            // Get segment ID
-            std::size_t segment_id = (*segment_map)[fd];
-            
-            // Set color based on segment
-            if (show_segments && segment_id < segment_colors.size()) {
-                QColor color = segment_colors[segment_id];
-                glColor3f(color.redF(), color.greenF(), color.blueF());
-            } else {
-                glColor3f(0.8f, 0.8f, 0.8f); // Default gray
-            }
-            
-            // Compute face normal
-            Vector normal = CGAL::Polygon_mesh_processing::compute_face_normal(fd, *mesh);
-            glNormal3d(normal.x(), normal.y(), normal.z());
-            
-            // Draw triangle
-            halfedge_descriptor h = mesh->halfedge(fd);
-            for (int i = 0; i < 3; ++i) {
-                Point p = mesh->point(mesh->target(h));
-                glVertex3d(p.x(), p.y(), p.z());
-                h = mesh->next(h);
-            }
-        }
-        glEnd();
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, position_vbo);
+        glVertexPointer(3, GL_FLOAT, 0, nullptr);
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, normal_vbo);
+        glNormalPointer(GL_FLOAT, 0, nullptr);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, color_vbo);
+        glColorPointer(3, GL_UNSIGNED_BYTE, 0, nullptr);
+        glDrawArrays(GL_TRIANGLES, 0, num_corners);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_NORMAL_ARRAY);
         
         // Draw wireframe
         glDisable(GL_LIGHTING);
         glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
         glColor3f(0.0f, 0.0f, 0.0f);
         glLineWidth(1.0f);
+        glDrawArrays(GL_TRIANGLES, 0, num_corners);
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
         
-        glBegin(GL_TRIANGLES);
-        for (face_descriptor fd : mesh->faces()) {
-            halfedge_descriptor h = mesh->halfedge(fd);
-            for (int i = 0; i < 3; ++i) {
-                Point p = mesh->point(mesh->target(h));
-                glVertex3d(p.x(), p.y(), p.z());
-                h = mesh->next(h);
-            }
+        // Segment boundaries over the wireframe
+        if (show_segments && num_boundary_points > 0) {
+            glBindBuffer(GL_ARRAY_BUFFER, boundary_vbo);
+            glVertexPointer(3, GL_FLOAT, 0, nullptr);
+            glColor3f(0.1f, 0.1f, 0.4f);
+            glLineWidth(3.0f);
+            glDrawArrays(GL_LINES, 0, num_boundary_points);
+            glLineWidth(1.0f);
+        }
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    
+    // Shift+click: the click ray is cast against the BVH instead of
+    // rendering the scene in GL_SELECT mode
+    void select(const QPoint& point) override {
+        if (!mesh || bvh.empty()) return;
+        MESH_TRACE_SCOPE("pick");
+        qglviewer::Vec origin, direction;
+        camera()->convertClickToLine(point, origin, direction);
+        const float o[3] = { float(origin.x), float(origin.y), float(origin.z) };
+        const float d[3] = { float(direction.x), float(direction.y), float(direction.z) };
+        mesh_tools::Face_hit hit;
+        if (!bvh.intersect(o, d, hit)) {
+            selectSegment(no_segment);
+            return;
         }
-        glEnd();
+        
+        Pick_result result;
+        result.face = face_descriptor(static_cast<Mesh::size_type>(hit.face));
+        result.segment = has_segments ? segment_map[result.face] : no_segment;
+        if (result.segment >= num_segments) result.segment = no_segment;
+        result.point = Point(o[0] + hit.t * d[0], o[1] + hit.t * d[1], o[2] + hit.t * d[2]);
+        selectSegment(result.segment);
+        if (pick_handler) pick_handler(result);
     }
     
     void keyPressEvent(QKeyEvent* e) override {
         if (e->key() == Qt::Key_S) {
-            show_segments = !show_segments;
-            update();
+            toggleSegments(!show_segments);
         } else {
             QGLViewer::keyPressEvent(e);
         }
     }
     
 private:
+    // Positions and flat normals of all faces in draw order
+    void uploadGeometry() {
+        MESH_TRACE_SCOPE("upload_geometry");
+        std::vector<float> positions, normals;
+        positions.reserve(draw_order.size() * 9);
+        normals.reserve(draw_order.size() * 9);
+        for (std::uint32_t f : draw_order) {
+            const face_descriptor fd(static_cast<Mesh::size_type>(f));
+            float n[3];
+            mesh_tools::detail::face_normal(*mesh, fd, n);
+            halfedge_descriptor h = mesh->halfedge(fd);
+            for (int i = 0; i < 3; ++i) {
+                const Point& p = mesh->point(mesh->target(h));
+                positions.insert(positions.end(), { float(p.x()), float(p.y()), float(p.z()) });
+                normals.insert(normals.end(), n, n + 3);
+                h = mesh->next(h);
+            }
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, position_vbo);
+        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(float), positions.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, normal_vbo);
+        glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(float), normals.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, color_vbo);
+        glBufferData(GL_ARRAY_BUFFER, draw_order.size() * 9, nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        geometry_dirty = false;
+        colors_dirty = true;
+    }
+    
+    // Two points per boundary edge, for GL_LINES
+    void uploadBoundaries() {
+        MESH_TRACE_SCOPE("upload_boundaries");
+        std::vector<float> points;
+        points.reserve(boundaries.num_edges() * 6);
+        auto add = [&](std::uint32_t v) {
+            const Point& p = mesh->point(vertex_descriptor(static_cast<Mesh::size_type>(v)));
+            points.insert(points.end(), { float(p.x()), float(p.y()), float(p.z()) });
+        };
+        for (std::size_t l = 0; l < boundaries.num_polylines(); ++l) {
+            const std::uint32_t first = boundaries.offsets[l], last = boundaries.offsets[l + 1] - 1;
+            for (std::uint32_t i = first; i < last; ++i) {
+                add(boundaries.vertices[i]);
+                add(boundaries.vertices[i + 1]);
+            }
+            if (boundaries.closed[l]) {
+                add(boundaries.vertices[last]);
+                add(boundaries.vertices[first]);
+            }
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, boundary_vbo);
+        glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(float), points.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        num_boundary_points = static_cast<GLsizei>(points.size() / 3);
+        boundaries_dirty = false;
+    }
+    
+    QColor segmentColor(std::size_t segment) const {
+        if (segment == selected_segment && segment != no_segment) return QColor(255, 210, 0);
+        if (show_segments && has_segments && segment < segment_colors.size()) return segment_colors[segment];
+        return QColor(204, 204, 204);   // default gray
+    }
+    
+    void uploadColors() {
+        std::vector<unsigned char> colors(draw_order.size() * 9);
+        if (has_segments) {
+            for (std::size_t s = 0; s < num_segments; ++s)
+                fillSegmentColors(colors.data() + segment_offsets[s] * 9, segment_offsets[s],
+                                  segment_offsets[s + 1] - segment_offsets[s], s);
+        } else {
+            fillSegmentColors(colors.data(), 0, draw_order.size(), no_segment);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, color_vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, colors.size(), colors.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        colors_dirty = false;
+    }
+    
+    // Rewrites the color range of one segment in the color buffer
+    void uploadSegmentColors(std::size_t segment) {
+        if (segment >= num_segments) return;
+        const std::size_t first = segment_offsets[segment];
+        const std::size_t count = segment_offsets[segment + 1] - first;
+        std::vector<unsigned char> colors(count * 9);
+        fillSegmentColors(colors.data(), first, count, segment);
+        glBindBuffer(GL_ARRAY_BUFFER, color_vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, first * 9, colors.size(), colors.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    
+    // Colors of the faces draw_order[first .. first + count), all in one segment
+    void fillSegmentColors(unsigned char* out, std::size_t first, std::size_t count, std::size_t segment) const {
+        const bool selected = segment == selected_segment && segment != no_segment;
+        if (vertex_overlay.empty() || selected) {
+            fillColors(out, count, segmentColor(segment));
+            return;
+        }
+        for (std::size_t i = 0; i < count; ++i) {
+            halfedge_descriptor h = mesh->halfedge(face_descriptor(static_cast<Mesh::size_type>(draw_order[first + i])));
+            for (int c = 0; c < 3; ++c) {
+                const unsigned char* rgb = &vertex_overlay[std::size_t(mesh->target(h).idx()) * 3];
+                std::copy(rgb, rgb + 3, out + (i * 3 + c) * 3);
+                h = mesh->next(h);
+            }
+        }
+    }
+    
+    static void fillColors(unsigned char* out, std::size_t num_faces, const QColor& color) {
+        for (std::size_t i = 0; i < num_faces * 3; ++i) {
+            out[i * 3] = static_cast<unsigned char>(color.red());
+            out[i * 3 + 1] = static_cast<unsigned char>(color.green());
+            out[i * 3 + 2] = static_cast<unsigned char>(color.blue());
+        }
+    }
+    
     Mesh* mesh;
-    Face_index_map* segment_map;
+    Face_index_map segment_map;
     std::vector<QColor> segment_colors;
+    std::vector<unsigned char> vertex_overlay;
     bool show_segments;
+    bool has_segments;
+    std::size_t num_segments;
+    std::size_t selected_segment;
+    std::function<void(const Pick_result&)> pick_handler;
+    mesh_tools::Face_bvh bvh;
+    
+    // Faces in buffer order; segment s covers draw_order[segment_offsets[s] .. segment_offsets[s + 1])
+    std::vector<std::uint32_t> draw_order;
+    std::vector<std::uint32_t> segment_offsets;
+    mesh_tools::Segment_boundaries boundaries;
+    bool geometry_dirty;
+    bool colors_dirty;
+    bool boundaries_dirty;
+    GLuint position_vbo, normal_vbo, color_vbo, boundary_vbo;
+    GLsizei num_boundary_points;
+    bool gl_ready;
 };
 
 // Main application window
@@ -224,7 +512,8 @@ class MainWindow : public QMainWindow {
     Q_OBJECT
     
 public:
-    MainWindow(QWidget* parent = nullptr) : QMainWindow(parent), mesh(nullptr) {
+    MainWindow(QWidget* parent = nullptr) : QMainWindow(parent), mesh(nullptr), num_segments(0), min_segment_area(0),
+          overlay_mode(0) {
         // Initialize CGAL Qt resources
         // CGAL::Qt::init_resources();
         
@@ -268,49 +557,131 @@ public:
         clustersSpinBox->setSingleStep(1);
         segLayout->addRow("Number of clusters:", clustersSpinBox);
         
-        // Smoothing lambda
-        QDoubleSpinBox* lambdaSpinBox = new QDoubleSpinBox(segGroup);
-        lambdaSpinBox->setRange(0.0, 1.0);
-        lambdaSpinBox->setValue(0.3);
-        lambdaSpinBox->setSingleStep(0.05);
-        segLayout->addRow("Smoothing lambda:", lambdaSpinBox);
+        // Engine: CGAL's SDF graph cut, the SDF merge tree that can be re-cut
+        // at any cluster count, or regions of similar normals for 5-axis work
+        QComboBox* engineComboBox = new QComboBox(segGroup);
+        engineComboBox->addItem("SDF graph cut");
+        engineComboBox->addItem("SDF merge tree");
+        engineComboBox->addItem("Normal cones");
+        segLayout->addRow("Engine:", engineComboBox);
+        
+        // Largest normal cone half-angle of a region, in degrees
+        QDoubleSpinBox* normalConeSpinBox = new QDoubleSpinBox(segGroup);
+        normalConeSpinBox->setRange(5.0, 90.0);
+        normalConeSpinBox->setValue(30.0);
+        normalConeSpinBox->setSingleStep(5.0);
+        segLayout->addRow("Normal cone (deg):", normalConeSpinBox);
+        
+        // Cuts the merge tree of the last segmentation while dragging; the
+        // graph cut takes the count at the next "Segment Mesh"
+        QSlider* clustersSlider = new QSlider(Qt::Horizontal, segGroup);
+        clustersSlider->setRange(2, 100);
+        clustersSlider->setValue(10);
+        segLayout->addRow(clustersSlider);
+        
+        // Weight of segment boundaries against SDF differences: the smoothing
+        // lambda of the graph cut, the boundary term of the merge tree
+        QDoubleSpinBox* boundaryWeightSpinBox = new QDoubleSpinBox(segGroup);
+        boundaryWeightSpinBox->setRange(0.0, 1.0);
+        boundaryWeightSpinBox->setValue(0.3);
+        boundaryWeightSpinBox->setSingleStep(0.05);
+        segLayout->addRow("Boundary weight:", boundaryWeightSpinBox);
+        
+        // Connected patches smaller than this are merged into a neighbour
+        QDoubleSpinBox* minAreaSpinBox = new QDoubleSpinBox(segGroup);
+        minAreaSpinBox->setRange(0.0, 10.0);
+        minAreaSpinBox->setValue(0.0);
+        minAreaSpinBox->setSingleStep(0.1);
+        segLayout->addRow("Min segment area (%):", minAreaSpinBox);
         
         // Buttons
         QPushButton* loadButton = new QPushButton("Load STL", controlWidget);
         QPushButton* segmentButton = new QPushButton("Segment Mesh", controlWidget);
+        QPushButton* exportButton = new QPushButton("Export Segments", controlWidget);
         QCheckBox* showSegmentsCheckBox = new QCheckBox("Show Segments", controlWidget);
         showSegmentsCheckBox->setChecked(true);
         
+        // Per-vertex overlays from the curvature kernel
+        QGroupBox* overlayGroup = new QGroupBox("Overlay", controlWidget);
+        QFormLayout* overlayLayout = new QFormLayout(overlayGroup);
+        QComboBox* overlayComboBox = new QComboBox(overlayGroup);
+        overlayComboBox->addItem("Segments");
+        overlayComboBox->addItem("Mean curvature");
+        overlayComboBox->addItem("Gaussian curvature");
+        overlayComboBox->addItem("Sharp edges");
+        overlayLayout->addRow("Color by:", overlayComboBox);
+        QDoubleSpinBox* sharpAngleSpinBox = new QDoubleSpinBox(overlayGroup);
+        sharpAngleSpinBox->setRange(5.0, 175.0);
+        sharpAngleSpinBox->setValue(45.0);
+        sharpAngleSpinBox->setSingleStep(5.0);
+        overlayLayout->addRow("Sharp angle (deg):", sharpAngleSpinBox);
+        
         // Add widgets to layout
         controlLayout->addWidget(loadButton);
         controlLayout->addWidget(sdfGroup);
         controlLayout->addWidget(segGroup);
         controlLayout->addWidget(segmentButton);
+        controlLayout->addWidget(exportButton);
         controlLayout->addWidget(showSegmentsCheckBox);
+        controlLayout->addWidget(overlayGroup);
         controlLayout->addStretch();
         
         // Set the control widget
         controlDock->setWidget(controlWidget);
         addDockWidget(Qt::RightDockWidgetArea, controlDock);
         
+        // Tools menu
+        QMenu* toolsMenu = menuBar()->addMenu("&Tools");
+        QAction* recordTraceAction = toolsMenu->addAction("Record Trace");
+        recordTraceAction->setCheckable(true);
+        QAction* saveTraceAction = toolsMenu->addAction("Save Trace...");
+        toolsMenu->addSeparator();
+        QAction* memoryReportAction = toolsMenu->addAction("Memory Report");
+        
         // Status bar
         statusBar()->showMessage("Ready");
         
         // Connect signals and slots
         connect(loadButton, &QPushButton::clicked, this, &MainWindow::loadSTL);
         connect(segmentButton, &QPushButton::clicked, [=]() {
-            if (mesh) {
+            if (mesh && engineComboBox->currentIndex() == 2) {
+                segmentByNormals(normalConeSpinBox->value());
+            } else if (mesh) {
                 segmentMesh(
                     raysSpinBox->value(),
                     coneAngleSpinBox->value(),
                     clustersSpinBox->value(),
-                    lambdaSpinBox->value()
+                    boundaryWeightSpinBox->value(),
+                    engineComboBox->currentIndex() == 1
                 );
             } else {
                 QMessageBox::warning(this, "Error", "No mesh loaded");
             }
         });
+        connect(clustersSlider, &QSlider::valueChanged, clustersSpinBox, &QSpinBox::setValue);
+        connect(clustersSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), [=](int value) {
+            clustersSlider->setValue(value);
+            cutSegmentation(value);
+        });
+        connect(minAreaSpinBox, QOverload<double>::of(&QDoubleSpinBox::valueChanged), [=](double value) {
+            min_segment_area = value;
+            cutSegmentation(clustersSpinBox->value());
+        });
+        connect(overlayComboBox, QOverload<int>::of(&QComboBox::currentIndexChanged), [=](int index) {
+            overlay_mode = index;
+            showOverlay();
+        });
+        connect(sharpAngleSpinBox, QOverload<double>::of(&QDoubleSpinBox::valueChanged), [=](double value) {
+            curvature_params.sharp_angle = value;
+            curvature = mesh_tools::Vertex_curvature();
+            showOverlay();
+        });
+        connect(exportButton, &QPushButton::clicked, this, &MainWindow::exportSegments);
         connect(showSegmentsCheckBox, &QCheckBox::toggled, viewer, &MeshViewerWidget::toggleSegments);
+        connect(recordTraceAction, &QAction::toggled, this, &MainWindow::recordTrace);
+        connect(saveTraceAction, &QAction::triggered, this, &MainWindow::saveTrace);
+        connect(memoryReportAction, &QAction::triggered, this, &MainWindow::showMemoryReport);
+        viewer->setPickHandler([this](const Pick_result& pick) { showPick(pick); });
         
         // Set window properties
         setWindowTitle("CGAL Mesh Segmentation");
@@ -324,11 +695,17 @@ public:
 private slots:
     void loadSTL() {
         QString filename = QFileDialog::getOpenFileName(
-            this, "Open STL File", "", "STL Files (*.stl);;All Files (*)");
+            this, "Open Mesh File", "", "Mesh Files (*.stl *.off);;STL Files (*.stl);;OFF Files (*.off);;All Files (*)");
         
         if (filename.isEmpty()) return;
+        MESH_TRACE_SCOPE("loadSTL");
         
         // Clean up previous mesh if any
+        viewer->setMesh(nullptr);
+        segment_stats.clear();
+        merge_tree.clear();
+        vertex_rings.clear();
+        curvature = mesh_tools::Vertex_curvature();
         if (mesh) {
             delete mesh;
             mesh = nullptr;
@@ -336,10 +713,17 @@ private slots:
         
         // Create new mesh
         mesh = new Mesh();
+        num_segments = 0;
         
-        // Load the STL file
-        if (!CGAL::Polygon_mesh_processing::IO::read_polygon_mesh(filename.toStdString(), *mesh)) {
-            QMessageBox::critical(this, "Error", "Failed to load STL file");
+        // Load the file; OFF and STL are built straight into the Surface_mesh
+        mesh_tools::Mesh_build_report report;
+        bool loaded;
+        {
+            mesh_tools::memory::Stage_scope stage("read_mesh");
+            loaded = mesh_tools::read_mesh(filename.toStdString(), *mesh, &report);
+        }
+        if (!loaded) {
+            QMessageBox::critical(this, "Error", "Failed to load mesh file");
             delete mesh;
             mesh = nullptr;
             return;
@@ -353,55 +737,301 @@ private slots:
             return;
         }
         
+        // Hilbert order of faces and vertices, so that SDF rays, graph cut and
+        // the per-face loops below walk memory roughly in spatial order
+        {
+            mesh_tools::memory::Stage_scope stage("spatial_sort_mesh");
+            mesh_tools::spatial_sort_mesh(*mesh, mesh_tools::Space_filling_curve::Hilbert);
+        }
+        
+        // Face adjacency is shared by every stage that walks neighbouring faces
+        {
+            mesh_tools::memory::Stage_scope stage("build_face_adjacency");
+            mesh_tools::build_face_adjacency(*mesh, adjacency);
+        }
+        
         // Update viewer
         viewer->setMesh(mesh);
-        statusBar()->showMessage(QString("Loaded mesh with %1 vertices and %2 faces")
+        showOverlay();
+        statusBar()->showMessage(QString("Loaded mesh with %1 vertices and %2 faces (%3 non-manifold faces skipped)")
             .arg(mesh->number_of_vertices())
-            .arg(mesh->number_of_faces()));
+            .arg(mesh->number_of_faces())
+            .arg(report.rejected_faces.size()));
     }
     
-    void segmentMesh(int num_rays, double cone_angle, int num_clusters, double lambda) {
+    void segmentMesh(int num_rays, double cone_angle, int num_clusters, double boundary_weight, bool use_merge_tree) {
         if (!mesh) return;
+        MESH_TRACE_SCOPE("segmentMesh");
         
         statusBar()->showMessage("Computing SDF values...");
         QApplication::processEvents();
         
-        // Create property maps for SDF values and segment IDs
+        // Create the property map for SDF values
         Face_double_map sdf_property_map;
-        sdf_property_map = mesh->add_property_map<face_descriptor, double>("f:sdf").first;
         
         // Compute SDF values
-        CGAL::sdf_values(*mesh, sdf_property_map, num_rays, cone_angle);
+        {
+            MESH_TRACE_SCOPE("sdf_values");
+            mesh_tools::memory::Stage_scope stage("sdf_values");
+            sdf_property_map = mesh->add_property_map<face_descriptor, double>("f:sdf").first;
+            CGAL::sdf_values(*mesh, sdf_property_map, num_rays, cone_angle);
+        }
+        
+        // Merge tree over the faces, computed once; the cluster count only
+        // picks a cut through it
+        if (use_merge_tree) {
+            statusBar()->showMessage("Building merge tree...");
+            QApplication::processEvents();
+            {
+                mesh_tools::memory::Stage_scope stage("build_merge_tree");
+                merge_tree = mesh_tools::build_merge_tree(*mesh, adjacency, sdf_property_map, boundary_weight);
+            }
+            cutSegmentation(num_clusters);
+            return;
+        }
         
+        // Graph cut with the boundary weight as smoothing lambda
+        merge_tree.clear();
         statusBar()->showMessage("Segmenting mesh...");
         QApplication::processEvents();
+        Face_index_map segment_property_map =
+            mesh->add_property_map<face_descriptor, std::size_t>("f:segment").first;
+        {
+            MESH_TRACE_SCOPE("segmentation_from_sdf_values");
+            mesh_tools::memory::Stage_scope stage("segmentation_from_sdf_values");
+            num_segments = CGAL::segmentation_from_sdf_values(
+                *mesh, sdf_property_map, segment_property_map, num_clusters, boundary_weight);
+        }
+        cleanSegmentation(segment_property_map);
+        showSdfSegmentation(segment_property_map);
+    }
+    
+    // Regions of faces whose normals fit in a cone, without SDF. The value
+    // shown per segment is the deviation of the face normals from the cone
+    // axis; the cluster count does not apply.
+    void segmentByNormals(double max_cone_angle) {
+        if (!mesh) return;
+        MESH_TRACE_SCOPE("segmentByNormals");
+        merge_tree.clear();
         
-        // Create a property map for segment IDs
-        if (mesh->property_map<face_descriptor, std::size_t>("f:segment").second) {
-            auto prop_pair = mesh->property_map<face_descriptor, std::size_t>("f:segment");
-            mesh->remove_property_map<face_descriptor, std::size_t>(prop_pair.first);
+        mesh_tools::Normal_regions regions;
+        {
+            mesh_tools::memory::Stage_scope stage("grow_normal_regions");
+            mesh_tools::Normal_region_params params;
+            params.max_cone_angle = max_cone_angle;
+            regions = mesh_tools::grow_normal_regions(*mesh, adjacency, params);
         }
-        Face_index_map segment_property_map = 
+        num_segments = regions.num_regions();
+        
+        Face_index_map segment_property_map =
             mesh->add_property_map<face_descriptor, std::size_t>("f:segment").first;
+        for (face_descriptor f : mesh->faces())
+            segment_property_map[f] = regions.face_region[f.idx()];
+        cleanSegmentation(segment_property_map);
+        Face_double_map deviation_map =
+            mesh->add_property_map<face_descriptor, double>("f:normal_deviation").first;
+        mesh_tools::normal_deviation(*mesh, regions, deviation_map);
         
-        // Segment the mesh
-        std::size_t num_segments = CGAL::segmentation_from_sdf_values(
-            *mesh, sdf_property_map, segment_property_map, num_clusters, lambda);
+        std::vector<QColor> colors = generate_random_colors(num_segments);
+        mesh_tools::Segment_buckets buckets =
+            mesh_tools::bucket_faces_by_segment(*mesh, segment_property_map, num_segments);
+        segment_stats = mesh_tools::compute_segment_stats(*mesh, buckets, deviation_map);
+        stats_value_name = "normal deviation";
+        viewer->setSegmentation(segment_property_map, buckets, colors);
         
+        statusBar()->showMessage(QString("Mesh segmented into %1 regions with normal cones up to %2 degrees")
+            .arg(num_segments)
+            .arg(max_cone_angle));
+    }
+    
+    // Segments of the current merge tree for the given cluster count; cheap
+    // enough to run on every slider move. Segment IDs, and with them colors,
+    // stay the same for segments that are not split or joined, unless small
+    // segments are cleaned up, which renumbers them.
+    void cutSegmentation(int num_clusters) {
+        if (!mesh || merge_tree.empty()) return;
+        MESH_TRACE_SCOPE("cutSegmentation");
+        
+        std::vector<std::uint32_t> labels(mesh->number_of_faces());
+        num_segments = mesh_tools::cut_merge_tree(merge_tree, num_clusters, labels);
+        
+        Face_index_map segment_property_map =
+            mesh->add_property_map<face_descriptor, std::size_t>("f:segment").first;
+        for (face_descriptor f : mesh->faces())
+            segment_property_map[f] = labels[f.idx()];
+        cleanSegmentation(segment_property_map);
+        showSdfSegmentation(segment_property_map);
+    }
+    
+    // Colors, buckets and per-segment SDF figures of an SDF segmentation
+    void showSdfSegmentation(Face_index_map& segment_property_map) {
         // Generate colors for segments
         std::vector<QColor> colors = generate_random_colors(num_segments);
         
+        // Per-segment figures shown when a segment is picked
+        Face_double_map sdf_property_map = mesh->property_map<face_descriptor, double>("f:sdf").first;
+        mesh_tools::Segment_buckets buckets =
+            mesh_tools::bucket_faces_by_segment(*mesh, segment_property_map, num_segments);
+        segment_stats = mesh_tools::compute_segment_stats(*mesh, buckets, sdf_property_map);
+        stats_value_name = "SDF";
+        
         // Update viewer
-        viewer->setSegmentMap(&segment_property_map);
-        viewer->setSegmentColors(colors);
-        viewer->update();
+        viewer->setSegmentation(segment_property_map, buckets, colors);
         
-        statusBar()->showMessage(QString("Mesh segmented into %1 parts").arg(num_segments));
+        std::size_t num_patches = mesh_tools::count_segment_patches(*mesh, adjacency, segment_property_map);
+        statusBar()->showMessage(QString("Mesh segmented into %1 parts (%2 connected patches)")
+            .arg(num_segments)
+            .arg(num_patches));
+    }
+    
+    // Splits segments into connected patches and merges the patches below the
+    // minimum segment area into neighbours, in place.
+    void cleanSegmentation(Face_index_map& segment_property_map) {
+        if (min_segment_area <= 0) return;
+        mesh_tools::memory::Stage_scope stage("clean_segments");
+        num_segments = mesh_tools::clean_segments(*mesh, adjacency, segment_property_map, min_segment_area / 100);
+    }
+    
+    void exportSegments() {
+        if (!mesh || num_segments == 0) {
+            QMessageBox::warning(this, "Error", "No segmented mesh");
+            return;
+        }
+        
+        QString filename = QFileDialog::getSaveFileName(
+            this, "Export Segments", "segment", "STL Files (*.stl);;OFF Files (*.off)");
+        if (filename.isEmpty()) return;
+        
+        // Each segment goes to <prefix>_<id>.<ext>
+        mesh_tools::Segment_file_format format = filename.endsWith(".off", Qt::CaseInsensitive)
+            ? mesh_tools::Segment_file_format::OFF
+            : mesh_tools::Segment_file_format::STL;
+        QString prefix = filename;
+        if (prefix.endsWith(".stl", Qt::CaseInsensitive) || prefix.endsWith(".off", Qt::CaseInsensitive))
+            prefix.chop(4);
+        
+        mesh_tools::memory::Stage_scope stage("export_segments");
+        Face_index_map segment_property_map =
+            mesh->property_map<face_descriptor, std::size_t>("f:segment").first;
+        mesh_tools::Segment_buckets buckets =
+            mesh_tools::bucket_faces_by_segment(*mesh, segment_property_map, num_segments);
+        std::vector<mesh_tools::Segment_view> views = mesh_tools::make_segment_views(*mesh, buckets);
+        
+        std::size_t num_failed = mesh_tools::export_segments(*mesh, views, prefix.toStdString(), format);
+        if (num_failed > 0) {
+            QMessageBox::critical(this, "Error", QString("Failed to write %1 segment files").arg(num_failed));
+            return;
+        }
+        statusBar()->showMessage(QString("Exported %1 segments").arg(num_segments));
+    }
+    
+    void recordTrace(bool record) {
+        if (record) {
+            mesh_tools::trace::clear();
+            mesh_tools::trace::start();
+            statusBar()->showMessage("Recording trace");
+        } else {
+            mesh_tools::trace::stop();
+            statusBar()->showMessage("Trace recording stopped");
+        }
+    }
+    
+    void saveTrace() {
+        QString filename = QFileDialog::getSaveFileName(
+            this, "Save Trace", "trace.json", "Chrome Trace Files (*.json)");
+        if (filename.isEmpty()) return;
+        
+        // Open with chrome://tracing or ui.perfetto.dev
+        if (!mesh_tools::trace::write_chrome_json(filename.toStdString())) {
+            QMessageBox::critical(this, "Error", "Failed to write trace file");
+            return;
+        }
+        statusBar()->showMessage("Saved trace to " + filename);
+    }
+    
+    // Colors the vertices by the selected overlay. Curvature is computed on
+    // first use for each mesh and sharp angle; the rings are kept per mesh.
+    void showOverlay() {
+        if (!mesh) return;
+        if (overlay_mode == 0) {
+            viewer->setVertexOverlay(std::vector<unsigned char>());
+            return;
+        }
+        if (curvature.size() != mesh->number_of_vertices()) {
+            mesh_tools::memory::Stage_scope stage("vertex_curvature");
+            mesh_tools::compute_vertex_curvature(*mesh, vertex_rings, curvature, curvature_params);
+        }
+        const std::size_t n = curvature.size();
+        std::vector<unsigned char> rgb;
+        if (overlay_mode == 3) {
+            rgb.assign(n * 3, 204);
+            for (std::size_t v = 0; v < n; ++v) {
+                if (!curvature.is_feature(v)) continue;
+                const QColor color = curvature.sharp_edges[v] > 2 ? QColor(30, 30, 30) : QColor(220, 60, 30);
+                rgb[v * 3] = static_cast<unsigned char>(color.red());
+                rgb[v * 3 + 1] = static_cast<unsigned char>(color.green());
+                rgb[v * 3 + 2] = static_cast<unsigned char>(color.blue());
+            }
+        } else {
+            std::vector<float> values(n);
+            for (std::size_t v = 0; v < n; ++v)
+                values[v] = overlay_mode == 1 ? curvature.mean(v) : curvature.gaussian(v);
+            // Scaled to the 95th percentile, so a few spikes do not wash out the rest
+            std::vector<float> magnitude(n);
+            for (std::size_t v = 0; v < n; ++v) magnitude[v] = std::fabs(values[v]);
+            float scale = 0;
+            if (n > 0) {
+                std::nth_element(magnitude.begin(), magnitude.begin() + n * 95 / 100, magnitude.end());
+                scale = magnitude[n * 95 / 100];
+            }
+            rgb = diverging_colors(values.data(), n, scale);
+        }
+        viewer->setVertexOverlay(rgb);
+    }
+    
+    // Face and segment under a Shift+click
+    void showPick(const Pick_result& pick) {
+        QString message = QString("Face %1").arg(pick.face.idx());
+        if (pick.segment < segment_stats.size()) {
+            const mesh_tools::Segment_stats& st = segment_stats[pick.segment];
+            message += QString(", segment %1: %2 faces, area %3, %4 %5 - %6, mean normal (%7, %8, %9)")
+                .arg(pick.segment)
+                .arg(st.num_faces)
+                .arg(st.area, 0, 'g', 4)
+                .arg(stats_value_name)
+                .arg(st.value_min, 0, 'g', 4)
+                .arg(st.value_max, 0, 'g', 4)
+                .arg(st.normal[0], 0, 'f', 2)
+                .arg(st.normal[1], 0, 'f', 2)
+                .arg(st.normal[2], 0, 'f', 2);
+        }
+        statusBar()->showMessage(message);
+    }
+    
+    void showMemoryReport() {
+        // Bytes counted per stage plus RSS sampled at stage boundaries
+        std::ostringstream report;
+        mesh_tools::memory::write_report(report);
+        QMessageBox box(this);
+        box.setWindowTitle("Memory Report");
+        box.setTextFormat(Qt::RichText);
+        box.setText("<pre>" + QString::fromStdString(report.str()).toHtmlEscaped() + "</pre>");
+        box.exec();
     }
     
 private:
     MeshViewerWidget* viewer;
     Mesh* mesh;
+    mesh_tools::Face_adjacency adjacency;
+    std::size_t num_segments;
+    std::vector<mesh_tools::Segment_stats> segment_stats;
+    mesh_tools::Merge_tree merge_tree;
+    double min_segment_area;      // percent of the surface; 0 keeps small segments
+    mesh_tools::Vertex_rings vertex_rings;
+    mesh_tools::Vertex_curvature curvature;
+    mesh_tools::Curvature_params curvature_params;
+    int overlay_mode;             // 0 segments, 1 mean, 2 Gaussian curvature, 3 sharp edges
+    QString stats_value_name;
 };
 
 // Main function
@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <limits>
+#include "stl_model.hpp"
+
+namespace stl_viewer {
+
+// Load model data from the STL mesh
+void loadModel(const stl_reader::StlMesh<float, unsigned int>& mesh,
+               std::vector<float>& vertices,
+               std::vector<float>& normals) {
+    MESH_TRACE_SCOPE("loadModel");
+    size_t numTriangles = mesh.num_tris();
+    
+    vertices.reserve(numTriangles * 9);  // 3 vertices per triangle, 3 coords per vertex
+    normals.reserve(numTriangles * 9);   // 3 normals per triangle, 3 coords per normal
+    
+    for (size_t itri = 0; itri < numTriangles; ++itri) {
+        const float* n = mesh.tri_normal(itri);
+        
+        for (int i = 0; i < 3; ++i) {
+            const float* coords = mesh.tri_corner_coords(itri, i);
+            
+            // Add vertex coordinates
+            vertices.push_back(coords[0]);
+            vertices.push_back(coords[1]);
+            vertices.push_back(coords[2]);
+            
+            // Add normal (same for all vertices in the triangle for flat shading)
+            normals.push_back(n[0]);
+            normals.push_back(n[1]);
+            normals.push_back(n[2]);
+        }
+    }
+}
+
+// Implementation for ModelStats centerCamera function
+ModelStats centerCamera(const std::vector<float>& vertices) {
+    float minX = std::numeric_limits<float>::max();
+    float maxX = std::numeric_limits<float>::min();
+    float minY = std::numeric_limits<float>::max();
+    float maxY = std::numeric_limits<float>::min();
+    float minZ = std::numeric_limits<float>::max();
+    float maxZ = std::numeric_limits<float>::min();
+    
+    for (size_t i = 0; i < vertices.size(); i += 3) {
+        minX = std::min(minX, vertices[i]);
+        maxX = std::max(maxX, vertices[i]);
+        minY = std::min(minY, vertices[i+1]);
+        maxY = std::max(maxY, vertices[i+1]);
+        minZ = std::min(minZ, vertices[i+2]);
+        maxZ = std::max(maxZ, vertices[i+2]);
+    }
+    
+    ModelStats stats;
+    stats.centerX = (minX + maxX) / 2.0f;
+    stats.centerY = (minY + maxY) / 2.0f;
+    stats.centerZ = (minZ + maxZ) / 2.0f;
+    stats.size = std::max({maxX - minX, maxY - minY, maxZ - minZ});
+    
+    return stats;
+}
+
+// Same layout as loadModel, but the quantized values are copied as they are
+void loadModelQuantized(const QuantizedStlMesh& mesh,
+                        std::vector<uint16_t>& positions,
+                        std::vector<int16_t>& normals) {
+    MESH_TRACE_SCOPE("loadModel");
+    size_t numTriangles = mesh.num_tris();
+    const stl_reader::StlStorageQuantized<float>& storage = mesh.storage_policy();
+    const uint16_t* coords = storage.raw_coords();
+    const int16_t* octNormals = storage.raw_normals();
+
+    positions.reserve(numTriangles * 9);
+    normals.reserve(numTriangles * 6);
+
+    for (size_t itri = 0; itri < numTriangles; ++itri) {
+        for (int i = 0; i < 3; ++i) {
+            const uint16_t* q = coords + mesh.tri_corner_ind(itri, i) * 3;
+            positions.insert(positions.end(), q, q + 3);
+            normals.insert(normals.end(), octNormals + itri * 2, octNormals + itri * 2 + 2);
+        }
+    }
+}
+
+ModelStats quantizedModelStats(const QuantizedStlMesh& mesh) {
+    const float* minCoord = mesh.storage_policy().bbox_min();
+    const float* scale = mesh.storage_policy().scale();
+    float extent[3];
+    for (int i = 0; i < 3; ++i)
+        extent[i] = scale[i] * 65535.0f;
+
+    ModelStats stats;
+    stats.centerX = minCoord[0] + extent[0] / 2.0f;
+    stats.centerY = minCoord[1] + extent[1] / 2.0f;
+    stats.centerZ = minCoord[2] + extent[2] / 2.0f;
+    stats.size = std::max({extent[0], extent[1], extent[2]});
+
+    return stats;
+}
+
+// Indexed models keep the vertex sharing of the mesh, so that the GPU vertex
+// cache can reuse transformed vertices; the triangle order is the mesh order
+void loadModelIndexed(const stl_reader::StlMesh<float, unsigned int>& mesh,
+                      std::vector<float>& positions,
+                      std::vector<unsigned int>& indices) {
+    MESH_TRACE_SCOPE("loadModel");
+    positions.assign(mesh.raw_coords(), mesh.raw_coords() + mesh.num_vrts() * 3);
+    indices.assign(mesh.raw_tris(), mesh.raw_tris() + mesh.num_tris() * 3);
+}
+
+void loadModelIndexedQuantized(const QuantizedStlMesh& mesh,
+                               std::vector<uint16_t>& positions,
+                               std::vector<unsigned int>& indices) {
+    MESH_TRACE_SCOPE("loadModel");
+    const uint16_t* coords = mesh.storage_policy().raw_coords();
+    positions.assign(coords, coords + mesh.num_vrts() * 3);
+    indices.assign(mesh.raw_tris(), mesh.raw_tris() + mesh.num_tris() * 3);
+}
+
+} // end namespace stl_viewer
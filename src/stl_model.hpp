@@ -0,0 +1,80 @@
+#ifndef STL_MODEL_HPP
+#define STL_MODEL_HPP
+
+#include <stdint.h>
+#include <vector>
+#include "trace.h"
+#include "stl_reader.h"
+
+/**
+ * @brief Model preparation for the STL viewer, kept free of OpenGL so that it
+ *        can be used by tools and benchmarks without a window system
+ */
+namespace stl_viewer {
+
+/**
+ * @brief Loads an STL model into vertex and normal arrays
+ * @param mesh STL mesh data
+ * @param vertices Output container for vertex data
+ * @param normals Output container for normal data
+ */
+void loadModel(const stl_reader::StlMesh<float, unsigned int>& mesh,
+               std::vector<float>& vertices,
+               std::vector<float>& normals);
+
+/**
+ * @brief Centers the camera on the model
+ * @param vertices Vertex data
+ * @return Center position and size of the model
+ */
+struct ModelStats {
+    float centerX, centerY, centerZ;
+    float size;
+};
+ModelStats centerCamera(const std::vector<float>& vertices);
+
+/**
+ * @brief STL mesh with 16 bit quantized positions and oct-encoded normals
+ */
+typedef stl_reader::StlMesh<float, unsigned int, stl_reader::StlStorageQuantized<float> > QuantizedStlMesh;
+
+/**
+ * @brief Loads a quantized STL model into vertex arrays without decoding it
+ * @param mesh Quantized STL mesh data
+ * @param positions Output container, 3 quantized coordinates per vertex
+ * @param normals Output container, 2 oct-encoded components per vertex
+ */
+void loadModelQuantized(const QuantizedStlMesh& mesh,
+                        std::vector<uint16_t>& positions,
+                        std::vector<int16_t>& normals);
+
+/**
+ * @brief Center and size of a quantized model, from its bounding box
+ * @param mesh Quantized STL mesh data
+ * @return Center position and size of the model
+ */
+ModelStats quantizedModelStats(const QuantizedStlMesh& mesh);
+
+/**
+ * @brief Loads an STL model as shared vertices and a triangle index buffer
+ * @param mesh STL mesh data
+ * @param positions Output container, 3 coordinates per vertex
+ * @param indices Output container, 3 vertex indices per triangle
+ */
+void loadModelIndexed(const stl_reader::StlMesh<float, unsigned int>& mesh,
+                      std::vector<float>& positions,
+                      std::vector<unsigned int>& indices);
+
+/**
+ * @brief Loads a quantized STL model as shared vertices and a triangle index buffer
+ * @param mesh Quantized STL mesh data
+ * @param positions Output container, 3 quantized coordinates per vertex
+ * @param indices Output container, 3 vertex indices per triangle
+ */
+void loadModelIndexedQuantized(const QuantizedStlMesh& mesh,
+                               std::vector<uint16_t>& positions,
+                               std::vector<unsigned int>& indices);
+
+} // namespace stl_viewer
+
+#endif // STL_MODEL_HPP
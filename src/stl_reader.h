@@ -4,11 +4,21 @@
 #define __H__STL_READER
 
 #include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <fstream>
 #include <sstream>
+#include <string>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #ifdef STL_READER_NO_EXCEPTIONS
   #define STL_READER_THROW(msg) return false;
   #define STL_READER_COND_THROW(cond, msg) if(cond) return false;
@@ -20,6 +30,19 @@
   #define STL_READER_COND_THROW(cond, msg)  if(cond){std::stringstream ss; ss << msg; throw(std::runtime_error(ss.str()));}
 #endif
 
+#ifndef STL_READER_TRACE_SCOPE
+  /// Marks the enclosing block as a traced stage. Expands to nothing unless
+  /// defined before this header is included, e.g. by trace.h.
+  #define STL_READER_TRACE_SCOPE(name)
+#endif
+
+#ifndef STL_READER_MEMORY_STAGE
+  /// Charges the heap use of the enclosing block to a named memory stage.
+  /// Expands to nothing unless defined before this header is included, e.g.
+  /// by memory_stats.h.
+  #define STL_READER_MEMORY_STAGE(name)
+#endif
+
 
 namespace stl_reader {
 
@@ -106,8 +129,562 @@ bool ReadStlFile_BINARY(const char* filename,
 inline bool StlFileHasASCIIFormat(const char* filename);
 
 
-/// convenience mesh class which makes accessing the stl data more easy
+namespace stl_reader_impl {
+  template <typename number_t, typename index_t>
+  struct CoordWithIndex;
+}
+
+/// Temporary buffers of the stl readers, which can be reused between loads
+/** Pass the same instance to consecutive calls of the reading functions, e.g.
+ * in a batch job. Buffers are only reset between loads, never freed, so once
+ * they have grown to the size of the largest file, loading performs no heap
+ * allocations of its own (output containers which are reused in the same way
+ * don't allocate either). An instance must not be used by several threads at
+ * the same time.
+ */
 template <class TNumber = float, class TIndex = unsigned int>
+class StlReadScratch {
+public:
+  /// releases the memory held by the buffers
+  void release ()
+  {
+    StlReadScratch tmp;
+    swap (tmp);
+  }
+
+  void swap (StlReadScratch& other)
+  {
+    fileBuffer.swap (other.fileBuffer);
+    coordsWithIndex.swap (other.coordsWithIndex);
+    newIndex.swap (other.newIndex);
+    newSolids.swap (other.newSolids);
+  }
+
+  std::vector<char>  fileBuffer;
+  std::vector<stl_reader_impl::CoordWithIndex<TNumber, TIndex> >  coordsWithIndex;
+  std::vector<TIndex>  newIndex;
+  std::vector<TIndex>  newSolids;
+};
+
+/// Reads a stl file like ReadStlFile, but leaves the corners unwelded
+/** The corners are kept in scratch.coordsWithIndex, one per triangle corner,
+ * and coordsOut is left empty until WeldStlCorners is called with the same
+ * containers and scratch. Parsing and welding can so run as separate stages,
+ * e.g. of a pipeline that parses one file while it welds another; each file
+ * in flight needs its own scratch.
+ */
+template <class TNumberContainer1, class TNumberContainer2,
+          class TIndexContainer1, class TIndexContainer2>
+bool ReadStlFile_Unwelded(const char* filename,
+                          TNumberContainer1& coordsOut,
+                          TNumberContainer2& normalsOut,
+                          TIndexContainer1& trisOut,
+                          TIndexContainer2& solidRangesOut,
+                          StlReadScratch<typename TNumberContainer1::value_type,
+                                         typename TIndexContainer1::value_type>& scratch);
+
+/// Welds the corners read by ReadStlFile_Unwelded
+/** Afterwards the containers hold what ReadStlFile would have returned.*/
+template <class TNumberContainer1, class TNumberContainer2,
+          class TIndexContainer1, class TIndexContainer2>
+void WeldStlCorners(TNumberContainer1& coordsOut,
+                    TNumberContainer2& normalsOut,
+                    TIndexContainer1& trisOut,
+                    TIndexContainer2& solidRangesOut,
+                    StlReadScratch<typename TNumberContainer1::value_type,
+                                   typename TIndexContainer1::value_type>& scratch);
+
+/// Reads the triangles of a binary stl file sequentially, a chunk at a time
+/** For files which are too large to be loaded as a whole. Corners are not
+ * welded: read() returns 9 coordinates per triangle, the normals are skipped.
+ * Only a buffer of a few megabytes is held, whatever the size of the file.
+ * ASCII files are rejected by open().
+ *
+ * \code
+ *   stl_reader::StlBinaryStream<float> stream;
+ *   stream.open ("huge.stl");
+ *   std::vector<float> coords (stream.chunk_size () * 9);
+ *   while (size_t n = stream.read (stream.chunk_size (), coords.data ())) {
+ *     // triangle i of the chunk has its corners at coords [i * 9 .. i * 9 + 8]
+ *   }
+ * \endcode
+ */
+template <class TNumber = float>
+class StlBinaryStream {
+public:
+  StlBinaryStream () : m_fd (-1), m_numTris (0), m_next (0) {}
+  ~StlBinaryStream ()  {close ();}
+
+  /// opens a binary stl file and reads its header
+  bool open (const char* filename)
+  {
+    close ();
+    STL_READER_COND_THROW(StlFileHasASCIIFormat (filename),
+                          "Only binary stl files can be streamed: " << filename);
+    m_filename = filename;
+    m_fd = ::open (filename, O_RDONLY);
+    STL_READER_COND_THROW(m_fd < 0, "Couldn't open file " << filename);
+
+    struct stat st;
+    char header [84];
+    if (fstat (m_fd, &st) != 0 || !read_bytes (header, 84)) {
+      close ();
+      STL_READER_THROW("Couldnt determine number of triangles in binary stl file " << filename);
+    }
+    unsigned int numTris = 0;
+    memcpy (&numTris, header + 80, 4);
+    if ((static_cast<size_t> (st.st_size) - 84) / 50 < numTris) {
+      close ();
+      STL_READER_THROW("Error while parsing trianlge in binary stl file " << filename);
+    }
+    m_numTris = numTris;
+    m_next = 0;
+    return true;
+  }
+
+  bool open (const std::string& filename)  {return open (filename.c_str ());}
+
+  void close ()
+  {
+    if (m_fd >= 0)
+      ::close (m_fd);
+    m_fd = -1;
+    m_numTris = m_next = 0;
+  }
+
+  bool is_open () const  {return m_fd >= 0;}
+
+  /// number of triangles in the file, as stated in its header
+  size_t num_tris () const  {return m_numTris;}
+
+  /// number of triangles read so far
+  size_t position () const  {return m_next;}
+
+  /// number of triangles read from the file with a single call
+  static size_t chunk_size ()  {return 1 << 16;}
+
+  /// goes back to the first triangle
+  bool rewind ()
+  {
+    STL_READER_COND_THROW(lseek (m_fd, 84, SEEK_SET) != 84, "Couldn't seek in file " << m_filename);
+    m_next = 0;
+    return true;
+  }
+
+  /// reads the next triangles, at most maxTris of them
+  /** \param coordsOut      [out] 9 coordinates per triangle read
+   * \param attributesOut  [out] Optional, the 16 bit 'attribute byte count' of
+   *                             each triangle read. May be NULL.
+   * \returns the number of triangles read, 0 at the end of the file.
+   */
+  size_t read (size_t maxTris, TNumber* coordsOut, uint16_t* attributesOut = NULL)
+  {
+    const size_t numTris = std::min (maxTris, m_numTris - m_next);
+    m_buffer.resize (chunk_size () * 50);
+    size_t done = 0;
+    while (done < numTris) {
+      const size_t n = std::min (numTris - done, chunk_size ());
+      STL_READER_COND_THROW(!read_bytes (&m_buffer [0], n * 50),
+                            "Error while reading from " << m_filename);
+      const char* record = &m_buffer [0];
+      for (size_t tri = 0; tri < n; ++tri, record += 50, ++done) {
+        float d [9];
+        memcpy (d, record + 12, 9 * 4);
+        for (int i = 0; i < 9; ++i)
+          coordsOut [done * 9 + i] = static_cast<TNumber> (d [i]);
+        if (attributesOut)
+          memcpy (attributesOut + done, record + 48, 2);
+      }
+    }
+    m_next += numTris;
+    return numTris;
+  }
+
+private:
+  StlBinaryStream (const StlBinaryStream&);
+  StlBinaryStream& operator = (const StlBinaryStream&);
+
+  bool read_bytes (char* out, size_t size)
+  {
+    size_t numRead = 0;
+    while (numRead < size) {
+      const ssize_t n = ::read (m_fd, out + numRead, size - numRead);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      numRead += static_cast<size_t> (n);
+    }
+    return true;
+  }
+
+  std::string       m_filename;
+  std::vector<char> m_buffer;
+  int     m_fd;
+  size_t  m_numTris;
+  size_t  m_next;
+};
+
+/// Reads an ASCII or binary stl file, using the given scratch buffers
+/** \copydetails ReadStlFile
+ * \param scratch [in,out] Temporary buffers, see StlReadScratch.
+ */
+template <class TNumberContainer1, class TNumberContainer2,
+          class TIndexContainer1, class TIndexContainer2>
+bool ReadStlFile(const char* filename,
+                 TNumberContainer1& coordsOut,
+                 TNumberContainer2& normalsOut,
+                 TIndexContainer1& trisOut,
+                 TIndexContainer2& solidRangesOut,
+                 StlReadScratch<typename TNumberContainer1::value_type,
+                                typename TIndexContainer1::value_type>& scratch);
+
+/// Reads an ASCII stl file, using the given scratch buffers
+template <class TNumberContainer1, class TNumberContainer2,
+          class TIndexContainer1, class TIndexContainer2>
+bool ReadStlFile_ASCII(const char* filename,
+                       TNumberContainer1& coordsOut,
+                       TNumberContainer2& normalsOut,
+                       TIndexContainer1& trisOut,
+                       TIndexContainer2& solidRangesOut,
+                       StlReadScratch<typename TNumberContainer1::value_type,
+                                      typename TIndexContainer1::value_type>& scratch);
+
+/// Reads a binary stl file, using the given scratch buffers
+template <class TNumberContainer1, class TNumberContainer2,
+          class TIndexContainer1, class TIndexContainer2>
+bool ReadStlFile_BINARY(const char* filename,
+                        TNumberContainer1& coordsOut,
+                        TNumberContainer2& normalsOut,
+                        TIndexContainer1& trisOut,
+                        TIndexContainer2& solidRangesOut,
+                        StlReadScratch<typename TNumberContainer1::value_type,
+                                       typename TIndexContainer1::value_type>& scratch);
+
+
+namespace stl_reader_impl {
+  // moves tuple i of data to position newIndex[i]
+  template <class T, class TIndex>
+  void PermuteTuples (std::vector<T>& data, const size_t tupleSize, const std::vector<TIndex>& newIndex)
+  {
+    std::vector<T> permuted (data.size());
+    for (size_t i = 0; i < newIndex.size() && (i + 1) * tupleSize <= data.size(); ++i)
+      std::copy (data.begin() + i * tupleSize, data.begin() + (i + 1) * tupleSize,
+                 permuted.begin() + static_cast<size_t> (newIndex[i]) * tupleSize);
+    data.swap (permuted);
+  }
+
+  // sets tuple i of data to the former tuple order[i]
+  template <class T, class TIndex>
+  void GatherTuples (std::vector<T>& data, const size_t tupleSize, const std::vector<TIndex>& order)
+  {
+    std::vector<T> gathered (data.size());
+    for (size_t i = 0; i < order.size() && (i + 1) * tupleSize <= data.size(); ++i)
+      std::copy (data.begin() + static_cast<size_t> (order[i]) * tupleSize,
+                 data.begin() + (static_cast<size_t> (order[i]) + 1) * tupleSize,
+                 gathered.begin() + i * tupleSize);
+    data.swap (gathered);
+  }
+}
+
+/// three decoded numbers, returned by value from compressed storage
+template <class TNumber>
+struct StlVec3 {
+  const TNumber& operator [] (const size_t i) const {return v[i];}
+  const TNumber* data () const                      {return v;}
+  TNumber v[3];
+};
+
+
+/// Storage policy of StlMesh: coordinates and normals as plain numbers
+/** This is the default. Accessors return pointers into the stored arrays.*/
+template <class TNumber = float>
+class StlStorageFull {
+public:
+  typedef const TNumber* coord_t;
+
+  /// arrays the reader writes into. finish() has to be called afterwards.
+  /** \{ */
+  std::vector<TNumber>& coord_buffer ()   {return coords;}
+  std::vector<TNumber>& normal_buffer ()  {return normals;}
+  /** \} */
+
+  void finish ()  {}
+
+  void clear ()
+  {
+    coords.clear ();
+    normals.clear ();
+  }
+
+  size_t num_vrts () const          {return coords.size() / 3;}
+  coord_t coord (const size_t vi) const   {return &coords[vi * 3];}
+  coord_t normal (const size_t ti) const  {return &normals[ti * 3];}
+
+  /// writes count*3 numbers, starting at vertex first
+  void decode_coords (const size_t first, const size_t count, TNumber* out) const
+  {
+    std::copy (coords.begin() + first * 3, coords.begin() + (first + count) * 3, out);
+  }
+
+  /// writes count*3 numbers, starting at triangle first
+  void decode_normals (const size_t first, const size_t count, TNumber* out) const
+  {
+    std::copy (normals.begin() + first * 3, normals.begin() + (first + count) * 3, out);
+  }
+
+  const TNumber* raw_coords () const
+  {
+    if(coords.empty())
+      return NULL;
+    return &coords[0];
+  }
+
+  const TNumber* raw_normals () const
+  {
+    if(normals.empty())
+      return NULL;
+    return &normals[0];
+  }
+
+  /// moves vertex vi to newVrtIndex[vi] and the normal of triOrder[ti] to ti
+  template <class TIndex>
+  void permute (const std::vector<TIndex>& triOrder, const std::vector<TIndex>& newVrtIndex)
+  {
+    stl_reader_impl::PermuteTuples (coords, 3, newVrtIndex);
+    stl_reader_impl::GatherTuples (normals, 3, triOrder);
+  }
+
+  size_t memory_bytes () const
+  {
+    return (coords.capacity() + normals.capacity()) * sizeof(TNumber);
+  }
+
+private:
+  std::vector<TNumber>  coords;
+  std::vector<TNumber>  normals;
+};
+
+
+/// Storage policy of StlMesh: 16 bit quantized positions and oct-encoded normals
+/** Positions are stored as 3 unsigned 16 bit values relative to the bounding
+ * box of the mesh, i.e. with an error of at most half a step of extent/65535
+ * per axis. Normals are mapped onto an octahedron and stored as 2 signed 16
+ * bit values (below 0.03 degrees error). Zero normals can't be represented
+ * and decode to (0,0,1). This takes 6 instead of 12 bytes per vertex and 4
+ * instead of 12 bytes per triangle normal for float meshes.
+ *
+ * The file is still read at full precision and compressed afterwards, so the
+ * peak memory while loading is that of the uncompressed mesh.
+ *
+ * Accessors return decoded values as StlVec3 instead of pointers. The raw
+ * arrays can be used directly as normalized GL vertex attributes: positions
+ * as GL_UNSIGNED_SHORT, scaled by scale() and offset by bbox_min(), normals
+ * as 2 GL_SHORT components, which have to be oct-decoded in the shader.
+ */
+template <class TNumber = float>
+class StlStorageQuantized {
+public:
+  typedef StlVec3<TNumber> coord_t;
+
+  StlStorageQuantized ()
+  {
+    for(int i = 0; i < 3; ++i){
+      m_min[i] = 0;
+      m_scale[i] = 0;
+    }
+  }
+
+  std::vector<TNumber>& coord_buffer ()   {return m_coordBuffer;}
+  std::vector<TNumber>& normal_buffer ()  {return m_normalBuffer;}
+
+  /// compresses the buffers and releases their memory
+  void finish ()
+  {
+    encode_coords ();
+    encode_normals ();
+    std::vector<TNumber>().swap (m_coordBuffer);
+    std::vector<TNumber>().swap (m_normalBuffer);
+  }
+
+  void clear ()
+  {
+    m_coords.clear ();
+    m_normals.clear ();
+    m_coordBuffer.clear ();
+    m_normalBuffer.clear ();
+  }
+
+  size_t num_vrts () const  {return m_coords.size() / 3;}
+
+  coord_t coord (const size_t vi) const
+  {
+    coord_t c;
+    for(size_t i = 0; i < 3; ++i)
+      c.v[i] = m_min[i] + static_cast<TNumber> (m_coords[vi * 3 + i]) * m_scale[i];
+    return c;
+  }
+
+  coord_t normal (const size_t ti) const
+  {
+    return decode_oct (m_normals[ti * 2], m_normals[ti * 2 + 1]);
+  }
+
+  void decode_coords (const size_t first, const size_t count, TNumber* out) const
+  {
+    for(size_t vi = first; vi < first + count; ++vi){
+      for(size_t i = 0; i < 3; ++i)
+        *out++ = m_min[i] + static_cast<TNumber> (m_coords[vi * 3 + i]) * m_scale[i];
+    }
+  }
+
+  void decode_normals (const size_t first, const size_t count, TNumber* out) const
+  {
+    for(size_t ti = first; ti < first + count; ++ti){
+      const coord_t n = normal (ti);
+      for(size_t i = 0; i < 3; ++i)
+        *out++ = n[i];
+    }
+  }
+
+  /// quantized positions, 3 per vertex
+  const uint16_t* raw_coords () const
+  {
+    if(m_coords.empty())
+      return NULL;
+    return &m_coords[0];
+  }
+
+  /// oct-encoded normals, 2 per triangle
+  const int16_t* raw_normals () const
+  {
+    if(m_normals.empty())
+      return NULL;
+    return &m_normals[0];
+  }
+
+  /// position = bbox_min + quantized * scale, per axis
+  /** \{ */
+  const TNumber* bbox_min () const  {return m_min;}
+  const TNumber* scale () const     {return m_scale;}
+  /** \} */
+
+  template <class TIndex>
+  void permute (const std::vector<TIndex>& triOrder, const std::vector<TIndex>& newVrtIndex)
+  {
+    stl_reader_impl::PermuteTuples (m_coords, 3, newVrtIndex);
+    stl_reader_impl::GatherTuples (m_normals, 2, triOrder);
+  }
+
+  size_t memory_bytes () const
+  {
+    return m_coords.capacity() * sizeof(uint16_t) + m_normals.capacity() * sizeof(int16_t)
+           + (m_coordBuffer.capacity() + m_normalBuffer.capacity()) * sizeof(TNumber);
+  }
+
+private:
+  void encode_coords ()
+  {
+    const size_t numVrts = m_coordBuffer.size() / 3;
+    TNumber maxCoord[3];
+    for(size_t i = 0; i < 3; ++i){
+      m_min[i] = numVrts ? m_coordBuffer[i] : 0;
+      maxCoord[i] = m_min[i];
+    }
+    for(size_t vi = 0; vi < numVrts; ++vi){
+      for(size_t i = 0; i < 3; ++i){
+        m_min[i] = std::min (m_min[i], m_coordBuffer[vi * 3 + i]);
+        maxCoord[i] = std::max (maxCoord[i], m_coordBuffer[vi * 3 + i]);
+      }
+    }
+
+    double invScale[3];
+    for(size_t i = 0; i < 3; ++i){
+      const double extent = static_cast<double> (maxCoord[i]) - static_cast<double> (m_min[i]);
+      m_scale[i] = static_cast<TNumber> (extent / 65535.0);
+      invScale[i] = extent > 0 ? 65535.0 / extent : 0;
+    }
+
+    m_coords.resize (m_coordBuffer.size());
+    for(size_t vi = 0; vi < numVrts; ++vi){
+      for(size_t i = 0; i < 3; ++i){
+        const double q = (static_cast<double> (m_coordBuffer[vi * 3 + i]) - m_min[i]) * invScale[i];
+        m_coords[vi * 3 + i] = static_cast<uint16_t> (std::min (65535.0, std::floor (q + 0.5)));
+      }
+    }
+  }
+
+  static int16_t to_snorm16 (double v)
+  {
+    v = std::max (-1.0, std::min (1.0, v));
+    return static_cast<int16_t> (std::floor (v * 32767.0 + 0.5));
+  }
+
+  static double sign_not_zero (double v)
+  {
+    return v < 0 ? -1.0 : 1.0;
+  }
+
+  void encode_normals ()
+  {
+    const size_t numNormals = m_normalBuffer.size() / 3;
+    m_normals.resize (numNormals * 2);
+    for(size_t ti = 0; ti < numNormals; ++ti){
+      const double x = m_normalBuffer[ti * 3];
+      const double y = m_normalBuffer[ti * 3 + 1];
+      const double z = m_normalBuffer[ti * 3 + 2];
+      const double l1 = std::fabs (x) + std::fabs (y) + std::fabs (z);
+      double u = 0, v = 0;
+      if(l1 > 0){
+        u = x / l1;
+        v = y / l1;
+        if(z < 0){
+          const double fu = (1.0 - std::fabs (v)) * sign_not_zero (u);
+          const double fv = (1.0 - std::fabs (u)) * sign_not_zero (v);
+          u = fu;
+          v = fv;
+        }
+      }
+      m_normals[ti * 2] = to_snorm16 (u);
+      m_normals[ti * 2 + 1] = to_snorm16 (v);
+    }
+  }
+
+  static coord_t decode_oct (const int16_t qu, const int16_t qv)
+  {
+    double u = std::max (-1.0, qu / 32767.0);
+    double v = std::max (-1.0, qv / 32767.0);
+    const double z = 1.0 - std::fabs (u) - std::fabs (v);
+    if(z < 0){
+      const double fu = (1.0 - std::fabs (v)) * sign_not_zero (u);
+      const double fv = (1.0 - std::fabs (u)) * sign_not_zero (v);
+      u = fu;
+      v = fv;
+    }
+    const double len = std::sqrt (u * u + v * v + z * z);
+    coord_t n;
+    n.v[0] = static_cast<TNumber> (u / len);
+    n.v[1] = static_cast<TNumber> (v / len);
+    n.v[2] = static_cast<TNumber> (z / len);
+    return n;
+  }
+
+  std::vector<uint16_t> m_coords;
+  std::vector<int16_t>  m_normals;
+  std::vector<TNumber>  m_coordBuffer;
+  std::vector<TNumber>  m_normalBuffer;
+  TNumber m_min[3];
+  TNumber m_scale[3];
+};
+
+
+/// convenience mesh class which makes accessing the stl data more easy
+/** The storage policy TStorage decides how coordinates and normals are kept,
+ * see StlStorageFull (default) and StlStorageQuantized. Accessors for
+ * coordinates and normals return `typename TStorage::coord_t`, which can be
+ * indexed with `[0..2]` in both cases.*/
+template <class TNumber = float, class TIndex = unsigned int,
+          class TStorage = StlStorageFull<TNumber> >
 class StlMesh {
 public:
   /// initializes an empty mesh
@@ -139,7 +716,7 @@ public:
     try {
     #endif
 
-    res = ReadStlFile (filename, coords, normals, tris, solids);
+    res = ReadStlFile (filename, storage.coord_buffer (), storage.normal_buffer (), tris, solids);
 
     #ifndef STL_READER_NO_EXCEPTIONS
     } catch (std::exception& e) {
@@ -147,13 +724,13 @@ public:
     if (!res) {
     #endif
 
-      coords.clear ();
-      normals.clear ();
+      storage.clear ();
       tris.clear ();
       solids.clear ();
       STL_READER_THROW (e.what());
     }
 
+    storage.finish ();
     return res;
   }
 
@@ -163,16 +740,76 @@ public:
   }
   /** \} */
 
+  /// fills the mesh with the contents of the specified stl-file, reusing scratch buffers
+  /** Reusing both the mesh and the scratch buffers for a series of files avoids
+   * heap allocations once the buffers have grown to the largest file.*/
+  bool read_file (const char* filename, StlReadScratch<TNumber, TIndex>& scratch)
+  {
+    bool res = false;
+
+    #ifndef STL_READER_NO_EXCEPTIONS
+    try {
+    #endif
+
+    res = ReadStlFile (filename, storage.coord_buffer (), storage.normal_buffer (), tris, solids, scratch);
+
+    #ifndef STL_READER_NO_EXCEPTIONS
+    } catch (std::exception& e) {
+    #else
+    if (!res) {
+    #endif
+
+      storage.clear ();
+      tris.clear ();
+      solids.clear ();
+      STL_READER_THROW (e.what());
+    }
+
+    storage.finish ();
+    return res;
+  }
+
+  /// fills the mesh using another reader with the interface of ReadStlFile
+  /** `reader(filename, coords, normals, tris, solids)` has to fill the given
+   * std::vectors like ReadStlFile and return true on success. This allows to
+   * load other formats into any storage policy, e.g. mesh_pack::MeshPackReader.*/
+  template <class TReader>
+  bool read_file_with (const char* filename, TReader reader)
+  {
+    bool res = false;
+
+    #ifndef STL_READER_NO_EXCEPTIONS
+    try {
+    #endif
+
+    res = reader (filename, storage.coord_buffer (), storage.normal_buffer (), tris, solids);
+
+    #ifndef STL_READER_NO_EXCEPTIONS
+    } catch (std::exception& e) {
+    #else
+    if (!res) {
+    #endif
+
+      storage.clear ();
+      tris.clear ();
+      solids.clear ();
+      STL_READER_THROW (e.what());
+    }
+
+    storage.finish ();
+    return res;
+  }
+
   /// returns the number of vertices in the mesh
   size_t num_vrts () const
   {
-    return coords.size() / 3;
+    return storage.num_vrts ();
   }
 
   /// returns an array of 3 floating point values, one for each coordinate of the vertex
-  const TNumber* vrt_coords (const size_t vi) const
+  typename TStorage::coord_t vrt_coords (const size_t vi) const
   {
-    return &coords[vi * 3];
+    return storage.coord (vi);
   }
 
   /// returns the number of triangles in the mesh
@@ -200,17 +837,32 @@ public:
    *          mesh.vrt_coords (mesh.tri_corner_ind (itri, icorner))
    *        \endcode
    */
-  const TNumber* tri_corner_coords (const size_t ti, const size_t ci) const
+  typename TStorage::coord_t tri_corner_coords (const size_t ti, const size_t ci) const
   {
-    return &coords[tri_corner_ind(ti, ci) * 3];
+    return storage.coord (tri_corner_ind(ti, ci));
   }
 
   /// returns an array of 3 floating point values defining the normal of a tri
-  const TNumber* tri_normal (const size_t ti) const
+  typename TStorage::coord_t tri_normal (const size_t ti) const
+  {
+    return storage.normal (ti);
+  }
+
+  /// batch decoding of coordinates and normals
+  /** Writes `count*3` numbers to out, starting at vertex or triangle `first`.
+   * With compressed storage this is faster than the single accessors.
+   * \{ */
+  void decode_vrt_coords (const size_t first, const size_t count, TNumber* out) const
   {
-    return &normals [ti * 3];
+    storage.decode_coords (first, count, out);
   }
 
+  void decode_tri_normals (const size_t first, const size_t count, TNumber* out) const
+  {
+    storage.decode_normals (first, count, out);
+  }
+  /** \} */
+
   /// returns the number of solids of the mesh
   /** solids can be seen as a partitioning of the triangles of a mesh.
    * By iterating consecutively from the index of the first triangle of a
@@ -238,22 +890,20 @@ public:
 
   /// returns a pointer to the coordinate array, containing `num_vrts()*3` entries.
   /** Storage layout: `x0,y0,z0,x1,y1,z1,...`
+   * \note Only available with StlStorageFull, see storage_policy() otherwise.
    * \returns pointer to a contiguous array of numbers, or `NULL` if no coords exist.*/
   const TNumber* raw_coords () const
   {
-    if(coords.empty())
-      return NULL;
-    return &coords[0];
+    return storage.raw_coords ();
   }
 
   /// returns a pointer to the normal array, containing `num_tris()*3` entries.
   /** Storage layout: `nx0,ny0,nz0,nx1,ny1,nz1,...`
+   * \note Only available with StlStorageFull, see storage_policy() otherwise.
    * \returns pointer to a contiguous array of numbers, or `NULL` if no normals exist.*/
   const TNumber* raw_normals () const
   {
-    if(normals.empty())
-      return NULL;
-    return &normals[0];
+    return storage.raw_normals ();
   }
 
   /// returns a pointer to the triangle array, containing `num_tris()*3` entries.
@@ -276,9 +926,37 @@ public:
     return &solids[0];
   }
 
+  /// reorders triangles and renumbers vertices
+  /** \param triOrder    [in] triOrder[ti] is the old index of the triangle
+   *                        which is moved to position ti. Has to map the
+   *                        range of every solid onto itself.
+   * \param newVrtIndex [in] newVrtIndex[vi] is the new index of vertex vi.
+   * \sa mesh_reorder::ReorderStlMesh, which computes cache friendly orders.*/
+  void reorder (const std::vector<TIndex>& triOrder, const std::vector<TIndex>& newVrtIndex)
+  {
+    std::vector<TIndex> newTris (tris.size());
+    for (size_t ti = 0; ti < triOrder.size(); ++ti) {
+      for (size_t ci = 0; ci < 3; ++ci)
+        newTris[ti * 3 + ci] = newVrtIndex[tris[static_cast<size_t> (triOrder[ti]) * 3 + ci]];
+    }
+    tris.swap (newTris);
+    storage.permute (triOrder, newVrtIndex);
+  }
+
+  /// gives access to the storage policy, e.g. to the quantized arrays
+  const TStorage& storage_policy () const
+  {
+    return storage;
+  }
+
+  /// returns the number of bytes allocated for coordinates, normals and indices
+  size_t memory_bytes () const
+  {
+    return storage.memory_bytes () + (tris.capacity() + solids.capacity()) * sizeof(TIndex);
+  }
+
 private:
-  std::vector<TNumber>  coords;
-  std::vector<TNumber>  normals;
+  TStorage              storage;
   std::vector<TIndex>   tris;
   std::vector<TIndex>   solids;
 };
@@ -330,9 +1008,13 @@ namespace stl_reader_impl {
                       std::vector <CoordWithIndex<
                         typename TNumberContainer1::value_type,
                         typename TIndexContainer1::value_type> >
-                        &coordsWithIndexInOut)
+                        &coordsWithIndexInOut,
+                      std::vector <typename TIndexContainer1::value_type>& newIndex,
+                      std::vector <typename TIndexContainer1::value_type>& newSolids)
   {
     using namespace std;
+    STL_READER_TRACE_SCOPE("RemoveDoubles");
+    STL_READER_MEMORY_STAGE("RemoveDoubles");
 
     typedef typename TNumberContainer1::value_type number_t;
     typedef typename TIndexContainer1::value_type  index_t;
@@ -347,9 +1029,8 @@ namespace stl_reader_impl {
     }
 
     uniqueCoordsOut.resize (numUnique * 3);
-    vector<index_t> newIndex (coordsWithIndexInOut.size());
-
-    TIndexContainer2 newSolids;
+    newIndex.resize (coordsWithIndexInOut.size());
+    newSolids.clear ();
 
   //  copy unique coordinates to 'uniqueCoordsOut' and create an index-map
   //  'newIndex', which allows to re-index triangles later on.
@@ -404,9 +1085,282 @@ namespace stl_reader_impl {
 
     if (!newSolids.empty ())
       newSolids.push_back (numUniqueTriInds / 3);
-    
-    using std::swap;
-    swap (solidsInOut, newSolids);
+
+  //  copy instead of swapping, so that newSolids keeps its capacity
+    solidsInOut.resize (newSolids.size ());
+    copy (newSolids.begin (), newSolids.end (), solidsInOut.begin ());
+  }
+
+  template <class TNumberContainer1, class TNumberContainer2,
+            class TIndexContainer1, class TIndexContainer2>
+  void RemoveDoubles (TNumberContainer1& uniqueCoordsOut,
+                      TIndexContainer1& trisInOut,
+                      TNumberContainer2& normalsInOut,
+                      TIndexContainer2& solidsInOut,
+                      std::vector <CoordWithIndex<
+                        typename TNumberContainer1::value_type,
+                        typename TIndexContainer1::value_type> >
+                        &coordsWithIndexInOut)
+  {
+    std::vector <typename TIndexContainer1::value_type> newIndex, newSolids;
+    RemoveDoubles (uniqueCoordsOut, trisInOut, normalsInOut, solidsInOut,
+                   coordsWithIndexInOut, newIndex, newSolids);
+  }
+
+  // reads the whole file into buffer, followed by a terminating zero, with
+  // plain POSIX calls. The buffer is only grown, never shrunk.
+  inline bool ReadFileToBuffer (const char* filename, std::vector<char>& buffer, size_t& sizeOut)
+  {
+    const int fd = open (filename, O_RDONLY);
+    STL_READER_COND_THROW(fd < 0, "Couldn't open file " << filename);
+
+    struct stat st;
+    if (fstat (fd, &st) != 0) {
+      close (fd);
+      STL_READER_THROW("Couldn't determine size of file " << filename);
+    }
+
+    const size_t size = static_cast<size_t> (st.st_size);
+    if (buffer.size () < size + 1)
+      buffer.resize (size + 1);
+
+    size_t numRead = 0;
+    while (numRead < size) {
+      const ssize_t n = read (fd, &buffer[numRead], size - numRead);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      numRead += static_cast<size_t> (n);
+    }
+    close (fd);
+    STL_READER_COND_THROW(numRead != size, "Error while reading file " << filename);
+
+    buffer[size] = 0;
+    sizeOut = size;
+    return true;
+  }
+
+  // same check as StlFileHasASCIIFormat, on the first 256 bytes of a buffer
+  inline bool BufferHasASCIIFormat (const char* data, size_t size)
+  {
+    char chars [257];
+    const size_t n = std::min<size_t> (size, 256);
+    for (size_t i = 0; i < n; ++i)
+      chars[i] = static_cast<char> (::tolower (static_cast<unsigned char> (data[i])));
+    chars[n] = 0;
+  //  embedded zeros would end the search early, so they are replaced
+    for (size_t i = 0; i < n; ++i)
+      if (chars[i] == 0) chars[i] = ' ';
+    return strstr (chars, "solid") != NULL &&
+           strchr (chars, '\n') != NULL &&
+           strstr (chars, "facet") != NULL &&
+           strstr (chars, "normal") != NULL;
+  }
+
+  inline bool IsSpace (char c)
+  {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+  }
+
+  inline bool TokenIs (const char* tok, size_t len, const char* keyword)
+  {
+    return strlen (keyword) == len && memcmp (tok, keyword, len) == 0;
+  }
+
+  // parses ASCII stl data. data has to be terminated by a zero.
+  template <class TNumberContainer1, class TNumberContainer2,
+            class TIndexContainer1, class TIndexContainer2>
+  bool ParseStl_ASCII (const char* filename,
+                       const char* data,
+                       size_t size,
+                       TNumberContainer1& coordsOut,
+                       TNumberContainer2& normalsOut,
+                       TIndexContainer1& trisOut,
+                       TIndexContainer2& solidRangesOut,
+                       StlReadScratch<typename TNumberContainer1::value_type,
+                                      typename TIndexContainer1::value_type>& scratch,
+                       bool weld = true)
+  {
+    using namespace std;
+    STL_READER_TRACE_SCOPE("ReadStlFile_ASCII");
+
+    typedef typename TNumberContainer1::value_type  number_t;
+    typedef typename TIndexContainer1::value_type index_t;
+
+    coordsOut.clear();
+    normalsOut.clear();
+    trisOut.clear();
+    solidRangesOut.clear();
+
+    vector<CoordWithIndex <number_t, index_t> >& coordsWithIndex = scratch.coordsWithIndex;
+    coordsWithIndex.clear();
+
+  //  lines are tokenized in place. Only the first few tokens of a line are
+  //  of interest, the others are only counted.
+    const int maxNumTokens = 6;
+    const char* tokens[maxNumTokens];
+    size_t tokenLens[maxNumTokens];
+
+    int lineCount = 1;
+    size_t numFaceVrts = 0;
+    const char* p = data;
+    const char* const end = data + size;
+
+    while(p < end)
+    {
+      const char* lineEnd = static_cast<const char*> (memchr (p, '\n', static_cast<size_t> (end - p)));
+      if(!lineEnd)
+        lineEnd = end;
+
+      int tokenCount = 0;
+      for(const char* q = p; q < lineEnd;){
+        while(q < lineEnd && IsSpace(*q))
+          ++q;
+        if(q == lineEnd)
+          break;
+        const char* tokBegin = q;
+        while(q < lineEnd && !IsSpace(*q))
+          ++q;
+        if(tokenCount < maxNumTokens){
+          tokens[tokenCount] = tokBegin;
+          tokenLens[tokenCount] = static_cast<size_t> (q - tokBegin);
+        }
+        ++tokenCount;
+      }
+
+      if(tokenCount > 0)
+      {
+        if(TokenIs(tokens[0], tokenLens[0], "vertex")){
+          if(tokenCount < 4){
+            STL_READER_THROW("ERROR while reading from " << filename <<
+              ": vertex not specified correctly in line " << lineCount);
+          }
+
+        //  read the position. Tokens are followed by a separator or the
+        //  terminating zero, so atof stops at the end of the token.
+          CoordWithIndex <number_t, index_t> c;
+          for(size_t i = 0; i < 3; ++i)
+            c[i] = static_cast<number_t> (atof(tokens[i+1]));
+          c.index = static_cast<index_t>(coordsWithIndex.size());
+          coordsWithIndex.push_back(c);
+          ++numFaceVrts;
+        }
+        else if(TokenIs(tokens[0], tokenLens[0], "facet"))
+        {
+          STL_READER_COND_THROW(tokenCount < 5,
+            "ERROR while reading from " << filename <<
+            ": triangle not specified correctly in line " << lineCount);
+
+          STL_READER_COND_THROW(!TokenIs(tokens[1], tokenLens[1], "normal"),
+            "ERROR while reading from " << filename <<
+            ": Missing normal specifier in line " << lineCount);
+
+        //  read the normal
+          for(size_t i = 0; i < 3; ++i)
+            normalsOut.push_back (static_cast<number_t> (atof(tokens[i+2])));
+
+          numFaceVrts = 0;
+        }
+        else if(TokenIs(tokens[0], tokenLens[0], "outer")){
+          STL_READER_COND_THROW ((tokenCount < 2) || !TokenIs(tokens[1], tokenLens[1], "loop"),
+            "ERROR while reading from " << filename <<
+            ": expecting outer loop in line " << lineCount);
+        }
+        else if(TokenIs(tokens[0], tokenLens[0], "endfacet")){
+          STL_READER_COND_THROW(numFaceVrts != 3,
+            "ERROR while reading from " << filename <<
+            ": bad number of vertices specified for face in line " << lineCount);
+
+          trisOut.push_back(static_cast<index_t> (coordsWithIndex.size() - 3));
+          trisOut.push_back(static_cast<index_t> (coordsWithIndex.size() - 2));
+          trisOut.push_back(static_cast<index_t> (coordsWithIndex.size() - 1));
+        }
+        else if(TokenIs(tokens[0], tokenLens[0], "solid")){
+          solidRangesOut.push_back(static_cast<index_t> (trisOut.size() / 3));
+        }
+      }
+      lineCount++;
+      p = lineEnd + 1;
+    }
+
+    solidRangesOut.push_back(static_cast<index_t> (trisOut.size() / 3));
+
+    if (weld)
+      RemoveDoubles (coordsOut, trisOut, normalsOut, solidRangesOut, coordsWithIndex,
+                     scratch.newIndex, scratch.newSolids);
+
+    return true;
+  }
+
+  // parses binary stl data
+  template <class TNumberContainer1, class TNumberContainer2,
+            class TIndexContainer1, class TIndexContainer2>
+  bool ParseStl_BINARY (const char* filename,
+                        const char* data,
+                        size_t size,
+                        TNumberContainer1& coordsOut,
+                        TNumberContainer2& normalsOut,
+                        TIndexContainer1& trisOut,
+                        TIndexContainer2& solidRangesOut,
+                        StlReadScratch<typename TNumberContainer1::value_type,
+                                       typename TIndexContainer1::value_type>& scratch,
+                        bool weld = true)
+  {
+    using namespace std;
+    STL_READER_TRACE_SCOPE("ReadStlFile_BINARY");
+
+    typedef typename TNumberContainer1::value_type  number_t;
+    typedef typename TIndexContainer1::value_type index_t;
+
+    coordsOut.clear();
+    normalsOut.clear();
+    trisOut.clear();
+    solidRangesOut.clear();
+
+    STL_READER_COND_THROW(size < 80, "Error while parsing binary stl header in file " << filename);
+    STL_READER_COND_THROW(size < 84, "Couldnt determine number of triangles in binary stl file " << filename);
+
+    unsigned int numTris = 0;
+    memcpy(&numTris, data + 80, 4);
+
+    const size_t numRecords = min<size_t> (numTris, (size - 84) / 50);
+    STL_READER_COND_THROW(numRecords < numTris && (size - 84) - numRecords * 50 < 48,
+      "Error while parsing trianlge in binary stl file " << filename);
+    STL_READER_COND_THROW(numRecords < numTris,
+      "Error while parsing additional triangle data in binary stl file " << filename);
+
+    vector<CoordWithIndex <number_t, index_t> >& coordsWithIndex = scratch.coordsWithIndex;
+    coordsWithIndex.resize(numTris * 3);
+    normalsOut.resize(numTris * 3);
+    trisOut.resize(numTris * 3);
+
+    const char* record = data + 84;
+    for(unsigned int tri = 0; tri < numTris; ++tri, record += 50){
+      float d[12];
+      memcpy(d, record, 12 * 4);
+
+      for(int i = 0; i < 3; ++i)
+        normalsOut[tri * 3 + i] = d[i];
+
+      for(size_t ivrt = 1; ivrt < 4; ++ivrt){
+        const size_t ci = tri * 3 + ivrt - 1;
+        CoordWithIndex <number_t, index_t>& c = coordsWithIndex[ci];
+        for(size_t i = 0; i < 3; ++i)
+          c[i] = d[ivrt * 3 + i];
+        c.index = static_cast<index_t>(ci);
+        trisOut[ci] = static_cast<index_t>(ci);
+      }
+    }
+
+    solidRangesOut.push_back(0);
+    solidRangesOut.push_back(static_cast<index_t> (trisOut.size() / 3));
+
+    if (weld)
+      RemoveDoubles (coordsOut, trisOut, normalsOut, solidRangesOut, coordsWithIndex,
+                     scratch.newIndex, scratch.newSolids);
+
+    return true;
   }
 }// end of namespace stl_reader_impl
 
@@ -419,10 +1373,34 @@ bool ReadStlFile(const char* filename,
                  TIndexContainer1& trisOut,
                  TIndexContainer2& solidRangesOut)
 {
-  if(StlFileHasASCIIFormat(filename))
-    return ReadStlFile_ASCII(filename, coordsOut, normalsOut, trisOut, solidRangesOut);
+  StlReadScratch<typename TNumberContainer1::value_type,
+                 typename TIndexContainer1::value_type> scratch;
+  return ReadStlFile(filename, coordsOut, normalsOut, trisOut, solidRangesOut, scratch);
+}
+
+
+template <class TNumberContainer1, class TNumberContainer2,
+          class TIndexContainer1, class TIndexContainer2>
+bool ReadStlFile(const char* filename,
+                 TNumberContainer1& coordsOut,
+                 TNumberContainer2& normalsOut,
+                 TIndexContainer1& trisOut,
+                 TIndexContainer2& solidRangesOut,
+                 StlReadScratch<typename TNumberContainer1::value_type,
+                                typename TIndexContainer1::value_type>& scratch)
+{
+  using namespace stl_reader_impl;
+
+//  the file is read once; the format is determined from the buffer
+  size_t size = 0;
+  if(!ReadFileToBuffer(filename, scratch.fileBuffer, size))
+    return false;
+
+  const char* data = &scratch.fileBuffer[0];
+  if(BufferHasASCIIFormat(data, size))
+    return ParseStl_ASCII(filename, data, size, coordsOut, normalsOut, trisOut, solidRangesOut, scratch);
   else
-    return ReadStlFile_BINARY(filename, coordsOut, normalsOut, trisOut, solidRangesOut);
+    return ParseStl_BINARY(filename, data, size, coordsOut, normalsOut, trisOut, solidRangesOut, scratch);
 }
 
 
@@ -434,105 +1412,29 @@ bool ReadStlFile_ASCII(const char* filename,
                        TIndexContainer1& trisOut,
                        TIndexContainer2& solidRangesOut)
 {
-  using namespace std;
-  using namespace stl_reader_impl;
-
-  typedef typename TNumberContainer1::value_type  number_t;
-  typedef typename TIndexContainer1::value_type index_t;
-
-  coordsOut.clear();
-  normalsOut.clear();
-  trisOut.clear();
-  solidRangesOut.clear();
-
-  ifstream in(filename);
-  STL_READER_COND_THROW(!in, "Couldn't open file " << filename);
-
-  vector<CoordWithIndex <number_t, index_t> > coordsWithIndex;
-
-  string buffer;
-  vector<string> tokens;
-  int lineCount = 1;
-  int maxNumTokens = 0;
-  size_t numFaceVrts = 0;
-
-  while(!(in.eof() || in.fail()))
-  {
-  //  read the line and tokenize.
-  //  In order to reuse memory in between lines, 'tokens' won't be cleared.
-  //  Instead we count the number of tokens using 'tokenCount'.
-    getline(in, buffer);
-
-    istringstream line(buffer);
-    int tokenCount = 0;
-    while(!(line.eof() || line.fail())){
-      if(tokenCount >= maxNumTokens){
-        maxNumTokens = tokenCount + 1;
-        tokens.resize(maxNumTokens);
-      }
-      line >> tokens[tokenCount];
-      ++tokenCount;
-    }
-
-    if(tokenCount > 0)
-    {
-      string& tok = tokens[0];
-      if(tok.compare("vertex") == 0){
-        if(tokenCount < 4){
-          STL_READER_THROW("ERROR while reading from " << filename <<
-            ": vertex not specified correctly in line " << lineCount);
-        }
-        
-      //  read the position
-        CoordWithIndex <number_t, index_t> c;
-        for(size_t i = 0; i < 3; ++i)
-          c[i] = static_cast<number_t> (atof(tokens[i+1].c_str()));
-        c.index = static_cast<index_t>(coordsWithIndex.size());
-        coordsWithIndex.push_back(c);
-        ++numFaceVrts;
-      }
-      else if(tok.compare("facet") == 0)
-      {
-        STL_READER_COND_THROW(tokenCount < 5,
-          "ERROR while reading from " << filename <<
-          ": triangle not specified correctly in line " << lineCount);
-        
-        STL_READER_COND_THROW(tokens[1].compare("normal") != 0,
-          "ERROR while reading from " << filename <<
-          ": Missing normal specifier in line " << lineCount);
-        
-      //  read the normal
-        for(size_t i = 0; i < 3; ++i)
-          normalsOut.push_back (static_cast<number_t> (atof(tokens[i+2].c_str())));
-
-        numFaceVrts = 0;
-      }
-      else if(tok.compare("outer") == 0){
-        STL_READER_COND_THROW ((tokenCount < 2) || (tokens[1].compare("loop") != 0),
-          "ERROR while reading from " << filename <<
-          ": expecting outer loop in line " << lineCount);
-      }
-      else if(tok.compare("endfacet") == 0){
-        STL_READER_COND_THROW(numFaceVrts != 3,
-          "ERROR while reading from " << filename <<
-          ": bad number of vertices specified for face in line " << lineCount);
-
-        trisOut.push_back(static_cast<index_t> (coordsWithIndex.size() - 3));
-        trisOut.push_back(static_cast<index_t> (coordsWithIndex.size() - 2));
-        trisOut.push_back(static_cast<index_t> (coordsWithIndex.size() - 1));
-      }
-      else if(tok.compare("solid") == 0){
-        solidRangesOut.push_back(static_cast<index_t> (trisOut.size() / 3));
-      }
-    }
-    lineCount++;
-  }
+  StlReadScratch<typename TNumberContainer1::value_type,
+                 typename TIndexContainer1::value_type> scratch;
+  return ReadStlFile_ASCII(filename, coordsOut, normalsOut, trisOut, solidRangesOut, scratch);
+}
 
-  solidRangesOut.push_back(static_cast<index_t> (trisOut.size() / 3));
 
-  RemoveDoubles (coordsOut, trisOut, normalsOut, solidRangesOut, coordsWithIndex);
+template <class TNumberContainer1, class TNumberContainer2,
+          class TIndexContainer1, class TIndexContainer2>
+bool ReadStlFile_ASCII(const char* filename,
+                       TNumberContainer1& coordsOut,
+                       TNumberContainer2& normalsOut,
+                       TIndexContainer1& trisOut,
+                       TIndexContainer2& solidRangesOut,
+                       StlReadScratch<typename TNumberContainer1::value_type,
+                                      typename TIndexContainer1::value_type>& scratch)
+{
+  using namespace stl_reader_impl;
 
-  return true;
+  size_t size = 0;
+  if(!ReadFileToBuffer(filename, scratch.fileBuffer, size))
+    return false;
+  return ParseStl_ASCII(filename, &scratch.fileBuffer[0], size,
+                        coordsOut, normalsOut, trisOut, solidRangesOut, scratch);
 }
 
 
@@ -544,61 +1446,69 @@ bool ReadStlFile_BINARY(const char* filename,
                         TIndexContainer1& trisOut,
                         TIndexContainer2& solidRangesOut)
 {
-  using namespace std;
-  using namespace stl_reader_impl;
-
-  typedef typename TNumberContainer1::value_type  number_t;
-  typedef typename TIndexContainer1::value_type index_t;
-
-  coordsOut.clear();
-  normalsOut.clear();
-  trisOut.clear();
-  solidRangesOut.clear();
-
-  ifstream in(filename, ios::binary);
-  STL_READER_COND_THROW(!in, "Couldnt open file " << filename);
-
-  char stl_header[80];
-  in.read(stl_header, 80);
-  STL_READER_COND_THROW(!in, "Error while parsing binary stl header in file " << filename);
+  StlReadScratch<typename TNumberContainer1::value_type,
+                 typename TIndexContainer1::value_type> scratch;
+  return ReadStlFile_BINARY(filename, coordsOut, normalsOut, trisOut, solidRangesOut, scratch);
+}
 
-  unsigned int numTris = 0;
-  in.read((char*)&numTris, 4);
-  STL_READER_COND_THROW(!in, "Couldnt determine number of triangles in binary stl file " << filename);
 
-  vector<CoordWithIndex <number_t, index_t> > coordsWithIndex;
+template <class TNumberContainer1, class TNumberContainer2,
+          class TIndexContainer1, class TIndexContainer2>
+bool ReadStlFile_BINARY(const char* filename,
+                        TNumberContainer1& coordsOut,
+                        TNumberContainer2& normalsOut,
+                        TIndexContainer1& trisOut,
+                        TIndexContainer2& solidRangesOut,
+                        StlReadScratch<typename TNumberContainer1::value_type,
+                                       typename TIndexContainer1::value_type>& scratch)
+{
+  using namespace stl_reader_impl;
 
-  for(unsigned int tri = 0; tri < numTris; ++tri){
-    float d[12];
-    in.read((char*)d, 12 * 4);
-    STL_READER_COND_THROW(!in, "Error while parsing trianlge in binary stl file " << filename);
+  size_t size = 0;
+  if(!ReadFileToBuffer(filename, scratch.fileBuffer, size))
+    return false;
+  return ParseStl_BINARY(filename, &scratch.fileBuffer[0], size,
+                         coordsOut, normalsOut, trisOut, solidRangesOut, scratch);
+}
 
-    for(int i = 0; i < 3; ++i)
-      normalsOut.push_back (d[i]);
 
-    for(size_t ivrt = 1; ivrt < 4; ++ivrt){
-      CoordWithIndex <number_t, index_t> c;
-      for(size_t i = 0; i < 3; ++i)
-        c[i] = d[ivrt * 3 + i];
-      c.index = static_cast<index_t>(coordsWithIndex.size());
-      coordsWithIndex.push_back(c);
-    }
+template <class TNumberContainer1, class TNumberContainer2,
+          class TIndexContainer1, class TIndexContainer2>
+bool ReadStlFile_Unwelded(const char* filename,
+                          TNumberContainer1& coordsOut,
+                          TNumberContainer2& normalsOut,
+                          TIndexContainer1& trisOut,
+                          TIndexContainer2& solidRangesOut,
+                          StlReadScratch<typename TNumberContainer1::value_type,
+                                         typename TIndexContainer1::value_type>& scratch)
+{
+  using namespace stl_reader_impl;
 
-    trisOut.push_back(static_cast<index_t> (coordsWithIndex.size() - 3));
-    trisOut.push_back(static_cast<index_t> (coordsWithIndex.size() - 2));
-    trisOut.push_back(static_cast<index_t> (coordsWithIndex.size() - 1));
+  size_t size = 0;
+  if(!ReadFileToBuffer(filename, scratch.fileBuffer, size))
+    return false;
 
-    char addData[2];
-    in.read(addData, 2);
-    STL_READER_COND_THROW(!in, "Error while parsing additional triangle data in binary stl file " << filename);
-  }
+  const char* data = &scratch.fileBuffer[0];
+  if(BufferHasASCIIFormat(data, size))
+    return ParseStl_ASCII(filename, data, size, coordsOut, normalsOut, trisOut, solidRangesOut, scratch, false);
+  else
+    return ParseStl_BINARY(filename, data, size, coordsOut, normalsOut, trisOut, solidRangesOut, scratch, false);
+}
 
-  solidRangesOut.push_back(0);
-  solidRangesOut.push_back(static_cast<index_t> (trisOut.size() / 3));
 
-  RemoveDoubles (coordsOut, trisOut, normalsOut, solidRangesOut, coordsWithIndex);
+template <class TNumberContainer1, class TNumberContainer2,
+          class TIndexContainer1, class TIndexContainer2>
+void WeldStlCorners(TNumberContainer1& coordsOut,
+                    TNumberContainer2& normalsOut,
+                    TIndexContainer1& trisOut,
+                    TIndexContainer2& solidRangesOut,
+                    StlReadScratch<typename TNumberContainer1::value_type,
+                                   typename TIndexContainer1::value_type>& scratch)
+{
+  using namespace stl_reader_impl;
 
-  return true;
+  RemoveDoubles (coordsOut, trisOut, normalsOut, solidRangesOut, scratch.coordsWithIndex,
+                 scratch.newIndex, scratch.newSolids);
 }
 
 
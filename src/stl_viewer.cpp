@@ -2,8 +2,11 @@
 #include <string>
 #include <vector>
 #include <cmath>
+#include <cstdlib>
 #include <limits>
+#include "trace.h"
 #include "stl_reader.h"
+#include "mesh_reorder.h"
 
 // OpenGL and GLFW
 #include <GL/glew.h>
@@ -36,34 +39,6 @@ int windowedHeight = HEIGHT;
 int windowedPosX = 100;
 int windowedPosY = 100;
 
-// Load model data from the STL mesh
-void loadModel(const stl_reader::StlMesh<float, unsigned int>& mesh,
-               std::vector<float>& vertices,
-               std::vector<float>& normals) {
-    size_t numTriangles = mesh.num_tris();
-    
-    vertices.reserve(numTriangles * 9);  // 3 vertices per triangle, 3 coords per vertex
-    normals.reserve(numTriangles * 9);   // 3 normals per triangle, 3 coords per normal
-    
-    for (size_t itri = 0; itri < numTriangles; ++itri) {
-        const float* n = mesh.tri_normal(itri);
-        
-        for (int i = 0; i < 3; ++i) {
-            const float* coords = mesh.tri_corner_coords(itri, i);
-            
-            // Add vertex coordinates
-            vertices.push_back(coords[0]);
-            vertices.push_back(coords[1]);
-            vertices.push_back(coords[2]);
-            
-            // Add normal (same for all vertices in the triangle for flat shading)
-            normals.push_back(n[0]);
-            normals.push_back(n[1]);
-            normals.push_back(n[2]);
-        }
-    }
-}
-
 // Shader compilation function
 GLuint compileShader(GLenum type, const char* source) {
     GLuint shader = glCreateShader(type);
@@ -180,52 +155,27 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
     glViewport(0, 0, width, height);
 }
 
-// Implementation for ModelStats centerCamera function
-ModelStats centerCamera(const std::vector<float>& vertices) {
-    float minX = std::numeric_limits<float>::max();
-    float maxX = std::numeric_limits<float>::min();
-    float minY = std::numeric_limits<float>::max();
-    float maxY = std::numeric_limits<float>::min();
-    float minZ = std::numeric_limits<float>::max();
-    float maxZ = std::numeric_limits<float>::min();
-    
-    for (size_t i = 0; i < vertices.size(); i += 3) {
-        minX = std::min(minX, vertices[i]);
-        maxX = std::max(maxX, vertices[i]);
-        minY = std::min(minY, vertices[i+1]);
-        maxY = std::max(maxY, vertices[i+1]);
-        minZ = std::min(minZ, vertices[i+2]);
-        maxZ = std::max(maxZ, vertices[i+2]);
-    }
-    
-    ModelStats stats;
-    stats.centerX = (minX + maxX) / 2.0f;
-    stats.centerY = (minY + maxY) / 2.0f;
-    stats.centerZ = (minZ + maxZ) / 2.0f;
-    stats.size = std::max({maxX - minX, maxY - minY, maxZ - minZ});
-    
-    return stats;
-}
-
 } // end namespace stl_viewer
 
 // OpenGL shader source (keep outside namespace)
 const char* vertexShaderSource = R"(
     #version 330 core
     layout (location = 0) in vec3 aPos;
-    layout (location = 1) in vec3 aNormal;
     
-    out vec3 Normal;
     out vec3 FragPos;
     
     uniform mat4 model;
     uniform mat4 view;
     uniform mat4 projection;
     
+    // Quantized models: positions are normalized to [0,1]
+    uniform vec3 posOffset;
+    uniform vec3 posScale;
+    
     void main() {
-        gl_Position = projection * view * model * vec4(aPos, 1.0);
-        FragPos = vec3(model * vec4(aPos, 1.0));
-        Normal = mat3(transpose(inverse(model))) * aNormal;
+        vec3 pos = posOffset + posScale * aPos;
+        gl_Position = projection * view * model * vec4(pos, 1.0);
+        FragPos = vec3(model * vec4(pos, 1.0));
     }
 )";
 
@@ -233,7 +183,6 @@ const char* fragmentShaderSource = R"(
     #version 330 core
     out vec4 FragColor;
     
-    in vec3 Normal;
     in vec3 FragPos;
     
     uniform vec3 lightPos;
@@ -246,8 +195,9 @@ const char* fragmentShaderSource = R"(
         float ambientStrength = 0.2;
         vec3 ambient = ambientStrength * lightColor;
         
-        // Diffuse
-        vec3 norm = normalize(Normal);
+        // Diffuse; vertices are shared between triangles, so the flat
+        // normal is taken from the screen space derivatives of the position
+        vec3 norm = normalize(cross(dFdx(FragPos), dFdy(FragPos)));
         vec3 lightDir = normalize(lightPos - FragPos);
         float diff = max(dot(norm, lightDir), 0.0);
         vec3 diffuse = diff * lightColor;
@@ -265,24 +215,78 @@ const char* fragmentShaderSource = R"(
 )";
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <model.stl>" << std::endl;
+    const char* filename = argc > 1 ? argv[1] : NULL;
+    const char* traceFile = NULL;
+    bool quantized = false;
+    bool reorder = false;
+    int maxFrames = 0;
+    bool usage = argc < 2;
+    for (int i = 2; i < argc && !usage; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--trace" && i + 1 < argc)
+            traceFile = argv[++i];
+        else if (arg == "--quantized")
+            quantized = true;
+        else if (arg == "--reorder")
+            reorder = true;
+        else if (arg == "--frames" && i + 1 < argc)
+            maxFrames = std::atoi(argv[++i]);
+        else
+            usage = true;
+    }
+    if (usage) {
+        std::cerr << "Usage: " << argv[0] << " <model.stl> [--quantized] [--reorder] [--frames <n>] [--trace <trace.json>]" << std::endl;
         return 1;
     }
 
-    const char* filename = argv[1];
+    if (traceFile)
+        mesh_tools::trace::start();
     std::vector<float> vertices;
-    std::vector<float> normals;
+    std::vector<uint16_t> quantizedVertices;
+    std::vector<unsigned int> indices;
+    stl_viewer::ModelStats modelStats;
+    glm::vec3 posOffset(0.0f), posScale(1.0f);
 
     try {
-        stl_reader::StlMesh<float, unsigned int> mesh(filename);
+        // Load model data into a shared vertex array and a triangle index
+        // array. Quantized models are uploaded as 16 bit values and decoded by
+        // the vertex shader. With --reorder, triangles are sorted for vertex
+        // cache reuse first.
+        size_t numTriangles = 0, meshBytes = 0, vertexBytes = 0;
+        mesh_reorder::Reordering<unsigned int> reordering;
+        if (quantized) {
+            stl_viewer::QuantizedStlMesh mesh(filename);
+            if (reorder)
+                reordering = mesh_reorder::ReorderStlMesh(mesh);
+            numTriangles = mesh.num_tris();
+            meshBytes = mesh.memory_bytes();
+            stl_viewer::loadModelIndexedQuantized(mesh, quantizedVertices, indices);
+            vertexBytes = quantizedVertices.size() * sizeof(uint16_t);
+            modelStats = stl_viewer::quantizedModelStats(mesh);
+            const float* minCoord = mesh.storage_policy().bbox_min();
+            const float* scale = mesh.storage_policy().scale();
+            posOffset = glm::vec3(minCoord[0], minCoord[1], minCoord[2]);
+            posScale = glm::vec3(scale[0], scale[1], scale[2]) * 65535.0f;
+        } else {
+            stl_reader::StlMesh<float, unsigned int> mesh(filename);
+            if (reorder)
+                reordering = mesh_reorder::ReorderStlMesh(mesh);
+            numTriangles = mesh.num_tris();
+            meshBytes = mesh.memory_bytes();
+            stl_viewer::loadModelIndexed(mesh, vertices, indices);
+            vertexBytes = vertices.size() * sizeof(float);
+            modelStats = stl_viewer::centerCamera(vertices);
+        }
+        vertexBytes += indices.size() * sizeof(unsigned int);
+        const GLsizei numIndices = static_cast<GLsizei>(indices.size());
 
-        size_t numTriangles = mesh.num_tris();
         std::cout << "Loaded STL: " << filename << "\n";
         std::cout << "Triangles: " << numTriangles << "\n";
-
-        // Load model data into vertex and normal arrays
-        stl_viewer::loadModel(mesh, vertices, normals);
+        std::cout << "Mesh memory: " << meshBytes / 1024 << " KB, vertex buffers: "
+                  << vertexBytes / 1024 << " KB" << (quantized ? " (quantized)" : "") << "\n";
+        if (reorder)
+            std::cout << "Vertex cache misses per triangle: " << reordering.acmrBefore
+                      << " -> " << reordering.acmrAfter << " (reordered)\n";
 
         // Initialize GLFW
         if (!glfwInit()) {
@@ -317,35 +321,49 @@ int main(int argc, char* argv[]) {
         // Create and compile shaders
         GLuint shaderProgram = stl_viewer::createShaderProgram(vertexShaderSource, fragmentShaderSource);
         
-        // Create VAO, VBO, normalVBO
-        GLuint VAO, VBO, normalVBO;
+        // Create VAO, VBO, EBO
+        GLuint VAO, VBO, EBO;
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
-        glGenBuffers(1, &normalVBO);
+        glGenBuffers(1, &EBO);
         
         glBindVertexArray(VAO);
         
-        // Position attribute
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(0);
-        
-        // Normal attribute
-        glBindBuffer(GL_ARRAY_BUFFER, normalVBO);
-        glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(float), normals.data(), GL_STATIC_DRAW);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(1);
+        // Upload vertex and index data
+        {
+            MESH_TRACE_SCOPE("upload");
+            glBindBuffer(GL_ARRAY_BUFFER, VBO);
+            if (quantized) {
+                // Normalized 16 bit attributes, positions map to [0,1]
+                glBufferData(GL_ARRAY_BUFFER, quantizedVertices.size() * sizeof(uint16_t), quantizedVertices.data(), GL_STATIC_DRAW);
+                glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, 3 * sizeof(uint16_t), (void*)0);
+            } else {
+                glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+                glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+            }
+            glEnableVertexAttribArray(0);
+
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+        }
         
         // Enable depth testing
         glEnable(GL_DEPTH_TEST);
         
         // Center the camera on the model
-        stl_viewer::ModelStats modelStats = stl_viewer::centerCamera(vertices);
         stl_viewer::cameraPos = glm::vec3(modelStats.centerX, modelStats.centerY, modelStats.centerZ + modelStats.size * 2.0f);
         
+        // With --frames, render without vsync and stop after the given
+        // number of frames, so that frame times can be compared
+        if (maxFrames > 0)
+            glfwSwapInterval(0);
+        int numFrames = 0;
+        const double startTime = glfwGetTime();
+        
         // Main render loop
-        while (!glfwWindowShouldClose(window)) {
+        while (!glfwWindowShouldClose(window) && (maxFrames <= 0 || numFrames < maxFrames)) {
+            MESH_TRACE_SCOPE("frame");
+            
             // Process input
             stl_viewer::processInput(window);
             
@@ -384,20 +402,29 @@ int main(int argc, char* argv[]) {
                         stl_viewer::cameraPos.z);
             glUniform3f(glGetUniformLocation(shaderProgram, "lightColor"), 1.0f, 1.0f, 1.0f);
             glUniform3f(glGetUniformLocation(shaderProgram, "objectColor"), 0.5f, 0.5f, 1.0f);
+            glUniform3f(glGetUniformLocation(shaderProgram, "posOffset"), posOffset.x, posOffset.y, posOffset.z);
+            glUniform3f(glGetUniformLocation(shaderProgram, "posScale"), posScale.x, posScale.y, posScale.z);
             
             // Draw model
             glBindVertexArray(VAO);
-            glDrawArrays(GL_TRIANGLES, 0, vertices.size() / 3);
+            glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, (void*)0);
             
             // Swap buffers and poll events
             glfwSwapBuffers(window);
             glfwPollEvents();
+            ++numFrames;
+        }
+        if (numFrames > 0) {
+            // glFinish makes the last frames count in full without vsync
+            glFinish();
+            std::cout << "Average frame time: " << (glfwGetTime() - startTime) * 1000.0 / numFrames
+                      << " ms over " << numFrames << " frames\n";
         }
         
         // Clean up
         glDeleteVertexArrays(1, &VAO);
         glDeleteBuffers(1, &VBO);
-        glDeleteBuffers(1, &normalVBO);
+        glDeleteBuffers(1, &EBO);
         glDeleteProgram(shaderProgram);
         
         glfwTerminate();
@@ -407,5 +434,10 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    if (traceFile && !mesh_tools::trace::write_chrome_json(traceFile)) {
+        std::cerr << "Failed to write trace file " << traceFile << std::endl;
+        return 1;
+    }
+
     return 0;
 }
\ No newline at end of file
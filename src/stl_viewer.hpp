@@ -4,7 +4,9 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <vector>
+#include "trace.h"
 #include "stl_reader.h"
+#include "stl_model.hpp"
 
 /**
  * @brief STL Viewer namespace containing all viewer functionality
@@ -41,16 +43,6 @@ void processInput(GLFWwindow* window);
  */
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 
-/**
- * @brief Loads an STL model into vertex and normal arrays
- * @param mesh STL mesh data
- * @param vertices Output container for vertex data
- * @param normals Output container for normal data
- */
-void loadModel(const stl_reader::StlMesh<float, unsigned int>& mesh,
-               std::vector<float>& vertices,
-               std::vector<float>& normals);
-
 /**
  * @brief Toggles between fullscreen and windowed mode
  * @param window GLFW window handle
@@ -68,17 +60,6 @@ GLuint initializeRendering(GLFWwindow* window,
                            const std::vector<float>& vertices,
                            const std::vector<float>& normals);
 
-/**
- * @brief Centers the camera on the model
- * @param vertices Vertex data
- * @return Center position and size of the model
- */
-struct ModelStats {
-    float centerX, centerY, centerZ;
-    float size;
-};
-ModelStats centerCamera(const std::vector<float>& vertices);
-
 } // namespace stl_viewer
 
 #endif // STL_VIEWER_HPP
\ No newline at end of file